@@ -0,0 +1,447 @@
+//
+//  libgwatch_agent.so - in-process watch agent, loaded into the tracee with LD_PRELOAD by the AGENT backend
+//
+//  Every watched variable gets one inherited perf_event hardware breakpoint with sigtrap set,
+//  so accesses are delivered as a synchronous SIGTRAP to the accessing thread itself.
+//  The handler captures value, tid and ip and appends them to the thread's ring in shared memory.
+//
+
+#include "AgentBuffer.hpp"
+#include "Decoder.hpp"
+#include "DwarfReader.hpp"
+#include "SymbolIndex.hpp"
+#include "Util.hpp"
+
+#include <array>
+#include <cstring>
+#include <ctime>
+#include <exception>
+#include <new>
+#include <string>
+
+#include <dlfcn.h>
+#include <fcntl.h>
+#include <linux/hw_breakpoint.h>
+#include <linux/perf_event.h>
+#include <pthread.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <ucontext.h>
+#include <unistd.h>
+
+// not exposed by older glibc versions
+#ifndef TRAP_PERF
+#define TRAP_PERF 6
+#endif
+
+namespace
+{
+
+using namespace dbg;
+
+constexpr const char* SELF_EXE = "/proc/self/exe";
+
+agent::Header* g_header = nullptr;
+pid_t g_pid = 0;
+std::array<std::atomic<uint64_t>, agent::MAX_WATCHES> g_lastValue{};
+struct sigaction g_previousAction{};
+
+// initial-exec keeps TLS access async-signal-safe (no lazy allocation in __tls_get_addr)
+__attribute__((tls_model("initial-exec"))) thread_local agent::ThreadRing* t_ring = nullptr;
+
+// set for every thread started through pthread_create, its destructor releases the ring of the exiting thread
+pthread_key_t g_ringKey;
+std::atomic<bool> g_ringKeyCreated{false};
+
+/// Access kind only depends on the instruction, cache it by ip to save reading the code on every trap
+struct ClassifiedIp
+{
+    uint64_t ip;
+    util::WatchpointEvent event;
+};
+
+constexpr size_t CLASSIFY_CACHE_SIZE = 64; // power of two
+__attribute__((tls_model("initial-exec"))) thread_local std::array<ClassifiedIp, CLASSIFY_CACHE_SIZE> t_classified{};
+
+/// Pass signals that were not raised by the agent's events to the previous handler
+void forwardSignal(int sig, siginfo_t* info, void* context)
+{
+    if (g_previousAction.sa_flags & SA_SIGINFO)
+    {
+        if (g_previousAction.sa_sigaction)
+        {
+            g_previousAction.sa_sigaction(sig, info, context);
+        }
+        return;
+    }
+
+    if (g_previousAction.sa_handler == SIG_IGN)
+    {
+        return;
+    }
+
+    if (g_previousAction.sa_handler == SIG_DFL)
+    {
+        signal(sig, SIG_DFL);
+        raise(sig);
+        return;
+    }
+
+    g_previousAction.sa_handler(sig);
+}
+
+/// Claim a free ring for the calling thread, only atomics so the signal handler can call it too:
+/// threads started through pthread_create claim at their start, others and those that found no free ring
+/// on their first access, a thread that finds none tries again on the next
+agent::ThreadRing* claimRing()
+{
+    if (t_ring)
+    {
+        return t_ring;
+    }
+
+    for (uint32_t index = 0; index < agent::MAX_THREADS; ++index)
+    {
+        agent::ThreadRing& ring = g_header->rings[index];
+        uint32_t expected = 0;
+        if (ring.owned.load(std::memory_order_relaxed) != 0 ||
+            !ring.owned.compare_exchange_strong(expected, 1, std::memory_order_acquire, std::memory_order_relaxed))
+        {
+            continue;
+        }
+
+        // gwatch drains the rings below the count, a released ring keeps its place
+        uint32_t count = g_header->threadCount.load(std::memory_order_relaxed);
+        while (count <= index && !g_header->threadCount.compare_exchange_weak(count, index + 1, std::memory_order_release))
+        {
+        }
+
+        t_ring = &ring;
+        t_ring->tid.store(static_cast<uint32_t>(gettid()), std::memory_order_release);
+        return t_ring;
+    }
+    return nullptr;
+}
+
+/// Hand the ring of an exiting thread to the next new one, gwatch still drains the records left in it.
+/// Threads not started through pthread_create, e.g. by a raw clone, keep their ring until the process exits
+void releaseRing(void*)
+{
+    if (t_ring)
+    {
+        t_ring->owned.store(0, std::memory_order_release);
+        t_ring = nullptr;
+    }
+}
+
+/// Start routine and argument of a thread created through the interposed pthread_create
+struct ThreadStart
+{
+    void* (*routine)(void*);
+    void* arg;
+};
+
+/// Bind a ring to the new thread before it runs any of its own code, outside of the signal handler
+void* startThread(void* data)
+{
+    ThreadStart start = *static_cast<ThreadStart*>(data);
+    delete static_cast<ThreadStart*>(data);
+
+    if (g_header && g_ringKeyCreated.load(std::memory_order_acquire))
+    {
+        // any value other than null makes the destructor run at thread exit
+        pthread_setspecific(g_ringKey, &g_ringKey);
+        claimRing();
+    }
+    return start.routine(start.arg);
+}
+
+void append(agent::Record record)
+{
+    agent::ThreadRing* ring = claimRing();
+    if (!ring)
+    {
+        g_header->droppedThreads.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+    record.tid = ring->tid.load(std::memory_order_relaxed);
+
+    uint64_t head = ring->head.load(std::memory_order_relaxed);
+    uint64_t tail = ring->tail.load(std::memory_order_acquire);
+
+    // never block inside the tracee, drop and count instead
+    if (head - tail >= agent::RECORDS_PER_THREAD)
+    {
+        ring->dropped.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+
+    ring->records[head & (agent::RECORDS_PER_THREAD - 1)] = record;
+    ring->head.store(head + 1, std::memory_order_release);
+}
+
+user_regs_struct toRegs(const mcontext_t& mcontext)
+{
+    user_regs_struct regs{};
+    regs.rax = mcontext.gregs[REG_RAX];
+    regs.rbx = mcontext.gregs[REG_RBX];
+    regs.rcx = mcontext.gregs[REG_RCX];
+    regs.rdx = mcontext.gregs[REG_RDX];
+    regs.rsi = mcontext.gregs[REG_RSI];
+    regs.rdi = mcontext.gregs[REG_RDI];
+    regs.rbp = mcontext.gregs[REG_RBP];
+    regs.rsp = mcontext.gregs[REG_RSP];
+    regs.rip = mcontext.gregs[REG_RIP];
+    regs.r8 = mcontext.gregs[REG_R8];
+    regs.r9 = mcontext.gregs[REG_R9];
+    regs.r10 = mcontext.gregs[REG_R10];
+    regs.r11 = mcontext.gregs[REG_R11];
+    regs.r12 = mcontext.gregs[REG_R12];
+    regs.r13 = mcontext.gregs[REG_R13];
+    regs.r14 = mcontext.gregs[REG_R14];
+    regs.r15 = mcontext.gregs[REG_R15];
+    return regs;
+}
+
+void onTrap(int sig, siginfo_t* info, void* context)
+{
+    if (info->si_code != TRAP_PERF || !g_header)
+    {
+        forwardSignal(sig, info, context);
+        return;
+    }
+
+    // si_perf_data follows si_addr in the kernel's siginfo layout and holds the watch index (sig_data)
+    unsigned long watch = 0;
+    memcpy(&watch, reinterpret_cast<const char*>(&info->si_addr) + sizeof(void*), sizeof(watch));
+    if (watch >= g_header->watchCount)
+    {
+        return;
+    }
+
+    int savedErrno = errno;
+
+    const agent::Watch& target = g_header->watches[watch];
+    user_regs_struct regs = toRegs(static_cast<ucontext_t*>(context)->uc_mcontext);
+
+    // the breakpoint is still armed, read through the kernel so the handler does not trap on its own access
+    uint64_t value = 0;
+    std::array<uint8_t, util::MAX_INSTRUCTION_LENGTH + 1> code{};
+    if (!util::readProcessMemory(g_pid, target.address, &value, target.size))
+    {
+        errno = savedErrno;
+        return;
+    }
+
+    ClassifiedIp& cached = t_classified[(regs.rip ^ (regs.rip >> 6)) & (CLASSIFY_CACHE_SIZE - 1)];
+    auto event = util::WatchpointEvent::OTHER;
+    if (cached.ip == regs.rip)
+    {
+        event = cached.event;
+    }
+    else if (util::readProcessMemory(g_pid, regs.rip - code.size(), code.data(), code.size()))
+    {
+        event = util::classifyTrappedAccess(code, regs, target.address, target.size);
+        cached = {regs.rip, event};
+    }
+
+    uint64_t oldValue = g_lastValue[watch].load(std::memory_order_relaxed);
+    if (event == util::WatchpointEvent::OTHER)
+    {
+        event = value != oldValue ? util::WatchpointEvent::WRITE : util::WatchpointEvent::READ;
+    }
+    if (event != util::WatchpointEvent::READ)
+    {
+        oldValue = g_lastValue[watch].exchange(value, std::memory_order_relaxed);
+    }
+
+    agent::Record record{};
+    record.time = util::getMonotonicTime();
+    record.ip = regs.rip;
+    record.oldValue = oldValue;
+    record.newValue = value;
+    record.watch = static_cast<uint8_t>(watch);
+    record.event = static_cast<uint8_t>(event == util::WatchpointEvent::READ    ? agent::RECORD_READ
+                                        : event == util::WatchpointEvent::WRITE ? agent::RECORD_WRITE
+                                                                                : agent::RECORD_READ_WRITE);
+    append(record);
+
+    errno = savedErrno;
+}
+
+/// Breakpoints are not inherited across fork, the child must not write to the parent's rings
+void onFork()
+{
+    g_header = nullptr;
+    t_ring = nullptr;
+}
+
+void fail(const char* message)
+{
+    strncpy(g_header->error, message, agent::MAX_ERROR_LENGTH - 1);
+    g_header->state.store(agent::STATE_ERROR, std::memory_order_release);
+}
+
+void arm()
+{
+    g_pid = getpid();
+
+    // find base address of the process and resolve watched variables
+    uintptr_t base = util::getBaseAddress(g_pid, SELF_EXE);
+    SymbolIndex symbols(SELF_EXE); // not cached, the agent runs inside the tracee and leaves its files alone
+    DwarfReader dwarf(SELF_EXE);
+    for (size_t i = 0; i < g_header->watchCount; ++i)
+    {
+        agent::Watch& watch = g_header->watches[i];
+        std::string_view name = watch.name;
+        std::string_view symbolName = name.substr(0, name.find_first_of(".["));
+        auto symbol = symbols.find(symbolName);
+        if (!symbol)
+        {
+            throw std::runtime_error("Symbol not found: " + std::string(symbolName));
+        }
+        watch.address = base + symbol->value;
+        watch.size = symbol->size;
+
+        // members and elements, e.g. cfg.max_conns, are located through DWARF
+        if (symbolName.size() != name.size())
+        {
+            auto location = dwarf.resolve(name, symbol->value);
+            if (!location)
+            {
+                throw std::runtime_error("No debug information for " + std::string(name) + ", build the program with -g");
+            }
+            watch.address += location->offset;
+            watch.size = location->size;
+        }
+
+        if (!util::fitsDebugRegister(watch.address, watch.size))
+        {
+            throw std::runtime_error(std::string(watch.name) + " (" + std::to_string(watch.size) +
+                                     " bytes) does not fit into a debug register, use the ptrace backend");
+        }
+
+        uint64_t value = 0;
+        memcpy(&value, reinterpret_cast<const void*>(watch.address), watch.size);
+        g_lastValue[i].store(value);
+    }
+
+    struct sigaction action{};
+    action.sa_sigaction = onTrap;
+    action.sa_flags = SA_SIGINFO | SA_RESTART;
+    sigemptyset(&action.sa_mask);
+    if (sigaction(SIGTRAP, &action, &g_previousAction) < 0)
+    {
+        throw std::runtime_error("sigaction failed: " + std::string(strerror(errno)));
+    }
+
+    pthread_atfork(nullptr, nullptr, onFork);
+    if (pthread_key_create(&g_ringKey, releaseRing) != 0)
+    {
+        throw std::runtime_error("pthread_key_create failed");
+    }
+    g_ringKeyCreated.store(true, std::memory_order_release);
+
+    // the main thread is not started through pthread_create and never releases its ring
+    claimRing();
+
+    // events of the calling thread are inherited by every thread created afterwards
+    for (size_t i = 0; i < g_header->watchCount; ++i)
+    {
+        const agent::Watch& watch = g_header->watches[i];
+
+        perf_event_attr attr{};
+        attr.size = sizeof(attr);
+        attr.type = PERF_TYPE_BREAKPOINT;
+        attr.bp_type = HW_BREAKPOINT_RW;
+        attr.bp_addr = watch.address;
+        attr.bp_len = watch.size;
+        attr.sample_period = 1;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        attr.inherit = 1;
+        attr.inherit_thread = 1;
+        attr.remove_on_exec = 1;
+        attr.sigtrap = 1;
+        attr.sig_data = i;
+
+        long fd = syscall(SYS_perf_event_open, &attr, 0, -1, -1, PERF_FLAG_FD_CLOEXEC);
+        if (fd < 0)
+        {
+            throw std::runtime_error("perf_event_open failed: " + std::string(strerror(errno)));
+        }
+    }
+
+    g_header->state.store(agent::STATE_ARMED, std::memory_order_release);
+}
+
+__attribute__((constructor)) void initAgent()
+{
+    const char* shmName = getenv(agent::SHM_ENV);
+    if (!shmName)
+    {
+        return;
+    }
+
+    int fd = shm_open(shmName, O_RDWR, 0);
+
+    // only the process started by gwatch attaches, processes it executes do not
+    unsetenv(agent::SHM_ENV);
+    if (fd < 0)
+    {
+        return;
+    }
+
+    void* map = mmap(nullptr, sizeof(agent::Header), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+    {
+        return;
+    }
+
+    g_header = static_cast<agent::Header*>(map);
+    if (g_header->magic != agent::MAGIC || g_header->version != agent::VERSION ||
+        g_header->watchCount > agent::MAX_WATCHES)
+    {
+        munmap(map, sizeof(agent::Header));
+        g_header = nullptr;
+        return;
+    }
+
+    try
+    {
+        arm();
+    }
+    catch (const std::exception& e)
+    {
+        fail(e.what());
+    }
+}
+
+} // namespace
+
+/// Interposed to bind a ring to every new thread at its start, claiming it in the signal handler
+/// would leave no async-signal-safe way to register the release at thread exit
+extern "C" int pthread_create(pthread_t* thread, const pthread_attr_t* attr, void* (*routine)(void*), void* arg)
+{
+    using Create = int (*)(pthread_t*, const pthread_attr_t*, void* (*)(void*), void*);
+    static const auto create = reinterpret_cast<Create>(dlsym(RTLD_NEXT, "pthread_create"));
+
+    if (!g_header)
+    {
+        return create(thread, attr, routine, arg);
+    }
+
+    auto* start = new (std::nothrow) ThreadStart{routine, arg};
+    if (!start)
+    {
+        return EAGAIN;
+    }
+    int result = create(thread, attr, startThread, start);
+    if (result != 0)
+    {
+        delete start;
+    }
+    return result;
+}
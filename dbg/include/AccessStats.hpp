@@ -0,0 +1,67 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <sys/types.h>
+#include <vector>
+
+namespace dbg
+{
+
+/// Accesses of one variable by one thread from one call site
+struct AccessCount
+{
+    uint64_t ip = 0; // address of the instruction following the access, 0 if not captured
+    pid_t tid = 0;   // 0 once merged over all threads
+    uint32_t watch = 0;
+    bool isWrite = false;
+    uint64_t count = 0;
+};
+
+/// Accesses of one thread over all variables
+struct ThreadAccesses
+{
+    pid_t tid = 0;
+    uint64_t reads = 0;
+    uint64_t writes = 0;
+};
+
+/// Counters of accesses by (variable, thread, instruction pointer, access type), updated on the stop path instead
+/// of reporting every access. The counters live in a flat open addressing table with linear probing, a hit on a
+/// known call site costs a hash and usually a single probe, the table only allocates when it grows
+class AccessStats
+{
+    std::vector<AccessCount> m_table; // count 0 marks a free slot
+    size_t m_mask;
+    size_t m_used = 0;
+    uint64_t m_total = 0;
+
+    [[nodiscard]] static size_t hash(uint32_t watch, pid_t tid, uint64_t ip, bool isWrite);
+    void grow();
+
+  public:
+    /// @param capacity initial number of slots, rounded up to a power of two
+    explicit AccessStats(size_t capacity = 1024);
+
+    /// Count one access
+    void record(uint32_t watch, pid_t tid, uint64_t ip, bool isWrite);
+
+    /// Every counter, by descending count
+    [[nodiscard]] std::vector<AccessCount> getCounts() const;
+
+    /// Call sites merged over all threads
+    /// @param limit number of call sites to return, 0 for all
+    /// @return call sites by descending count
+    [[nodiscard]] std::vector<AccessCount> getTopCallSites(size_t limit) const;
+
+    /// Reads and writes of every thread, by thread id
+    [[nodiscard]] std::vector<ThreadAccesses> getThreads() const;
+
+    /// Number of counted accesses
+    [[nodiscard]] uint64_t getTotal() const;
+
+    /// Number of distinct (variable, thread, instruction pointer, access type) counters
+    [[nodiscard]] size_t size() const;
+};
+
+} // namespace dbg
@@ -1,35 +1,263 @@
 #pragma once
 
+#include "AccessStats.hpp"
+#include "Predicate.hpp"
+#include "StackTable.hpp"
+#include "StopRecording.hpp"
 #include "Variable.hpp"
 
+#include <array>
+#include <atomic>
+#include <concepts>
+#include <cstdint>
 #include <functional>
+#include <map>
+#include <memory>
+#include <optional>
+#include <span>
 #include <string>
+#include <sys/types.h>
+#include <unordered_map>
 #include <vector>
 
 namespace dbg
 {
 
+namespace util
+{
+struct DebugRegisterSlot;
+struct MappedFile;
+enum class WatchpointEvent;
+} // namespace util
+
+struct PerfSample;
+class AgentSession;
+class DutyCycle;
+class EventLoop;
+class LinkMap;
+class PageWatcher;
+struct PageFault;
+class ProcessMemory;
+struct MemoryRange;
+struct ThreadState;
+struct ProcessState;
+struct LibraryWatch;
+class TraceBackend;
+class Unwinder;
+
+/// Debug register layout used for the watched variables
+enum class WatchMode
+{
+    DUAL_REGISTER,  // write-only + read-write register per variable, up to 2 variables
+    SINGLE_REGISTER // one read-write register per variable, up to 4 variables,
+                    // reads and writes are told apart by decoding the trapping instruction
+};
+
+/// Kernel interface used to collect watchpoint hits
+enum class Backend
+{
+    PTRACE, // tracee stops on every access, values are read synchronously
+    PERF,   // perf_event breakpoints write samples to ring buffers drained in batches while the tracee keeps running,
+            // values are read when a batch is drained
+    AGENT   // libgwatch_agent.so is preloaded into the tracee and captures values synchronously in a SIGTRAP handler,
+            // records are read from shared memory while the tracee keeps running
+};
+
+/// Context of a reported access, valid while the onRead / onWrite callbacks run
+struct EventInfo
+{
+    uint64_t time = 0;  // CLOCK_MONOTONIC nanoseconds
+    pid_t tid = 0;      // accessing thread
+    uint64_t ip = 0;    // address of the instruction following the access, 0 if not captured
+    uint32_t stack = 0; // id of the call stack in getStacks(), 0 if not captured
+    pid_t pid = 0;      // process of the accessing thread
+};
+
+/// Access passed to the batch callback, trivially copyable, the variable is referred to by its index in getVars()
+struct Event
+{
+    uint64_t time = 0;                  // CLOCK_MONOTONIC nanoseconds
+    uint64_t ip = 0;                    // address of the instruction following the access, 0 if not captured
+    std::array<uint64_t, 2> oldValue{}; // little endian words of the value before the access
+    std::array<uint64_t, 2> newValue{}; // value after the access, bytes beyond 16 are not passed
+    pid_t tid = 0;                      // accessing thread
+    pid_t pid = 0;                      // process of the accessing thread
+    uint32_t stack = 0;                 // id of the call stack in getStacks(), 0 if not captured
+    uint32_t watch = 0;                 // index of the variable
+    uint32_t offset = 0;                // offset of the accessed element of a wide variable
+    uint8_t size = 0;                   // bytes of the variable or the accessed element
+    bool isWrite = false;
+    bool element = false; // accessed element of a wide variable
+};
+
+/// Handler whose onEvent is called for every event of a batch, see Debugger::setHandler
+template <typename T>
+concept EventHandler = requires(T& handler, const Event& event) {
+    { handler.onEvent(event) } -> std::same_as<void>;
+};
+
+/// Function containing a code address of the traced process, resolved after the run
+struct CodeLocation
+{
+    std::string function; // (mangled) symbol name, empty if no function covers the address
+    uint64_t offset = 0;  // from the start of the function
+    std::string object;   // path of the executable or shared object of the function
+};
+
+/// Counters of the page protection engine used for watches that do not fit into the debug registers
+struct PageWatchStats
+{
+    uint64_t faults = 0;       // faults on protected pages
+    uint64_t hits = 0;         // faults that accessed a watched range
+    uint64_t falseSharing = 0; // faults on a protected page outside of every watched range
+    uint64_t syscalls = 0;     // syscalls made to decode and step over the faults
+};
+
+/// Cost of tracing with the ptrace backend, printed at exit
+struct TraceStats
+{
+    uint64_t stops = 0;         // ptrace stops handled
+    uint64_t events = 0;        // reported accesses
+    uint64_t syscalls = 0;      // syscalls the tracer made while handling stops, waitpid included
+    uint64_t cpuTime = 0;       // CPU time of the tracing thread in nanoseconds
+    uint64_t suppressed = 0;    // accesses a predicate rejected before any callback (every backend)
+    uint64_t sampledOut = 0;    // accesses skipped by sampling (every backend)
+    double samplingRatio = 1.0; // expected share of the accesses sampling let through, counts / ratio estimate all
+};
+
 class Debugger
 {
     std::string m_path;
     std::vector<std::string> m_args;
-    Variable m_var;
+    std::vector<Variable> m_vars;
     Variable m_prevVar{};
+    size_t m_prevIndex = SIZE_MAX; // variable m_prevVar describes, SIZE_MAX for an element of a wide variable
+    WatchMode m_mode;
+    Backend m_backend = Backend::PTRACE;
+    bool m_captureIp = false;
+    std::vector<std::optional<Predicate>> m_predicates; // by variable, evaluated before the callbacks
+    uint64_t m_sampleEvery = 1;                         // report every Nth access of each variable
+    std::vector<uint64_t> m_sampleCounts;               // accesses of each variable since the last reported one
+    double m_overheadBudget = 0;                        // duty cycle the debug registers, 0 to keep them armed
+    std::unique_ptr<DutyCycle> m_dutyCycle;
+    double m_armedRatio = 1.0;                          // share of the time the debug registers were armed
+    std::optional<AccessStats> m_accessStats;           // accesses are counted instead of reported
+    bool m_symbolize = false;                           // keep the mapped objects for symbolize
+    std::vector<util::MappedFile> m_mappedFiles;        // objects mapped at start and at exit
+    size_t m_backtraceDepth = 0;                        // frames captured per write, 0 for none
+    std::unique_ptr<Unwinder> m_unwinder;
+    StackTable m_stacks;
+    std::vector<uint64_t> m_frames;                     // frames of the last captured stack
+    size_t m_tracerThreads = 1;                         // threads waiting for the stops of the tracee
+    EventInfo m_event{};
+
+    std::vector<util::DebugRegisterSlot> m_slots;
+    std::vector<size_t> m_slotVars;     // variable watched by each slot, a split variable owns consecutive slots
+    std::vector<size_t> m_hardwareVars; // variables watched with debug registers, in slot order
+    std::vector<size_t> m_softwareVars; // variables watched with page protection (ptrace backend only)
+    std::vector<Value> m_softwareValues; // values before the access that is currently stepped over
+    std::unique_ptr<PageWatcher> m_pageWatcher;
+    std::unique_ptr<ProcessMemory> m_memory;
+    std::unique_ptr<TraceBackend> m_traceBackend; // syscalls of the ptrace stop loop, or recorded stops
+    std::unique_ptr<EventLoop> m_eventLoop;       // fds the ptrace stop loop waits on, none for a replay
+    bool m_tracing = false;                       // the stop loop runs, until the traced process exits or is detached
+    bool m_unnotified = false;                    // stops may be pending that the event loop was not notified of
+    std::vector<std::pair<pid_t, int>> m_deferredStops; // reaped while other threads were stopped, handled next
+    pid_t m_tracedPid = 0;
+    uint64_t m_cpuStart = 0;                      // CPU time of the tracing thread when the stop loop started
+    std::optional<StopRecording> m_recording;     // stops of the ptrace run are recorded into it
+    std::unordered_map<pid_t, std::unique_ptr<ThreadState>> m_threads;
+    bool m_followFork = false;
+    std::unordered_map<pid_t, std::unique_ptr<ProcessState>> m_processes; // traced processes, with follow fork only
+    pid_t m_activePid = 0; // process whose variables, slots and memory the members above hold
+    std::map<std::pair<dev_t, ino_t>, std::vector<Variable>> m_images; // variables resolved per binary, at base 0
+    std::unique_ptr<LinkMap> m_linkMap; // follows loaded libraries while there are library watches
+    std::vector<LibraryWatch> m_libraryWatches; // watches qualified with a library, e.g. libfoo.so:counter
+    bool m_resetDebugStatus = true; // kernel keeps DR6 bits of earlier hits, clear them after every hit
+    TraceStats m_stats{};
+
+    bool m_seized = false;              // threads were seized with attach, so the process can be detached again
+    uint64_t m_maxEvents = 0;           // detach after this many events, 0 for no limit
+    std::atomic<bool> m_detach = false; // detach requested, set from a signal handler
 
     using callback_t = std::function<void(const Variable&)>;
     callback_t m_onRead;
     callback_t m_onWrite;
 
+    using batch_callback_t = std::function<void(std::span<const Event>)>;
+    batch_callback_t m_onEvents;
+    std::vector<Event> m_batch; // events not passed to m_onEvents yet, reserved for EVENT_BATCH_SIZE
+
 private:
-    void traceNewThread(pid_t threadId) const;
+    ThreadState& addThread(pid_t threadId, pid_t process);
+    void traceNewThread(pid_t threadId, pid_t process);
+    bool startNewThread(pid_t threadId);
+    void armNewThread(pid_t threadId, ThreadState& state);
+    void traceNewProcess(pid_t processId);
+    void handleExec(pid_t processId);
+    void handleProcessExit(pid_t threadId);
+    void activateProcess(pid_t process);
+    [[nodiscard]] const std::vector<Variable>& resolveImage(const std::string& path);
+
+    void waitForStop(pid_t childPid) const;
+    void resolveVariables(pid_t childPid);
+
+    void addHardwareWatch(size_t index);
+    [[nodiscard]] const std::vector<util::DebugRegisterSlot>& currentSlots() const;
+    void switchWindow();
+    bool resolveLibraryVariables();
+    void updateThreadWatchpoints(pid_t stoppedThread);
+    std::vector<pid_t> stopOtherThreads(pid_t stoppedThread, bool activeProcessOnly);
+    void resumeThreads(const std::vector<pid_t>& threadIds);
+    int handleLibraryEvent(pid_t threadId);
 
     void attachDebugger(pid_t childPid);
-    void traceChild(pid_t childPid);
+    void seizeProcess(pid_t pid);
+    void startTrace(pid_t childPid);
+    void beginTrace(pid_t childPid);
+    void handleStops(bool block);
+    void handleWaitStatus(pid_t threadId, int status);
+    int handleStop(pid_t threadId, int status);
+    void housekeeping();
+    void endTrace();
+    [[nodiscard]] bool shouldDetach() const;
+    void detachProcess(pid_t pid, pid_t stoppedThread, int signal);
+
+    void tracePerf(pid_t childPid);
+    void handlePerfSamples(std::vector<PerfSample>& samples, bool final);
+
+    void traceAgent(pid_t childPid, AgentSession& session);
 
+    void traceShards();
+    void printTraceStats() const;
+
+    void readMemory(std::span<const MemoryRange> ranges) const;
+    uint64_t readInstructionPointer(pid_t threadId);
+    util::WatchpointEvent classifyAccess(pid_t threadId, const Variable& var, const Value& value);
+    void handleWatchpoint(pid_t threadId);
+    int handlePageFault(pid_t threadId, bool stopOthers);
+    Variable accessedElement(const Variable& var, const PageFault& fault) const;
+    void keepPrevious(size_t index, Variable& var);
+    void report(size_t index, util::WatchpointEvent event, Value value);
+    void reportElement(size_t index, Variable element, util::WatchpointEvent event, Value oldValue, Value newValue);
+    void dispatch(size_t index, util::WatchpointEvent event, const Variable& var);
+    [[nodiscard]] bool accept(size_t index, const Variable& var, bool isWrite);
+    void deliver(size_t index, const Variable& var, bool isWrite);
+    void flushEvents();
+    void bindPredicates(pid_t pid);
+    void recordMappings(pid_t pid);
+    [[nodiscard]] bool needsInstructionPointer() const;
+
+    void checkRunSettings() const;
     void runChild();
 
   public:
+    /// Events passed to the batch callback at most at once
+    static constexpr size_t EVENT_BATCH_SIZE = 1024;
+
     Debugger(const std::string& program, const std::vector<std::string>& args, const Variable& variable);
+    Debugger(const std::string& program, const std::vector<std::string>& args, const std::vector<Variable>& variables);
+    ~Debugger();
 
     Debugger(const Debugger&) = delete;
     Debugger(Debugger&&) = delete;
@@ -39,10 +267,153 @@ private:
     void setOnRead(callback_t onRead);
     void setOnWrite(callback_t onWrite);
 
+    /// Receive the accesses in batches instead of the onRead / onWrite callbacks, one call per batch of up to
+    /// EVENT_BATCH_SIZE events: the batch is passed once it is full or its oldest event is 10 ms old, after every
+    /// drain of the perf, agent and tracer thread backends and when the run ends or the process is detached
+    void setOnEvents(batch_callback_t onEvents);
+
+    /// Statically dispatched variant of setOnEvents: handler.onEvent is called for every event of a batch
+    /// from a loop instantiated for Handler, so it can be inlined, the handler has to outlive the run
+    template <EventHandler Handler> void setHandler(Handler& handler)
+    {
+        setOnEvents(
+            [&handler](std::span<const Event> events)
+            {
+                for (const Event& event : events)
+                {
+                    handler.onEvent(event);
+                }
+            });
+    }
+
+    /// Select debug register layout, defaults to DUAL_REGISTER for up to 2 variables and SINGLE_REGISTER otherwise
+    void setWatchMode(WatchMode mode);
+
+    /// Select how watchpoint hits are collected, defaults to PTRACE
+    void setBackend(Backend backend);
+
+    /// Also capture the instruction pointer of every hit,
+    /// costs one extra syscall per stop with the ptrace backend in dual register mode, free otherwise
+    void setCaptureInstructionPointer(bool capture);
+
+    /// Report accesses of a variable only if they satisfy a condition, the predicate runs on the tracer
+    /// before any callback, rejected accesses are counted in TraceStats::suppressed
+    /// @param index index of the variable
+    /// @param predicate compiled condition, functions it uses are resolved in the traced binary
+    void setPredicate(size_t index, Predicate predicate);
+
+    /// Report only every Nth access of each variable, the skipped ones still cost their stop
+    /// and are counted in TraceStats::sampledOut
+    /// @param every N, 1 (default) reports every access
+    void setSampling(uint64_t every);
+
+    /// Duty cycle the debug registers so the tracer stays within an overhead budget (ptrace backend only):
+    /// the watches are armed for a share of every period and disarmed on all threads for the rest of it,
+    /// the share follows the measured stop rate and tracer CPU time, TraceStats::samplingRatio reports the armed share
+    /// @param budget allowed overhead per wall time, e.g. 0.05, 0 (default) keeps the watches armed
+    void setOverheadBudget(double budget);
+
+    /// Count accesses per variable, thread, call site and access type instead of reporting them,
+    /// the callbacks are not called and the instruction pointer is captured with every access
+    void setAccessStats(bool enable);
+
+    /// Counters of the accesses, nullptr unless enabled with setAccessStats
+    [[nodiscard]] const AccessStats* getAccessStats() const;
+
+    /// Keep the list of objects mapped into the tracee when it starts and when it exits or is detached,
+    /// so symbolize can resolve instruction pointers after the run (stops every exiting thread with ptrace)
+    void setSymbolize(bool enable);
+
+    /// Resolve captured instruction pointers to function + offset in one batch, off the stop path,
+    /// functions of libraries that were unloaded before the tracee exited are not found
+    /// @param addresses code addresses, e.g. AccessCount::ip
+    /// @return location of each address in the same order
+    [[nodiscard]] std::vector<CodeLocation> symbolize(std::span<const uint64_t> addresses) const;
+
+    /// Capture the call stack of every reported write (ptrace backend only): one PTRACE_GETREGS and one
+    /// process_vm_readv of the stack per write, frames are walked through the frame pointers or, in functions
+    /// compiled without them, the .eh_frame call frame information, EventInfo::stack refers to the stored stack
+    /// @param depth maximum number of frames including the accessing instruction, 0 (default) captures none
+    void setBacktrace(size_t depth);
+
+    /// Distinct call stacks of the reported writes with their hit counts, empty unless enabled with setBacktrace
+    [[nodiscard]] const StackTable& getStacks() const;
+
+    /// Wait for the stops of the tracee on several tracer threads (ptrace backend, run only): every tracer thread
+    /// owns a shard of the tracee threads, new threads go to the shard tracing the fewest, hits are merged into the
+    /// callbacks, which are called on the thread calling run. Watches have to fit into the debug registers,
+    /// library watches, overhead budgets and backtraces need a single tracer thread
+    /// @param count number of tracer threads, 1 (default) traces on the calling thread
+    void setTracerThreads(size_t count);
+
+    /// Also trace the processes the tracee forks (ptrace backend, single tracer thread): children get the
+    /// watchpoints of their parent, a process that calls exec is resolved again in its new binary, once per binary
+    /// for all processes mapping the same file, a watch the binary lacks stays disarmed in that process.
+    /// The trace ends when the last traced process exits, Event::pid and EventInfo::pid tell the processes apart.
+    /// Watches have to fit into the debug registers, library watches, overhead budgets, backtraces, stop recording
+    /// and conditions on functions need a single process
+    void setFollowFork(bool enable);
+
+    /// Record the stops of the ptrace backend with what was read while handling them, for replay,
+    /// costs a copy of the read values per stop
+    void setStopRecording(bool enable);
+
+    /// Stops of the last run, nullptr unless enabled with setStopRecording
+    [[nodiscard]] const StopRecording* getStopRecording() const;
+
     [[nodiscard]] const Variable& getVar() const;
+    [[nodiscard]] const std::vector<Variable>& getVars() const;
     [[nodiscard]] const Variable& getLastVar() const;
 
+    /// Thread, time and instruction pointer of the access currently reported
+    [[nodiscard]] const EventInfo& getEventInfo() const;
+
+    /// Fault counters of the watches that did not fit into the debug registers
+    [[nodiscard]] PageWatchStats getPageWatchStats() const;
+
+    /// Stops, syscalls and CPU time of the tracer (ptrace backend)
+    [[nodiscard]] TraceStats getTraceStats() const;
+
+    /// Detach from an attached process after this many reported events, 0 (default) for no limit
+    void setMaxEvents(uint64_t maxEvents);
+
+    /// Detach from an attached process as soon as the tracer wakes up, async-signal-safe,
+    /// a signal handler interrupts the wait for the next stop unless it was installed with SA_RESTART
+    void requestDetach();
+
+    /// Start the program and trace it until it exits
     void run();
+
+    /// Start the program and return once it runs with the watchpoints armed, the stops are then handled by poll
+    /// (ptrace backend with a single tracer thread). SIGCHLD is blocked on the calling thread until the trace
+    /// ends, other threads of the application should block it as well so the stops wake up getFd() without delay
+    void start();
+
+    /// Attach to a running process like attach and return, the stops are then handled by poll
+    /// @param pid id of the running process
+    void startAttach(pid_t pid);
+
+    /// File descriptor for the reactor of an embedding application, readable when poll has work: a stop of the
+    /// tracee or the housekeeping timer (batch flushes, duty cycle windows, detach requests), -1 when not tracing
+    [[nodiscard]] int getFd() const;
+
+    /// Handle the pending stops of a trace begun with start or startAttach, waiting up to timeoutMs for one,
+    /// has to be called on the thread that started the trace, ptrace serves only that thread
+    /// @param timeoutMs maximum time to wait (milliseconds), 0 to not block, -1 without limit
+    /// @return false once the traced process exited or was detached and the trace statistics were printed
+    bool poll(int timeoutMs);
+
+    /// Handle recorded stops again without a tracee and without syscalls, e.g. to profile the stop loop,
+    /// the callbacks see the recorded accesses, event times are taken when the stops are replayed.
+    /// The recording defines the variables and the watch mode, watches have to fit into the debug registers,
+    /// library watches, overhead budgets, backtraces, symbolize and conditions on functions are not replayed
+    /// @param recording stops of a run with setStopRecording, or synthetic ones
+    void replay(const StopRecording& recording);
+
+    /// Trace an already running process until it exits or is detached, with the ptrace backend only,
+    /// on detach the watchpoints of every thread are cleared and the process keeps running at full speed
+    /// @param pid id of the running process, its binary is read through /proc/<pid>/exe
+    void attach(pid_t pid);
 };
 
 } // namespace dbg
@@ -0,0 +1,119 @@
+#pragma once
+
+#include "Variable.hpp"
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <sys/uio.h>
+#include <thread>
+#include <vector>
+
+namespace dbg
+{
+
+/// What happens to an event when the writer thread falls behind and the ring is full
+enum class OverflowPolicy
+{
+    BLOCK,    // wait for the writer, nothing is lost but the tracee stays stopped meanwhile
+    DROP,     // drop the event and count it
+    AGGREGATE // merge the event into a summary line per watch, written once the ring has room again
+};
+
+/// Watchpoint hit queued for output
+struct OutputEvent
+{
+    enum Kind : uint8_t
+    {
+        READ,
+        WRITE
+    };
+
+    uint64_t oldValue = 0; // writes only
+    uint64_t newValue = 0;
+    uint64_t oldHigh = 0; // bytes 8 - 15 of values wider than 8 bytes
+    uint64_t newHigh = 0;
+    uint32_t watch = 0;  // index of the watched variable
+    uint32_t offset = 0; // offset of the accessed element of a wide variable
+    uint32_t count = 1;  // number of events merged into this one (AGGREGATE policy)
+    uint32_t stack = 0;  // id of the call stack of a write, 0 if not captured or the merged writes differ
+    uint32_t pid = 0;    // process of the access, printed unless 0 (--follow-fork)
+    uint8_t size = 0;
+    Kind kind = READ;
+    bool element = false; // accessed element of a wide variable, printed as name+offset
+};
+
+/// Writes watchpoint hits from a separate thread, so the tracee does not stay stopped while output is written.
+/// Events are pushed into a preallocated single producer / single consumer ring,
+/// the writer formats them with std::to_chars into large buffers and writes them with writev
+class OutputPipeline
+{
+    struct Watch
+    {
+        std::string name;
+        bool isSigned;
+        bool isFloat;
+    };
+
+    int m_fd;
+    std::vector<Watch> m_watches;
+    OverflowPolicy m_policy;
+
+    // ring, head is written by the producer, tail by the writer thread
+    std::vector<OutputEvent> m_ring;
+    size_t m_mask;
+    alignas(64) std::atomic<uint64_t> m_head{0};
+    alignas(64) std::atomic<uint64_t> m_tail{0};
+    alignas(64) std::atomic<bool> m_closed{false};
+
+    // producer side
+    std::vector<OutputEvent> m_pending; // aggregated events waiting for room in the ring
+    uint64_t m_dropped = 0;
+    uint64_t m_aggregated = 0;
+
+    // writer side
+    std::vector<char> m_buffer;
+    std::vector<iovec> m_chunks; // filled part of every buffer chunk
+    bool m_failed = false;
+
+    std::thread m_writer;
+
+    bool tryPush(const OutputEvent& event);
+    bool flushPending();
+    void aggregate(const OutputEvent& event);
+
+    void writerLoop();
+    void format(const OutputEvent& event);
+    void flush();
+
+  public:
+    static constexpr size_t DEFAULT_CAPACITY = 1 << 16;
+
+    /// Start the writer thread
+    /// @param fd file descriptor the output is written to, stays owned by the caller
+    /// @param watches watched variables, events refer to them by index
+    /// @param policy what to do with events while the ring is full
+    /// @param capacity number of events the ring holds, rounded up to a power of two
+    OutputPipeline(int fd, const std::vector<Variable>& watches, OverflowPolicy policy,
+                   size_t capacity = DEFAULT_CAPACITY);
+    ~OutputPipeline();
+
+    OutputPipeline(const OutputPipeline&) = delete;
+    OutputPipeline(OutputPipeline&&) = delete;
+    OutputPipeline& operator=(const OutputPipeline&) = delete;
+    OutputPipeline& operator=(OutputPipeline&&) = delete;
+
+    /// Queue an event, must always be called from the same thread
+    void push(const OutputEvent& event);
+
+    /// Write all queued events and stop the writer thread, called from the producer thread
+    void close();
+
+    /// Number of events lost because the ring was full
+    [[nodiscard]] uint64_t getDropped() const;
+
+    /// Number of events merged into summary lines because the ring was full
+    [[nodiscard]] uint64_t getAggregated() const;
+};
+
+} // namespace dbg
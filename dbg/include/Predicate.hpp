@@ -0,0 +1,119 @@
+#pragma once
+
+#include "Variable.hpp"
+
+#include <compare>
+#include <cstdint>
+#include <functional>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <sys/types.h>
+#include <utility>
+#include <vector>
+
+namespace dbg
+{
+
+/// Access evaluated by a Predicate before it is reported
+struct Access
+{
+    const Variable* var = nullptr;   // accessed variable or element, holds the new value
+    const Value* oldValue = nullptr; // value before the access
+    bool isWrite = false;
+    pid_t tid = 0;
+    uint64_t ip = 0; // 0 if not captured
+};
+
+/// Condition on an access, compiled once from an expression into a small stack bytecode, e.g.
+///   new > 1000            new != old            write && tid == 1234            ip in update_counter
+/// Operands are new, old (interpreted with the type of the variable), tid, ip and integer or floating point literals,
+/// combined with == != < <= > >=, && (and), || (or), ! (not), parentheses and the flags read and write.
+/// "x in function" is true if x lies within the symbol of a function, functions are resolved with bind.
+class Predicate
+{
+    enum class Op : uint8_t
+    {
+        PUSH,
+        LOAD_NEW,
+        LOAD_OLD,
+        LOAD_TID,
+        LOAD_IP,
+        IS_WRITE,
+        IN_FUNCTION,
+        EQUAL,
+        NOT_EQUAL,
+        LESS,
+        LESS_EQUAL,
+        GREATER,
+        GREATER_EQUAL,
+        NOT,
+        JUMP_IF_FALSE, // keep the top and jump if it is false, pop it otherwise (&&)
+        JUMP_IF_TRUE   // keep the top and jump if it is true, pop it otherwise (||)
+    };
+
+    /// Operand on the evaluation stack, comparisons promote to double if either side is floating point
+    struct Number
+    {
+        enum Kind : uint8_t
+        {
+            UNSIGNED,
+            SIGNED,
+            FLOAT
+        };
+
+        Kind kind = UNSIGNED;
+        uint64_t bits = 0; // two's complement for SIGNED, bit pattern of a double for FLOAT
+    };
+
+    struct Instruction
+    {
+        Op op;
+        Number value{}; // PUSH
+        size_t arg = 0; // function of IN_FUNCTION, target of the jumps
+    };
+
+    struct Function
+    {
+        std::string name;
+        uint64_t start = 0;
+        uint64_t end = 0;
+    };
+
+    class Parser;
+
+    std::string m_expression;
+    std::vector<Instruction> m_code;
+    std::vector<Function> m_functions;
+    bool m_usesIp = false;
+
+    [[nodiscard]] static Number load(const Variable& var, const Value& value);
+    [[nodiscard]] static std::partial_ordering compare(Number lhs, Number rhs);
+
+  public:
+    /// Deepest evaluation stack of an expression
+    static constexpr size_t MAX_DEPTH = 16;
+
+    /// Compile an expression
+    /// @param expression condition, see the class description
+    /// @throws std::invalid_argument on syntax errors
+    explicit Predicate(std::string_view expression);
+
+    /// Resolve the functions used with "in" to their address ranges in the traced process
+    /// @param resolve returns [start, end) of a function, nothing if there is no such function
+    void bind(const std::function<std::optional<std::pair<uint64_t, uint64_t>>(const std::string&)>& resolve);
+
+    /// Run the bytecode on an access
+    /// @return true if the access should be reported
+    [[nodiscard]] bool evaluate(const Access& access) const;
+
+    /// True if the expression reads ip, the debugger then captures it with every stop
+    [[nodiscard]] bool usesInstructionPointer() const;
+
+    /// True if the expression uses "in", bind has to be called before evaluate
+    [[nodiscard]] bool usesFunctions() const;
+
+    [[nodiscard]] const std::string& getExpression() const;
+};
+
+} // namespace dbg
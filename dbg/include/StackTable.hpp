@@ -0,0 +1,52 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <vector>
+
+namespace dbg
+{
+
+/// Call stacks stored once each (hash consing): a captured stack is looked up by its frames and refers to the
+/// stored copy by id, so repeated hits from the same path cost one hash and one table lookup and no allocation
+class StackTable
+{
+    struct Stack
+    {
+        uint64_t hash;
+        size_t offset; // first frame in m_frames
+        size_t depth;
+        uint64_t count = 0;
+    };
+
+    std::vector<uint64_t> m_frames; // frames of all stacks, back to back
+    std::vector<Stack> m_stacks;    // by id - 1
+    std::vector<uint32_t> m_index;  // open addressing table of ids, 0 marks a free slot
+    size_t m_mask;
+
+    [[nodiscard]] static uint64_t hash(std::span<const uint64_t> frames);
+    void grow();
+
+  public:
+    /// @param capacity initial number of slots, rounded up to a power of two
+    explicit StackTable(size_t capacity = 256);
+
+    /// Look up a stack, store it if it is new, and count the hit
+    /// @param frames instruction pointer of the access followed by the return addresses, innermost first
+    /// @return id of the stack, ids start at 1
+    uint32_t intern(std::span<const uint64_t> frames);
+
+    /// Frames of a stored stack, innermost first
+    /// @param id id returned by intern
+    [[nodiscard]] std::span<const uint64_t> getFrames(uint32_t id) const;
+
+    /// Number of hits of a stored stack
+    /// @param id id returned by intern
+    [[nodiscard]] uint64_t getCount(uint32_t id) const;
+
+    /// Number of distinct stacks, ids run from 1 to size()
+    [[nodiscard]] size_t size() const;
+};
+
+} // namespace dbg
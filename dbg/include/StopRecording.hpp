@@ -0,0 +1,39 @@
+#pragma once
+
+#include "Variable.hpp"
+
+#include <cstdint>
+#include <sys/types.h>
+#include <vector>
+
+namespace dbg
+{
+
+enum class WatchMode;
+
+/// Stop of a traced thread as the tracer saw it, with what the kernel returned while the stop was handled
+struct RecordedStop
+{
+    pid_t tid = 0;                  // thread waitpid returned
+    int status = 0;                 // wait status, e.g. SIGTRAP << 8 | 0x7f for a watchpoint hit
+    uint64_t debugStatus = 0;       // DR6
+    unsigned long eventMessage = 0; // PTRACE_GETEVENTMSG, the new thread of a clone event
+    size_t firstWord = 0;           // words of the memory and register reads in StopRecording::words
+    size_t wordCount = 0;
+};
+
+/// Stops of a ptrace run, handled again by Debugger::replay without a tracee and without syscalls
+struct StopRecording
+{
+    pid_t pid = 0;              // main thread of the traced process, the replay ends when it exits
+    WatchMode mode{};           // debug register layout of the recorded run
+    std::vector<Variable> vars; // watched variables with resolved addresses and their values at the start
+    std::vector<RecordedStop> stops;
+
+    /// Results of the reads made while handling the stops, in the order of the reads, 8 bytes per word:
+    /// a memory range takes its size rounded up to words, the registers sizeof(user_regs_struct) / 8 words,
+    /// the instruction pointer one word, the bytes preceding an address their count followed by the bytes
+    std::vector<uint64_t> words;
+};
+
+} // namespace dbg
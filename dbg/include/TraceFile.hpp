@@ -0,0 +1,153 @@
+#pragma once
+
+#include "OutputPipeline.hpp"
+#include "Variable.hpp"
+
+#include <cstdint>
+#include <span>
+#include <string>
+#include <sys/types.h>
+#include <vector>
+
+namespace dbg
+{
+
+/// Binary trace written with --trace-out, little endian:
+///
+///   header  "GWTRACE\0", u32 version, u32 watch count,
+///           varint length + target path, varint length + build-id (hex),
+///           per watch: varint address, varint size, u8 encoding (0 unsigned, 1 signed, 2 floating point),
+///                     varint length + name
+///   chunks  u32 "GWCK", u32 record count, u32 payload size, u32 reserved, u64 base time, payload
+///
+/// Records are delta encoded against the previous record of the same chunk (the first against the base time),
+/// so every chunk can be decoded on its own:
+///
+///   varint watch << 2 | element << 1 | write
+///   varint time delta, zigzag varint tid delta, zigzag varint ip delta
+///   varint new value, writes: zigzag varint new - old
+///   elements: varint offset, u8 size
+///   values wider than 8 bytes: varint new high word, writes: zigzag varint new - old high word
+namespace trace
+{
+constexpr char MAGIC[8] = {'G', 'W', 'T', 'R', 'A', 'C', 'E', '\0'};
+constexpr uint32_t VERSION = 1;
+constexpr uint32_t CHUNK_MAGIC = 0x4B435747; // "GWCK"
+
+/// Records are collected into chunks of at most this many payload bytes
+constexpr size_t MAX_CHUNK_PAYLOAD = 64 * 1024;
+
+/// Longest encoded record: nine varints of at most 10 bytes and the element size
+constexpr size_t MAX_RECORD_SIZE = 9 * 10 + 1;
+
+struct ChunkHeader
+{
+    uint32_t magic;
+    uint32_t count;
+    uint32_t payloadSize;
+    uint32_t reserved;
+    uint64_t baseTime;
+};
+} // namespace trace
+
+/// Watched variable as stored in the trace header
+struct TraceWatch
+{
+    std::string name;
+    uintptr_t address = 0;
+    size_t size = 0;
+    bool isSigned = false;
+    bool isFloat = false;
+};
+
+/// Single watchpoint hit of a trace
+struct TraceRecord
+{
+    uint64_t time = 0; // CLOCK_MONOTONIC nanoseconds
+    uint64_t ip = 0;   // instruction pointer after the access, 0 if unknown
+    pid_t tid = 0;
+    OutputEvent event{}; // watch, access type, values and accessed element
+};
+
+/// Writes a binary trace, records are encoded into a chunk buffer that is written once it is full
+class TraceWriter
+{
+    int m_fd = -1;
+    std::vector<uint8_t> m_chunk; // payload of the current chunk
+    trace::ChunkHeader m_chunkHeader{};
+    TraceRecord m_previous{};
+    uint64_t m_records = 0;
+
+    void writeAll(std::span<const uint8_t> header, std::span<const uint8_t> payload);
+    void flushChunk();
+
+  public:
+    /// Create (truncate) the trace file
+    /// @param path path of the trace file
+    /// @param target path of the traced binary, its build-id is stored with it
+    /// @param watches watched variables with resolved addresses, records refer to them by index
+    TraceWriter(const std::string& path, const std::string& target, const std::vector<Variable>& watches);
+    ~TraceWriter();
+
+    TraceWriter(const TraceWriter&) = delete;
+    TraceWriter(TraceWriter&&) = delete;
+    TraceWriter& operator=(const TraceWriter&) = delete;
+    TraceWriter& operator=(TraceWriter&&) = delete;
+
+    /// Encode a record into the current chunk
+    void append(const TraceRecord& record);
+
+    /// Write the last chunk and close the file, called by the destructor
+    void finish();
+
+    [[nodiscard]] uint64_t getRecordCount() const;
+};
+
+/// Reads a binary trace, the file is mapped and records are decoded in place chunk by chunk
+class TraceReader
+{
+    const uint8_t* m_begin = nullptr;
+    const uint8_t* m_end = nullptr;
+    size_t m_mapSize = 0;
+
+    std::string m_target;
+    std::string m_buildId;
+    std::vector<TraceWatch> m_watches;
+
+    const uint8_t* m_firstChunk = nullptr;
+    const uint8_t* m_nextChunk = nullptr; // header of the chunk after the current one
+    const uint8_t* m_cursor = nullptr;    // next record of the current chunk
+    const uint8_t* m_chunkEnd = nullptr;
+    uint32_t m_remaining = 0; // records left in the current chunk
+    TraceRecord m_previous{};
+
+    bool nextChunk();
+
+  public:
+    /// Map the trace and parse its header
+    /// @param path path of the trace file
+    explicit TraceReader(const std::string& path);
+    ~TraceReader();
+
+    TraceReader(const TraceReader&) = delete;
+    TraceReader(TraceReader&&) = delete;
+    TraceReader& operator=(const TraceReader&) = delete;
+    TraceReader& operator=(TraceReader&&) = delete;
+
+    /// Decode the next record
+    /// @param record filled with the decoded record
+    /// @return false once all records were read
+    bool next(TraceRecord& record);
+
+    /// Start reading from the first record again
+    void rewind();
+
+    [[nodiscard]] const std::string& getTarget() const;
+    [[nodiscard]] const std::string& getBuildId() const;
+    [[nodiscard]] const std::vector<TraceWatch>& getWatches() const;
+
+    /// Watch table as variables, e.g. for formatting records with OutputPipeline
+    [[nodiscard]] std::vector<Variable> getVariables() const;
+};
+
+} // namespace dbg
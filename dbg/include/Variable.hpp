@@ -1,12 +1,52 @@
 #pragma once
 
+#include <array>
 #include <cstdint>
+#include <cstring>
+#include <span>
 #include <stdexcept>
 #include <string>
+#include <type_traits>
+#include <vector>
 
 namespace dbg
 {
 
+/// Raw bytes of a watched value, stored inline up to INLINE_SIZE bytes (e.g. 16 byte atomics and small structs)
+/// so values of usual sizes are copied without allocating, larger objects are stored on the heap
+class Value
+{
+  public:
+    static constexpr size_t INLINE_SIZE = 16;
+
+  private:
+    std::array<uint8_t, INLINE_SIZE> m_inline{};
+    std::vector<uint8_t> m_heap;
+    size_t m_size = 0;
+
+  public:
+    Value() = default;
+
+    /// Zero initialized value of size bytes
+    explicit Value(size_t size);
+
+    /// Value of size bytes (at most 8) taken from the low bytes of word
+    static Value fromWord(uint64_t word, size_t size);
+
+    [[nodiscard]] uint8_t* data();
+    [[nodiscard]] const uint8_t* data() const;
+    [[nodiscard]] size_t size() const;
+    [[nodiscard]] std::span<const uint8_t> bytes() const;
+
+    /// Little endian 8 byte word at index, bytes beyond the value are zero
+    [[nodiscard]] uint64_t word(size_t index = 0) const;
+
+    /// Hexadecimal representation of the value as a little endian integer, e.g. 0x0000000200000001 for 8 bytes
+    [[nodiscard]] std::string toHex() const;
+
+    bool operator==(const Value& other) const;
+};
+
 struct Variable
 {
     // set by client
@@ -16,42 +56,26 @@ struct Variable
     // set by debugger
     uintptr_t address = 0;
     size_t size = 0;
-    uint64_t bytes = 0;
+    bool isFloat = false; // float or double according to DWARF
+    Value value{};
 
     Variable() = default;
     Variable(const std::string& varName, bool varSigned = false);
 
     [[nodiscard]] std::string toString() const;
 
+    /// Value as T, T has to be trivially copyable and of the variable's size (e.g. int, __int128 or a struct)
     template <typename T> [[nodiscard]] T get() const
     {
-        if (sizeof(T) != size)
+        static_assert(std::is_trivially_copyable_v<T>);
+        if (sizeof(T) != size || value.size() != size)
         {
             throw std::runtime_error("Size mismatch in Variable::get");
         }
 
-        if (isSigned)
-        {
-            switch (size)
-            {
-            case 1: return static_cast<T>(static_cast<int8_t>(bytes));
-            case 2: return static_cast<T>(static_cast<int16_t>(bytes));
-            case 4: return static_cast<T>(static_cast<int32_t>(bytes));
-            case 8: return static_cast<T>(static_cast<int64_t>(bytes));
-            }
-        }
-        else
-        {
-            switch (size)
-            {
-            case 1: return static_cast<T>(static_cast<uint8_t>(bytes));
-            case 2: return static_cast<T>(static_cast<uint16_t>(bytes));
-            case 4: return static_cast<T>(static_cast<uint32_t>(bytes));
-            case 8: return static_cast<T>(static_cast<uint64_t>(bytes));
-            }
-        }
-
-        throw std::runtime_error("Unsupported variable size in Variable::get()");
+        T result;
+        memcpy(&result, value.data(), sizeof(T));
+        return result;
     }
 };
 
@@ -0,0 +1,151 @@
+#include "AccessStats.hpp"
+
+#include <algorithm>
+#include <bit>
+#include <iterator>
+#include <map>
+#include <tuple>
+
+namespace dbg
+{
+
+/// Share of used slots at which the table doubles, probe sequences stay short below it
+static constexpr size_t MAX_LOAD_PERCENT = 50;
+
+/// Orders counters by descending count, ties by call site so the output is stable
+static bool byCount(const AccessCount& lhs, const AccessCount& rhs)
+{
+    return std::tie(rhs.count, lhs.ip, lhs.watch, lhs.isWrite, lhs.tid) <
+           std::tie(lhs.count, rhs.ip, rhs.watch, rhs.isWrite, rhs.tid);
+}
+
+AccessStats::AccessStats(size_t capacity) : m_table(std::bit_ceil(std::max<size_t>(capacity, 16)))
+{
+    m_mask = m_table.size() - 1;
+}
+
+size_t AccessStats::hash(uint32_t watch, pid_t tid, uint64_t ip, bool isWrite)
+{
+    // finalizer of splitmix64, instruction pointers of one function differ only in the low bits
+    uint64_t key = ip ^ (static_cast<uint64_t>(static_cast<uint32_t>(tid)) << 32) ^ (uint64_t{watch} << 1) ^ isWrite;
+    key = (key ^ (key >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    key = (key ^ (key >> 27)) * 0x94D049BB133111EBULL;
+    return static_cast<size_t>(key ^ (key >> 31));
+}
+
+void AccessStats::record(uint32_t watch, pid_t tid, uint64_t ip, bool isWrite)
+{
+    ++m_total;
+    for (size_t slot = hash(watch, tid, ip, isWrite) & m_mask;; slot = (slot + 1) & m_mask)
+    {
+        AccessCount& entry = m_table[slot];
+        if (entry.count == 0)
+        {
+            entry = {ip, tid, watch, isWrite, 1};
+            if (++m_used * 100 > m_table.size() * MAX_LOAD_PERCENT)
+            {
+                grow();
+            }
+            return;
+        }
+
+        if (entry.ip == ip && entry.tid == tid && entry.watch == watch && entry.isWrite == isWrite)
+        {
+            ++entry.count;
+            return;
+        }
+    }
+}
+
+void AccessStats::grow()
+{
+    std::vector<AccessCount> old(m_table.size() * 2);
+    old.swap(m_table);
+    m_mask = m_table.size() - 1;
+
+    for (const AccessCount& entry : old)
+    {
+        if (entry.count == 0)
+        {
+            continue;
+        }
+
+        size_t slot = hash(entry.watch, entry.tid, entry.ip, entry.isWrite) & m_mask;
+        while (m_table[slot].count != 0)
+        {
+            slot = (slot + 1) & m_mask;
+        }
+        m_table[slot] = entry;
+    }
+}
+
+std::vector<AccessCount> AccessStats::getCounts() const
+{
+    std::vector<AccessCount> counts;
+    counts.reserve(m_used);
+    std::copy_if(m_table.begin(), m_table.end(), std::back_inserter(counts),
+                 [](const AccessCount& entry) { return entry.count != 0; });
+    std::sort(counts.begin(), counts.end(), byCount);
+    return counts;
+}
+
+std::vector<AccessCount> AccessStats::getTopCallSites(size_t limit) const
+{
+    // runs once at exit, an ordered map keeps it simple
+    std::map<std::tuple<uint64_t, uint32_t, bool>, uint64_t> sites;
+    for (const AccessCount& entry : m_table)
+    {
+        if (entry.count != 0)
+        {
+            sites[{entry.ip, entry.watch, entry.isWrite}] += entry.count;
+        }
+    }
+
+    std::vector<AccessCount> top;
+    top.reserve(sites.size());
+    for (const auto& [key, count] : sites)
+    {
+        top.push_back({std::get<0>(key), 0, std::get<1>(key), std::get<2>(key), count});
+    }
+
+    size_t size = limit == 0 ? top.size() : std::min(limit, top.size());
+    std::partial_sort(top.begin(), top.begin() + static_cast<std::ptrdiff_t>(size), top.end(), byCount);
+    top.resize(size);
+    return top;
+}
+
+std::vector<ThreadAccesses> AccessStats::getThreads() const
+{
+    std::map<pid_t, ThreadAccesses> threads;
+    for (const AccessCount& entry : m_table)
+    {
+        if (entry.count == 0)
+        {
+            continue;
+        }
+
+        ThreadAccesses& thread = threads[entry.tid];
+        thread.tid = entry.tid;
+        (entry.isWrite ? thread.writes : thread.reads) += entry.count;
+    }
+
+    std::vector<ThreadAccesses> result;
+    result.reserve(threads.size());
+    for (const auto& [tid, thread] : threads)
+    {
+        result.push_back(thread);
+    }
+    return result;
+}
+
+uint64_t AccessStats::getTotal() const
+{
+    return m_total;
+}
+
+size_t AccessStats::size() const
+{
+    return m_used;
+}
+
+} // namespace dbg
@@ -0,0 +1,84 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+/// Shared memory layout between gwatch and the preloaded libgwatch_agent.so,
+/// gwatch creates the segment and names the watched variables, the agent resolves and arms them inside the tracee
+/// and appends every access to a lock-free single producer / single consumer ring owned by the accessing thread
+namespace dbg::agent
+{
+
+constexpr uint32_t MAGIC = 0x54415747; // "GWAT"
+constexpr uint32_t VERSION = 2;
+
+/// Environment variable holding the shared memory name passed to the agent
+constexpr const char* SHM_ENV = "GWATCH_SHM";
+
+constexpr size_t MAX_WATCHES = 4;
+constexpr size_t MAX_NAME_LENGTH = 128;
+constexpr size_t MAX_THREADS = 64; // rings are released at thread exit, this bounds live threads only
+constexpr size_t RECORDS_PER_THREAD = 16384; // power of two
+constexpr size_t MAX_ERROR_LENGTH = 256;
+
+/// Agent state, written by the agent
+enum State : uint32_t
+{
+    STATE_INIT = 0,
+    STATE_ARMED = 1,
+    STATE_ERROR = 2
+};
+
+/// Access kind of a record, matches util::WatchpointEvent
+enum RecordEvent : uint8_t
+{
+    RECORD_READ = 0,
+    RECORD_WRITE = 1,
+    RECORD_READ_WRITE = 2
+};
+
+struct Record
+{
+    uint64_t time; // CLOCK_MONOTONIC nanoseconds
+    uint64_t ip;   // address of the instruction following the access
+    uint64_t oldValue;
+    uint64_t newValue;
+    uint32_t tid;
+    uint8_t watch;
+    uint8_t event;
+};
+
+struct alignas(64) ThreadRing
+{
+    alignas(64) std::atomic<uint64_t> head; // written by the agent thread
+    alignas(64) std::atomic<uint64_t> tail; // written by gwatch
+    std::atomic<uint32_t> tid;
+    std::atomic<uint32_t> owned; // set while a thread appends to the ring, cleared at its exit
+    std::atomic<uint64_t> dropped; // records dropped because the ring was full
+    Record records[RECORDS_PER_THREAD];
+};
+
+struct Watch
+{
+    char name[MAX_NAME_LENGTH]; // written by gwatch
+    uint64_t address;           // written by the agent
+    uint64_t size;              // written by the agent
+};
+
+struct Header
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t watchCount;
+    std::atomic<uint32_t> state;
+    char error[MAX_ERROR_LENGTH];
+    Watch watches[MAX_WATCHES];
+    std::atomic<uint32_t> threadCount; // rings ever claimed, released rings keep their unread records
+    std::atomic<uint64_t> droppedThreads; // accesses of threads that found every ring owned
+    ThreadRing rings[MAX_THREADS];
+};
+
+static_assert(std::atomic<uint64_t>::is_always_lock_free, "shared memory rings require lock-free atomics");
+
+} // namespace dbg::agent
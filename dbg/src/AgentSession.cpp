@@ -0,0 +1,141 @@
+#include "AgentSession.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+namespace dbg
+{
+
+namespace
+{
+
+/// Environment variable overriding the location of the agent library
+constexpr const char* AGENT_PATH_ENV = "GWATCH_AGENT";
+
+} // namespace
+
+AgentSession::AgentSession(const std::vector<Variable>& vars)
+{
+    if (vars.size() > agent::MAX_WATCHES)
+    {
+        throw std::runtime_error("Too many variables for the agent: " + std::to_string(vars.size()));
+    }
+
+    static std::atomic<unsigned int> sessionCount{0};
+    m_name = "/gwatch-" + std::to_string(getpid()) + "-" + std::to_string(sessionCount++);
+
+    int fd = shm_open(m_name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+    if (fd < 0)
+    {
+        throw std::runtime_error("shm_open failed: " + std::string(strerror(errno)));
+    }
+
+    if (ftruncate(fd, sizeof(agent::Header)) < 0)
+    {
+        close(fd);
+        shm_unlink(m_name.c_str());
+        throw std::runtime_error("ftruncate failed: " + std::string(strerror(errno)));
+    }
+
+    void* map = mmap(nullptr, sizeof(agent::Header), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+    {
+        shm_unlink(m_name.c_str());
+        throw std::runtime_error("mmap failed: " + std::string(strerror(errno)));
+    }
+
+    // the segment is zero filled, only the header has to be written
+    m_header = static_cast<agent::Header*>(map);
+    m_header->magic = agent::MAGIC;
+    m_header->version = agent::VERSION;
+    m_header->watchCount = static_cast<uint32_t>(vars.size());
+
+    for (size_t i = 0; i < vars.size(); ++i)
+    {
+        if (vars[i].name.size() >= agent::MAX_NAME_LENGTH)
+        {
+            munmap(map, sizeof(agent::Header));
+            shm_unlink(m_name.c_str());
+            throw std::runtime_error("Symbol name too long: " + vars[i].name);
+        }
+        strcpy(m_header->watches[i].name, vars[i].name.c_str());
+    }
+}
+
+AgentSession::~AgentSession()
+{
+    munmap(m_header, sizeof(agent::Header));
+    shm_unlink(m_name.c_str());
+}
+
+void AgentSession::exportEnvironment() const
+{
+    const char* agentPath = getenv(AGENT_PATH_ENV);
+    std::string preload = agentPath ? agentPath : GWATCH_AGENT_PATH;
+
+    const char* currentPreload = getenv("LD_PRELOAD");
+    if (currentPreload && *currentPreload)
+    {
+        preload += ":" + std::string(currentPreload);
+    }
+
+    setenv("LD_PRELOAD", preload.c_str(), 1);
+    setenv(agent::SHM_ENV, m_name.c_str(), 1);
+}
+
+agent::State AgentSession::getState() const
+{
+    return static_cast<agent::State>(m_header->state.load(std::memory_order_acquire));
+}
+
+std::string AgentSession::getError() const
+{
+    return std::string(m_header->error, strnlen(m_header->error, agent::MAX_ERROR_LENGTH));
+}
+
+const agent::Watch& AgentSession::getWatch(size_t index) const
+{
+    return m_header->watches[index];
+}
+
+void AgentSession::drain(std::vector<agent::Record>& records)
+{
+    size_t first = records.size();
+    size_t threadCount = std::min<size_t>(m_header->threadCount.load(std::memory_order_acquire), agent::MAX_THREADS);
+
+    for (size_t i = 0; i < threadCount; ++i)
+    {
+        agent::ThreadRing& ring = m_header->rings[i];
+
+        uint64_t tail = ring.tail.load(std::memory_order_relaxed);
+        uint64_t head = ring.head.load(std::memory_order_acquire);
+        for (; tail < head; ++tail)
+        {
+            records.push_back(ring.records[tail & (agent::RECORDS_PER_THREAD - 1)]);
+        }
+        ring.tail.store(tail, std::memory_order_release);
+    }
+
+    // rings are ordered by themselves, merge them by time
+    std::stable_sort(records.begin() + static_cast<long>(first), records.end(),
+                     [](const agent::Record& a, const agent::Record& b) { return a.time < b.time; });
+}
+
+uint64_t AgentSession::getDropped() const
+{
+    uint64_t dropped = m_header->droppedThreads.load(std::memory_order_relaxed);
+    for (const agent::ThreadRing& ring : m_header->rings)
+    {
+        dropped += ring.dropped.load(std::memory_order_relaxed);
+    }
+    return dropped;
+}
+
+} // namespace dbg
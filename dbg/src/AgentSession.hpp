@@ -0,0 +1,46 @@
+#pragma once
+
+#include "AgentBuffer.hpp"
+#include "Variable.hpp"
+
+#include <string>
+#include <vector>
+
+namespace dbg
+{
+
+/// Shared memory segment read by gwatch while the preloaded agent watches variables inside the tracee
+class AgentSession
+{
+    std::string m_name;
+    agent::Header* m_header = nullptr;
+
+  public:
+    /// Create the shared memory segment and name the watched variables
+    /// @param vars variables the agent should watch
+    explicit AgentSession(const std::vector<Variable>& vars);
+    ~AgentSession();
+
+    AgentSession(const AgentSession&) = delete;
+    AgentSession(AgentSession&&) = delete;
+    AgentSession& operator=(const AgentSession&) = delete;
+    AgentSession& operator=(AgentSession&&) = delete;
+
+    /// Set up the environment of the calling (child) process so the agent is preloaded into the next exec
+    void exportEnvironment() const;
+
+    [[nodiscard]] agent::State getState() const;
+    [[nodiscard]] std::string getError() const;
+
+    /// Address and size of a watch, resolved by the agent once it is armed
+    [[nodiscard]] const agent::Watch& getWatch(size_t index) const;
+
+    /// Move records of every thread ring to records, ordered by time
+    /// @param records vector the records are appended to
+    void drain(std::vector<agent::Record>& records);
+
+    /// Number of records dropped because a ring was full or no ring was left for a thread
+    [[nodiscard]] uint64_t getDropped() const;
+};
+
+} // namespace dbg
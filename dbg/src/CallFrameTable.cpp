@@ -0,0 +1,511 @@
+#include "CallFrameTable.hpp"
+
+#include "ElfFile.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cstring>
+#include <string_view>
+
+namespace dbg
+{
+
+// pointer encodings (DW_EH_PE_*), low nibble is the format, the next bits the base
+static constexpr uint8_t PE_ABSPTR = 0x00;
+static constexpr uint8_t PE_ULEB128 = 0x01;
+static constexpr uint8_t PE_UDATA2 = 0x02;
+static constexpr uint8_t PE_UDATA4 = 0x03;
+static constexpr uint8_t PE_UDATA8 = 0x04;
+static constexpr uint8_t PE_SLEB128 = 0x09;
+static constexpr uint8_t PE_SDATA2 = 0x0A;
+static constexpr uint8_t PE_SDATA4 = 0x0B;
+static constexpr uint8_t PE_SDATA8 = 0x0C;
+static constexpr uint8_t PE_PCREL = 0x10;
+static constexpr uint8_t PE_INDIRECT = 0x80;
+
+// DWARF register numbers of x86-64
+static constexpr uint64_t REG_RBP = 6;
+static constexpr uint64_t REG_RSP = 7;
+static constexpr uint64_t REG_RA = 16;
+
+/// Longest remember_state stack of a CFA program
+static constexpr size_t MAX_REMEMBERED = 8;
+
+namespace
+{
+
+/// Bounds checked reader of .eh_frame, reads past the end yield 0 and clear ok
+struct Reader
+{
+    const uint8_t* begin;
+    const uint8_t* pos;
+    const uint8_t* end;
+    uint64_t address; // link time address of begin, base of pc relative pointers
+    bool ok = true;
+
+    template <typename T> T read()
+    {
+        T value{};
+        if (static_cast<size_t>(end - pos) < sizeof(T))
+        {
+            ok = false;
+            pos = end;
+            return value;
+        }
+        memcpy(&value, pos, sizeof(T));
+        pos += sizeof(T);
+        return value;
+    }
+
+    uint64_t uleb()
+    {
+        uint64_t value = 0;
+        for (unsigned shift = 0; pos < end && shift < 64; shift += 7)
+        {
+            uint8_t byte = *pos++;
+            value |= static_cast<uint64_t>(byte & 0x7F) << shift;
+            if (!(byte & 0x80))
+            {
+                return value;
+            }
+        }
+        ok = false;
+        return value;
+    }
+
+    int64_t sleb()
+    {
+        int64_t value = 0;
+        unsigned shift = 0;
+        while (pos < end && shift < 64)
+        {
+            uint8_t byte = *pos++;
+            value |= static_cast<int64_t>(byte & 0x7F) << shift;
+            shift += 7;
+            if (!(byte & 0x80))
+            {
+                if (shift < 64 && (byte & 0x40))
+                {
+                    value |= -(int64_t{1} << shift);
+                }
+                return value;
+            }
+        }
+        ok = false;
+        return value;
+    }
+
+    /// Read a pointer, only absolute and pc relative pointers occur in the FDEs of .eh_frame
+    uint64_t pointer(uint8_t encoding)
+    {
+        uint64_t fieldAddress = address + static_cast<uint64_t>(pos - begin);
+        uint64_t value = 0;
+        switch (encoding & 0x0F)
+        {
+        case PE_ABSPTR: value = read<uint64_t>(); break;
+        case PE_ULEB128: value = uleb(); break;
+        case PE_UDATA2: value = read<uint16_t>(); break;
+        case PE_UDATA4: value = read<uint32_t>(); break;
+        case PE_UDATA8: value = read<uint64_t>(); break;
+        case PE_SLEB128: value = static_cast<uint64_t>(sleb()); break;
+        case PE_SDATA2: value = static_cast<uint64_t>(static_cast<int64_t>(read<int16_t>())); break;
+        case PE_SDATA4: value = static_cast<uint64_t>(static_cast<int64_t>(read<int32_t>())); break;
+        case PE_SDATA8: value = read<uint64_t>(); break;
+        default: ok = false; return 0;
+        }
+
+        switch (encoding & 0x70)
+        {
+        case PE_ABSPTR: break;
+        case PE_PCREL: value += fieldAddress; break;
+        default: ok = false; break;
+        }
+        return value;
+    }
+};
+
+/// Common information entry shared by the FDEs of an object
+struct Cie
+{
+    uint64_t codeAlignment = 1;
+    int64_t dataAlignment = -8;
+    uint64_t returnRegister = REG_RA;
+    uint8_t fdeEncoding = PE_ABSPTR;
+    bool hasAugmentationData = false;
+    const uint8_t* instructions = nullptr;
+    const uint8_t* end = nullptr;
+};
+
+/// Register rule of a row, only the ones needed to find the caller are kept
+struct RegisterRule
+{
+    bool saved = false; // at CFA + offset
+    bool unsupported = false;
+    int64_t offset = 0;
+};
+
+/// CFA rule and the rules of rbp and the return address
+struct Row
+{
+    uint64_t cfaRegister = REG_RSP;
+    int64_t cfaOffset = 0;
+    bool cfaUnsupported = false;
+    RegisterRule framePointer;
+    RegisterRule returnAddress;
+
+    RegisterRule* rule(uint64_t reg, uint64_t returnRegister)
+    {
+        if (reg == REG_RBP)
+        {
+            return &framePointer;
+        }
+        return reg == returnRegister ? &returnAddress : nullptr;
+    }
+};
+
+/// Parse the CIE at the start of reader, the length field was already read
+bool parseCie(Reader& reader, Cie& cie)
+{
+    uint8_t version = reader.read<uint8_t>();
+    const char* augmentation = reinterpret_cast<const char*>(reader.pos);
+    size_t augmentationLength = strnlen(augmentation, static_cast<size_t>(reader.end - reader.pos));
+    reader.pos += std::min<size_t>(augmentationLength + 1, static_cast<size_t>(reader.end - reader.pos));
+    std::string_view augmentationString(augmentation, augmentationLength);
+
+    if (augmentationString.find("eh") != std::string_view::npos)
+    {
+        reader.read<uint64_t>(); // GCC 2 exception table pointer
+    }
+    cie.codeAlignment = reader.uleb();
+    cie.dataAlignment = reader.sleb();
+    cie.returnRegister = version == 1 ? reader.read<uint8_t>() : reader.uleb();
+
+    if (!augmentationString.empty() && augmentationString.front() == 'z')
+    {
+        cie.hasAugmentationData = true;
+        uint64_t length = reader.uleb();
+        const uint8_t* dataEnd = reader.pos + std::min<uint64_t>(length, reader.end - reader.pos);
+        for (char c : augmentationString.substr(1))
+        {
+            if (c == 'R')
+            {
+                cie.fdeEncoding = reader.read<uint8_t>();
+            }
+            else if (c == 'P')
+            {
+                uint8_t encoding = reader.read<uint8_t>();
+                reader.pointer(static_cast<uint8_t>(encoding & ~PE_INDIRECT));
+            }
+            else if (c == 'L')
+            {
+                reader.read<uint8_t>();
+            }
+        }
+        reader.pos = dataEnd;
+    }
+
+    cie.instructions = reader.pos;
+    cie.end = reader.end;
+    return reader.ok;
+}
+
+/// Run a CFA program until the row of pc
+/// @return false on unsupported or malformed instructions
+bool execute(Reader reader, const Cie& cie, uint64_t loc, uint64_t pc, Row& row, Row initial)
+{
+    std::array<Row, MAX_REMEMBERED> remembered{};
+    size_t rememberedCount = 0;
+
+    while (reader.pos < reader.end && reader.ok)
+    {
+        uint8_t opcode = reader.read<uint8_t>();
+        uint8_t high = opcode & 0xC0;
+        uint8_t low = opcode & 0x3F;
+
+        uint64_t advance = 0;
+        if (high == 0x40) // advance_loc
+        {
+            advance = low;
+        }
+        else if (high == 0x80) // offset
+        {
+            int64_t offset = static_cast<int64_t>(reader.uleb()) * cie.dataAlignment;
+            if (RegisterRule* rule = row.rule(low, cie.returnRegister))
+            {
+                *rule = {true, false, offset};
+            }
+            continue;
+        }
+        else if (high == 0xC0) // restore
+        {
+            if (RegisterRule* rule = row.rule(low, cie.returnRegister))
+            {
+                *rule = *initial.rule(low, cie.returnRegister);
+            }
+            continue;
+        }
+        else
+        {
+            switch (opcode)
+            {
+            case 0x00: break; // nop
+            case 0x01: loc = reader.pointer(cie.fdeEncoding); break;
+            case 0x02: advance = reader.read<uint8_t>(); break;
+            case 0x03: advance = reader.read<uint16_t>(); break;
+            case 0x04: advance = reader.read<uint32_t>(); break;
+            case 0x05: // offset_extended
+            case 0x11: // offset_extended_sf
+            case 0x14: // val_offset
+            case 0x15: // val_offset_sf
+            {
+                uint64_t reg = reader.uleb();
+                bool isSigned = opcode == 0x11 || opcode == 0x15;
+                int64_t factored = isSigned ? reader.sleb() : static_cast<int64_t>(reader.uleb());
+                int64_t offset = factored * cie.dataAlignment;
+                if (RegisterRule* rule = row.rule(reg, cie.returnRegister))
+                {
+                    bool isValue = opcode == 0x14 || opcode == 0x15;
+                    *rule = {!isValue, isValue, offset};
+                }
+                break;
+            }
+            case 0x06: // restore_extended
+            {
+                uint64_t reg = reader.uleb();
+                if (RegisterRule* rule = row.rule(reg, cie.returnRegister))
+                {
+                    *rule = *initial.rule(reg, cie.returnRegister);
+                }
+                break;
+            }
+            case 0x07: // undefined
+            case 0x08: // same_value
+            {
+                if (RegisterRule* rule = row.rule(reader.uleb(), cie.returnRegister))
+                {
+                    *rule = {};
+                }
+                break;
+            }
+            case 0x09: // register
+            {
+                uint64_t reg = reader.uleb();
+                reader.uleb();
+                if (RegisterRule* rule = row.rule(reg, cie.returnRegister))
+                {
+                    *rule = {false, true, 0};
+                }
+                break;
+            }
+            case 0x0A: // remember_state
+                if (rememberedCount == MAX_REMEMBERED)
+                {
+                    return false;
+                }
+                remembered[rememberedCount++] = row;
+                break;
+            case 0x0B: // restore_state
+                if (rememberedCount == 0)
+                {
+                    return false;
+                }
+                row = remembered[--rememberedCount];
+                break;
+            case 0x0C: // def_cfa
+                row.cfaRegister = reader.uleb();
+                row.cfaOffset = static_cast<int64_t>(reader.uleb());
+                row.cfaUnsupported = false;
+                break;
+            case 0x0D: // def_cfa_register
+                row.cfaRegister = reader.uleb();
+                break;
+            case 0x0E: // def_cfa_offset
+                row.cfaOffset = static_cast<int64_t>(reader.uleb());
+                break;
+            case 0x0F: // def_cfa_expression
+                reader.pos += std::min<uint64_t>(reader.uleb(), static_cast<uint64_t>(reader.end - reader.pos));
+                row.cfaUnsupported = true;
+                break;
+            case 0x10: // expression
+            case 0x16: // val_expression
+            {
+                uint64_t reg = reader.uleb();
+                reader.pos += std::min<uint64_t>(reader.uleb(), static_cast<uint64_t>(reader.end - reader.pos));
+                if (RegisterRule* rule = row.rule(reg, cie.returnRegister))
+                {
+                    *rule = {false, true, 0};
+                }
+                break;
+            }
+            case 0x12: // def_cfa_sf
+                row.cfaRegister = reader.uleb();
+                row.cfaOffset = reader.sleb() * cie.dataAlignment;
+                row.cfaUnsupported = false;
+                break;
+            case 0x13: // def_cfa_offset_sf
+                row.cfaOffset = reader.sleb() * cie.dataAlignment;
+                break;
+            case 0x2E: // GNU_args_size
+                reader.uleb();
+                break;
+            case 0x2F: // GNU_negative_offset_extended
+            {
+                uint64_t reg = reader.uleb();
+                int64_t offset = -static_cast<int64_t>(reader.uleb()) * cie.dataAlignment;
+                if (RegisterRule* rule = row.rule(reg, cie.returnRegister))
+                {
+                    *rule = {true, false, offset};
+                }
+                break;
+            }
+            default: return false;
+            }
+        }
+
+        // the row of pc is the one before the first advance past it
+        if (advance > 0)
+        {
+            loc += advance * cie.codeAlignment;
+            if (loc > pc)
+            {
+                break;
+            }
+        }
+    }
+    return reader.ok;
+}
+
+} // namespace
+
+CallFrameTable::CallFrameTable(const std::string& path, uint64_t start)
+{
+    ElfFile elf(path);
+    m_bias = elf.isPositionIndependent() ? start - elf.getLinkBase() : 0;
+    m_start = start;
+    m_end = m_bias + elf.getLinkEnd();
+
+    std::optional<ElfFile::Section> section = elf.getSection(".eh_frame");
+    if (!section)
+    {
+        return;
+    }
+    m_data.assign(section->data.begin(), section->data.end());
+    m_address = section->address;
+
+    // every entry starts with its length, a CIE has id 0, an FDE the distance back to its CIE
+    Reader reader{m_data.data(), m_data.data(), m_data.data() + m_data.size(), m_address};
+    while (reader.pos + sizeof(uint32_t) <= reader.end)
+    {
+        const uint8_t* entry = reader.pos;
+        uint32_t length = reader.read<uint32_t>();
+        if (length == 0 || length == 0xFFFFFFFF || length > static_cast<size_t>(reader.end - reader.pos))
+        {
+            break; // terminator, or 64-bit DWARF which .eh_frame does not use
+        }
+        const uint8_t* next = reader.pos + length;
+
+        const uint8_t* idField = reader.pos;
+        uint32_t id = reader.read<uint32_t>();
+        if (id != 0 && static_cast<size_t>(idField - m_data.data()) >= id)
+        {
+            Cie cie;
+            Reader cieReader = reader;
+            cieReader.pos = idField - id;
+            uint32_t cieLength = cieReader.read<uint32_t>();
+            cieReader.end = std::min(cieReader.pos + cieLength, reader.end);
+            cieReader.read<uint32_t>();
+
+            Reader fdeReader = reader;
+            fdeReader.end = next;
+            if (parseCie(cieReader, cie))
+            {
+                uint64_t pcBegin = fdeReader.pointer(cie.fdeEncoding);
+                uint64_t pcRange = fdeReader.pointer(cie.fdeEncoding & 0x0F);
+                if (fdeReader.ok && pcRange > 0)
+                {
+                    m_fdes.push_back({pcBegin, pcBegin + pcRange, static_cast<size_t>(entry - m_data.data())});
+                }
+            }
+        }
+        reader.pos = next;
+    }
+
+    std::sort(m_fdes.begin(), m_fdes.end(), [](const Fde& lhs, const Fde& rhs) { return lhs.start < rhs.start; });
+}
+
+std::optional<FrameRule> CallFrameTable::find(uint64_t pc) const
+{
+    uint64_t linkPc = pc - m_bias;
+    auto next = std::upper_bound(m_fdes.begin(), m_fdes.end(), linkPc,
+                                 [](uint64_t value, const Fde& fde) { return value < fde.start; });
+    if (next == m_fdes.begin() || linkPc >= std::prev(next)->end)
+    {
+        return std::nullopt;
+    }
+    const Fde& fde = *std::prev(next);
+
+    // the FDE was validated when it was indexed
+    Reader reader{m_data.data(), m_data.data() + fde.offset, m_data.data() + m_data.size(), m_address};
+    uint32_t length = reader.read<uint32_t>();
+    reader.end = reader.pos + length;
+    const uint8_t* idField = reader.pos;
+    uint32_t id = reader.read<uint32_t>();
+
+    Cie cie;
+    Reader cieReader = reader;
+    cieReader.pos = idField - id;
+    uint32_t cieLength = cieReader.read<uint32_t>();
+    cieReader.end = cieReader.pos + cieLength;
+    cieReader.read<uint32_t>();
+    if (!parseCie(cieReader, cie))
+    {
+        return std::nullopt;
+    }
+
+    reader.pointer(cie.fdeEncoding);
+    reader.pointer(cie.fdeEncoding & 0x0F);
+    if (cie.hasAugmentationData)
+    {
+        reader.pos += std::min<uint64_t>(reader.uleb(), static_cast<uint64_t>(reader.end - reader.pos));
+    }
+
+    // the initial instructions of the CIE apply to every FDE, restore goes back to their rules
+    Row initial;
+    Reader initialReader{m_data.data(), cie.instructions, cie.end, m_address};
+    if (!execute(initialReader, cie, fde.start, UINT64_MAX, initial, initial))
+    {
+        return std::nullopt;
+    }
+
+    Row row = initial;
+    if (!execute(reader, cie, fde.start, linkPc, row, initial))
+    {
+        return std::nullopt;
+    }
+
+    if (row.cfaUnsupported || (row.cfaRegister != REG_RSP && row.cfaRegister != REG_RBP) ||
+        !row.returnAddress.saved || row.framePointer.unsupported)
+    {
+        return std::nullopt;
+    }
+
+    FrameRule rule;
+    rule.cfaFromFramePointer = row.cfaRegister == REG_RBP;
+    rule.cfaOffset = row.cfaOffset;
+    rule.returnOffset = row.returnAddress.offset;
+    rule.framePointerSaved = row.framePointer.saved;
+    rule.framePointerOffset = row.framePointer.offset;
+    return rule;
+}
+
+bool CallFrameTable::contains(uint64_t address) const
+{
+    return address >= m_start && address < m_end;
+}
+
+size_t CallFrameTable::size() const
+{
+    return m_fdes.size();
+}
+
+} // namespace dbg
@@ -0,0 +1,62 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <vector>
+
+namespace dbg
+{
+
+/// Row of the call frame information of one instruction: where the canonical frame address (the stack pointer
+/// before the call) and the saved return address and frame pointer are
+struct FrameRule
+{
+    bool cfaFromFramePointer = false; // CFA = rbp + cfaOffset, rsp + cfaOffset otherwise
+    int64_t cfaOffset = 0;
+    int64_t returnOffset = -8; // return address saved at CFA + returnOffset
+    bool framePointerSaved = false;
+    int64_t framePointerOffset = 0; // caller's rbp saved at CFA + framePointerOffset
+};
+
+/// Call frame information (CFI) from the .eh_frame section of an elf file, used to unwind functions compiled
+/// without frame pointers. The FDEs are indexed once by the address range they cover, the CFA program of an FDE
+/// is only run when an address inside it is unwound. Rules other than CFA = rsp / rbp + offset and registers saved
+/// at an offset from the CFA (e.g. DWARF expressions of PLT entries) end the unwinding
+class CallFrameTable
+{
+    struct Fde
+    {
+        uint64_t start; // link time address range
+        uint64_t end;
+        size_t offset; // of the FDE in m_data
+    };
+
+    std::vector<uint8_t> m_data; // .eh_frame
+    uint64_t m_address = 0;      // link time address of .eh_frame
+    uint64_t m_bias = 0;         // load address - link time address
+    uint64_t m_start = 0;        // addresses the object is mapped at
+    uint64_t m_end = 0;
+    std::vector<Fde> m_fdes;     // sorted by start
+
+  public:
+    /// Index the FDEs of an elf file
+    /// @param path path of a mapped elf file
+    /// @param start address the first segment of the file is mapped at
+    /// @throws std::runtime_error if the file can not be read
+    CallFrameTable(const std::string& path, uint64_t start);
+
+    /// Run the CFA program of the FDE covering an address
+    /// @param pc address in the traced process, for callers the return address - 1
+    /// @return rule of the instruction, nothing if no FDE covers it or its rules are not supported
+    [[nodiscard]] std::optional<FrameRule> find(uint64_t pc) const;
+
+    /// Check if an address lies within the segments of the object
+    [[nodiscard]] bool contains(uint64_t address) const;
+
+    /// Number of indexed FDEs
+    [[nodiscard]] size_t size() const;
+};
+
+} // namespace dbg
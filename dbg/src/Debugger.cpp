@@ -1,199 +1,2328 @@
 #include "Debugger.hpp"
 
+#include "AgentSession.hpp"
+#include "Decoder.hpp"
+#include "DutyCycle.hpp"
+#include "DwarfReader.hpp"
+#include "EventLoop.hpp"
+#include "LinkMap.hpp"
+#include "PageWatcher.hpp"
+#include "PerfSession.hpp"
+#include "ProcessMemory.hpp"
+#include "SymbolIndex.hpp"
+#include "Symbolizer.hpp"
+#include "TraceBackend.hpp"
+#include "TracerPool.hpp"
+#include "Unwinder.hpp"
 #include "Util.hpp"
+#include "WatchpointHits.hpp"
 
+#include <algorithm>
+#include <array>
+#include <bit>
 #include <cassert>
+#include <chrono>
 #include <cstring>
 #include <filesystem>
+#include <iomanip>
 #include <iostream>
+#include <memory>
 #include <stdexcept>
+#include <thread>
+#include <type_traits>
+#include <unordered_set>
 #include <sys/ptrace.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/user.h>
 #include <sys/wait.h>
 #include <unistd.h>
 
 namespace dbg
 {
 
+/// Maximum time the perf backend sleeps between two drains (milliseconds)
+static constexpr int PERF_DRAIN_INTERVAL_MS = 10;
+
+/// Time the agent backend sleeps between two drains
+static constexpr std::chrono::microseconds AGENT_DRAIN_INTERVAL{500};
+
+/// Period of the housekeeping timer of the ptrace backend: batch flushes, detach requests and stops whose SIGCHLD
+/// was accepted by another thread of the tracer
+static constexpr std::chrono::milliseconds HOUSEKEEPING_TICK{10};
+
+/// Period of the housekeeping timer with an overhead budget, the duty cycle switches windows on it while disarmed
+static constexpr std::chrono::milliseconds DUTY_CYCLE_TICK{1};
+
+/// Age of the oldest batched event at which the batch is passed on before it is full
+static constexpr std::chrono::nanoseconds EVENT_BATCH_LATENCY{std::chrono::milliseconds(10)};
+
+/// Widest element of a wide variable reported for a single access
+static constexpr size_t MAX_ELEMENT_SIZE = sizeof(uint64_t);
+
+/// Variables that fit into the debug registers in a watch mode
+static size_t maxHardwareVariables(WatchMode mode)
+{
+    return mode == WatchMode::DUAL_REGISTER ? util::DEBUG_REGISTER_COUNT / 2 : util::DEBUG_REGISTER_COUNT;
+}
+
+/// Debug registers a variable takes when it is split into aligned ranges, 0 if it is wider than a reported value
+static size_t requiredSlots(const Variable& var, WatchMode mode)
+{
+    if (var.size == 0 || var.size > Value::INLINE_SIZE)
+    {
+        return 0;
+    }
+    return util::planWatch(var.address, var.size).size() * (mode == WatchMode::DUAL_REGISTER ? 2 : 1);
+}
+
+static_assert(std::is_trivially_copyable_v<Event>, "events are passed to the batch callback by span");
+
+/// Start of a new thread, the clone event of its parent and its own initial stop are reported in either order
+enum class ThreadStart : uint8_t
+{
+    CLONED,  // announced by the clone event, the initial stop is still to come
+    STOPPED, // initial stop reported first, the thread stays stopped until the clone event names its process
+    ARMED,   // debug registers are set, the thread runs
+};
+
+/// Tracer side state of a traced thread
+struct ThreadState
+{
+    util::DebugRegisterState debugRegisters; // values last written to the debug registers of the thread
+    pid_t process = 0;                       // thread group the thread belongs to, 0 while STOPPED
+    ThreadStart start = ThreadStart::ARMED;
+};
+
+/// Variables, debug register slots and memory of a traced process while another one is active (follow fork),
+/// the members of the Debugger hold those of the active process, which leaves its own state empty
+struct ProcessState
+{
+    std::vector<Variable> vars; // addresses in this process and the values last seen in it
+    std::vector<util::DebugRegisterSlot> slots;
+    std::unique_ptr<ProcessMemory> memory;
+    std::unique_ptr<TraceBackend> traceBackend;
+    bool exited = false; // the main process stays until the last process exited, for the results of the run
+};
+
+/// Watch of a global variable of a shared library, resolved whenever the dynamic linker changes its list of objects
+struct LibraryWatch
+{
+    size_t var = 0;
+    std::string library;    // as given before the colon, e.g. libfoo.so
+    std::string expression; // e.g. counter or cfg.limits[1]
+    size_t slot = 0;        // first debug register slot reserved for the watch
+    std::string path;       // path of the loaded library, empty while it is not loaded
+    uintptr_t base = 0;     // l_addr of the loaded library
+};
+
+/// Split a library-qualified name (libfoo.so:counter) at its colon, "::" of a c++ name is no separator
+/// @return library and expression, the library is empty for a variable of the main executable
+static std::pair<std::string, std::string> splitLibrary(const std::string& name)
+{
+    size_t colon = name.find(':');
+    if (colon == std::string::npos || colon == 0 || name.compare(colon, 2, "::") == 0)
+    {
+        return {{}, name};
+    }
+    return {name.substr(0, colon), name.substr(colon + 1)};
+}
+
+/// Check if a loaded library is the one a watch names, either by path, file name or file name without the version
+/// (libfoo.so matches /usr/lib/libfoo.so.1)
+static bool matchesLibrary(const std::string& path, const std::string& library)
+{
+    std::string fileName = std::filesystem::path(path).filename().string();
+    return path == library || fileName == library ||
+           (fileName.starts_with(library) && fileName[library.size()] == '.' && library.ends_with(".so"));
+}
+
+/// Device and inode of a file, binaries mapped by several processes are resolved once
+static std::pair<dev_t, ino_t> getFileId(const std::string& path)
+{
+    struct stat file{};
+    if (stat(path.c_str(), &file) < 0)
+    {
+        throw std::runtime_error("stat of " + path + " failed: " + std::string(strerror(errno)));
+    }
+    return {file.st_dev, file.st_ino};
+}
+
+/// Narrow a variable to the member or element its name selects (e.g. cfg.limits[1].max) and take signedness
+/// and floating point from its DWARF type, --svar still forces signed
+/// @param dwarf debug information of the traced binary
+/// @param var variable with the address and size of its symbol
+/// @param expression name of the variable without its library
+/// @param symbolValue link time address of the symbol
+static void applyDebugInfo(const DwarfReader& dwarf, Variable& var, const std::string& expression, uint64_t symbolValue)
+{
+    bool isPath = expression.find_first_of(".[") != std::string::npos;
+    auto location = dwarf.resolve(expression, symbolValue);
+    if (!location)
+    {
+        if (isPath)
+        {
+            throw std::runtime_error("No debug information for " + var.name + ", build the program with -g");
+        }
+        return;
+    }
+
+    if (isPath)
+    {
+        var.address += location->offset;
+        var.size = location->size;
+    }
+    var.isSigned = var.isSigned || location->isSigned;
+    var.isFloat = location->isFloat;
+}
+
+/// Set address, size and type of a variable from the symbol and the debug information of its binary
+/// @param symbols symbols of the binary
+/// @param dwarf debug information of the binary
+/// @param var variable to resolve
+/// @param expression name of the variable without its library, the symbol of cfg.limits[1].max is cfg
+/// @param base load address of the binary
+static void resolveSymbol(const SymbolIndex& symbols, const DwarfReader& dwarf, Variable& var,
+                          const std::string& expression, uintptr_t base)
+{
+    std::string symbolName = expression.substr(0, expression.find_first_of(".["));
+    auto symbol = symbols.find(symbolName);
+    if (!symbol)
+    {
+        throw std::runtime_error("Symbol not found: " + symbolName);
+    }
+    var.address = base + symbol->value;
+    var.size = symbol->size;
+    applyDebugInfo(dwarf, var, expression, symbol->value);
+
+    if (var.size == 0)
+    {
+        throw std::runtime_error("Invalid watchpoint size 0 of " + var.name);
+    }
+}
+
 Debugger::Debugger(const std::string& program, const std::vector<std::string>& args, const Variable& variable)
+    : Debugger(program, args, std::vector<Variable>{variable})
+{
+}
+
+Debugger::Debugger(const std::string& program, const std::vector<std::string>& args,
+                   const std::vector<Variable>& variables)
     : m_path{program},
       m_args{args},
-      m_var{variable}
+      m_vars{variables},
+      m_mode{variables.size() <= 2 ? WatchMode::DUAL_REGISTER : WatchMode::SINGLE_REGISTER}
 {
 }
 
+Debugger::~Debugger() = default;
+
 void Debugger::setOnRead(callback_t onRead)
 {
     m_onRead = onRead;
 }
 
-void Debugger::setOnWrite(callback_t onWrite)
+void Debugger::setOnWrite(callback_t onWrite)
+{
+    m_onWrite = onWrite;
+}
+
+void Debugger::setOnEvents(batch_callback_t onEvents)
+{
+    m_onEvents = std::move(onEvents);
+    m_batch.reserve(EVENT_BATCH_SIZE);
+}
+
+void Debugger::setWatchMode(WatchMode mode)
+{
+    m_mode = mode;
+}
+
+void Debugger::setBackend(Backend backend)
+{
+    m_backend = backend;
+}
+
+void Debugger::setCaptureInstructionPointer(bool capture)
+{
+    m_captureIp = capture;
+}
+
+void Debugger::setPredicate(size_t index, Predicate predicate)
+{
+    if (index >= m_vars.size())
+    {
+        throw std::runtime_error("No variable with index " + std::to_string(index) + " for --when");
+    }
+    m_predicates.resize(m_vars.size());
+    m_predicates[index] = std::move(predicate);
+}
+
+bool Debugger::needsInstructionPointer() const
+{
+    return m_captureIp || m_accessStats || std::any_of(m_predicates.begin(), m_predicates.end(), [](const auto& predicate)
+                                      { return predicate && predicate->usesInstructionPointer(); });
+}
+
+void Debugger::bindPredicates(pid_t pid)
+{
+    if (std::none_of(m_predicates.begin(), m_predicates.end(),
+                     [](const auto& predicate) { return predicate && predicate->usesFunctions(); }))
+    {
+        return;
+    }
+
+    // functions of the main executable, e.g. --when 'ip in update_counter'
+    uintptr_t base = util::getBaseAddress(pid, m_path);
+    SymbolIndex symbols(m_path, SymbolIndex::getDefaultCacheDirectory());
+    auto resolve = [&](const std::string& name) -> std::optional<std::pair<uint64_t, uint64_t>>
+    {
+        auto symbol = symbols.find(name);
+        if (!symbol)
+        {
+            return std::nullopt;
+        }
+        return std::pair{base + symbol->value, base + symbol->value + std::max<uint64_t>(symbol->size, 1)};
+    };
+
+    for (auto& predicate : m_predicates)
+    {
+        if (predicate)
+        {
+            predicate->bind(resolve);
+        }
+    }
+}
+
+void Debugger::setSampling(uint64_t every)
+{
+    m_sampleEvery = std::max<uint64_t>(every, 1);
+}
+
+void Debugger::setOverheadBudget(double budget)
+{
+    m_overheadBudget = budget;
+}
+
+void Debugger::setAccessStats(bool enable)
+{
+    if (enable)
+    {
+        m_accessStats.emplace();
+    }
+    else
+    {
+        m_accessStats.reset();
+    }
+}
+
+const AccessStats* Debugger::getAccessStats() const
+{
+    return m_accessStats ? &*m_accessStats : nullptr;
+}
+
+void Debugger::setSymbolize(bool enable)
+{
+    m_symbolize = enable;
+}
+
+void Debugger::setBacktrace(size_t depth)
+{
+    m_backtraceDepth = depth;
+}
+
+const StackTable& Debugger::getStacks() const
+{
+    return m_stacks;
+}
+
+void Debugger::setTracerThreads(size_t count)
+{
+    m_tracerThreads = std::max<size_t>(count, 1);
+}
+
+void Debugger::setFollowFork(bool enable)
+{
+    m_followFork = enable;
+}
+
+void Debugger::setStopRecording(bool enable)
+{
+    if (enable)
+    {
+        m_recording.emplace();
+    }
+    else
+    {
+        m_recording.reset();
+    }
+}
+
+const StopRecording* Debugger::getStopRecording() const
+{
+    return m_recording ? &*m_recording : nullptr;
+}
+
+void Debugger::recordMappings(pid_t pid)
+{
+    if (!m_symbolize)
+    {
+        return;
+    }
+
+    // libraries loaded later are added, unloaded ones are kept for the accesses made before
+    for (util::MappedFile& file : util::getMappedFiles(pid))
+    {
+        if (std::none_of(m_mappedFiles.begin(), m_mappedFiles.end(), [&](const util::MappedFile& known)
+                         { return known.start == file.start && known.path == file.path; }))
+        {
+            m_mappedFiles.push_back(std::move(file));
+        }
+    }
+}
+
+std::vector<CodeLocation> Debugger::symbolize(std::span<const uint64_t> addresses) const
+{
+    if (addresses.empty())
+    {
+        return {};
+    }
+    return Symbolizer(m_mappedFiles).resolve(addresses);
+}
+
+void Debugger::setMaxEvents(uint64_t maxEvents)
+{
+    m_maxEvents = maxEvents;
+}
+
+void Debugger::requestDetach()
+{
+    m_detach = true;
+}
+
+const Variable& Debugger::getVar() const
+{
+    return m_vars.front();
+}
+
+const std::vector<Variable>& Debugger::getVars() const
+{
+    return m_vars;
+}
+
+const Variable& Debugger::getLastVar() const
+{
+    return m_prevVar;
+}
+
+const EventInfo& Debugger::getEventInfo() const
+{
+    return m_event;
+}
+
+PageWatchStats Debugger::getPageWatchStats() const
+{
+    return m_pageWatcher ? m_pageWatcher->getStats() : PageWatchStats{};
+}
+
+TraceStats Debugger::getTraceStats() const
+{
+    TraceStats stats = m_stats;
+    stats.syscalls += getPageWatchStats().syscalls;
+    if (m_memory)
+    {
+        stats.syscalls += m_memory->getSyscalls();
+    }
+    if (m_linkMap)
+    {
+        stats.syscalls += m_linkMap->getSyscalls();
+    }
+    if (m_unwinder)
+    {
+        stats.syscalls += m_unwinder->getSyscalls();
+    }
+    stats.samplingRatio = m_armedRatio / static_cast<double>(m_sampleEvery);
+    return stats;
+}
+
+void Debugger::waitForStop(pid_t childPid) const
+{
+    int status = 0;
+    pid_t wRet = waitpid(childPid, &status, 0);
+
+    if (wRet < 0)
+    {
+        throw std::runtime_error("waitpid failed for " + std::to_string(childPid));
+    }
+
+    if (!WIFSTOPPED(status))
+    {
+        throw std::runtime_error("child did not stop as expected " + std::to_string(childPid));
+    }
+}
+
+void Debugger::resolveVariables(pid_t childPid)
+{
+    recordMappings(childPid);
+
+    // find base address of the process after it was mapped into memory
+    uintptr_t base = util::getBaseAddress(childPid, m_path);
+    SymbolIndex symbols(m_path, SymbolIndex::getDefaultCacheDirectory());
+    DwarfReader dwarf(m_path, SymbolIndex::getDefaultCacheDirectory());
+    m_memory = std::make_unique<ProcessMemory>(childPid);
+    if (m_recording)
+    {
+        *m_recording = StopRecording{};
+    }
+    m_traceBackend = std::make_unique<LiveBackend>(*m_memory, m_recording ? &*m_recording : nullptr);
+    if (m_backtraceDepth > 0)
+    {
+        m_unwinder = std::make_unique<Unwinder>(childPid);
+    }
+
+    m_slots.clear();
+    m_slotVars.clear();
+    m_hardwareVars.clear();
+    m_softwareVars.clear();
+    m_libraryWatches.clear();
+
+    // library watches reserve their debug registers first, they are armed once their library is loaded
+    size_t slotsPerVariable = m_mode == WatchMode::DUAL_REGISTER ? 2 : 1;
+    for (size_t i = 0; i < m_vars.size(); ++i)
+    {
+        auto [library, expression] = splitLibrary(m_vars[i].name);
+        if (library.empty())
+        {
+            continue;
+        }
+
+        if (m_slots.size() + slotsPerVariable > util::DEBUG_REGISTER_COUNT)
+        {
+            throw std::runtime_error("No debug register left for " + m_vars[i].name +
+                                     ", library watches can not fall back to page protection");
+        }
+
+        m_libraryWatches.push_back({i, library, expression, m_slots.size(), "", 0}); // not loaded yet
+        m_hardwareVars.push_back(i);
+        m_vars[i].address = 0;
+        m_vars[i].size = 0;
+        if (m_mode == WatchMode::DUAL_REGISTER)
+        {
+            m_slots.push_back({0, 0, util::ON_DATA_WRITE});
+            m_slotVars.push_back(i);
+        }
+        m_slots.push_back({0, 0, util::ON_READ_WRITE});
+        m_slotVars.push_back(i);
+    }
+
+    for (size_t i = 0; i < m_vars.size(); ++i)
+    {
+        Variable& var = m_vars[i];
+        if (!splitLibrary(var.name).first.empty())
+        {
+            continue;
+        }
+
+        // extract symbol information from the elf file
+        resolveSymbol(symbols, dwarf, var, var.name, base);
+
+        // unaligned variables and small structs are split over several debug registers, the records of the tracer
+        // threads hold one word, arrays, larger structs and variables beyond the free registers fall back to page
+        // protection
+        size_t required = requiredSlots(var, m_mode);
+        if (m_tracerThreads > 1 && var.size > sizeof(uint64_t))
+        {
+            required = 0;
+        }
+        size_t freeSlots = util::DEBUG_REGISTER_COUNT - m_slots.size();
+        if (required == 0 || required > freeSlots)
+        {
+            std::string reason = var.name + " (" + std::to_string(var.size) + " bytes) ";
+            reason += required == 0 ? "does not fit into the debug registers"
+                                    : "needs " + std::to_string(required) + " debug registers, " +
+                                          std::to_string(freeSlots) + " are free";
+
+            // the pages of a forked child are protected as well, but the faults only reach one PageWatcher
+            if (m_followFork)
+            {
+                throw std::runtime_error(reason + ", which following forks needs");
+            }
+
+            if (m_backend != Backend::PTRACE)
+            {
+                throw std::runtime_error(reason + ", use the ptrace backend");
+            }
+
+            if (required > 0)
+            {
+                std::cerr << reason << ", watching it with page protection\n";
+            }
+            m_softwareVars.push_back(i);
+            continue;
+        }
+
+        // perf events and the agent report every register on its own, without merging the hits of a split variable
+        if (m_backend != Backend::PTRACE && required > slotsPerVariable)
+        {
+            throw std::runtime_error(var.name + " (" + std::to_string(var.size) +
+                                     " bytes) does not fit into a debug register, use the ptrace backend");
+        }
+        addHardwareWatch(i);
+    }
+
+    m_softwareValues.assign(m_softwareVars.size(), Value{});
+
+    // processes that exec the traced binary again find its variables without reading it again
+    if (m_followFork)
+    {
+        std::vector<Variable> image = m_vars;
+        for (Variable& var : image)
+        {
+            var.address -= base;
+        }
+        m_images.clear();
+        m_images.emplace(getFileId(m_path), std::move(image));
+    }
+
+    // initial values are needed to report the old value of the first write, all are read with one call,
+    // wide variables are reported per accessed element instead
+    std::vector<MemoryRange> ranges;
+    for (Variable& var : m_vars)
+    {
+        if (var.size > 0 && var.size <= Value::INLINE_SIZE)
+        {
+            var.value = Value(var.size);
+            ranges.push_back({var.address, var.value.data(), var.size});
+        }
+    }
+    readMemory(ranges);
+    bindPredicates(childPid);
+    if (m_recording)
+    {
+        m_recording->pid = childPid;
+        m_recording->mode = m_mode;
+        m_recording->vars = m_vars;
+    }
+
+    // libraries loaded before (when attaching) are resolved right away, later ones when the breakpoint is hit
+    if (!m_libraryWatches.empty())
+    {
+        m_linkMap = std::make_unique<LinkMap>(childPid);
+        m_linkMap->insertBreakpoint(childPid);
+        resolveLibraryVariables();
+    }
+}
+
+void Debugger::addHardwareWatch(size_t index)
+{
+    const Variable& var = m_vars[index];
+    m_hardwareVars.push_back(index);
+
+    // Note: in dual register mode two debug registers are used per aligned range of the variable,
+    // first set to write-only and second to read-write, this way:
+    // read = read-write && !write-only
+    // write = read-write && write-only
+    for (const util::DebugRegisterSlot& range : util::planWatch(var.address, var.size))
+    {
+        if (m_mode == WatchMode::DUAL_REGISTER)
+        {
+            m_slots.push_back({range.addr, range.size, util::ON_DATA_WRITE});
+            m_slotVars.push_back(index);
+        }
+        m_slots.push_back({range.addr, range.size, util::ON_READ_WRITE});
+        m_slotVars.push_back(index);
+    }
+}
+
+const std::vector<util::DebugRegisterSlot>& Debugger::currentSlots() const
+{
+    static const std::vector<util::DebugRegisterSlot> DISARMED;
+    return !m_dutyCycle || m_dutyCycle->isArmed() ? m_slots : DISARMED;
+}
+
+void Debugger::switchWindow()
+{
+    uint64_t now = util::getMonotonicTime();
+    bool wasArmed = m_dutyCycle->isArmed();
+    bool armed = m_dutyCycle->advance(now, util::getThreadCpuTime(), m_stats.stops);
+    m_armedRatio = m_dutyCycle->getArmedRatio(now);
+    if (armed == wasArmed)
+    {
+        return;
+    }
+
+    // values changed while disarmed, the first write after arming has to report the current one as old value
+    if (armed)
+    {
+        std::vector<MemoryRange> ranges;
+        for (size_t index : m_hardwareVars)
+        {
+            Variable& var = m_vars[index];
+            if (var.size > 0 && var.size <= Value::INLINE_SIZE)
+            {
+                ranges.push_back({var.address, var.value.data(), var.size});
+            }
+        }
+        m_memory->read(ranges);
+    }
+    updateThreadWatchpoints(0);
+}
+
+bool Debugger::resolveLibraryVariables()
+{
+    std::vector<LoadedLibrary> libraries = m_linkMap->getLibraries();
+
+    bool changed = false;
+    for (LibraryWatch& watch : m_libraryWatches)
+    {
+        auto loaded = std::find_if(libraries.begin(), libraries.end(), [&](const LoadedLibrary& library)
+                                   { return matchesLibrary(library.path, watch.library); });
+        std::string path = loaded != libraries.end() ? loaded->path : std::string{};
+        uintptr_t base = loaded != libraries.end() ? loaded->base : 0;
+        if (path == watch.path && base == watch.base)
+        {
+            continue; // neither loaded, unloaded nor loaded again
+        }
+
+        watch.path = path;
+        watch.base = base;
+        changed = true;
+
+        Variable& var = m_vars[watch.var];
+        var.address = 0;
+        var.size = 0;
+        if (!path.empty())
+        {
+            SymbolIndex symbols(path, SymbolIndex::getDefaultCacheDirectory());
+            DwarfReader dwarf(path, SymbolIndex::getDefaultCacheDirectory());
+            resolveSymbol(symbols, dwarf, var, watch.expression, base);
+            if (!util::fitsDebugRegister(var.address, var.size))
+            {
+                throw std::runtime_error(var.name + " (" + std::to_string(var.size) +
+                                         " bytes) does not fit into a debug register");
+            }
+
+            var.value = Value(var.size);
+            MemoryRange range{var.address, var.value.data(), var.size};
+            readMemory(std::span(&range, 1));
+        }
+
+        // an unloaded library leaves its registers disabled until it is loaded again
+        for (size_t slot = watch.slot; slot < watch.slot + (m_mode == WatchMode::DUAL_REGISTER ? 2 : 1); ++slot)
+        {
+            m_slots[slot].addr = var.address;
+            m_slots[slot].size = var.size;
+        }
+    }
+    return changed;
+}
+
+void Debugger::updateThreadWatchpoints(pid_t stoppedThread)
+{
+    if (auto it = m_threads.find(stoppedThread); it != m_threads.end())
+    {
+        m_stats.syscalls += util::setHardwareWatchpoints(stoppedThread, currentSlots(), it->second->debugRegisters);
+    }
+
+    // debug registers can only be written while a thread is stopped, every other thread is stopped with SIGSTOP,
+    // a thread that stops for another reason first is updated in that stop, which is left to the stop loop,
+    // threads cloned meanwhile start with the new slots
+    std::vector<pid_t> stopped = stopOtherThreads(stoppedThread, false);
+    for (pid_t threadId : stopped)
+    {
+        m_stats.syscalls += util::setHardwareWatchpoints(threadId, currentSlots(), m_threads.at(threadId)->debugRegisters);
+    }
+    for (const auto& [threadId, status] : m_deferredStops)
+    {
+        auto it = m_threads.find(threadId);
+        if (WIFSTOPPED(status) && it != m_threads.end())
+        {
+            m_stats.syscalls += util::setHardwareWatchpoints(threadId, currentSlots(), it->second->debugRegisters);
+        }
+    }
+    resumeThreads(stopped);
+}
+
+std::vector<pid_t> Debugger::stopOtherThreads(pid_t stoppedThread, bool activeProcessOnly)
+{
+    // every other running thread is stopped with SIGSTOP, a thread that stops for another reason first
+    // keeps that stop for the stop loop, its SIGSTOP is suppressed like any other once it continues,
+    // threads stopped by this function are continued again by the caller
+    std::vector<pid_t> threadIds;
+    for (const auto& [threadId, state] : m_threads)
+    {
+        if (threadId != stoppedThread && state->start == ThreadStart::ARMED &&
+            (!activeProcessOnly || state->process == m_activePid) &&
+            std::none_of(m_deferredStops.begin(), m_deferredStops.end(),
+                         [threadId](const auto& stop) { return stop.first == threadId; }))
+        {
+            threadIds.push_back(threadId);
+        }
+    }
+
+    std::vector<pid_t> stopped;
+    for (pid_t threadId : threadIds)
+    {
+        ++m_stats.syscalls;
+        if (syscall(SYS_tkill, threadId, SIGSTOP) < 0)
+        {
+            continue; // thread exited meanwhile
+        }
+
+        int status = 0;
+        ++m_stats.syscalls;
+        if (waitpid(threadId, &status, __WALL) < 0)
+        {
+            throw std::runtime_error("waitpid failed:" + std::string(strerror(errno)));
+        }
+
+        if (WIFSTOPPED(status) && static_cast<unsigned int>(status) >> 16 == 0 && WSTOPSIG(status) == SIGSTOP)
+        {
+            stopped.push_back(threadId);
+        }
+        else
+        {
+            m_deferredStops.emplace_back(threadId, status);
+        }
+    }
+    return stopped;
+}
+
+void Debugger::resumeThreads(const std::vector<pid_t>& threadIds)
+{
+    for (pid_t threadId : threadIds)
+    {
+        ++m_stats.syscalls;
+        if (ptrace(PTRACE_CONT, threadId, nullptr, 0) < 0 && errno != ESRCH)
+        {
+            throw std::runtime_error("PTRACE_CONT failed: " + std::string(strerror(errno)));
+        }
+    }
+}
+
+int Debugger::handleLibraryEvent(pid_t threadId)
+{
+    // the breakpoint is hit before and after every change, the libraries are mapped once the list is consistent,
+    // the loaded objects are recorded before dlclose can unmap them again
+    if (m_linkMap->isConsistent())
+    {
+        recordMappings(threadId);
+        if (resolveLibraryVariables())
+        {
+            updateThreadWatchpoints(threadId);
+        }
+    }
+    return m_linkMap->stepOverBreakpoint(threadId);
+}
+
+void Debugger::attachDebugger(pid_t childPid)
+{
+    waitForStop(childPid);
+    resolveVariables(childPid);
+    m_resetDebugStatus = !util::kernelResetsDebugStatus();
+
+    // set hardware watchpoints
+    util::setHardwareWatchpoints(childPid, m_slots, addThread(childPid, childPid).debugRegisters);
+
+    // protect the pages of the remaining watches while the process is still single threaded
+    if (!m_softwareVars.empty())
+    {
+        m_pageWatcher = std::make_unique<PageWatcher>(childPid);
+        for (size_t index : m_softwareVars)
+        {
+            m_pageWatcher->watch(m_vars[index].address, m_vars[index].size);
+        }
+        m_pageWatcher->arm(childPid);
+    }
+
+    // also trace child's threads, and stop them on exit while the objects to symbolize are still mapped,
+    // forked children inherit the options
+    long options = PTRACE_O_TRACECLONE | PTRACE_O_EXITKILL | (m_symbolize ? PTRACE_O_TRACEEXIT : 0);
+    if (m_followFork)
+    {
+        options |= PTRACE_O_TRACEFORK | PTRACE_O_TRACEVFORK | PTRACE_O_TRACEEXEC;
+    }
+    long pRet = ptrace(PTRACE_SETOPTIONS, childPid, nullptr, options);
+    if (pRet == -1)
+    {
+        throw std::runtime_error("PTRACE_SETOPTIONS failed " + std::string(strerror(errno)));
+    }
+
+    pRet = ptrace(PTRACE_CONT, childPid, nullptr, nullptr);
+    if (pRet < 0)
+    {
+        throw std::runtime_error("PTRACE_CONT failed: " + std::string(strerror(errno)));
+    }
+}
+
+void Debugger::seizeProcess(pid_t pid)
+{
+    m_path = "/proc/" + std::to_string(pid) + "/exe";
+
+    // threads cloned by a seized thread are attached by the kernel and reported with PTRACE_EVENT_CLONE,
+    // once every known thread is stopped, threads still missing were cloned by threads seized too late
+    std::unordered_map<pid_t, int> stopped; // thread -> signal to deliver when it continues
+    std::unordered_set<pid_t> running;      // seized threads that did not stop yet
+    while (true)
+    {
+        for (pid_t threadId : util::getThreadIds(pid))
+        {
+            if (stopped.contains(threadId) || running.contains(threadId))
+            {
+                continue;
+            }
+
+            long options = PTRACE_O_TRACECLONE | (m_symbolize ? PTRACE_O_TRACEEXIT : 0);
+            if (ptrace(PTRACE_SEIZE, threadId, nullptr, options) < 0)
+            {
+                if (errno == ESRCH)
+                {
+                    continue; // thread exited meanwhile
+                }
+                throw std::runtime_error("PTRACE_SEIZE failed for " + std::to_string(threadId) + ": " +
+                                         std::string(strerror(errno)));
+            }
+
+            if (ptrace(PTRACE_INTERRUPT, threadId, nullptr, nullptr) < 0)
+            {
+                throw std::runtime_error("PTRACE_INTERRUPT failed: " + std::string(strerror(errno)));
+            }
+            running.insert(threadId);
+        }
+
+        if (running.empty())
+        {
+            break;
+        }
+
+        while (!running.empty())
+        {
+            int status = 0;
+            pid_t threadId = waitpid(-1, &status, __WALL);
+            if (threadId < 0)
+            {
+                if (errno == EINTR)
+                {
+                    continue;
+                }
+                throw std::runtime_error("waitpid failed:" + std::string(strerror(errno)));
+            }
+
+            if (WIFEXITED(status) || WIFSIGNALED(status))
+            {
+                if (threadId == pid)
+                {
+                    throw std::runtime_error("process " + std::to_string(pid) + " exited during attach");
+                }
+                running.erase(threadId);
+                stopped.erase(threadId);
+                continue;
+            }
+
+            if (!WIFSTOPPED(status))
+            {
+                continue;
+            }
+
+            int signal = 0;
+            unsigned int event = static_cast<unsigned int>(status) >> 16;
+            if (event == PTRACE_EVENT_CLONE)
+            {
+                unsigned long newTid = 0;
+                if (ptrace(PTRACE_GETEVENTMSG, threadId, nullptr, &newTid) < 0)
+                {
+                    throw std::runtime_error("PTRACE_GETEVENTMSG failed: " + std::string(strerror(errno)));
+                }
+                if (!stopped.contains(static_cast<pid_t>(newTid)))
+                {
+                    running.insert(static_cast<pid_t>(newTid));
+                }
+            }
+            else if (event == 0)
+            {
+                signal = WSTOPSIG(status); // signal-delivery-stop, the signal is delivered once armed
+            }
+
+            running.erase(threadId);
+            stopped[threadId] = signal;
+        }
+    }
+
+    // every thread is stopped now, the pending interrupt of a thread that stopped for another reason
+    // is reported with PTRACE_EVENT_STOP after it continues
+    resolveVariables(pid);
+    m_resetDebugStatus = !util::kernelResetsDebugStatus();
+    m_seized = true;
+
+    for (const auto& [threadId, signal] : stopped)
+    {
+        util::setHardwareWatchpoints(threadId, m_slots, addThread(threadId, pid).debugRegisters);
+    }
+
+    if (!m_softwareVars.empty())
+    {
+        m_pageWatcher = std::make_unique<PageWatcher>(pid);
+        for (size_t index : m_softwareVars)
+        {
+            m_pageWatcher->watch(m_vars[index].address, m_vars[index].size);
+        }
+        m_pageWatcher->arm(pid);
+    }
+
+    for (const auto& [threadId, signal] : stopped)
+    {
+        if (ptrace(PTRACE_CONT, threadId, nullptr, signal) < 0)
+        {
+            throw std::runtime_error("PTRACE_CONT failed: " + std::string(strerror(errno)));
+        }
+    }
+}
+
+bool Debugger::shouldDetach() const
+{
+    return m_seized && (m_detach || (m_maxEvents > 0 && m_stats.events >= m_maxEvents));
+}
+
+void Debugger::detachProcess(pid_t pid, pid_t stoppedThread, int signal)
+{
+    recordMappings(pid);
+
+    // interrupt every running thread, hits and faults reported before the interrupt are still handled
+    std::unordered_map<pid_t, int> stopped; // thread -> signal to deliver on detach
+    std::unordered_set<pid_t> running;
+    if (stoppedThread > 0)
+    {
+        stopped[stoppedThread] = signal;
+    }
+
+    for (const auto& [threadId, state] : m_threads)
+    {
+        // a new thread whose initial stop was reported already is stopped and waits for its clone event
+        if (state->start == ThreadStart::STOPPED)
+        {
+            stopped[threadId] = 0;
+        }
+        else if (threadId != stoppedThread && ptrace(PTRACE_INTERRUPT, threadId, nullptr, nullptr) == 0)
+        {
+            running.insert(threadId);
+        }
+    }
+
+    // stops reaped while the other threads were stopped for a page watch step come first
+    while (!running.empty() || !m_deferredStops.empty())
+    {
+        int status = 0;
+        pid_t threadId = 0;
+        if (!m_deferredStops.empty())
+        {
+            std::tie(threadId, status) = m_deferredStops.front();
+            m_deferredStops.erase(m_deferredStops.begin());
+        }
+        else
+        {
+            threadId = waitpid(-1, &status, __WALL);
+        }
+        if (threadId < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            throw std::runtime_error("waitpid failed:" + std::string(strerror(errno)));
+        }
+
+        if (WIFEXITED(status) || WIFSIGNALED(status))
+        {
+            running.erase(threadId);
+            m_threads.erase(threadId);
+            continue;
+        }
+
+        if (!WIFSTOPPED(status))
+        {
+            continue;
+        }
+
+        int threadSignal = 0;
+        unsigned int event = static_cast<unsigned int>(status) >> 16;
+        if (event == PTRACE_EVENT_CLONE)
+        {
+            // the new thread is attached as well and reports its own stop
+            unsigned long newTid = 0;
+            if (ptrace(PTRACE_GETEVENTMSG, threadId, nullptr, &newTid) < 0)
+            {
+                throw std::runtime_error("PTRACE_GETEVENTMSG failed: " + std::string(strerror(errno)));
+            }
+            if (!stopped.contains(static_cast<pid_t>(newTid)))
+            {
+                running.insert(static_cast<pid_t>(newTid));
+            }
+        }
+        else if (event == 0 && WSTOPSIG(status) == SIGTRAP && m_linkMap && m_linkMap->isBreakpointHit(threadId))
+        {
+            threadSignal = m_linkMap->stepOverBreakpoint(threadId);
+            if (threadSignal < 0)
+            {
+                running.erase(threadId);
+                m_threads.erase(threadId);
+                continue;
+            }
+        }
+        else if (event == 0 && WSTOPSIG(status) == SIGTRAP)
+        {
+            handleWatchpoint(threadId);
+        }
+        else if (event == 0 && WSTOPSIG(status) == SIGSEGV && m_pageWatcher)
+        {
+            // stopped threads are not reaped again, the others are being interrupted already
+            threadSignal = handlePageFault(threadId, false);
+            if (threadSignal < 0)
+            {
+                running.erase(threadId);
+                m_threads.erase(threadId);
+                continue;
+            }
+        }
+        else if (event == 0)
+        {
+            threadSignal = WSTOPSIG(status);
+        }
+
+        running.erase(threadId);
+        stopped[threadId] = threadSignal;
+    }
+
+    // the pages are unprotected while every thread is stopped, the syscall stub stays mapped
+    if (m_pageWatcher && !stopped.empty())
+    {
+        m_pageWatcher->disarm(stopped.contains(pid) ? pid : stopped.begin()->first);
+    }
+
+    if (m_linkMap && !stopped.empty())
+    {
+        m_linkMap->removeBreakpoint(stopped.begin()->first);
+    }
+
+    // clearing DR7 disables the watchpoints, threads attached meanwhile have none
+    for (const auto& [threadId, threadSignal] : stopped)
+    {
+        auto it = m_threads.find(threadId);
+        if (it != m_threads.end())
+        {
+            util::setHardwareWatchpoints(threadId, {}, it->second->debugRegisters);
+        }
+
+        if (ptrace(PTRACE_DETACH, threadId, nullptr, threadSignal) < 0 && errno != ESRCH)
+        {
+            throw std::runtime_error("PTRACE_DETACH failed: " + std::string(strerror(errno)));
+        }
+    }
+
+    m_threads.clear();
+    std::cerr << "detached from " << pid << " (" << stopped.size() << " threads)\n";
+}
+
+ThreadState& Debugger::addThread(pid_t threadId, pid_t process)
+{
+    auto& state = m_threads[threadId];
+    state = std::make_unique<ThreadState>();
+    state->process = process;
+    return *state;
+}
+
+void Debugger::traceNewThread(pid_t threadId, pid_t process)
+{
+    // waiting here for the initial stop would keep every other stopped thread of the tracee waiting as well,
+    // the thread is armed whenever the stop loop reports it
+    auto it = m_threads.find(threadId);
+    if (it == m_threads.end())
+    {
+        addThread(threadId, process).start = ThreadStart::CLONED;
+        return;
+    }
+
+    it->second->process = process;
+    armNewThread(threadId, *it->second);
+}
+
+bool Debugger::startNewThread(pid_t threadId)
+{
+    auto it = m_threads.find(threadId);
+    if (it == m_threads.end())
+    {
+        // reported before the clone event of its parent, it did not run yet
+        addThread(threadId, 0).start = ThreadStart::STOPPED;
+        return true;
+    }
+
+    if (it->second->start != ThreadStart::CLONED)
+    {
+        return false;
+    }
+    armNewThread(threadId, *it->second);
+    return true;
+}
+
+void Debugger::armNewThread(pid_t threadId, ThreadState& state)
+{
+    // debug registers are not inherited by new threads, a forked child starts with the slots of its parent, which
+    // are current while the parent is active
+    m_stats.syscalls += 1 + m_traceBackend->setHardwareWatchpoints(threadId, currentSlots(), state.debugRegisters);
+    state.start = ThreadStart::ARMED;
+
+    long pRet = m_traceBackend->resume(threadId, 0);
+    if (pRet < 0)
+    {
+        throw std::runtime_error("PTRACE_CONT failed: " + std::string(strerror(errno)));
+    }
+}
+
+void Debugger::traceNewProcess(pid_t processId)
+{
+    // the child is a copy of the stopped parent, its variables are at the same addresses with the same values
+    auto state = std::make_unique<ProcessState>();
+    state->vars = m_vars;
+    state->slots = m_slots;
+    state->memory = std::make_unique<ProcessMemory>(processId);
+    state->traceBackend = std::make_unique<LiveBackend>(*state->memory, nullptr);
+    m_processes[processId] = std::move(state);
+
+    // the parent's slots are current, the child starts without debug registers like a new thread
+    traceNewThread(processId, processId);
+}
+
+const std::vector<Variable>& Debugger::resolveImage(const std::string& path)
+{
+    auto [image, inserted] = m_images.try_emplace(getFileId(path));
+    if (!inserted)
+    {
+        return image->second;
+    }
+
+    // a binary without the symbols, e.g. a helper the server execs, leaves the watches disarmed
+    std::vector<Variable>& vars = image->second;
+    vars = m_vars;
+    try
+    {
+        SymbolIndex symbols(path, SymbolIndex::getDefaultCacheDirectory());
+        DwarfReader dwarf(path, SymbolIndex::getDefaultCacheDirectory());
+        for (Variable& var : vars)
+        {
+            try
+            {
+                resolveSymbol(symbols, dwarf, var, var.name, 0);
+            }
+            catch (const std::runtime_error&)
+            {
+                var.address = 0;
+                var.size = 0;
+            }
+        }
+    }
+    catch (const std::runtime_error&)
+    {
+        for (Variable& var : vars)
+        {
+            var.address = 0;
+            var.size = 0;
+        }
+    }
+    return vars;
+}
+
+void Debugger::handleExec(pid_t processId)
+{
+    // the other threads are gone, the one that called exec continues as the thread group leader
+    std::erase_if(m_threads, [processId](const auto& thread)
+                  { return thread.second->process == processId && thread.first != processId; });
+
+    std::string path = "/proc/" + std::to_string(processId) + "/exe";
+    const std::vector<Variable>& image = resolveImage(path);
+    uintptr_t base = util::getBaseAddress(processId, path);
+
+    // memory of the old image is not readable through the old /proc/<pid>/mem
+    m_stats.syscalls += m_memory->getSyscalls();
+    m_memory = std::make_unique<ProcessMemory>(processId);
+    m_traceBackend = std::make_unique<LiveBackend>(*m_memory, nullptr);
+
+    // a variable keeps its debug registers if it splits into as many ranges in the new binary, else it is disarmed
+    size_t slotsPerVariable = m_mode == WatchMode::DUAL_REGISTER ? 2 : 1;
+    std::vector<MemoryRange> ranges;
+    size_t slot = 0;
+    for (size_t index : m_hardwareVars)
+    {
+        size_t first = slot;
+        while (slot < m_slots.size() && m_slotVars[slot] == index)
+        {
+            ++slot;
+        }
+
+        Variable& var = m_vars[index];
+        Variable resolved = image[index];
+        resolved.address += base;
+        std::vector<util::DebugRegisterSlot> planned;
+        if (requiredSlots(resolved, m_mode) == slot - first)
+        {
+            planned = util::planWatch(resolved.address, resolved.size);
+        }
+        bool armed = !planned.empty();
+        var.address = armed ? resolved.address : 0;
+        var.size = armed ? resolved.size : 0;
+        var.isSigned = resolved.isSigned;
+        var.isFloat = resolved.isFloat;
+        var.value = Value(var.size);
+        if (armed)
+        {
+            ranges.push_back({var.address, var.value.data(), var.size});
+        }
+
+        for (size_t owned = first; owned < slot; ++owned)
+        {
+            m_slots[owned].addr = armed ? planned[(owned - first) / slotsPerVariable].addr : 0;
+            m_slots[owned].size = armed ? planned[(owned - first) / slotsPerVariable].size : 0;
+        }
+    }
+    readMemory(ranges);
+
+    // exec cleared the debug registers
+    m_stats.syscalls += m_traceBackend->setHardwareWatchpoints(processId, m_slots,
+                                                               addThread(processId, processId).debugRegisters);
+}
+
+void Debugger::activateProcess(pid_t process)
+{
+    if (process == m_activePid)
+    {
+        return;
+    }
+
+    for (pid_t exchanged : {m_activePid, process})
+    {
+        ProcessState& state = *m_processes.at(exchanged);
+        std::swap(m_vars, state.vars);
+        std::swap(m_slots, state.slots);
+        std::swap(m_memory, state.memory);
+        std::swap(m_traceBackend, state.traceBackend);
+    }
+    m_activePid = process;
+}
+
+void Debugger::handleProcessExit(pid_t threadId)
+{
+    if (!m_followFork)
+    {
+        if (threadId == m_tracedPid)
+        {
+            endTrace();
+        }
+        return;
+    }
+
+    auto process = m_processes.find(threadId);
+    if (process == m_processes.end())
+    {
+        return; // a thread
+    }
+
+    process->second->exited = true;
+    if (threadId != m_tracedPid)
+    {
+        activateProcess(m_tracedPid);
+        m_stats.syscalls += process->second->memory->getSyscalls();
+        m_processes.erase(process);
+    }
+
+    if (m_processes.size() == 1 && m_processes.at(m_tracedPid)->exited)
+    {
+        endTrace();
+    }
+    else if (threadId == m_tracedPid && m_eventLoop)
+    {
+        // its children are still traced, the pidfd of the exited process would wake every wait right away
+        m_stats.syscalls += m_eventLoop->removeProcess();
+    }
+}
+
+void Debugger::startTrace(pid_t childPid)
+{
+    m_eventLoop = std::make_unique<EventLoop>(childPid, m_overheadBudget > 0 ? DUTY_CYCLE_TICK : HOUSEKEEPING_TICK);
+    m_unnotified = true;
+    beginTrace(childPid);
+}
+
+void Debugger::beginTrace(pid_t childPid)
+{
+    m_tracedPid = childPid;
+    m_activePid = childPid;
+    m_processes.clear();
+    if (m_followFork)
+    {
+        m_processes[childPid] = std::make_unique<ProcessState>();
+    }
+    m_cpuStart = util::getThreadCpuTime();
+    if (m_overheadBudget > 0)
+    {
+        m_dutyCycle =
+            std::make_unique<DutyCycle>(m_overheadBudget, util::getMonotonicTime(), m_cpuStart, m_stats.stops);
+    }
+    m_tracing = true;
+}
+
+int Debugger::getFd() const
+{
+    return m_eventLoop ? m_eventLoop->getFd() : -1;
+}
+
+bool Debugger::poll(int timeoutMs)
+{
+    if (!m_tracing)
+    {
+        return false;
+    }
+
+    // with nothing due on the timer the next stop is waited for in waitpid itself,
+    // which saves the epoll_wait, the signalfd read and the empty waitpid of every stop
+    bool timed = m_dutyCycle || !m_batch.empty();
+    if (m_eventLoop && timeoutMs < 0 && !timed)
+    {
+        handleStops(true);
+    }
+    else
+    {
+        if (m_eventLoop)
+        {
+            // stops before the loop existed sent their SIGCHLD elsewhere, look for them without waiting,
+            // deferred stops were reaped already
+            m_stats.syscalls += m_eventLoop->wait(m_unnotified || !m_deferredStops.empty() ? 0 : timeoutMs);
+            m_unnotified = false;
+        }
+        handleStops(false);
+    }
+
+    if (m_tracing)
+    {
+        housekeeping();
+    }
+    return m_tracing;
+}
+
+void Debugger::handleStops(bool block)
+{
+    // SIGCHLD does not queue, without blocking every pending stop is collected before the next wait
+    while (m_tracing)
+    {
+        if (!m_deferredStops.empty())
+        {
+            auto [threadId, status] = m_deferredStops.front();
+            m_deferredStops.erase(m_deferredStops.begin());
+            handleWaitStatus(threadId, status);
+            continue;
+        }
+
+        int status = 0;
+        pid_t threadId = m_traceBackend->wait(-1, status, (block ? 0 : WNOHANG) | __WNOTHREAD);
+        ++m_stats.syscalls;
+        if (threadId == 0)
+        {
+            return;
+        }
+
+        if (threadId < 0)
+        {
+            // a signal handler of the tracer interrupted the wait, e.g. to detach
+            if (errno == EINTR)
+            {
+                return;
+            }
+
+            throw std::runtime_error("waitpid failed:" + std::string(strerror(errno)));
+        }
+
+        handleWaitStatus(threadId, status);
+        if (block)
+        {
+            return;
+        }
+    }
+}
+
+void Debugger::handleWaitStatus(pid_t threadId, int status)
+{
+    // the members hold the variables, slots and memory of one process at a time
+    if (m_followFork)
+    {
+        if (auto thread = m_threads.find(threadId); thread != m_threads.end() && thread->second->process != 0)
+        {
+            activateProcess(thread->second->process);
+        }
+    }
+
+    if (WIFEXITED(status))
+    {
+        if (WEXITSTATUS(status) != 0)
+        {
+            std::cerr << "child exited with status " << WEXITSTATUS(status) << "\n";
+        }
+
+        m_threads.erase(threadId);
+        handleProcessExit(threadId);
+    }
+
+    if (WIFSIGNALED(status))
+    {
+        std::cerr << "child killed by signal " << WTERMSIG(status) << "\n";
+
+        m_threads.erase(threadId);
+        handleProcessExit(threadId);
+    }
+
+    if (WIFSTOPPED(status))
+    {
+        // the main thread stops on exit while the objects are still mapped, with setSymbolize only
+        if (threadId == m_tracedPid && static_cast<unsigned int>(status) >> 16 == PTRACE_EVENT_EXIT)
+        {
+            recordMappings(m_tracedPid);
+        }
+
+        ++m_stats.stops;
+        if (startNewThread(threadId))
+        {
+            return;
+        }
+
+        int signal = handleStop(threadId, status);
+        if (signal < 0)
+        {
+            return; // thread is gone
+        }
+
+        if (shouldDetach())
+        {
+            detachProcess(m_tracedPid, threadId, signal);
+            endTrace();
+            return;
+        }
+
+        ++m_stats.syscalls;
+        long pRet = m_traceBackend->resume(threadId, signal);
+        if (pRet < 0)
+        {
+            throw std::runtime_error("PTRACE_CONT failed: " + std::string(strerror(errno)));
+        }
+    }
+}
+
+void Debugger::housekeeping()
+{
+    // windows switch on the timer as well, nothing may stop while the watches are disarmed
+    uint64_t now = util::getMonotonicTime();
+    if (m_dutyCycle && m_dutyCycle->isDue(now))
+    {
+        switchWindow();
+    }
+
+    // a tracee that stopped accessing the variables does not fill the batch
+    if (!m_batch.empty() && now - m_batch.front().time >= static_cast<uint64_t>(EVENT_BATCH_LATENCY.count()))
+    {
+        flushEvents();
+    }
+
+    if (shouldDetach())
+    {
+        detachProcess(m_tracedPid, 0, 0);
+        endTrace();
+    }
+}
+
+void Debugger::endTrace()
+{
+    m_tracing = false;
+    m_eventLoop.reset();
+    if (m_followFork)
+    {
+        activateProcess(m_tracedPid);
+        m_processes.clear();
+    }
+
+    flushEvents();
+    m_stats.cpuTime = util::getThreadCpuTime() - m_cpuStart;
+    if (m_dutyCycle)
+    {
+        m_armedRatio = m_dutyCycle->getArmedRatio(util::getMonotonicTime());
+        std::cerr << "duty cycle: watches armed " << std::fixed << std::setprecision(1) << 100.0 * m_armedRatio
+                  << "% of the time, last duty " << 100.0 * m_dutyCycle->getDuty() << "%\n"
+                  << std::defaultfloat;
+    }
+
+    if (m_pageWatcher)
+    {
+        const PageWatchStats& stats = m_pageWatcher->getStats();
+        std::cerr << "page watch: " << stats.faults << " faults, " << stats.hits << " hits, " << stats.falseSharing
+                  << " false sharing\n";
+    }
+
+    printTraceStats();
+}
+
+void Debugger::printTraceStats() const
+{
+    TraceStats stats = getTraceStats();
+    if (stats.events > 0)
+    {
+        auto events = static_cast<double>(stats.events);
+        std::cerr << "ptrace: " << stats.events << " events, " << stats.stops << " stops, " << std::fixed
+                  << std::setprecision(2) << static_cast<double>(stats.syscalls) / events << " syscalls/event, "
+                  << static_cast<double>(stats.cpuTime) / 1000.0 / events << " us cpu/event\n"
+                  << std::defaultfloat;
+    }
+}
+
+int Debugger::handleStop(pid_t threadId, int status)
+{
+    int signal = 0;
+
+    // kernel sends SIGTRAP on hardware watchpoint set
+    if (WSTOPSIG(status) == SIGTRAP)
+    {
+        unsigned int event = static_cast<unsigned int>(status) >> 16;
+
+        // handle new threads
+        if (event == PTRACE_EVENT_CLONE)
+        {
+            // the message is an unsigned long, reading it into a pid_t overwrites the stack
+            unsigned long newTid = 0;
+            ++m_stats.syscalls;
+            long pRet = m_traceBackend->getEventMessage(threadId, newTid);
+            if (pRet < 0)
+            {
+                throw std::runtime_error("PTRACE_GETEVENTMSG failed: " + std::string(strerror(errno)));
+            }
+
+            traceNewThread(static_cast<pid_t>(newTid), m_activePid);
+        }
+        // with follow fork, the child stops before it runs like a new thread
+        else if (event == PTRACE_EVENT_FORK || event == PTRACE_EVENT_VFORK)
+        {
+            unsigned long newPid = 0;
+            ++m_stats.syscalls;
+            long pRet = m_traceBackend->getEventMessage(threadId, newPid);
+            if (pRet < 0)
+            {
+                throw std::runtime_error("PTRACE_GETEVENTMSG failed: " + std::string(strerror(errno)));
+            }
+
+            traceNewProcess(static_cast<pid_t>(newPid));
+        }
+        else if (event == PTRACE_EVENT_EXEC)
+        {
+            handleExec(threadId);
+        }
+        // the dynamic linker changed its list of libraries, DR6 still holds the bits of the last hit then
+        else if (event == 0 && m_linkMap && m_linkMap->isBreakpointHit(threadId))
+        {
+            signal = handleLibraryEvent(threadId);
+        }
+        // a seized thread stopped by PTRACE_INTERRUPT only has to continue, an exiting one too
+        else if (event != PTRACE_EVENT_STOP && event != PTRACE_EVENT_EXIT)
+        {
+            handleWatchpoint(threadId);
+        }
+    }
+    // software watchpoints fault before the access
+    else if (WSTOPSIG(status) == SIGSEGV && m_pageWatcher)
+    {
+        signal = handlePageFault(threadId, true);
+    }
+
+    if (signal < 0)
+    {
+        m_threads.erase(threadId);
+    }
+    return signal;
+}
+
+uint64_t Debugger::readInstructionPointer(pid_t threadId)
+{
+    ++m_stats.syscalls;
+    uint64_t rip = 0;
+    if (!m_traceBackend->getInstructionPointer(threadId, rip))
+    {
+        throw std::runtime_error("PTRACE_PEEKUSER rip failed: " + std::string(strerror(errno)));
+    }
+    return rip;
+}
+
+void Debugger::readMemory(std::span<const MemoryRange> ranges) const
+{
+    if (!m_traceBackend->readMemory(ranges))
+    {
+        throw std::runtime_error("Reading process memory failed: " + std::string(strerror(errno)));
+    }
+}
+
+util::WatchpointEvent Debugger::classifyAccess(pid_t threadId, const Variable& var, const Value& value)
+{
+    ++m_stats.syscalls;
+    user_regs_struct regs{};
+    long pRet = m_traceBackend->getRegisters(threadId, regs);
+    if (pRet < 0)
+    {
+        throw std::runtime_error("PTRACE_GETREGS failed: " + std::string(strerror(errno)));
+    }
+    m_event.ip = regs.rip;
+
+    // fetch the bytes preceding rip
+    std::array<uint8_t, 2 * sizeof(long)> code{};
+    auto event = util::classifyTrappedAccess(m_traceBackend->readPreceding(regs.rip, code), regs, var.address, var.size);
+    if (event != util::WatchpointEvent::OTHER)
+    {
+        return event;
+    }
+
+    // instruction could not be decoded, fall back to comparing the value before and after the access
+    return value == var.value ? util::WatchpointEvent::READ : util::WatchpointEvent::WRITE;
+}
+
+void Debugger::handleWatchpoint(pid_t threadId)
+{
+    // kernels since 5.11 reset DR6 on every debug exception, so it is only read, after the signal info told apart
+    // a SIGTRAP the tracee sends itself, which would still show the bits of the last hit
+    uint64_t dr6 = m_traceBackend->getDebugStatus(threadId, m_resetDebugStatus);
+    m_stats.syscalls += 2;
+    m_event = {util::getMonotonicTime(), threadId, 0, 0, m_activePid};
+
+    WatchpointHits hits;
+    if (!readWatchpointHits(dr6, m_slots, m_slotVars, m_vars, m_mode, *m_traceBackend, hits))
+    {
+        throw std::runtime_error("Reading process memory failed: " + std::string(strerror(errno)));
+    }
+    if (hits.count == 0)
+    {
+        return;
+    }
+
+    if (m_mode == WatchMode::DUAL_REGISTER && needsInstructionPointer())
+    {
+        m_event.ip = readInstructionPointer(threadId);
+    }
+
+    for (size_t j = 0; j < hits.count; ++j)
+    {
+        auto event = util::WatchpointEvent::OTHER;
+        if (m_mode == WatchMode::DUAL_REGISTER)
+        {
+            event = hits.writes[j] ? util::WatchpointEvent::WRITE : util::WatchpointEvent::READ;
+        }
+        else
+        {
+            event = classifyAccess(threadId, m_vars[hits.vars[j]], hits.values[j]);
+        }
+
+        report(hits.vars[j], event, std::move(hits.values[j]));
+    }
+}
+
+int Debugger::handlePageFault(pid_t threadId, bool stopOthers)
+{
+    PageFault fault{};
+    if (!m_pageWatcher->decodeFault(threadId, fault))
+    {
+        return SIGSEGV; // genuine segmentation fault
+    }
+
+    // accessed variables (or their accessed elements) before and after the access,
+    // /proc/<pid>/mem can still read the protected pages
+    std::vector<size_t> accessed;
+    std::vector<Variable> elements;
+    std::vector<MemoryRange> ranges;
+    if (fault.hit)
+    {
+        for (size_t k = 0; k < m_softwareVars.size(); ++k)
+        {
+            const Variable& var = m_vars[m_softwareVars[k]];
+            if (fault.overlaps(var.address, var.size))
+            {
+                accessed.push_back(k);
+                elements.push_back(accessedElement(var, fault));
+            }
+        }
+
+        for (size_t j = 0; j < accessed.size(); ++j)
+        {
+            Value& value = m_softwareValues[accessed[j]];
+            value = Value(elements[j].size);
+            ranges.push_back({elements[j].address, value.data(), elements[j].size});
+        }
+        readMemory(ranges);
+    }
+
+    // the page is unprotected during the step, other threads would access it unnoticed
+    std::vector<pid_t> stopped = stopOthers ? stopOtherThreads(threadId, true) : std::vector<pid_t>{};
+    int signal = 0;
+    bool executed = m_pageWatcher->stepOver(threadId, fault, signal);
+    resumeThreads(stopped);
+    if (!executed)
+    {
+        return signal;
+    }
+    m_event = {util::getMonotonicTime(), threadId, fault.ip, 0, m_activePid};
+
+    if (fault.hit)
+    {
+        std::vector<Value> newValues(accessed.size());
+        for (size_t j = 0; j < accessed.size(); ++j)
+        {
+            newValues[j] = Value(elements[j].size);
+            ranges[j].dst = newValues[j].data();
+        }
+        readMemory(ranges);
+
+        for (size_t j = 0; j < accessed.size(); ++j)
+        {
+            size_t index = m_softwareVars[accessed[j]];
+            Value& oldValue = m_softwareValues[accessed[j]];
+
+            // instruction could not be decoded, fall back to comparing the value before and after the access
+            auto event = fault.event;
+            if (event == util::WatchpointEvent::OTHER)
+            {
+                event = newValues[j] == oldValue ? util::WatchpointEvent::READ : util::WatchpointEvent::WRITE;
+            }
+
+            if (m_vars[index].size <= Value::INLINE_SIZE)
+            {
+                m_vars[index].value = std::move(oldValue);
+                report(index, event, std::move(newValues[j]));
+            }
+            else
+            {
+                reportElement(index, std::move(elements[j]), event, std::move(oldValue), std::move(newValues[j]));
+            }
+        }
+    }
+
+    // the stepped instruction may also have triggered a debug register
+    if (!m_hardwareVars.empty())
+    {
+        handleWatchpoint(threadId);
+    }
+
+    return signal;
+}
+
+Variable Debugger::accessedElement(const Variable& var, const PageFault& fault) const
+{
+    if (var.size <= Value::INLINE_SIZE)
+    {
+        return var;
+    }
+
+    // wide variables report the accessed element (at most 8 bytes), named by its offset, e.g. table+12
+    uintptr_t start = std::max(fault.addr, var.address);
+    size_t accessSize = fault.size > 0 ? fault.size : MAX_ELEMENT_SIZE;
+    uintptr_t end = std::min({fault.addr + accessSize, var.address + var.size, start + MAX_ELEMENT_SIZE});
+
+    Variable element = var;
+    element.address = start;
+    element.size = std::bit_floor(end - start);
+    element.name = var.name + "+" + std::to_string(start - var.address);
+    return element;
+}
+
+void Debugger::keepPrevious(size_t index, Variable& var)
+{
+    // the name is only copied when another variable is reported, the value is moved
+    if (m_prevIndex != index)
+    {
+        m_prevVar.name = var.name;
+        m_prevIndex = index;
+    }
+    m_prevVar.isSigned = var.isSigned;
+    m_prevVar.address = var.address;
+    m_prevVar.size = var.size;
+    m_prevVar.isFloat = var.isFloat;
+    m_prevVar.value = std::move(var.value);
+}
+
+void Debugger::report(size_t index, util::WatchpointEvent event, Value value)
+{
+    Variable& var = m_vars[index];
+    keepPrevious(index, var);
+    var.value = std::move(value);
+    dispatch(index, event, var);
+}
+
+void Debugger::reportElement(size_t index, Variable element, util::WatchpointEvent event, Value oldValue,
+                             Value newValue)
+{
+    m_prevVar = element;
+    m_prevIndex = SIZE_MAX;
+    m_prevVar.value = std::move(oldValue);
+    element.value = std::move(newValue);
+    dispatch(index, event, element);
+}
+
+bool Debugger::accept(size_t index, const Variable& var, bool isWrite)
+{
+    // the variable already holds the new value, the value before the access is kept in m_prevVar
+    if (index < m_predicates.size() && m_predicates[index] &&
+        !m_predicates[index]->evaluate({&var, &m_prevVar.value, isWrite, m_event.tid, m_event.ip}))
+    {
+        ++m_stats.suppressed;
+        return false;
+    }
+
+    // every Nth access that satisfies the predicate
+    if (m_sampleEvery > 1)
+    {
+        m_sampleCounts.resize(m_vars.size());
+        if (++m_sampleCounts[index] < m_sampleEvery)
+        {
+            ++m_stats.sampledOut;
+            return false;
+        }
+        m_sampleCounts[index] = 0;
+    }
+    return true;
+}
+
+void Debugger::deliver(size_t index, const Variable& var, bool isWrite)
+{
+    ++m_stats.events;
+    m_event.stack = 0;
+    if (m_unwinder && isWrite)
+    {
+        // the accessing thread is still stopped, its stack is walked before the callback runs
+        m_unwinder->unwind(m_event.tid, m_backtraceDepth, m_frames);
+        m_event.stack = m_stacks.intern(m_frames);
+    }
+
+    if (m_accessStats)
+    {
+        m_accessStats->record(static_cast<uint32_t>(index), m_event.tid, m_event.ip, isWrite);
+    }
+    else if (m_onEvents)
+    {
+        // reported elements of wide variables are not kept in m_vars, m_prevVar describes the same element
+        const Variable& watched = m_vars[index];
+        Event& event = m_batch.emplace_back();
+        event.time = m_event.time;
+        event.ip = m_event.ip;
+        event.oldValue = {m_prevVar.value.word(0), m_prevVar.value.word(1)};
+        event.newValue = {var.value.word(0), var.value.word(1)};
+        event.tid = m_event.tid;
+        event.pid = m_event.pid;
+        event.stack = m_event.stack;
+        event.watch = static_cast<uint32_t>(index);
+        event.offset = static_cast<uint32_t>(var.address - watched.address);
+        event.size = static_cast<uint8_t>(var.size);
+        event.isWrite = isWrite;
+        event.element = m_prevIndex != index;
+        if (m_batch.size() == EVENT_BATCH_SIZE ||
+            m_event.time - m_batch.front().time >= static_cast<uint64_t>(EVENT_BATCH_LATENCY.count()))
+        {
+            flushEvents();
+        }
+    }
+    else if (isWrite)
+    {
+        m_onWrite(var);
+    }
+    else
+    {
+        m_onRead(var);
+    }
+}
+
+void Debugger::flushEvents()
 {
-    m_onWrite = onWrite;
+    if (!m_batch.empty())
+    {
+        m_onEvents(m_batch);
+        m_batch.clear();
+    }
 }
 
-const Variable& Debugger::getVar() const
+void Debugger::dispatch(size_t index, util::WatchpointEvent event, const Variable& var)
 {
-    return m_var;
+    switch (event)
+    {
+    case util::WatchpointEvent::READ:
+        if (accept(index, var, false))
+        {
+            deliver(index, var, false);
+        }
+        break;
+    case util::WatchpointEvent::WRITE:
+        if (accept(index, var, true))
+        {
+            deliver(index, var, true);
+        }
+        break;
+    case util::WatchpointEvent::READ_WRITE:
+        // read-modify-write reads the old value and writes the new one
+        if (accept(index, m_prevVar, false))
+        {
+            deliver(index, m_prevVar, false);
+        }
+        if (accept(index, var, true))
+        {
+            deliver(index, var, true);
+        }
+        break;
+    case util::WatchpointEvent::OTHER: break;
+    }
 }
 
-const Variable& Debugger::getLastVar() const
+void Debugger::tracePerf(pid_t childPid)
 {
-    return m_prevVar;
-}
+    waitForStop(childPid);
+    resolveVariables(childPid);
 
-void Debugger::attachDebugger(pid_t childPid)
-{
-    int status = 0;
-    pid_t wRet = waitpid(childPid, &status, 0);
+    PerfSession session(childPid, m_slots, m_mode == WatchMode::SINGLE_REGISTER);
 
-    if (wRet < 0)
+    // events are inherited by every thread, so threads do not need to be traced,
+    // the main thread stays traced only to stop it on exit, while its memory can still be read for the last batch
+    long pRet = ptrace(PTRACE_SETOPTIONS, childPid, nullptr, PTRACE_O_TRACEEXIT | PTRACE_O_EXITKILL);
+    if (pRet == -1)
     {
-        throw std::runtime_error("waitpid failed for " + std::to_string(childPid));
+        throw std::runtime_error("PTRACE_SETOPTIONS failed " + std::string(strerror(errno)));
     }
 
-    if (!WIFSTOPPED(status))
+    pRet = ptrace(PTRACE_CONT, childPid, nullptr, nullptr);
+    if (pRet < 0)
     {
-        throw std::runtime_error("child did not stop as expected " + std::to_string(childPid));
+        throw std::runtime_error("PTRACE_CONT failed: " + std::string(strerror(errno)));
     }
 
-    // find base address of the process after it was mapped into memory
-    uintptr_t base = util::getBaseAddress(childPid, m_path);
+    std::vector<PerfSample> samples;
+    bool running = true;
+    while (running)
+    {
+        session.wait(PERF_DRAIN_INTERVAL_MS);
+
+        int status = 0;
+        pid_t wRet = waitpid(childPid, &status, WNOHANG);
+        if (wRet < 0)
+        {
+            throw std::runtime_error("waitpid failed:" + std::string(strerror(errno)));
+        }
+
+        int signal = 0;
+        bool exiting = false;
+        if (wRet == childPid && WIFSTOPPED(status))
+        {
+            exiting = (static_cast<unsigned int>(status) >> 16) == PTRACE_EVENT_EXIT;
+            if (!exiting && WSTOPSIG(status) != SIGTRAP)
+            {
+                signal = WSTOPSIG(status); // forward signals delivered to the main thread
+            }
+        }
 
-    // extract symbol information from the elf file
-    auto symbol = util::findSymbol(m_path, m_var.name);
-    m_var.address = base + symbol.first;
-    m_var.size = symbol.second;
+        // drain while the main thread is stopped on exit, the process memory is still mapped
+        if (exiting)
+        {
+            recordMappings(childPid);
+        }
+        session.drain(samples);
+        handlePerfSamples(samples, exiting);
 
-    // set hardware watchpoint
-    util::setHardwareWatchpoint(childPid, m_var.address, m_var.size);
+        if (wRet == childPid && WIFSTOPPED(status))
+        {
+            pRet = ptrace(PTRACE_CONT, childPid, nullptr, signal);
+            if (pRet < 0)
+            {
+                throw std::runtime_error("PTRACE_CONT failed: " + std::string(strerror(errno)));
+            }
+        }
 
-    // also trace child's threads
-    long pRet = ptrace(PTRACE_SETOPTIONS, childPid, nullptr, PTRACE_O_TRACECLONE | PTRACE_O_EXITKILL);
-    if (pRet == -1)
-    {
-        throw std::runtime_error("PTRACE_SETOPTIONS failed " + std::string(strerror(errno)));
+        if (wRet == childPid && WIFEXITED(status))
+        {
+            if (WEXITSTATUS(status) != 0)
+            {
+                std::cerr << "child exited with status " << WEXITSTATUS(status) << "\n";
+            }
+            running = false;
+        }
+
+        if (wRet == childPid && WIFSIGNALED(status))
+        {
+            std::cerr << "child killed by signal " << WTERMSIG(status) << "\n";
+            running = false;
+        }
     }
 
-    pRet = ptrace(PTRACE_CONT, childPid, nullptr, nullptr);
-    if (pRet < 0)
+    session.drain(samples);
+    handlePerfSamples(samples, true);
+
+    if (session.getLost() > 0)
     {
-        throw std::runtime_error("PTRACE_CONT failed: " + std::string(strerror(errno)));
+        std::cerr << "perf: " << session.getLost() << " samples lost\n";
     }
 }
 
-void Debugger::traceNewThread(pid_t threadId) const
+void Debugger::handlePerfSamples(std::vector<PerfSample>& samples, bool final)
 {
-    int status = 0;
-    int wRet = waitpid(threadId, &status, 0);
+    // values are read once per batch with a single call, the process may be gone already
+    std::vector<Value> values(m_vars.size());
+    std::vector<MemoryRange> ranges;
+    for (size_t i = 0; i < m_vars.size(); ++i)
+    {
+        values[i] = Value(m_vars[i].size);
+        ranges.push_back({m_vars[i].address, values[i].data(), m_vars[i].size});
+    }
+    if (!m_memory->read(ranges))
+    {
+        for (size_t i = 0; i < m_vars.size(); ++i)
+        {
+            values[i] = m_vars[i].value;
+        }
+    }
 
-    if (wRet < 0)
+    // classify the samples first, only the last access of a variable in the batch gets the value read above
+    struct Access
+    {
+        size_t sample;
+        util::WatchpointEvent event;
+    };
+    std::vector<Access> accesses;
+    std::vector<bool> written(m_vars.size());
+    std::vector<size_t> undecoded;
+    size_t slotsPerVariable = m_mode == WatchMode::DUAL_REGISTER ? 2 : 1;
+
+    size_t i = 0;
+    while (i < samples.size())
+    {
+        const PerfSample& sample = samples[i];
+        size_t index = m_slotVars[sample.slot];
+        const Variable& var = m_vars[index];
+
+        if (m_mode == WatchMode::SINGLE_REGISTER)
+        {
+            std::array<uint8_t, util::MAX_INSTRUCTION_LENGTH + 1> code{};
+            auto event = util::WatchpointEvent::OTHER;
+            if (m_memory->read(sample.regs.rip - code.size(), code.data(), code.size()))
+            {
+                event = util::classifyTrappedAccess(code, sample.regs, var.address, var.size);
+            }
+
+            if (event == util::WatchpointEvent::OTHER)
+            {
+                undecoded.push_back(accesses.size());
+            }
+            written[index] = written[index] || event == util::WatchpointEvent::WRITE ||
+                             event == util::WatchpointEvent::READ_WRITE;
+            accesses.push_back({i, event});
+            ++i;
+            continue;
+        }
+
+        // a write fires both the write-only and the read-write event of a variable with the same thread and ip,
+        // pair them up, an unpaired sample at the end of a batch may still get its pair with the next batch
+        bool paired = i + 1 < samples.size() && samples[i + 1].slot / slotsPerVariable == sample.slot / slotsPerVariable &&
+                      samples[i + 1].slot != sample.slot && samples[i + 1].tid == sample.tid &&
+                      samples[i + 1].ip == sample.ip;
+
+        if (!paired && i + 1 == samples.size() && !final)
+        {
+            break;
+        }
+
+        bool isWrite = paired || m_slots[sample.slot].type == util::ON_DATA_WRITE;
+        accesses.push_back({i, isWrite ? util::WatchpointEvent::WRITE : util::WatchpointEvent::READ});
+        i += paired ? 2 : 1;
+    }
+
+    // an access the decoder does not know is a write if the value changed and no decoded access wrote it,
+    // only the first one of a variable can be told apart this way
+    for (size_t j : undecoded)
     {
-        throw std::runtime_error("waitpid(newThreadId) failed: " + std::string(strerror(errno)));
+        size_t index = m_slotVars[samples[accesses[j].sample].slot];
+        bool changed = !written[index] && !(values[index] == m_vars[index].value);
+        accesses[j].event = changed ? util::WatchpointEvent::WRITE : util::WatchpointEvent::READ;
+        written[index] = true;
     }
 
-    util::setHardwareWatchpoint(threadId, m_var.address, m_var.size);
+    std::vector<size_t> last(m_vars.size(), SIZE_MAX);
+    for (size_t j = 0; j < accesses.size(); ++j)
+    {
+        last[m_slotVars[samples[accesses[j].sample].slot]] = j;
+    }
+    if (i < samples.size())
+    {
+        last[m_slotVars[samples[i].slot]] = SIZE_MAX; // the value may already be that of the deferred sample
+    }
 
-    long pRet = ptrace(PTRACE_CONT, threadId, nullptr, nullptr);
-    if (pRet < 0)
+    for (size_t j = 0; j < accesses.size(); ++j)
     {
-        throw std::runtime_error("PTRACE_CONT failed: " + std::string(strerror(errno)));
+        const PerfSample& sample = samples[accesses[j].sample];
+        size_t index = m_slotVars[sample.slot];
+        m_event = {sample.time, static_cast<pid_t>(sample.tid), sample.ip, 0, static_cast<pid_t>(sample.pid)};
+
+        // earlier accesses keep the value from before the batch, the value in between is not known
+        Value value = last[index] == j ? std::move(values[index]) : m_vars[index].value;
+        report(index, accesses[j].event, std::move(value));
     }
+
+    samples.erase(samples.begin(), samples.begin() + static_cast<long>(i));
+    flushEvents();
 }
 
-void Debugger::traceChild(pid_t childPid)
+void Debugger::traceAgent(pid_t childPid, AgentSession& session)
 {
-    while (true)
+    std::vector<agent::Record> records;
+    bool armed = false;
+    bool running = true;
+    while (running)
     {
-        int status = 0;
-        pid_t threadId = waitpid(-1, &status, __WALL);
+        std::this_thread::sleep_for(AGENT_DRAIN_INTERVAL);
 
-        if (threadId < 0)
+        int status = 0;
+        pid_t wRet = waitpid(childPid, &status, WNOHANG);
+        if (wRet < 0)
         {
-            if (errno == WNOHANG)
-            {
-                continue;
-            }
-
             throw std::runtime_error("waitpid failed:" + std::string(strerror(errno)));
         }
 
-        if (WIFEXITED(status))
+        if (wRet == childPid && WIFEXITED(status))
         {
             if (WEXITSTATUS(status) != 0)
             {
                 std::cerr << "child exited with status " << WEXITSTATUS(status) << "\n";
             }
-
-            if (childPid == threadId)
-            {
-                break;
-            }
+            running = false;
         }
 
-        if (WIFSIGNALED(status))
+        if (wRet == childPid && WIFSIGNALED(status))
         {
             std::cerr << "child killed by signal " << WTERMSIG(status) << "\n";
+            running = false;
+        }
 
-            if (childPid == threadId)
+        agent::State state = session.getState();
+        if (state == agent::STATE_ERROR)
+        {
+            if (running)
             {
-                break;
+                kill(childPid, SIGKILL);
+                waitpid(childPid, &status, 0);
             }
+            throw std::runtime_error("agent failed: " + session.getError());
         }
 
-        if (WIFSTOPPED(status))
+        // the agent resolves the variables inside the tracee
+        if (!armed && state == agent::STATE_ARMED)
         {
-            // kernel sends SIGTRAP on hardware watchpoint set
-            if (WSTOPSIG(status) == SIGTRAP)
+            DwarfReader dwarf(m_path, SymbolIndex::getDefaultCacheDirectory());
+            for (size_t i = 0; i < m_vars.size(); ++i)
             {
-                unsigned int event = static_cast<unsigned int>(status) >> 16;
+                m_vars[i].address = session.getWatch(i).address;
+                m_vars[i].size = session.getWatch(i).size;
 
-                // handle new threads
-                if (event == PTRACE_EVENT_CLONE)
-                {
-                    pid_t newTid = 0;
-                    long pRet = ptrace(PTRACE_GETEVENTMSG, threadId, nullptr, &newTid);
-                    if (pRet < 0)
-                    {
-                        throw std::runtime_error("PTRACE_GETEVENTMSG failed: " + std::string(strerror(errno)));
-                    }
-
-                    traceNewThread(newTid);
-                }
-                else
+                // only the types, the agent already applied member offsets
+                if (auto location = dwarf.resolve(m_vars[i].name, 0))
                 {
-                    // read variable's value with ptrace
-                    long word = ptrace(PTRACE_PEEKDATA, threadId, m_var.address, nullptr);
-                    if (word == -1 && errno != 0)
-                    {
-                        throw std::runtime_error("PTRACE_PEEKDATA failed: " + std::string(strerror(errno)));
-                    }
-
-                    m_prevVar = m_var;
-                    memcpy(&m_var.bytes, &word, m_var.size);
-
-                    auto watchpointEvent = util::getWatchpointEvent(threadId);
-                    switch (watchpointEvent)
-                    {
-                    case util::WatchpointEvent::READ: m_onRead(m_var); break;
-                    case util::WatchpointEvent::WRITE: m_onWrite(m_var); break;
-                    }
+                    m_vars[i].isSigned = m_vars[i].isSigned || location->isSigned;
+                    m_vars[i].isFloat = location->isFloat;
                 }
             }
+            bindPredicates(childPid);
+            recordMappings(childPid);
+            armed = true;
+        }
 
-            long pRet = ptrace(PTRACE_CONT, threadId, nullptr, nullptr);
-            if (pRet < 0)
+        session.drain(records);
+        for (const agent::Record& record : records)
+        {
+            Variable& var = m_vars[record.watch];
+            var.value = Value::fromWord(record.oldValue, var.size);
+            m_event = {record.time, static_cast<pid_t>(record.tid), record.ip, 0, childPid};
+
+            auto event = static_cast<util::WatchpointEvent>(record.event);
+            report(record.watch, event, Value::fromWord(record.newValue, var.size));
+        }
+        records.clear();
+        flushEvents();
+    }
+
+    if (!armed)
+    {
+        throw std::runtime_error("agent was not loaded into " + m_path);
+    }
+
+    if (session.getDropped() > 0)
+    {
+        std::cerr << "agent: " << session.getDropped() << " records dropped\n";
+    }
+}
+
+void Debugger::traceShards()
+{
+    ShardConfig config;
+    TracerPool pool(m_tracerThreads, config);
+    uint64_t cpuStart = util::getThreadCpuTime();
+
+    // the child is forked by the first tracer thread, PTRACE_TRACEME attaches it to the forking thread
+    pool.start(
+        [this, &config]
+        {
+            pid_t pid = fork();
+            if (pid == -1)
             {
-                throw std::runtime_error("PTRACE_CONT failed: " + std::string(strerror(errno)));
+                throw std::runtime_error("fork failed");
+            }
+            if (pid == 0)
+            {
+                runChild();
             }
+
+            attachDebugger(pid);
+            config = {m_vars, m_slotVars, m_slots, m_mode, needsInstructionPointer(), m_resetDebugStatus};
+            return pid;
+        });
+
+    std::vector<ShardRecord> records;
+    while (pool.drain(records))
+    {
+        pid_t pid = pool.getPid();
+        for (const ShardRecord& record : records)
+        {
+            m_event = {record.time, static_cast<pid_t>(record.tid), record.ip, 0, pid};
+            auto event = static_cast<util::WatchpointEvent>(record.event);
+            report(record.watch, event, Value::fromWord(record.value, m_vars[record.watch].size));
         }
+        records.clear();
+        flushEvents();
+    }
+    pool.join();
+
+    int status = pool.getExitStatus();
+    if (WIFEXITED(status) && WEXITSTATUS(status) != 0)
+    {
+        std::cerr << "child exited with status " << WEXITSTATUS(status) << "\n";
+    }
+    if (WIFSIGNALED(status))
+    {
+        std::cerr << "child killed by signal " << WTERMSIG(status) << "\n";
+    }
+
+    PoolStats poolStats = pool.getStats();
+    m_stats.stops += poolStats.stops;
+    m_stats.syscalls += poolStats.syscalls;
+    m_stats.cpuTime = poolStats.cpuTime + util::getThreadCpuTime() - cpuStart;
+
+    std::cerr << "tracer threads: " << poolStats.tracedThreads.size() << ", traced threads per tracer";
+    for (size_t traced : poolStats.tracedThreads)
+    {
+        std::cerr << " " << traced;
     }
+    std::cerr << ", " << poolStats.handedOver << " handed over\n";
+    printTraceStats();
 }
 
 void Debugger::runChild()
 {
-    std::vector<char*> cStrArray = util::toCStringArray(m_args, m_path);
-
-    // resolve path
+    // resolve path, argv[0] points into it, so it is resolved first, a program that execs itself needs it
     try
     {
         m_path = std::filesystem::canonical(m_path).string();
@@ -203,8 +2332,12 @@ void Debugger::runChild()
         std::cerr << "Failed to resolve path: " << e.what() << "\n";
         std::exit(3);
     }
+    std::vector<char*> cStrArray = util::toCStringArray(m_args, m_path);
 
-    ptrace(PTRACE_TRACEME, 0, NULL, NULL);
+    if (m_backend != Backend::AGENT)
+    {
+        ptrace(PTRACE_TRACEME, 0, NULL, NULL);
+    }
     int ret = execvp(m_path.c_str(), cStrArray.data());
 
     if (ret == -1)
@@ -214,8 +2347,191 @@ void Debugger::runChild()
     }
 }
 
+void Debugger::startAttach(pid_t pid)
+{
+    if (m_backend != Backend::PTRACE)
+    {
+        throw std::runtime_error("Attaching to a running process requires the ptrace backend");
+    }
+
+    if (m_vars.empty())
+    {
+        throw std::runtime_error("Unsupported number of watched variables: 0");
+    }
+
+    if (m_tracerThreads > 1)
+    {
+        throw std::runtime_error("Attaching to a running process requires a single tracer thread");
+    }
+
+    if (m_followFork)
+    {
+        throw std::runtime_error("Following forks requires starting the program");
+    }
+
+    seizeProcess(pid);
+    startTrace(pid);
+}
+
+void Debugger::attach(pid_t pid)
+{
+    startAttach(pid);
+    while (poll(-1))
+    {
+    }
+}
+
+void Debugger::replay(const StopRecording& recording)
+{
+    bool functionPredicate = std::any_of(m_predicates.begin(), m_predicates.end(), [](const auto& predicate)
+                                         { return predicate && predicate->usesFunctions(); });
+    if (m_overheadBudget > 0 || m_backtraceDepth > 0 || m_symbolize || functionPredicate || m_followFork)
+    {
+        throw std::runtime_error("Replaying stops does not support overhead budgets, backtraces, symbolize, "
+                                 "conditions on functions and following forks");
+    }
+
+    m_vars = recording.vars;
+    m_mode = recording.mode;
+    m_slots.clear();
+    m_slotVars.clear();
+    m_hardwareVars.clear();
+    m_softwareVars.clear();
+    m_libraryWatches.clear();
+    for (size_t i = 0; i < m_vars.size(); ++i)
+    {
+        const Variable& var = m_vars[i];
+        size_t required = requiredSlots(var, m_mode);
+        if (!splitLibrary(var.name).first.empty() || required == 0 ||
+            m_slots.size() + required > util::DEBUG_REGISTER_COUNT)
+        {
+            throw std::runtime_error("Replaying stops requires watches that fit into the debug registers, " + var.name +
+                                     " does not");
+        }
+        addHardwareWatch(i);
+    }
+
+    // DR6 is not written back, recorded stops already hold the bits of their own hit
+    m_resetDebugStatus = false;
+    m_traceBackend = std::make_unique<ReplayBackend>(recording);
+    m_threads.clear();
+    addThread(recording.pid, recording.pid);
+    beginTrace(recording.pid);
+    while (poll(-1))
+    {
+    }
+    m_traceBackend.reset();
+}
+
+void Debugger::checkRunSettings() const
+{
+    // with ptrace, variables beyond the debug registers fall back to page protection
+    size_t maxVariables = maxHardwareVariables(m_mode);
+    if (m_vars.empty() || (m_backend != Backend::PTRACE && m_vars.size() > maxVariables))
+    {
+        throw std::runtime_error("Unsupported number of watched variables: " + std::to_string(m_vars.size()) +
+                                 " (at most " + std::to_string(maxVariables) + " in this watch mode)");
+    }
+
+    if (m_backend != Backend::PTRACE && m_overheadBudget > 0)
+    {
+        throw std::runtime_error("An overhead budget requires the ptrace backend");
+    }
+
+    if (m_backend != Backend::PTRACE && m_backtraceDepth > 0)
+    {
+        throw std::runtime_error("Capturing backtraces requires the ptrace backend");
+    }
+
+    if ((m_backend != Backend::PTRACE || m_tracerThreads > 1) && m_recording)
+    {
+        throw std::runtime_error("Recording stops requires the ptrace backend and a single tracer thread");
+    }
+
+    for (const Variable& var : m_vars)
+    {
+        if (m_backend != Backend::PTRACE && !splitLibrary(var.name).first.empty())
+        {
+            throw std::runtime_error("Watching " + var.name + " in a shared library requires the ptrace backend");
+        }
+    }
+
+    // the state of these features belongs to the first process, forked ones would share it
+    if (m_followFork)
+    {
+        bool libraryWatch = std::any_of(m_vars.begin(), m_vars.end(), [](const Variable& var)
+                                        { return !splitLibrary(var.name).first.empty(); });
+        bool functionPredicate = std::any_of(m_predicates.begin(), m_predicates.end(), [](const auto& predicate)
+                                             { return predicate && predicate->usesFunctions(); });
+        if (m_backend != Backend::PTRACE || m_tracerThreads > 1 || libraryWatch || m_overheadBudget > 0 ||
+            m_backtraceDepth > 0 || m_recording || functionPredicate)
+        {
+            throw std::runtime_error("Following forks requires the ptrace backend and a single tracer thread, without "
+                                     "library watches, overhead budget, backtraces, stop recording or conditions on "
+                                     "functions");
+        }
+    }
+}
+
+void Debugger::start()
+{
+    if (m_backend != Backend::PTRACE || m_tracerThreads > 1)
+    {
+        throw std::runtime_error("Driving the tracer with poll requires the ptrace backend and a single tracer thread");
+    }
+    checkRunSettings();
+
+    pid_t pid = fork();
+    if (pid == -1)
+    {
+        throw std::runtime_error("fork failed");
+    }
+
+    if (pid == 0)
+    {
+        runChild();
+    }
+
+    attachDebugger(pid);
+    startTrace(pid);
+}
+
 void Debugger::run()
 {
+    checkRunSettings();
+
+    if (m_tracerThreads > 1)
+    {
+        // the tracer threads only read debug register hits and do not share the state of the other features
+        bool libraryWatch = std::any_of(m_vars.begin(), m_vars.end(), [](const Variable& var)
+                                        { return !splitLibrary(var.name).first.empty(); });
+        if (m_backend != Backend::PTRACE || m_vars.size() > maxHardwareVariables(m_mode) || libraryWatch ||
+            m_overheadBudget > 0 || m_backtraceDepth > 0)
+        {
+            throw std::runtime_error("Several tracer threads require the ptrace backend and watches that fit into the "
+                                     "debug registers, without library watches, overhead budget or backtraces");
+        }
+
+        traceShards();
+        return;
+    }
+
+    if (m_backend == Backend::PTRACE)
+    {
+        start();
+        while (poll(-1))
+        {
+        }
+        return;
+    }
+
+    // shared memory has to exist before the agent is loaded into the child
+    std::unique_ptr<AgentSession> agentSession;
+    if (m_backend == Backend::AGENT)
+    {
+        agentSession = std::make_unique<AgentSession>(m_vars);
+    }
+
     pid_t pid = fork();
     if (pid == -1)
     {
@@ -224,11 +2540,21 @@ void Debugger::run()
 
     if (pid != 0)
     {
-        attachDebugger(pid);
-        traceChild(pid);
+        if (m_backend == Backend::PERF)
+        {
+            tracePerf(pid);
+        }
+        else
+        {
+            traceAgent(pid, *agentSession);
+        }
     }
     else
     {
+        if (agentSession)
+        {
+            agentSession->exportEnvironment();
+        }
         runChild();
     }
 }
@@ -0,0 +1,491 @@
+#include "Decoder.hpp"
+
+#include <algorithm>
+
+namespace dbg::util
+{
+
+namespace
+{
+
+/// Size of the immediate operand that follows the memory operand
+enum Immediate
+{
+    IMM_NONE,
+    IMM_8,
+    IMM_Z // 16 bits with operand size prefix, 32 bits otherwise
+};
+
+/// Size of the memory operand
+enum OperandSize
+{
+    OPERAND_V, // 64 bits with REX.W, 16 bits with operand size prefix, 32 bits otherwise
+    OPERAND_B,
+    OPERAND_W,
+    OPERAND_D,
+    OPERAND_Q,
+    OPERAND_UNKNOWN // vector operands, depends on prefixes not tracked here
+};
+
+/// Effect of an opcode on its ModRM memory operand
+struct Opcode
+{
+    WatchpointEvent access;
+    Immediate imm = IMM_NONE;
+    OperandSize size = OPERAND_V;
+};
+
+/// Widest memory operand considered when matching an instruction to the watched range (SSE)
+constexpr uint64_t MAX_OPERAND_SIZE = 16;
+
+constexpr WatchpointEvent READ = WatchpointEvent::READ;
+constexpr WatchpointEvent WRITE = WatchpointEvent::WRITE;
+constexpr WatchpointEvent READ_WRITE = WatchpointEvent::READ_WRITE;
+constexpr WatchpointEvent NONE = WatchpointEvent::OTHER;
+
+/// One-byte opcode map, reg is the ModRM reg field used by group opcodes
+std::optional<Opcode> lookupOneByte(uint8_t op, uint8_t reg)
+{
+    // add, or, adc, sbb, and, sub, xor, cmp between register and memory
+    if (op < 0x40 && (op & 7) < 4)
+    {
+        bool isCmp = (op >> 3) == 7;
+        bool memoryDestination = (op & 7) < 2;
+        return Opcode{isCmp || !memoryDestination ? READ : READ_WRITE, IMM_NONE, op & 1 ? OPERAND_V : OPERAND_B};
+    }
+
+    switch (op)
+    {
+    case 0x63: return Opcode{READ, IMM_NONE, OPERAND_D};             // movsxd
+    case 0x69: return Opcode{READ, IMM_Z};                           // imul Gv, Ev, Iz
+    case 0x6B: return Opcode{READ, IMM_8};                           // imul Gv, Ev, Ib
+    case 0x80: return Opcode{reg == 7 ? READ : READ_WRITE, IMM_8, OPERAND_B}; // group 1 Eb, Ib
+    case 0x83: return Opcode{reg == 7 ? READ : READ_WRITE, IMM_8};   // group 1 Ev, Ib
+    case 0x81: return Opcode{reg == 7 ? READ : READ_WRITE, IMM_Z};   // group 1 Ev, Iz
+    case 0x84: return Opcode{READ, IMM_NONE, OPERAND_B};             // test Eb, Gb
+    case 0x85: return Opcode{READ};                                  // test Ev, Gv
+    case 0x86: return Opcode{READ_WRITE, IMM_NONE, OPERAND_B};       // xchg Eb, Gb
+    case 0x87: return Opcode{READ_WRITE};                            // xchg Ev, Gv
+    case 0x88: return Opcode{WRITE, IMM_NONE, OPERAND_B};            // mov Eb, Gb
+    case 0x89: return Opcode{WRITE};                                 // mov Ev, Gv
+    case 0x8C: return Opcode{WRITE, IMM_NONE, OPERAND_W};            // mov Ev, Sreg
+    case 0x8A: return Opcode{READ, IMM_NONE, OPERAND_B};             // mov Gb, Eb
+    case 0x8B: return Opcode{READ};                                  // mov Gv, Ev
+    case 0x8E: return Opcode{READ, IMM_NONE, OPERAND_W};             // mov Sreg, Ev
+    case 0x8D: return Opcode{NONE};                                  // lea does not access memory
+    case 0x8F: return reg == 0 ? std::optional<Opcode>{Opcode{WRITE, IMM_NONE, OPERAND_Q}} : std::nullopt; // pop Ev
+    case 0xC0: return Opcode{READ_WRITE, IMM_8, OPERAND_B};          // shift group Eb, Ib
+    case 0xC1: return Opcode{READ_WRITE, IMM_8};                     // shift group Ev, Ib
+    case 0xC6: return reg == 0 ? std::optional<Opcode>{Opcode{WRITE, IMM_8, OPERAND_B}} : std::nullopt; // mov Eb, Ib
+    case 0xC7: return reg == 0 ? std::optional<Opcode>{Opcode{WRITE, IMM_Z}} : std::nullopt; // mov Ev, Iz
+    case 0xD0:                                                       // shift group Eb by 1 or cl
+    case 0xD2: return Opcode{READ_WRITE, IMM_NONE, OPERAND_B};
+    case 0xD1:                                                       // shift group Ev by 1 or cl
+    case 0xD3: return Opcode{READ_WRITE};
+    case 0xF6:                                                       // group 3 Eb
+    case 0xF7:                                                       // group 3 Ev
+    {
+        OperandSize size = op == 0xF6 ? OPERAND_B : OPERAND_V;
+        if (reg <= 1)
+        {
+            return Opcode{READ, op == 0xF6 ? IMM_8 : IMM_Z, size}; // test
+        }
+        return Opcode{reg <= 3 ? READ_WRITE : READ, IMM_NONE, size}; // not, neg / mul, imul, div, idiv
+    }
+    case 0xFE: // inc, dec Eb
+        return reg <= 1 ? std::optional<Opcode>{Opcode{READ_WRITE, IMM_NONE, OPERAND_B}} : std::nullopt;
+    case 0xFF:                                                       // group 5
+        if (reg <= 1)
+        {
+            return Opcode{READ_WRITE}; // inc, dec
+        }
+        return reg <= 6 ? std::optional<Opcode>{Opcode{READ, IMM_NONE, OPERAND_Q}} : std::nullopt; // call, jmp, push
+    default: return std::nullopt;
+    }
+}
+
+/// Two-byte (0F xx) opcode map
+std::optional<Opcode> lookupTwoByte(uint8_t op, uint8_t reg, bool repPrefix)
+{
+    if (op >= 0x40 && op <= 0x4F) // cmovcc
+    {
+        return Opcode{READ};
+    }
+    if (op >= 0x90 && op <= 0x9F) // setcc
+    {
+        return Opcode{WRITE, IMM_NONE, OPERAND_B};
+    }
+    if (op >= 0x50 && op <= 0x6F) // sse / mmx arithmetic and loads
+    {
+        return Opcode{READ, IMM_NONE, OPERAND_UNKNOWN};
+    }
+    if (op >= 0xD0 && op <= 0xFE) // sse / mmx arithmetic, except stores below
+    {
+        return Opcode{op == 0xD6 || op == 0xE7 ? WRITE : READ, IMM_NONE, OPERAND_UNKNOWN}; // movq Wq, Vq / movntdq
+    }
+
+    // sse operand sizes depend on the mandatory prefix
+    constexpr OperandSize VEC = OPERAND_UNKNOWN;
+
+    switch (op)
+    {
+    case 0x10: return Opcode{READ, IMM_NONE, VEC};  // movups, movss, movsd, movupd
+    case 0x11: return Opcode{WRITE, IMM_NONE, VEC};
+    case 0x12: return Opcode{READ, IMM_NONE, VEC};  // movlps
+    case 0x13: return Opcode{WRITE, IMM_NONE, VEC};
+    case 0x14:
+    case 0x15:
+    case 0x16: return Opcode{READ, IMM_NONE, VEC};  // unpck, movhps
+    case 0x17: return Opcode{WRITE, IMM_NONE, VEC};
+    case 0x18:                                      // prefetch and hint nops never trigger data breakpoints
+    case 0x1F: return Opcode{NONE};
+    case 0x28: return Opcode{READ, IMM_NONE, VEC};  // movaps
+    case 0x29: return Opcode{WRITE, IMM_NONE, VEC};
+    case 0x2A: return Opcode{READ, IMM_NONE, VEC};  // cvtsi2ss
+    case 0x2B: return Opcode{WRITE, IMM_NONE, VEC}; // movntps
+    case 0x2C:
+    case 0x2D:
+    case 0x2E:
+    case 0x2F: return Opcode{READ, IMM_NONE, VEC};  // cvt, ucomis, comis
+    case 0x70: return Opcode{READ, IMM_8, VEC};     // pshuf
+    case 0x74:
+    case 0x75:
+    case 0x76: return Opcode{READ, IMM_NONE, VEC};  // pcmpeq
+    case 0x7E: return Opcode{repPrefix ? READ : WRITE, IMM_NONE, VEC}; // movq xmm, m64 / movd Ed, xmm
+    case 0x7F: return Opcode{WRITE, IMM_NONE, VEC}; // movdqa, movdqu
+    case 0xA3: return Opcode{READ};  // bt
+    case 0xA4:
+    case 0xAC: return Opcode{READ_WRITE, IMM_8}; // shld, shrd Ib
+    case 0xA5:
+    case 0xAD:
+    case 0xAB:
+    case 0xB3:
+    case 0xBB: return Opcode{READ_WRITE}; // shld, shrd cl, bts, btr, btc
+    case 0xAF: return Opcode{READ}; // imul Gv, Ev
+    case 0xB0:
+    case 0xC0: return Opcode{READ_WRITE, IMM_NONE, OPERAND_B}; // cmpxchg, xadd Eb
+    case 0xB1:
+    case 0xC1: return Opcode{READ_WRITE}; // cmpxchg, xadd Ev
+    case 0xB6:
+    case 0xBE: return Opcode{READ, IMM_NONE, OPERAND_B}; // movzx, movsx Gv, Eb
+    case 0xB7:
+    case 0xBF: return Opcode{READ, IMM_NONE, OPERAND_W}; // movzx, movsx Gv, Ew
+    case 0xB8:
+    case 0xBC:
+    case 0xBD: return Opcode{READ}; // popcnt, bsf, bsr
+    case 0xBA: return reg >= 4 ? std::optional<Opcode>{Opcode{reg == 4 ? READ : READ_WRITE, IMM_8}} : std::nullopt;
+    case 0xC2:
+    case 0xC4:
+    case 0xC6: return Opcode{READ, IMM_8, VEC}; // cmpps, pinsrw, shufps
+    case 0xC3: return Opcode{WRITE};            // movnti
+    case 0xC7: return reg == 1 ? std::optional<Opcode>{Opcode{READ_WRITE, IMM_NONE, VEC}} : std::nullopt; // cmpxchg8b/16b
+    default: return std::nullopt;
+    }
+}
+
+/// Three-byte (0F 38 xx and 0F 3A xx) opcode maps
+Opcode lookupThreeByte(uint8_t map, uint8_t op)
+{
+    if (map == 0x38)
+    {
+        if (op == 0xF0 || op == 0xF1)
+        {
+            return Opcode{op == 0xF1 ? WRITE : READ}; // movbe My, Gy stores
+        }
+        return Opcode{READ, IMM_NONE, OPERAND_UNKNOWN};
+    }
+
+    return Opcode{op >= 0x14 && op <= 0x17 ? WRITE : READ, IMM_8, OPERAND_UNKNOWN}; // pextr*, extractps store
+}
+
+/// Value of general purpose register number n
+uint64_t registerValue(const user_regs_struct& regs, int n)
+{
+    switch (n)
+    {
+    case 0: return regs.rax;
+    case 1: return regs.rcx;
+    case 2: return regs.rdx;
+    case 3: return regs.rbx;
+    case 4: return regs.rsp;
+    case 5: return regs.rbp;
+    case 6: return regs.rsi;
+    case 7: return regs.rdi;
+    case 8: return regs.r8;
+    case 9: return regs.r9;
+    case 10: return regs.r10;
+    case 11: return regs.r11;
+    case 12: return regs.r12;
+    case 13: return regs.r13;
+    case 14: return regs.r14;
+    case 15: return regs.r15;
+    default: return 0;
+    }
+}
+
+/// Read a little endian signed value of n bytes
+int64_t readSigned(std::span<const uint8_t> code, size_t pos, size_t n)
+{
+    uint64_t value = 0;
+    for (size_t i = 0; i < n; ++i)
+    {
+        value |= static_cast<uint64_t>(code[pos + i]) << (8 * i);
+    }
+
+    // sign extend
+    if (n < 8 && (value & (1ULL << (8 * n - 1))))
+    {
+        value |= ~0ULL << (8 * n);
+    }
+    return static_cast<int64_t>(value);
+}
+
+} // namespace
+
+std::optional<DecodedInstruction> decodeInstruction(std::span<const uint8_t> code)
+{
+    DecodedInstruction instr{};
+
+    bool operandSize16 = false;
+    bool addressSize32 = false;
+    bool repPrefix = false;
+    uint8_t rex = 0;
+
+    // legacy prefixes
+    size_t pos = 0;
+    for (; pos < code.size() && pos < MAX_INSTRUCTION_LENGTH; ++pos)
+    {
+        uint8_t b = code[pos];
+        if (b == 0x66)
+            operandSize16 = true;
+        else if (b == 0x67)
+            addressSize32 = true;
+        else if (b == 0xF3)
+            repPrefix = true;
+        else if (b == 0x64)
+            instr.segment = 4;
+        else if (b == 0x65)
+            instr.segment = 5;
+        else if (b != 0xF0 && b != 0xF2 && b != 0x2E && b != 0x36 && b != 0x3E && b != 0x26)
+            break;
+    }
+
+    // REX prefix must immediately precede the opcode
+    if (pos < code.size() && (code[pos] & 0xF0) == 0x40)
+    {
+        rex = code[pos++];
+    }
+
+    if (pos >= code.size())
+    {
+        return std::nullopt;
+    }
+
+    uint8_t op = code[pos++];
+
+    // mov between accumulator and absolute address (moffs)
+    if (op >= 0xA0 && op <= 0xA3)
+    {
+        size_t addressSize = addressSize32 ? 4 : 8;
+        if (pos + addressSize > code.size())
+        {
+            return std::nullopt;
+        }
+
+        instr.absolute = true;
+        instr.disp = readSigned(code, pos, addressSize);
+        instr.access = op <= 0xA1 ? READ : WRITE;
+        instr.operandSize = (op & 1) == 0 ? 1 : ((rex & 0x8) ? 8 : (operandSize16 ? 2 : 4));
+        instr.length = pos + addressSize;
+        return instr;
+    }
+
+    // opcode map escapes
+    uint8_t map = 0;
+    if (op == 0x0F)
+    {
+        if (pos >= code.size())
+        {
+            return std::nullopt;
+        }
+
+        op = code[pos++];
+        map = 0x0F;
+        if (op == 0x38 || op == 0x3A)
+        {
+            if (pos >= code.size())
+            {
+                return std::nullopt;
+            }
+
+            map = op;
+            op = code[pos++];
+        }
+    }
+
+    // ModRM
+    if (pos >= code.size())
+    {
+        return std::nullopt;
+    }
+
+    uint8_t modrm = code[pos++];
+    uint8_t mod = modrm >> 6;
+    uint8_t reg = (modrm >> 3) & 7;
+    uint8_t rm = modrm & 7;
+
+    std::optional<Opcode> opcode;
+    switch (map)
+    {
+    case 0: opcode = lookupOneByte(op, reg); break;
+    case 0x0F: opcode = lookupTwoByte(op, reg, repPrefix); break;
+    default: opcode = lookupThreeByte(map, op); break;
+    }
+
+    // unknown opcode or register operand
+    if (!opcode || mod == 3)
+    {
+        return std::nullopt;
+    }
+
+    size_t dispSize = mod == 1 ? 1 : (mod == 2 ? 4 : 0);
+
+    if (rm == 4)
+    {
+        // SIB byte
+        if (pos >= code.size())
+        {
+            return std::nullopt;
+        }
+
+        uint8_t sib = code[pos++];
+        int index = ((sib >> 3) & 7) | ((rex & 0x2) << 2);
+        int base = sib & 7;
+
+        instr.scale = 1U << (sib >> 6);
+        if (index != 4)
+        {
+            instr.index = index;
+        }
+
+        if (base == 5 && mod == 0)
+        {
+            dispSize = 4; // no base register
+        }
+        else
+        {
+            instr.base = base | ((rex & 0x1) << 3);
+        }
+    }
+    else if (rm == 5 && mod == 0)
+    {
+        instr.ripRelative = true;
+        dispSize = 4;
+    }
+    else
+    {
+        instr.base = rm | ((rex & 0x1) << 3);
+    }
+
+    if (pos + dispSize > code.size())
+    {
+        return std::nullopt;
+    }
+
+    if (dispSize > 0)
+    {
+        instr.disp = readSigned(code, pos, dispSize);
+        pos += dispSize;
+    }
+
+    switch (opcode->imm)
+    {
+    case IMM_8: pos += 1; break;
+    case IMM_Z: pos += operandSize16 ? 2 : 4; break;
+    case IMM_NONE: break;
+    }
+
+    if (pos > code.size() || pos > MAX_INSTRUCTION_LENGTH)
+    {
+        return std::nullopt;
+    }
+
+    switch (opcode->size)
+    {
+    case OPERAND_V: instr.operandSize = (rex & 0x8) ? 8 : (operandSize16 ? 2 : 4); break;
+    case OPERAND_B: instr.operandSize = 1; break;
+    case OPERAND_W: instr.operandSize = 2; break;
+    case OPERAND_D: instr.operandSize = 4; break;
+    case OPERAND_Q: instr.operandSize = 8; break;
+    case OPERAND_UNKNOWN: instr.operandSize = 0; break;
+    }
+
+    instr.access = opcode->access;
+    instr.length = pos;
+    return instr;
+}
+
+WatchpointEvent classifyTrappedAccess(std::span<const uint8_t> before, const user_regs_struct& regs, uintptr_t addr,
+                                      size_t size)
+{
+    // x86 data breakpoints trap after the instruction, so decoding has to go backwards:
+    // try every start offset and keep the instruction that ends exactly at rip and touches the watched range.
+    // Register based operands are matched against post-execution registers, so rip relative matches are preferred.
+    // Of those the longest wins, shorter ones are suffixes that lost an escape or prefix byte
+    // (e.g. 11 05 of movsd f2 0f 11 05 would be an adc).
+    std::optional<WatchpointEvent> ripMatch;
+    std::optional<WatchpointEvent> registerMatch;
+
+    size_t maxLength = std::min(before.size(), MAX_INSTRUCTION_LENGTH);
+    for (size_t length = 1; length <= maxLength; ++length)
+    {
+        auto instr = decodeInstruction(before.subspan(before.size() - length));
+        if (!instr || instr->length != length || instr->access == WatchpointEvent::OTHER)
+        {
+            continue;
+        }
+
+        uint64_t ea = static_cast<uint64_t>(instr->disp);
+        if (instr->ripRelative)
+        {
+            ea += regs.rip;
+        }
+        if (instr->base >= 0)
+        {
+            ea += registerValue(regs, instr->base);
+        }
+        if (instr->index >= 0)
+        {
+            ea += registerValue(regs, instr->index) * instr->scale;
+        }
+        if (instr->segment == 4)
+        {
+            ea += regs.fs_base;
+        }
+        else if (instr->segment == 5)
+        {
+            ea += regs.gs_base;
+        }
+
+        uint64_t operandSize = instr->operandSize > 0 ? instr->operandSize : MAX_OPERAND_SIZE;
+        if (ea >= addr + size || ea + operandSize <= addr)
+        {
+            continue;
+        }
+
+        if (instr->ripRelative || instr->absolute)
+        {
+            ripMatch = instr->access;
+            continue;
+        }
+
+        if (!registerMatch)
+        {
+            registerMatch = instr->access;
+        }
+    }
+
+    return ripMatch ? *ripMatch : registerMatch.value_or(WatchpointEvent::OTHER);
+}
+
+} // namespace dbg::util
@@ -0,0 +1,49 @@
+#pragma once
+
+#include "Util.hpp"
+
+#include <cstdint>
+#include <optional>
+#include <span>
+#include <sys/user.h>
+
+namespace dbg::util
+{
+
+/// Maximum length of a single x86-64 instruction
+constexpr size_t MAX_INSTRUCTION_LENGTH = 15;
+
+/// Memory operand and effect of a decoded x86-64 instruction
+/// Only the subset of the instruction set that accesses memory through ModRM or moffs is decoded
+struct DecodedInstruction
+{
+    size_t length = 0;
+    WatchpointEvent access = WatchpointEvent::OTHER; // effect on the memory operand
+    size_t operandSize = 0;                          // bytes accessed, 0 if unknown (vector operands)
+
+    // memory operand: segment + base + index * scale + disp
+    bool ripRelative = false;
+    bool absolute = false; // moffs form, disp holds the full address
+    int segment = -1;      // -1 = none, 4 = FS, 5 = GS (other segments have zero base)
+    int base = -1;         // -1 = none, otherwise register number 0 - 15
+    int index = -1;        // -1 = none, otherwise register number 0 - 15
+    unsigned int scale = 1;
+    int64_t disp = 0;
+};
+
+/// Decode a single instruction at the start of code
+/// @param code instruction bytes
+/// @return decoded instruction, or empty if the instruction is unknown or has no memory operand
+std::optional<DecodedInstruction> decodeInstruction(std::span<const uint8_t> code);
+
+/// Classify the access that triggered a trap-after data breakpoint,
+/// searches the bytes preceding rip for an instruction ending at rip whose memory operand hits [addr, addr + size)
+/// @param before up to MAX_INSTRUCTION_LENGTH bytes that precede rip in the tracee
+/// @param regs register state of the stopped thread (rip points past the trapping instruction)
+/// @param addr watched address
+/// @param size watched size
+/// @return access type of the trapping instruction, OTHER if it could not be identified
+WatchpointEvent classifyTrappedAccess(std::span<const uint8_t> before, const user_regs_struct& regs, uintptr_t addr,
+                                      size_t size);
+
+} // namespace dbg::util
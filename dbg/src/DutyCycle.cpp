@@ -0,0 +1,72 @@
+#include "DutyCycle.hpp"
+
+#include <algorithm>
+
+namespace dbg
+{
+
+DutyCycle::DutyCycle(double budget, uint64_t now, uint64_t cpu, uint64_t stops)
+    : m_budget{budget},
+      m_start{now},
+      m_periodStart{now},
+      m_periodCpu{cpu},
+      m_periodStops{stops},
+      m_windowStart{now},
+      m_windowEnd{now + PERIOD}
+{
+}
+
+bool DutyCycle::isDue(uint64_t now) const
+{
+    return now >= m_windowEnd;
+}
+
+bool DutyCycle::advance(uint64_t now, uint64_t cpu, uint64_t stops)
+{
+    if (m_armed)
+    {
+        m_armedTime += now - m_windowStart;
+    }
+    m_windowStart = now;
+
+    // the on-window ended, the watches stay disarmed for the rest of the period
+    if (m_armed && m_duty < 1.0 && now < m_periodStart + PERIOD)
+    {
+        m_armed = false;
+        m_windowEnd = m_periodStart + PERIOD;
+        return m_armed;
+    }
+
+    // the windows end late when the tracer is busy, the overhead is measured over the actual period
+    double elapsed = static_cast<double>(std::max<uint64_t>(now - m_periodStart, 1));
+    double overhead = static_cast<double>(cpu - m_periodCpu + (stops - m_periodStops) * STOP_COST) / elapsed;
+    if (overhead > 0)
+    {
+        m_duty = std::clamp(m_duty * std::clamp(m_budget / overhead, 0.5, 2.0), MIN_DUTY, 1.0);
+    }
+
+    m_periodStart = now;
+    m_periodCpu = cpu;
+    m_periodStops = stops;
+    m_armed = true;
+    m_windowEnd = now + static_cast<uint64_t>(m_duty * static_cast<double>(PERIOD));
+    return m_armed;
+}
+
+bool DutyCycle::isArmed() const
+{
+    return m_armed;
+}
+
+double DutyCycle::getDuty() const
+{
+    return m_duty;
+}
+
+double DutyCycle::getArmedRatio(uint64_t now) const
+{
+    uint64_t armed = m_armedTime + (m_armed ? now - m_windowStart : 0);
+    return now > m_start ? static_cast<double>(armed) / static_cast<double>(now - m_start) : 1.0;
+}
+
+} // namespace dbg
@@ -0,0 +1,63 @@
+#pragma once
+
+#include <cstdint>
+
+namespace dbg
+{
+
+/// Controller of the duty-cycled watch mode: the debug registers are armed for an on-window at the start of every
+/// period and disarmed for the rest of it. At the end of each period the overhead (the CPU time of the tracer plus the
+/// stop rate times the cost of a stop on the side of the tracee, per wall time) is compared against the budget and
+/// the share of the on-window is scaled by budget / overhead, by at most a factor of two per period
+class DutyCycle
+{
+    double m_budget;
+    double m_duty = 1.0; // share of the period the watches are armed
+    bool m_armed = true;
+
+    uint64_t m_start;       // monotonic time the controller started at
+    uint64_t m_periodStart; // start of the current period
+    uint64_t m_periodCpu;   // tracer CPU time at the start of the current period
+    uint64_t m_periodStops; // stops before the current period
+    uint64_t m_windowStart;
+    uint64_t m_windowEnd;
+    uint64_t m_armedTime = 0; // of the finished windows
+
+  public:
+    /// Length of a period in nanoseconds
+    static constexpr uint64_t PERIOD = 200'000'000;
+
+    /// Shortest on-window, as a share of the period
+    static constexpr double MIN_DUTY = 0.02;
+
+    /// Nanoseconds a stop costs the tracee that the CPU time of the tracer does not show: the debug exception and
+    /// the switches to the tracer and back, 10-15 us on current x86-64 machines
+    static constexpr uint64_t STOP_COST = 10'000;
+
+    /// @param budget allowed overhead, e.g. 0.05 for 5%
+    /// @param now current monotonic time in nanoseconds
+    /// @param cpu current CPU time of the tracing thread in nanoseconds
+    /// @param stops stops of the tracee so far
+    DutyCycle(double budget, uint64_t now, uint64_t cpu, uint64_t stops);
+
+    /// Check if the current window is over
+    [[nodiscard]] bool isDue(uint64_t now) const;
+
+    /// Start the next window, a new period adjusts the share of the on-window to the measured overhead
+    /// @param now current monotonic time in nanoseconds
+    /// @param cpu current CPU time of the tracing thread in nanoseconds
+    /// @param stops stops of the tracee so far
+    /// @return true if the watches are armed in the new window
+    bool advance(uint64_t now, uint64_t cpu, uint64_t stops);
+
+    [[nodiscard]] bool isArmed() const;
+
+    /// Share of the on-window in the current period
+    [[nodiscard]] double getDuty() const;
+
+    /// Share of the time since the start the watches were armed, counts scale back to estimates by its inverse
+    /// @param now current monotonic time in nanoseconds
+    [[nodiscard]] double getArmedRatio(uint64_t now) const;
+};
+
+} // namespace dbg
@@ -0,0 +1,1368 @@
+#include "DwarfReader.hpp"
+
+#include <algorithm>
+#include <charconv>
+#include <cstring>
+#include <stdexcept>
+
+#include <elf.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace dbg
+{
+
+namespace
+{
+// tags
+constexpr uint64_t DW_TAG_array_type = 0x01;
+constexpr uint64_t DW_TAG_class_type = 0x02;
+constexpr uint64_t DW_TAG_enumeration_type = 0x04;
+constexpr uint64_t DW_TAG_member = 0x0d;
+constexpr uint64_t DW_TAG_pointer_type = 0x0f;
+constexpr uint64_t DW_TAG_reference_type = 0x10;
+constexpr uint64_t DW_TAG_structure_type = 0x13;
+constexpr uint64_t DW_TAG_typedef = 0x16;
+constexpr uint64_t DW_TAG_union_type = 0x17;
+constexpr uint64_t DW_TAG_inheritance = 0x1c;
+constexpr uint64_t DW_TAG_ptr_to_member_type = 0x1f;
+constexpr uint64_t DW_TAG_subrange_type = 0x21;
+constexpr uint64_t DW_TAG_base_type = 0x24;
+constexpr uint64_t DW_TAG_const_type = 0x26;
+constexpr uint64_t DW_TAG_variable = 0x34;
+constexpr uint64_t DW_TAG_volatile_type = 0x35;
+constexpr uint64_t DW_TAG_restrict_type = 0x37;
+constexpr uint64_t DW_TAG_rvalue_reference_type = 0x42;
+constexpr uint64_t DW_TAG_atomic_type = 0x47;
+
+// attributes
+constexpr uint64_t DW_AT_sibling = 0x01;
+constexpr uint64_t DW_AT_location = 0x02;
+constexpr uint64_t DW_AT_name = 0x03;
+constexpr uint64_t DW_AT_byte_size = 0x0b;
+constexpr uint64_t DW_AT_bit_offset = 0x0c;
+constexpr uint64_t DW_AT_bit_size = 0x0d;
+constexpr uint64_t DW_AT_upper_bound = 0x2f;
+constexpr uint64_t DW_AT_count = 0x37;
+constexpr uint64_t DW_AT_data_member_location = 0x38;
+constexpr uint64_t DW_AT_declaration = 0x3c;
+constexpr uint64_t DW_AT_encoding = 0x3e;
+constexpr uint64_t DW_AT_specification = 0x47;
+constexpr uint64_t DW_AT_type = 0x49;
+constexpr uint64_t DW_AT_data_bit_offset = 0x6b;
+constexpr uint64_t DW_AT_str_offsets_base = 0x72;
+constexpr uint64_t DW_AT_addr_base = 0x73;
+constexpr uint64_t DW_AT_GNU_addr_base = 0x2133;
+
+// forms
+constexpr uint64_t DW_FORM_addr = 0x01;
+constexpr uint64_t DW_FORM_block2 = 0x03;
+constexpr uint64_t DW_FORM_block4 = 0x04;
+constexpr uint64_t DW_FORM_data2 = 0x05;
+constexpr uint64_t DW_FORM_data4 = 0x06;
+constexpr uint64_t DW_FORM_data8 = 0x07;
+constexpr uint64_t DW_FORM_string = 0x08;
+constexpr uint64_t DW_FORM_block = 0x09;
+constexpr uint64_t DW_FORM_block1 = 0x0a;
+constexpr uint64_t DW_FORM_data1 = 0x0b;
+constexpr uint64_t DW_FORM_flag = 0x0c;
+constexpr uint64_t DW_FORM_sdata = 0x0d;
+constexpr uint64_t DW_FORM_strp = 0x0e;
+constexpr uint64_t DW_FORM_udata = 0x0f;
+constexpr uint64_t DW_FORM_ref_addr = 0x10;
+constexpr uint64_t DW_FORM_ref1 = 0x11;
+constexpr uint64_t DW_FORM_ref2 = 0x12;
+constexpr uint64_t DW_FORM_ref4 = 0x13;
+constexpr uint64_t DW_FORM_ref8 = 0x14;
+constexpr uint64_t DW_FORM_ref_udata = 0x15;
+constexpr uint64_t DW_FORM_indirect = 0x16;
+constexpr uint64_t DW_FORM_sec_offset = 0x17;
+constexpr uint64_t DW_FORM_exprloc = 0x18;
+constexpr uint64_t DW_FORM_flag_present = 0x19;
+constexpr uint64_t DW_FORM_strx = 0x1a;
+constexpr uint64_t DW_FORM_addrx = 0x1b;
+constexpr uint64_t DW_FORM_ref_sup4 = 0x1c;
+constexpr uint64_t DW_FORM_strp_sup = 0x1d;
+constexpr uint64_t DW_FORM_data16 = 0x1e;
+constexpr uint64_t DW_FORM_line_strp = 0x1f;
+constexpr uint64_t DW_FORM_ref_sig8 = 0x20;
+constexpr uint64_t DW_FORM_implicit_const = 0x21;
+constexpr uint64_t DW_FORM_loclistx = 0x22;
+constexpr uint64_t DW_FORM_rnglistx = 0x23;
+constexpr uint64_t DW_FORM_ref_sup8 = 0x24;
+constexpr uint64_t DW_FORM_strx1 = 0x25;
+constexpr uint64_t DW_FORM_strx2 = 0x26;
+constexpr uint64_t DW_FORM_strx3 = 0x27;
+constexpr uint64_t DW_FORM_strx4 = 0x28;
+constexpr uint64_t DW_FORM_addrx1 = 0x29;
+constexpr uint64_t DW_FORM_addrx2 = 0x2a;
+constexpr uint64_t DW_FORM_addrx3 = 0x2b;
+constexpr uint64_t DW_FORM_addrx4 = 0x2c;
+constexpr uint64_t DW_FORM_GNU_addr_index = 0x1f01;
+constexpr uint64_t DW_FORM_GNU_str_index = 0x1f02;
+constexpr uint64_t DW_FORM_GNU_ref_alt = 0x1f20;
+constexpr uint64_t DW_FORM_GNU_strp_alt = 0x1f21;
+
+// location expressions
+constexpr uint8_t DW_OP_addr = 0x03;
+constexpr uint8_t DW_OP_plus_uconst = 0x23;
+constexpr uint8_t DW_OP_addrx = 0xa1;
+constexpr uint8_t DW_OP_GNU_addr_index = 0xfb;
+
+// base type encodings
+constexpr uint64_t DW_ATE_float = 0x04;
+constexpr uint64_t DW_ATE_signed = 0x05;
+constexpr uint64_t DW_ATE_signed_char = 0x06;
+constexpr uint64_t DW_ATE_signed_fixed = 0x0d;
+
+// unit types (DWARF 5)
+constexpr uint8_t DW_UT_type = 0x02;
+constexpr uint8_t DW_UT_skeleton = 0x04;
+constexpr uint8_t DW_UT_split_compile = 0x05;
+constexpr uint8_t DW_UT_split_type = 0x06;
+
+// name index attributes (DWARF 5)
+constexpr uint64_t DW_IDX_compile_unit = 1;
+constexpr uint64_t DW_IDX_die_offset = 3;
+
+/// Bounds checked little endian reader of a section
+class Cursor
+{
+    const uint8_t* m_data;
+    size_t m_size;
+    size_t m_pos;
+
+  public:
+    Cursor(const uint8_t* data, size_t size, size_t pos = 0)
+        : m_data{data},
+          m_size{size},
+          m_pos{pos > size ? size : pos}
+    {
+    }
+
+    [[nodiscard]] size_t position() const
+    {
+        return m_pos;
+    }
+
+    [[nodiscard]] bool atEnd() const
+    {
+        return m_pos >= m_size;
+    }
+
+    void seek(size_t pos)
+    {
+        if (pos > m_size)
+        {
+            throw std::runtime_error("Malformed DWARF: offset beyond section");
+        }
+        m_pos = pos;
+    }
+
+    const uint8_t* take(size_t count)
+    {
+        if (count > m_size - m_pos)
+        {
+            throw std::runtime_error("Malformed DWARF: read beyond section");
+        }
+        const uint8_t* data = m_data + m_pos;
+        m_pos += count;
+        return data;
+    }
+
+    /// Unsigned little endian value of 1 to 8 bytes
+    uint64_t read(size_t size)
+    {
+        uint64_t value = 0;
+        memcpy(&value, take(size), size);
+        return value;
+    }
+
+    uint64_t uleb()
+    {
+        uint64_t value = 0;
+        for (unsigned shift = 0;; shift += 7)
+        {
+            uint8_t byte = *take(1);
+            value |= shift < 64 ? static_cast<uint64_t>(byte & 0x7f) << shift : 0;
+            if (!(byte & 0x80))
+            {
+                return value;
+            }
+        }
+    }
+
+    int64_t sleb()
+    {
+        uint64_t value = 0;
+        unsigned shift = 0;
+        uint8_t byte;
+        do
+        {
+            byte = *take(1);
+            value |= shift < 64 ? static_cast<uint64_t>(byte & 0x7f) << shift : 0;
+            shift += 7;
+        } while (byte & 0x80);
+
+        if (shift < 64 && (byte & 0x40))
+        {
+            value |= ~uint64_t{0} << shift;
+        }
+        return static_cast<int64_t>(value);
+    }
+
+    std::string_view cstr()
+    {
+        const auto* begin = reinterpret_cast<const char*>(m_data + m_pos);
+        size_t length = strnlen(begin, m_size - m_pos);
+        if (length == m_size - m_pos)
+        {
+            throw std::runtime_error("Malformed DWARF: unterminated string");
+        }
+        m_pos += length + 1;
+        return {begin, length};
+    }
+
+    /// Initial length of a unit, 0xffffffff introduces the 64-bit format with 8 byte section offsets
+    uint64_t unitLength(uint8_t& offsetSize)
+    {
+        uint64_t length = read(4);
+        offsetSize = 4;
+        if (length == 0xffffffff)
+        {
+            length = read(8);
+            offsetSize = 8;
+        }
+        if (length > m_size - m_pos)
+        {
+            throw std::runtime_error("Malformed DWARF: unit beyond section");
+        }
+        return length;
+    }
+};
+
+/// Hash of the name index, DJB hash of the case folded name (ASCII names fold to lowercase)
+uint32_t hashIndexName(std::string_view name)
+{
+    uint32_t hash = 5381;
+    for (char c : name)
+    {
+        hash = hash * 33 + static_cast<uint8_t>(c >= 'A' && c <= 'Z' ? c - 'A' + 'a' : c);
+    }
+    return hash;
+}
+
+bool isRecord(uint64_t tag)
+{
+    return tag == DW_TAG_structure_type || tag == DW_TAG_class_type || tag == DW_TAG_union_type;
+}
+} // namespace
+
+DwarfReader::DwarfReader(const std::string& exePath, const std::string& cacheDir)
+    : m_exePath(exePath), m_cacheDir(cacheDir)
+{
+    int fd = open(exePath.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+    {
+        throw std::runtime_error("Could not open " + exePath);
+    }
+
+    struct stat st{};
+    if (fstat(fd, &st) < 0)
+    {
+        close(fd);
+        throw std::runtime_error("Fstat failed: " + exePath);
+    }
+
+    void* map = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+    {
+        throw std::runtime_error("Mmap failed: " + exePath);
+    }
+    m_map = map;
+    m_mapSize = st.st_size;
+
+    const auto* base = reinterpret_cast<const uint8_t*>(map);
+    const auto* elfHdr = reinterpret_cast<const Elf64_Ehdr*>(base);
+    if (m_mapSize < sizeof(Elf64_Ehdr) || memcmp(elfHdr->e_ident, ELFMAG, SELFMAG) != 0 ||
+        elfHdr->e_shoff + elfHdr->e_shnum * sizeof(Elf64_Shdr) > m_mapSize || elfHdr->e_shstrndx >= elfHdr->e_shnum)
+    {
+        munmap(map, m_mapSize);
+        throw std::runtime_error(exePath + " is not an ELF file");
+    }
+
+    // only the section headers are read here, the sections themselves are paged in when a lookup touches them
+    const auto* elfSecHdr = reinterpret_cast<const Elf64_Shdr*>(base + elfHdr->e_shoff);
+    const Elf64_Shdr& names = elfSecHdr[elfHdr->e_shstrndx];
+    const std::pair<const char*, Section*> wanted[] = {
+        {".debug_info", &m_info},
+        {".debug_abbrev", &m_abbrev},
+        {".debug_str", &m_str},
+        {".debug_line_str", &m_lineStr},
+        {".debug_str_offsets", &m_strOffsets},
+        {".debug_addr", &m_addr},
+        {".debug_names", &m_names},
+        {".debug_pubnames", &m_pubnames},
+        {".debug_gnu_pubnames", &m_gnuPubnames},
+        {".debug_aranges", &m_aranges},
+    };
+
+    for (int i = 0; i < elfHdr->e_shnum; ++i)
+    {
+        const Elf64_Shdr& section = elfSecHdr[i];
+        // compressed sections (-gz) are left out, as if there was no debug information
+        if (section.sh_type == SHT_NOBITS || (section.sh_flags & SHF_COMPRESSED) || section.sh_name >= names.sh_size ||
+            section.sh_offset + section.sh_size > m_mapSize)
+        {
+            continue;
+        }
+
+        const char* name = reinterpret_cast<const char*>(base + names.sh_offset + section.sh_name);
+        for (auto [wantedName, target] : wanted)
+        {
+            if (strncmp(name, wantedName, names.sh_size - section.sh_name) == 0)
+            {
+                *target = {base + section.sh_offset, section.sh_size};
+            }
+        }
+    }
+}
+
+DwarfReader::~DwarfReader()
+{
+    if (m_map)
+    {
+        munmap(m_map, m_mapSize);
+    }
+}
+
+bool DwarfReader::hasDebugInfo() const
+{
+    return m_info.size > 0 && m_abbrev.size > 0;
+}
+
+DwarfReader::Unit DwarfReader::readUnit(size_t offset) const
+{
+    Cursor cursor(m_info.data, m_info.size, offset);
+    Unit unit;
+    unit.offset = offset;
+    uint64_t length = cursor.unitLength(unit.offsetSize);
+    unit.end = cursor.position() + length;
+    unit.version = static_cast<uint16_t>(cursor.read(2));
+    if (unit.version < 2 || unit.version > 5)
+    {
+        throw std::runtime_error("Unsupported DWARF version " + std::to_string(unit.version));
+    }
+
+    if (unit.version >= 5)
+    {
+        uint8_t unitType = static_cast<uint8_t>(cursor.read(1));
+        unit.addressSize = static_cast<uint8_t>(cursor.read(1));
+        unit.abbrevOffset = cursor.read(unit.offsetSize);
+        if (unitType == DW_UT_skeleton || unitType == DW_UT_split_compile)
+        {
+            cursor.read(8); // dwo id
+        }
+        else if (unitType == DW_UT_type || unitType == DW_UT_split_type)
+        {
+            cursor.read(8); // type signature
+            cursor.read(unit.offsetSize);
+        }
+    }
+    else
+    {
+        unit.abbrevOffset = cursor.read(unit.offsetSize);
+        unit.addressSize = static_cast<uint8_t>(cursor.read(1));
+    }
+    unit.firstDie = cursor.position();
+
+    // string and address indexes of the unit's DIEs are relative to the bases of its root DIE
+    Die root = readDie(unit, unit.firstDie);
+    unit.strOffsetsBase = root.strOffsetsBase;
+    unit.addrBase = root.addrBase;
+    return unit;
+}
+
+DwarfReader::Unit DwarfReader::findUnit(size_t dieOffset) const
+{
+    // only the unit headers are read, one length per unit
+    Cursor cursor(m_info.data, m_info.size);
+    while (!cursor.atEnd())
+    {
+        size_t offset = cursor.position();
+        uint8_t offsetSize = 0;
+        uint64_t length = cursor.unitLength(offsetSize);
+        size_t end = cursor.position() + length;
+        if (dieOffset < end)
+        {
+            return readUnit(offset);
+        }
+        cursor.seek(end);
+    }
+    throw std::runtime_error("Malformed DWARF: reference beyond .debug_info");
+}
+
+const std::unordered_map<uint64_t, DwarfReader::Abbrev>& DwarfReader::abbrevTable(size_t offset) const
+{
+    auto cached = m_abbrevTables.find(offset);
+    if (cached != m_abbrevTables.end())
+    {
+        return cached->second;
+    }
+
+    std::unordered_map<uint64_t, Abbrev> table;
+    Cursor cursor(m_abbrev.data, m_abbrev.size, offset);
+    for (uint64_t code = cursor.uleb(); code != 0; code = cursor.uleb())
+    {
+        Abbrev& abbrev = table[code];
+        abbrev.tag = cursor.uleb();
+        abbrev.children = cursor.read(1) != 0;
+        for (;;)
+        {
+            uint64_t name = cursor.uleb();
+            uint64_t form = cursor.uleb();
+            if (name == 0 && form == 0)
+            {
+                break;
+            }
+            int64_t implicitConst = form == DW_FORM_implicit_const ? cursor.sleb() : 0;
+            abbrev.attributes.push_back({name, form, implicitConst});
+        }
+    }
+    return m_abbrevTables.emplace(offset, std::move(table)).first->second;
+}
+
+std::string_view DwarfReader::readString(uint64_t offset, const Section& section) const
+{
+    if (offset >= section.size)
+    {
+        throw std::runtime_error("Malformed DWARF: string offset beyond section");
+    }
+    Cursor cursor(section.data, section.size, offset);
+    return cursor.cstr();
+}
+
+DwarfReader::Die DwarfReader::readDie(const Unit& unit, size_t offset) const
+{
+    Cursor cursor(m_info.data, unit.end, offset);
+    Die die;
+    die.offset = offset;
+
+    uint64_t code = cursor.uleb();
+    if (code == 0)
+    {
+        die.end = cursor.position(); // end of a list of siblings
+        return die;
+    }
+
+    const auto& table = abbrevTable(unit.abbrevOffset);
+    auto abbrev = table.find(code);
+    if (abbrev == table.end())
+    {
+        throw std::runtime_error("Malformed DWARF: unknown abbreviation " + std::to_string(code));
+    }
+    die.tag = abbrev->second.tag;
+    die.children = abbrev->second.children;
+
+    // indexed strings and addresses are resolved after all attributes were read,
+    // as the root DIE may list its bases after them
+    std::optional<uint64_t> nameIndex;
+    std::optional<uint64_t> addressIndex;
+
+    for (const AttributeSpec& spec : abbrev->second.attributes)
+    {
+        uint64_t form = spec.form;
+        while (form == DW_FORM_indirect)
+        {
+            form = cursor.uleb();
+        }
+
+        uint64_t value = 0;
+        bool isConstant = false;
+        bool isReference = false;
+        const uint8_t* block = nullptr;
+        size_t blockSize = 0;
+        std::optional<std::string_view> string;
+        std::optional<uint64_t> stringIndex;
+
+        switch (form)
+        {
+        case DW_FORM_addr:
+            value = cursor.read(unit.addressSize);
+            isConstant = true;
+            break;
+        case DW_FORM_data1:
+        case DW_FORM_data2:
+        case DW_FORM_data4:
+        case DW_FORM_data8:
+            value = cursor.read(form == DW_FORM_data1 ? 1 : form == DW_FORM_data2 ? 2 : form == DW_FORM_data4 ? 4 : 8);
+            isConstant = true;
+            break;
+        case DW_FORM_sdata:
+            value = static_cast<uint64_t>(cursor.sleb());
+            isConstant = true;
+            break;
+        case DW_FORM_udata:
+            value = cursor.uleb();
+            isConstant = true;
+            break;
+        case DW_FORM_implicit_const:
+            value = static_cast<uint64_t>(spec.implicitConst);
+            isConstant = true;
+            break;
+        case DW_FORM_flag:
+            value = cursor.read(1);
+            isConstant = true;
+            break;
+        case DW_FORM_flag_present:
+            value = 1;
+            isConstant = true;
+            break;
+        case DW_FORM_ref1:
+        case DW_FORM_ref2:
+        case DW_FORM_ref4:
+        case DW_FORM_ref8:
+            value = unit.offset + cursor.read(form == DW_FORM_ref1   ? 1
+                                              : form == DW_FORM_ref2 ? 2
+                                              : form == DW_FORM_ref4 ? 4
+                                                                     : 8);
+            isReference = true;
+            break;
+        case DW_FORM_ref_udata:
+            value = unit.offset + cursor.uleb();
+            isReference = true;
+            break;
+        case DW_FORM_ref_addr:
+            value = cursor.read(unit.version <= 2 ? unit.addressSize : unit.offsetSize);
+            isReference = true;
+            break;
+        case DW_FORM_ref_sig8:
+            cursor.read(8); // types in type units are not followed
+            break;
+        case DW_FORM_string:
+            string = cursor.cstr();
+            break;
+        case DW_FORM_strp:
+            string = readString(cursor.read(unit.offsetSize), m_str);
+            break;
+        case DW_FORM_line_strp:
+            string = readString(cursor.read(unit.offsetSize), m_lineStr);
+            break;
+        case DW_FORM_strx:
+        case DW_FORM_GNU_str_index:
+            stringIndex = cursor.uleb();
+            break;
+        case DW_FORM_strx1:
+        case DW_FORM_strx2:
+        case DW_FORM_strx3:
+        case DW_FORM_strx4:
+            stringIndex = cursor.read(form - DW_FORM_strx1 + 1);
+            break;
+        case DW_FORM_addrx:
+        case DW_FORM_GNU_addr_index:
+            cursor.uleb(); // code addresses, not needed
+            break;
+        case DW_FORM_addrx1:
+        case DW_FORM_addrx2:
+        case DW_FORM_addrx3:
+        case DW_FORM_addrx4:
+            cursor.read(form - DW_FORM_addrx1 + 1);
+            break;
+        case DW_FORM_block1:
+        case DW_FORM_block2:
+        case DW_FORM_block4:
+        case DW_FORM_block:
+        case DW_FORM_exprloc:
+            blockSize = form == DW_FORM_block1   ? cursor.read(1)
+                        : form == DW_FORM_block2 ? cursor.read(2)
+                        : form == DW_FORM_block4 ? cursor.read(4)
+                                                 : cursor.uleb();
+            block = cursor.take(blockSize);
+            break;
+        case DW_FORM_sec_offset:
+            value = cursor.read(unit.offsetSize);
+            break;
+        case DW_FORM_strp_sup:
+        case DW_FORM_GNU_ref_alt:
+        case DW_FORM_GNU_strp_alt:
+            cursor.read(unit.offsetSize);
+            break;
+        case DW_FORM_ref_sup4:
+            cursor.read(4);
+            break;
+        case DW_FORM_ref_sup8:
+            cursor.read(8);
+            break;
+        case DW_FORM_data16:
+            cursor.take(16);
+            break;
+        case DW_FORM_loclistx:
+        case DW_FORM_rnglistx:
+            cursor.uleb();
+            break;
+        default:
+            throw std::runtime_error("Unsupported DWARF form " + std::to_string(form));
+        }
+
+        switch (spec.name)
+        {
+        case DW_AT_name:
+            if (string)
+            {
+                die.name = *string;
+            }
+            nameIndex = stringIndex;
+            break;
+        case DW_AT_type:
+            die.type = isReference ? value : 0;
+            break;
+        case DW_AT_sibling:
+            die.sibling = isReference ? value : 0;
+            break;
+        case DW_AT_specification:
+            die.specification = isReference ? value : 0;
+            break;
+        case DW_AT_byte_size:
+            die.byteSize = isConstant ? value : 0;
+            break;
+        case DW_AT_encoding:
+            die.encoding = value;
+            break;
+        case DW_AT_declaration:
+            die.declaration = value != 0;
+            break;
+        case DW_AT_bit_size:
+        case DW_AT_bit_offset:
+        case DW_AT_data_bit_offset:
+            die.bitField = true;
+            break;
+        case DW_AT_upper_bound:
+            // variable length and unknown bounds stay unset
+            if (isConstant)
+            {
+                die.count = value + 1;
+            }
+            break;
+        case DW_AT_count:
+            if (isConstant)
+            {
+                die.count = value;
+            }
+            break;
+        case DW_AT_str_offsets_base:
+            die.strOffsetsBase = value;
+            break;
+        case DW_AT_addr_base:
+        case DW_AT_GNU_addr_base:
+            die.addrBase = value;
+            break;
+        case DW_AT_data_member_location:
+            if (isConstant)
+            {
+                die.memberOffset = value;
+            }
+            else if (block && blockSize > 1 && block[0] == DW_OP_plus_uconst)
+            {
+                Cursor expression(block, blockSize, 1);
+                die.memberOffset = expression.uleb();
+            }
+            break;
+        case DW_AT_location:
+            // only static locations, a single DW_OP_addr or DW_OP_addrx
+            if (block && blockSize == 1u + unit.addressSize && block[0] == DW_OP_addr)
+            {
+                Cursor expression(block, blockSize, 1);
+                die.address = expression.read(unit.addressSize);
+            }
+            else if (block && blockSize > 1 && (block[0] == DW_OP_addrx || block[0] == DW_OP_GNU_addr_index))
+            {
+                Cursor expression(block, blockSize, 1);
+                uint64_t index = expression.uleb();
+                if (expression.atEnd())
+                {
+                    addressIndex = index;
+                }
+            }
+            break;
+        default:
+            break;
+        }
+    }
+    die.end = cursor.position();
+
+    uint64_t strOffsetsBase = die.strOffsetsBase ? die.strOffsetsBase : unit.strOffsetsBase;
+    if (nameIndex && m_strOffsets.size > 0)
+    {
+        Cursor offsets(m_strOffsets.data, m_strOffsets.size, strOffsetsBase + *nameIndex * unit.offsetSize);
+        die.name = readString(offsets.read(unit.offsetSize), m_str);
+    }
+
+    uint64_t addrBase = die.addrBase ? die.addrBase : unit.addrBase;
+    if (addressIndex && m_addr.size > 0)
+    {
+        Cursor addresses(m_addr.data, m_addr.size, addrBase + *addressIndex * unit.addressSize);
+        die.address = addresses.read(unit.addressSize);
+    }
+    return die;
+}
+
+size_t DwarfReader::nextSibling(const Unit& unit, const Die& die) const
+{
+    if (!die.children)
+    {
+        return die.end;
+    }
+    if (die.sibling > die.offset && die.sibling <= unit.end)
+    {
+        return die.sibling;
+    }
+
+    // without DW_AT_sibling the children have to be skipped one by one
+    size_t offset = die.end;
+    for (;;)
+    {
+        Die child = readDie(unit, offset);
+        if (child.tag == 0)
+        {
+            return child.end;
+        }
+        offset = nextSibling(unit, child);
+    }
+}
+
+std::vector<std::pair<size_t, size_t>> DwarfReader::lookupNames(std::string_view name) const
+{
+    std::vector<std::pair<size_t, size_t>> found;
+    uint32_t hash = hashIndexName(name);
+
+    // one name index per unit, or one for the whole binary when the linker merged them
+    Cursor index(m_names.data, m_names.size);
+    while (!index.atEnd())
+    {
+        uint8_t offsetSize = 0;
+        uint64_t length = index.unitLength(offsetSize);
+        size_t end = index.position() + length;
+        uint16_t version = static_cast<uint16_t>(index.read(2));
+        if (version != 5)
+        {
+            index.seek(end);
+            continue;
+        }
+
+        index.read(2); // padding
+        uint32_t cuCount = static_cast<uint32_t>(index.read(4));
+        uint32_t localTuCount = static_cast<uint32_t>(index.read(4));
+        uint32_t foreignTuCount = static_cast<uint32_t>(index.read(4));
+        uint32_t bucketCount = static_cast<uint32_t>(index.read(4));
+        uint32_t nameCount = static_cast<uint32_t>(index.read(4));
+        uint32_t abbrevSize = static_cast<uint32_t>(index.read(4));
+        uint32_t augmentationSize = static_cast<uint32_t>(index.read(4));
+        index.take((augmentationSize + 3) & ~3u);
+
+        size_t cuList = index.position();
+        size_t buckets = cuList + (static_cast<size_t>(cuCount) + localTuCount) * offsetSize + foreignTuCount * 8ul;
+        size_t hashes = buckets + bucketCount * 4ul;
+        size_t strings = hashes + (bucketCount ? nameCount * 4ul : 0);
+        size_t entries = strings + nameCount * static_cast<size_t>(offsetSize);
+        size_t abbrevs = entries + nameCount * static_cast<size_t>(offsetSize);
+        size_t pool = abbrevs + abbrevSize;
+        if (pool > end)
+        {
+            throw std::runtime_error("Malformed DWARF: name index beyond unit");
+        }
+
+        Cursor table(m_names.data, end);
+        auto at = [&](size_t offset, size_t size) {
+            table.seek(offset);
+            return table.read(size);
+        };
+
+        // candidate names: the chain of the hash's bucket, or all names if the index has no hash table
+        uint32_t first = 1;
+        uint32_t last = nameCount;
+        if (bucketCount > 0)
+        {
+            first = static_cast<uint32_t>(at(buckets + (hash % bucketCount) * 4ul, 4));
+        }
+
+        for (uint32_t i = first; first != 0 && i <= last; ++i)
+        {
+            if (bucketCount > 0)
+            {
+                uint32_t nameHash = static_cast<uint32_t>(at(hashes + (i - 1) * 4ul, 4));
+                if (nameHash % bucketCount != hash % bucketCount)
+                {
+                    break;
+                }
+                if (nameHash != hash)
+                {
+                    continue;
+                }
+            }
+            if (readString(at(strings + (i - 1) * static_cast<size_t>(offsetSize), offsetSize), m_str) != name)
+            {
+                continue;
+            }
+
+            // entries of the name up to a zero abbreviation code, their abbreviations are only parsed when needed
+            table.seek(pool + at(entries + (i - 1) * static_cast<size_t>(offsetSize), offsetSize));
+            for (uint64_t code = table.uleb(); code != 0; code = table.uleb())
+            {
+                Cursor abbrev(m_names.data, pool, abbrevs);
+                uint64_t tag = 0;
+                std::vector<std::pair<uint64_t, uint64_t>> attributes;
+                for (uint64_t abbrevCode = abbrev.uleb(); abbrevCode != 0; abbrevCode = abbrev.uleb())
+                {
+                    tag = abbrev.uleb();
+                    attributes.clear();
+                    for (uint64_t idx = abbrev.uleb(), form = abbrev.uleb(); idx != 0 || form != 0;
+                         idx = abbrev.uleb(), form = abbrev.uleb())
+                    {
+                        attributes.emplace_back(idx, form);
+                    }
+                    if (abbrevCode == code)
+                    {
+                        break;
+                    }
+                    tag = 0;
+                }
+                if (tag == 0)
+                {
+                    throw std::runtime_error("Malformed DWARF: unknown name index abbreviation");
+                }
+
+                uint64_t cu = 0;
+                std::optional<uint64_t> die;
+                for (auto [idx, form] : attributes)
+                {
+                    uint64_t value = 0;
+                    switch (form)
+                    {
+                    case DW_FORM_flag_present:
+                        break;
+                    case DW_FORM_data1:
+                    case DW_FORM_ref1:
+                    case DW_FORM_flag:
+                        value = table.read(1);
+                        break;
+                    case DW_FORM_data2:
+                    case DW_FORM_ref2:
+                        value = table.read(2);
+                        break;
+                    case DW_FORM_data4:
+                    case DW_FORM_ref4:
+                        value = table.read(4);
+                        break;
+                    case DW_FORM_data8:
+                    case DW_FORM_ref8:
+                    case DW_FORM_ref_sig8:
+                        value = table.read(8);
+                        break;
+                    case DW_FORM_udata:
+                    case DW_FORM_ref_udata:
+                        value = table.uleb();
+                        break;
+                    default:
+                        throw std::runtime_error("Unsupported name index form " + std::to_string(form));
+                    }
+
+                    if (idx == DW_IDX_compile_unit)
+                    {
+                        cu = value;
+                    }
+                    else if (idx == DW_IDX_die_offset)
+                    {
+                        die = value;
+                    }
+                }
+
+                if (tag == DW_TAG_variable && die && cu < cuCount)
+                {
+                    size_t next = table.position();
+                    size_t cuOffset = at(cuList + cu * offsetSize, offsetSize);
+                    found.emplace_back(cuOffset, cuOffset + *die);
+                    table.seek(next);
+                }
+            }
+        }
+        index.seek(end);
+    }
+    return found;
+}
+
+std::vector<std::pair<size_t, size_t>> DwarfReader::lookupPubnames(const Section& section, bool gnu,
+                                                                   std::string_view name) const
+{
+    std::vector<std::pair<size_t, size_t>> found;
+    Cursor cursor(section.data, section.size);
+    while (!cursor.atEnd())
+    {
+        uint8_t offsetSize = 0;
+        uint64_t length = cursor.unitLength(offsetSize);
+        size_t end = cursor.position() + length;
+        Cursor set(section.data, end, cursor.position());
+        set.read(2); // version
+        size_t cuOffset = set.read(offsetSize);
+        set.read(offsetSize); // unit length
+
+        for (uint64_t dieOffset = set.read(offsetSize); dieOffset != 0; dieOffset = set.read(offsetSize))
+        {
+            if (gnu)
+            {
+                set.read(1); // symbol kind, variables are told apart by their tag anyway
+            }
+            if (set.cstr() == name)
+            {
+                found.emplace_back(cuOffset, cuOffset + dieOffset);
+            }
+        }
+        cursor.seek(end);
+    }
+    return found;
+}
+
+std::optional<size_t> DwarfReader::lookupAranges(uint64_t address) const
+{
+    Cursor cursor(m_aranges.data, m_aranges.size);
+    while (!cursor.atEnd())
+    {
+        size_t start = cursor.position();
+        uint8_t offsetSize = 0;
+        uint64_t length = cursor.unitLength(offsetSize);
+        size_t end = cursor.position() + length;
+        Cursor set(m_aranges.data, end, cursor.position());
+        set.read(2); // version
+        size_t cuOffset = set.read(offsetSize);
+        uint8_t addressSize = static_cast<uint8_t>(set.read(1));
+        uint8_t segmentSize = static_cast<uint8_t>(set.read(1));
+        if (addressSize == 0 || addressSize > 8 || segmentSize != 0)
+        {
+            cursor.seek(end);
+            continue;
+        }
+
+        // tuples are aligned to twice the address size from the start of the set
+        size_t tupleSize = 2ul * addressSize;
+        set.seek(start + (set.position() - start + tupleSize - 1) / tupleSize * tupleSize);
+        while (!set.atEnd())
+        {
+            uint64_t begin = set.read(addressSize);
+            uint64_t size = set.read(addressSize);
+            if (begin == 0 && size == 0)
+            {
+                break;
+            }
+            if (address >= begin && address - begin < size)
+            {
+                return cuOffset;
+            }
+        }
+        cursor.seek(end);
+    }
+    return std::nullopt;
+}
+
+bool DwarfReader::isVariable(const Unit& unit, const Die& die, std::string_view name, uint64_t address) const
+{
+    if (die.tag != DW_TAG_variable || die.declaration)
+    {
+        return false;
+    }
+
+    // definitions of class members and of variables declared earlier only name their declaration
+    std::string_view dieName = die.name;
+    if (dieName.empty() && die.specification)
+    {
+        dieName = readDie(unit.offset <= die.specification && die.specification < unit.end ? unit
+                                                                                             : findUnit(die.specification),
+                          die.specification)
+                      .name;
+    }
+
+    // static variables of the same name in other compilation units have other addresses
+    return dieName == name && (address == 0 || !die.address || *die.address == address);
+}
+
+std::optional<DwarfReader::Die> DwarfReader::scanUnit(const Unit& unit, std::string_view name, uint64_t address) const
+{
+    // only the top-level DIEs, nested ones are skipped through DW_AT_sibling
+    Die root = readDie(unit, unit.firstDie);
+    if (!root.children)
+    {
+        return std::nullopt;
+    }
+
+    for (size_t offset = root.end; offset < unit.end;)
+    {
+        Die die = readDie(unit, offset);
+        if (die.tag == 0)
+        {
+            break;
+        }
+        if (isVariable(unit, die, name, address))
+        {
+            return die;
+        }
+        offset = nextSibling(unit, die);
+    }
+    return std::nullopt;
+}
+
+std::optional<std::pair<DwarfReader::Unit, DwarfReader::Die>> DwarfReader::findVariable(std::string_view name,
+                                                                                        uint64_t address) const
+{
+    // DIE offsets from the name indexes, the first candidate that is the definition wins
+    auto check = [&](const std::vector<std::pair<size_t, size_t>>& candidates)
+        -> std::optional<std::pair<Unit, Die>> {
+        for (auto [cuOffset, dieOffset] : candidates)
+        {
+            Unit unit = readUnit(cuOffset);
+            if (dieOffset < unit.firstDie || dieOffset >= unit.end)
+            {
+                continue;
+            }
+            Die die = readDie(unit, dieOffset);
+            if (isVariable(unit, die, name, address))
+            {
+                return std::pair{unit, die};
+            }
+        }
+        return std::nullopt;
+    };
+
+    if (m_names.size > 0)
+    {
+        if (auto found = check(lookupNames(name)))
+        {
+            return found;
+        }
+    }
+    if (m_pubnames.size > 0)
+    {
+        if (auto found = check(lookupPubnames(m_pubnames, false, name)))
+        {
+            return found;
+        }
+    }
+    if (m_gnuPubnames.size > 0)
+    {
+        if (auto found = check(lookupPubnames(m_gnuPubnames, true, name)))
+        {
+            return found;
+        }
+    }
+
+    // the unit covering the symbol's address, if the compiler listed data in .debug_aranges
+    std::optional<size_t> arangesUnit = address != 0 && m_aranges.size > 0 ? lookupAranges(address) : std::nullopt;
+    if (arangesUnit)
+    {
+        Unit unit = readUnit(*arangesUnit);
+        if (auto die = scanUnit(unit, name, address))
+        {
+            return std::pair{unit, *die};
+        }
+    }
+
+    // no index of the compiler knows the variable, the top-level variables of every unit are indexed once
+    if (!m_variables)
+    {
+        m_variables =
+            std::make_unique<SymbolIndex>(m_exePath, m_cacheDir, ".dwidx", [this] { return collectVariables(); });
+    }
+
+    // a static variable is found by its address among others of the same name
+    std::string key(name);
+    for (bool byAddress : {address != 0, false})
+    {
+        std::optional<ElfSymbol> entry = m_variables->find(byAddress ? key + "@" + std::to_string(address) : key);
+        if (!entry || entry->size >= m_info.size)
+        {
+            continue;
+        }
+
+        Unit unit = readUnit(entry->size);
+        if (entry->value < unit.firstDie || entry->value >= unit.end)
+        {
+            continue;
+        }
+        Die die = readDie(unit, entry->value);
+        if (isVariable(unit, die, name, address))
+        {
+            return std::pair{unit, die};
+        }
+    }
+    return std::nullopt;
+}
+
+std::vector<NamedSymbol> DwarfReader::collectVariables() const
+{
+    // one walk over the top level of every unit, an entry holds the DIE offset as value and the unit offset as size
+    std::vector<NamedSymbol> variables;
+    for (size_t offset = 0; offset < m_info.size;)
+    {
+        Unit unit = readUnit(offset);
+        Die root = readDie(unit, unit.firstDie);
+        for (size_t dieOffset = root.children ? root.end : unit.end; dieOffset < unit.end;)
+        {
+            Die die = readDie(unit, dieOffset);
+            if (die.tag == 0)
+            {
+                break;
+            }
+
+            if (die.tag == DW_TAG_variable && !die.declaration)
+            {
+                // definitions of class members and of variables declared earlier only name their declaration
+                std::string_view name = die.name;
+                if (name.empty() && die.specification)
+                {
+                    bool local = unit.offset <= die.specification && die.specification < unit.end;
+                    name = readDie(local ? unit : findUnit(die.specification), die.specification).name;
+                }
+
+                if (!name.empty())
+                {
+                    ElfSymbol location{die.offset, unit.offset};
+                    if (die.address)
+                    {
+                        variables.push_back({std::string(name) + "@" + std::to_string(*die.address), location});
+                    }
+                    variables.push_back({std::string(name), location});
+                }
+            }
+            dieOffset = nextSibling(unit, die);
+        }
+        offset = unit.end;
+    }
+    return variables;
+}
+
+DwarfReader::Type DwarfReader::resolveType(const Unit& unit, uint64_t offset) const
+{
+    Type type;
+    type.unit = unit;
+    for (;;)
+    {
+        if (offset == 0)
+        {
+            return type; // void
+        }
+        if (offset < type.unit.offset || offset >= type.unit.end)
+        {
+            type.unit = findUnit(offset);
+        }
+
+        type.die = readDie(type.unit, offset);
+        if (type.name.empty())
+        {
+            type.name = type.die.name;
+        }
+
+        switch (type.die.tag)
+        {
+        case DW_TAG_typedef:
+        case DW_TAG_const_type:
+        case DW_TAG_volatile_type:
+        case DW_TAG_restrict_type:
+        case DW_TAG_atomic_type:
+            offset = type.die.type;
+            continue;
+
+        case DW_TAG_array_type: {
+            // one subrange per dimension, e.g. int m[2][3] has two, arrays of arrays are flattened the same way
+            for (size_t child = type.die.end; type.die.children;)
+            {
+                Die subrange = readDie(type.unit, child);
+                if (subrange.tag == 0)
+                {
+                    break;
+                }
+                if (subrange.tag == DW_TAG_subrange_type)
+                {
+                    type.dimensions.push_back(subrange.count.value_or(0));
+                }
+                child = nextSibling(type.unit, subrange);
+            }
+
+            Type element = resolveType(type.unit, type.die.type);
+            type.dimensions.insert(type.dimensions.end(), element.dimensions.begin(), element.dimensions.end());
+            type.unit = element.unit;
+            type.die = element.die;
+            type.elementSize = element.elementSize;
+            type.isSigned = element.isSigned;
+            type.isFloat = element.isFloat;
+            if (type.name.empty())
+            {
+                type.name = element.name;
+            }
+            return type;
+        }
+
+        case DW_TAG_base_type:
+            type.elementSize = type.die.byteSize;
+            type.isSigned = type.die.encoding == DW_ATE_signed || type.die.encoding == DW_ATE_signed_char ||
+                            type.die.encoding == DW_ATE_signed_fixed;
+            type.isFloat = type.die.encoding == DW_ATE_float && (type.elementSize == 4 || type.elementSize == 8);
+            return type;
+
+        case DW_TAG_enumeration_type:
+            type.elementSize = type.die.byteSize;
+            if (type.die.type)
+            {
+                type.isSigned = resolveType(type.unit, type.die.type).isSigned;
+            }
+            return type;
+
+        case DW_TAG_pointer_type:
+        case DW_TAG_reference_type:
+        case DW_TAG_rvalue_reference_type:
+        case DW_TAG_ptr_to_member_type:
+            type.elementSize = type.die.byteSize ? type.die.byteSize : type.unit.addressSize;
+            return type;
+
+        default:
+            // structs, classes and unions keep their DIE for member lookups
+            type.elementSize = type.die.byteSize;
+            return type;
+        }
+    }
+}
+
+std::optional<std::pair<DwarfReader::Unit, DwarfReader::Die>> DwarfReader::findMember(const Type& type,
+                                                                                      std::string_view name,
+                                                                                      uint64_t& offset) const
+{
+    for (size_t child = type.die.end; type.die.children;)
+    {
+        Die member = readDie(type.unit, child);
+        if (member.tag == 0)
+        {
+            break;
+        }
+        child = nextSibling(type.unit, member);
+
+        if (member.tag == DW_TAG_member && member.name == name)
+        {
+            offset += member.memberOffset;
+            return std::pair{type.unit, member};
+        }
+
+        // members of anonymous structs and unions and of base classes are accessed as if they were declared here
+        bool anonymous = member.tag == DW_TAG_member && member.name.empty();
+        if (anonymous || member.tag == DW_TAG_inheritance)
+        {
+            Type nested = resolveType(type.unit, member.type);
+            uint64_t nestedOffset = offset + member.memberOffset;
+            if (isRecord(nested.die.tag) && nested.dimensions.empty())
+            {
+                if (auto found = findMember(nested, name, nestedOffset))
+                {
+                    offset = nestedOffset;
+                    return found;
+                }
+            }
+        }
+    }
+    return std::nullopt;
+}
+
+std::optional<DwarfLocation> DwarfReader::resolve(std::string_view expression, uint64_t address) const
+{
+    if (!hasDebugInfo())
+    {
+        return std::nullopt;
+    }
+
+    size_t nameEnd = std::min(expression.find_first_of(".["), expression.size());
+    auto variable = findVariable(expression.substr(0, nameEnd), address);
+    if (!variable)
+    {
+        return std::nullopt;
+    }
+
+    auto [unit, die] = *variable;
+    uint64_t typeOffset = die.type;
+    if (typeOffset == 0 && die.specification)
+    {
+        Unit specUnit = die.specification >= unit.offset && die.specification < unit.end ? unit
+                                                                                         : findUnit(die.specification);
+        typeOffset = readDie(specUnit, die.specification).type;
+        unit = specUnit;
+    }
+
+    DwarfLocation location;
+    Type type = resolveType(unit, typeOffset);
+    for (size_t pos = nameEnd; pos < expression.size();)
+    {
+        std::string_view prefix = expression.substr(0, pos);
+        if (expression[pos] == '[')
+        {
+            size_t indexEnd = std::min(expression.find(']', pos), expression.size());
+            uint64_t index = 0;
+            auto [end, error] = std::from_chars(expression.data() + pos + 1, expression.data() + indexEnd, index);
+            if (indexEnd == expression.size() || error != std::errc{} || end != expression.data() + indexEnd)
+            {
+                throw std::runtime_error("Invalid index in " + std::string(expression));
+            }
+            if (type.dimensions.empty())
+            {
+                throw std::runtime_error(std::string(prefix) + " is not an array");
+            }
+            if (type.dimensions.front() != 0 && index >= type.dimensions.front())
+            {
+                throw std::runtime_error("Index " + std::to_string(index) + " out of range of " + std::string(prefix) +
+                                         "[" + std::to_string(type.dimensions.front()) + "]");
+            }
+
+            uint64_t stride = type.elementSize;
+            for (size_t i = 1; i < type.dimensions.size(); ++i)
+            {
+                stride *= type.dimensions[i];
+            }
+            location.offset += index * stride;
+            type.dimensions.erase(type.dimensions.begin());
+            pos = indexEnd + 1;
+            continue;
+        }
+
+        size_t memberEnd = std::min(expression.find_first_of(".[", pos + 1), expression.size());
+        std::string_view memberName = expression.substr(pos + 1, memberEnd - pos - 1);
+        if (expression[pos] != '.' || memberName.empty())
+        {
+            throw std::runtime_error("Invalid variable expression " + std::string(expression));
+        }
+        if (!type.dimensions.empty() || !isRecord(type.die.tag))
+        {
+            throw std::runtime_error(std::string(prefix) + " is not a struct, class or union");
+        }
+
+        auto member = findMember(type, memberName, location.offset);
+        if (!member)
+        {
+            throw std::runtime_error(std::string(prefix) + " has no member " + std::string(memberName));
+        }
+        if (member->second.bitField)
+        {
+            throw std::runtime_error("Bit-field " + std::string(expression.substr(0, memberEnd)) +
+                                     " can not be watched");
+        }
+        type = resolveType(member->first, member->second.type);
+        pos = memberEnd;
+    }
+
+    location.size = type.elementSize;
+    for (uint64_t dimension : type.dimensions)
+    {
+        location.size *= dimension;
+        type.name += "[" + std::to_string(dimension) + "]";
+    }
+    location.isSigned = type.dimensions.empty() && type.isSigned;
+    location.isFloat = type.dimensions.empty() && type.isFloat;
+    location.typeName = std::move(type.name);
+    return location;
+}
+
+} // namespace dbg
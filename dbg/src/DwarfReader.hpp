@@ -0,0 +1,161 @@
+#pragma once
+
+#include "SymbolIndex.hpp"
+
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+namespace dbg
+{
+
+/// Watched part of a global variable as described by DWARF, e.g. cfg.max_conns or table[3]
+struct DwarfLocation
+{
+    uint64_t offset = 0; // offset from the address of the variable's symbol
+    uint64_t size = 0;
+    bool isSigned = false;
+    bool isFloat = false; // float or double
+    std::string typeName; // e.g. "unsigned int" or "Config", empty for unnamed types
+};
+
+/// Reads the types of global variables from the DWARF debug information (versions 2 - 5) of an elf file.
+/// The DIE of a variable is found through .debug_names, .debug_pubnames or .debug_gnu_pubnames, or through
+/// .debug_aranges by the address of its symbol, and only the DIEs on the way from it to the watched member are parsed.
+/// Without any index the top-level variables of every compilation unit are collected once into a name index,
+/// which is cached by the build-id of the binary like the SymbolIndex, so later runs do not walk .debug_info again.
+class DwarfReader
+{
+    struct Section
+    {
+        const uint8_t* data = nullptr;
+        size_t size = 0;
+    };
+
+    struct Unit
+    {
+        size_t offset = 0; // of the unit header in .debug_info
+        size_t end = 0;
+        size_t firstDie = 0;
+        uint16_t version = 0;
+        uint8_t addressSize = 8;
+        uint8_t offsetSize = 4; // 8 for 64-bit DWARF
+        size_t abbrevOffset = 0;
+        uint64_t strOffsetsBase = 0;
+        uint64_t addrBase = 0;
+    };
+
+    struct AttributeSpec
+    {
+        uint64_t name;
+        uint64_t form;
+        int64_t implicitConst;
+    };
+
+    struct Abbrev
+    {
+        uint64_t tag = 0;
+        bool children = false;
+        std::vector<AttributeSpec> attributes;
+    };
+
+    /// Attributes of a DIE used to resolve variables and types, references are .debug_info offsets
+    struct Die
+    {
+        size_t offset = 0;
+        size_t end = 0; // first byte after the attributes, the first child if children is set
+        uint64_t tag = 0;
+        bool children = false;
+        std::string_view name;
+        uint64_t type = 0;
+        uint64_t sibling = 0;
+        uint64_t specification = 0;
+        uint64_t byteSize = 0;
+        uint64_t encoding = 0;
+        uint64_t memberOffset = 0;
+        std::optional<uint64_t> count; // elements of an array dimension
+        std::optional<uint64_t> address; // DW_OP_addr location of a variable
+        uint64_t strOffsetsBase = 0;
+        uint64_t addrBase = 0;
+        bool declaration = false;
+        bool bitField = false;
+    };
+
+    /// Type after typedefs and qualifiers were stripped, arrays keep their dimensions
+    struct Type
+    {
+        Unit unit;
+        Die die;
+        std::string name;
+        std::vector<uint64_t> dimensions; // outermost first, the die is the element type
+        uint64_t elementSize = 0;
+        bool isSigned = false;
+        bool isFloat = false;
+    };
+
+    void* m_map = nullptr;
+    size_t m_mapSize = 0;
+    std::string m_exePath;
+    std::string m_cacheDir;
+    mutable std::unique_ptr<SymbolIndex> m_variables; // name -> DIE of the top-level variables, built on demand
+
+    Section m_info;
+    Section m_abbrev;
+    Section m_str;
+    Section m_lineStr;
+    Section m_strOffsets;
+    Section m_addr;
+    Section m_names;
+    Section m_pubnames;
+    Section m_gnuPubnames;
+    Section m_aranges;
+
+    mutable std::unordered_map<size_t, std::unordered_map<uint64_t, Abbrev>> m_abbrevTables; // by table offset
+
+    [[nodiscard]] Unit readUnit(size_t offset) const;
+    [[nodiscard]] Unit findUnit(size_t dieOffset) const;
+    [[nodiscard]] const std::unordered_map<uint64_t, Abbrev>& abbrevTable(size_t offset) const;
+    [[nodiscard]] Die readDie(const Unit& unit, size_t offset) const;
+    [[nodiscard]] size_t nextSibling(const Unit& unit, const Die& die) const;
+    [[nodiscard]] std::string_view readString(uint64_t offset, const Section& section) const;
+
+    [[nodiscard]] std::vector<std::pair<size_t, size_t>> lookupNames(std::string_view name) const;
+    [[nodiscard]] std::vector<std::pair<size_t, size_t>> lookupPubnames(const Section& section, bool gnu,
+                                                                        std::string_view name) const;
+    [[nodiscard]] std::optional<size_t> lookupAranges(uint64_t address) const;
+    [[nodiscard]] bool isVariable(const Unit& unit, const Die& die, std::string_view name, uint64_t address) const;
+    [[nodiscard]] std::optional<Die> scanUnit(const Unit& unit, std::string_view name, uint64_t address) const;
+    [[nodiscard]] std::vector<NamedSymbol> collectVariables() const;
+    [[nodiscard]] std::optional<std::pair<Unit, Die>> findVariable(std::string_view name, uint64_t address) const;
+
+    [[nodiscard]] Type resolveType(const Unit& unit, uint64_t offset) const;
+    [[nodiscard]] std::optional<std::pair<Unit, Die>> findMember(const Type& type, std::string_view name,
+                                                                 uint64_t& offset) const;
+
+  public:
+    /// Map the elf file and locate its debug sections
+    /// @param exePath path to an elf binary
+    /// @param cacheDir directory of cached indexes, empty to always build the variable index of a binary without one
+    explicit DwarfReader(const std::string& exePath, const std::string& cacheDir = "");
+    ~DwarfReader();
+
+    DwarfReader(const DwarfReader&) = delete;
+    DwarfReader(DwarfReader&&) = delete;
+    DwarfReader& operator=(const DwarfReader&) = delete;
+    DwarfReader& operator=(DwarfReader&&) = delete;
+
+    /// True if the binary has uncompressed .debug_info
+    [[nodiscard]] bool hasDebugInfo() const;
+
+    /// Resolve a global variable or a part of it
+    /// @param expression variable name followed by member accesses and array indexes, e.g. cfg.limits[1].max
+    /// @param address link time address of the variable's symbol, tells apart static variables of the same name
+    /// @return offset, size and type of the watched part, nothing if the variable has no debug information
+    [[nodiscard]] std::optional<DwarfLocation> resolve(std::string_view expression, uint64_t address) const;
+};
+
+} // namespace dbg
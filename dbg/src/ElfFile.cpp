@@ -0,0 +1,163 @@
+#include "ElfFile.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <limits>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace dbg
+{
+
+/// Alignment of the segments mapped by the kernel and the dynamic linker
+static constexpr uint64_t PAGE_SIZE = 4096;
+
+ElfFile::ElfFile(const std::string& path)
+{
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+    {
+        throw std::runtime_error("Could not open " + path);
+    }
+
+    struct stat st{};
+    if (fstat(fd, &st) < 0)
+    {
+        close(fd);
+        throw std::runtime_error("Fstat failed: " + path);
+    }
+
+    m_size = static_cast<size_t>(st.st_size);
+    m_map = mmap(nullptr, m_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (m_map == MAP_FAILED)
+    {
+        m_map = nullptr;
+        throw std::runtime_error("Mmap failed: " + path);
+    }
+
+    m_header = reinterpret_cast<const Elf64_Ehdr*>(m_map);
+    if (m_size < sizeof(Elf64_Ehdr) || memcmp(m_header->e_ident, ELFMAG, SELFMAG) != 0 ||
+        m_header->e_shoff + m_header->e_shnum * sizeof(Elf64_Shdr) > m_size ||
+        m_header->e_phoff + m_header->e_phnum * sizeof(Elf64_Phdr) > m_size)
+    {
+        munmap(m_map, m_size);
+        throw std::runtime_error(path + " is not an ELF file");
+    }
+}
+
+ElfFile::~ElfFile()
+{
+    munmap(m_map, m_size);
+}
+
+std::string_view ElfFile::SymbolTable::name(const Elf64_Sym& symbol) const
+{
+    if (symbol.st_name >= namesSize)
+    {
+        return {};
+    }
+    return {names + symbol.st_name, strnlen(names + symbol.st_name, namesSize - symbol.st_name)};
+}
+
+std::vector<ElfFile::SymbolTable> ElfFile::getSymbolTables() const
+{
+    const char* base = reinterpret_cast<const char*>(m_map);
+    const Elf64_Shdr* sections = reinterpret_cast<const Elf64_Shdr*>(base + m_header->e_shoff);
+
+    std::vector<SymbolTable> tables;
+    for (uint32_t type : {SHT_SYMTAB, SHT_DYNSYM})
+    {
+        for (int i = 0; i < m_header->e_shnum; ++i)
+        {
+            const Elf64_Shdr& table = sections[i];
+            if (table.sh_type != type || table.sh_link >= m_header->e_shnum)
+            {
+                continue;
+            }
+
+            const Elf64_Shdr& strings = sections[table.sh_link];
+            if (table.sh_offset + table.sh_size > m_size || strings.sh_offset + strings.sh_size > m_size)
+            {
+                continue;
+            }
+
+            auto symbols = reinterpret_cast<const Elf64_Sym*>(base + table.sh_offset);
+            tables.push_back(
+                {{symbols, table.sh_size / sizeof(Elf64_Sym)}, base + strings.sh_offset, strings.sh_size});
+        }
+    }
+    return tables;
+}
+
+std::optional<ElfFile::Section> ElfFile::getSection(std::string_view name) const
+{
+    const char* base = reinterpret_cast<const char*>(m_map);
+    const Elf64_Shdr* sections = reinterpret_cast<const Elf64_Shdr*>(base + m_header->e_shoff);
+    if (m_header->e_shstrndx >= m_header->e_shnum)
+    {
+        return std::nullopt;
+    }
+
+    const Elf64_Shdr& names = sections[m_header->e_shstrndx];
+    for (int i = 0; i < m_header->e_shnum; ++i)
+    {
+        const Elf64_Shdr& section = sections[i];
+        if (section.sh_name >= names.sh_size || section.sh_type == SHT_NOBITS ||
+            section.sh_offset + section.sh_size > m_size)
+        {
+            continue;
+        }
+
+        const char* sectionName = base + names.sh_offset + section.sh_name;
+        if (std::string_view(sectionName, strnlen(sectionName, names.sh_size - section.sh_name)) == name)
+        {
+            auto data = reinterpret_cast<const uint8_t*>(base + section.sh_offset);
+            return Section{{data, section.sh_size}, section.sh_addr};
+        }
+    }
+    return std::nullopt;
+}
+
+uint64_t ElfFile::getLinkBase() const
+{
+    const char* base = reinterpret_cast<const char*>(m_map);
+    const Elf64_Phdr* segments = reinterpret_cast<const Elf64_Phdr*>(base + m_header->e_phoff);
+
+    uint64_t linkBase = std::numeric_limits<uint64_t>::max();
+    for (int i = 0; i < m_header->e_phnum; ++i)
+    {
+        if (segments[i].p_type == PT_LOAD)
+        {
+            linkBase = std::min(linkBase, segments[i].p_vaddr & ~(PAGE_SIZE - 1));
+        }
+    }
+    return linkBase == std::numeric_limits<uint64_t>::max() ? 0 : linkBase;
+}
+
+uint64_t ElfFile::getLinkEnd() const
+{
+    const char* base = reinterpret_cast<const char*>(m_map);
+    const Elf64_Phdr* segments = reinterpret_cast<const Elf64_Phdr*>(base + m_header->e_phoff);
+
+    uint64_t linkEnd = 0;
+    for (int i = 0; i < m_header->e_phnum; ++i)
+    {
+        if (segments[i].p_type == PT_LOAD)
+        {
+            linkEnd = std::max(linkEnd, segments[i].p_vaddr + segments[i].p_memsz);
+        }
+    }
+    return linkEnd;
+}
+
+bool ElfFile::isPositionIndependent() const
+{
+    return m_header->e_type == ET_DYN;
+}
+
+} // namespace dbg
@@ -0,0 +1,70 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <elf.h>
+
+namespace dbg
+{
+
+/// Read-only mapping of a 64-bit elf file, shared by the symbol index and the symbolizer
+class ElfFile
+{
+    void* m_map = nullptr;
+    size_t m_size = 0;
+    const Elf64_Ehdr* m_header = nullptr;
+
+  public:
+    /// Symbol table section with its string table
+    struct SymbolTable
+    {
+        std::span<const Elf64_Sym> symbols;
+        const char* names = nullptr;
+        size_t namesSize = 0;
+
+        /// Name of a symbol of this table, empty if its offset lies outside the string table
+        [[nodiscard]] std::string_view name(const Elf64_Sym& symbol) const;
+    };
+
+    /// Contents of a section and its link time address
+    struct Section
+    {
+        std::span<const uint8_t> data;
+        uint64_t address = 0;
+    };
+
+    /// Map an elf file
+    /// @param path path to an elf binary or shared object
+    /// @throws std::runtime_error if the file can not be mapped or is not an elf file
+    explicit ElfFile(const std::string& path);
+    ~ElfFile();
+
+    ElfFile(const ElfFile&) = delete;
+    ElfFile(ElfFile&&) = delete;
+    ElfFile& operator=(const ElfFile&) = delete;
+    ElfFile& operator=(ElfFile&&) = delete;
+
+    /// .symtab and .dynsym tables, .symtab first so its definitions win over the exported copies
+    [[nodiscard]] std::vector<SymbolTable> getSymbolTables() const;
+
+    /// Look up a section by name, e.g. .eh_frame
+    /// @return contents and address, nothing if the file has no such section or it has no contents (SHT_NOBITS)
+    [[nodiscard]] std::optional<Section> getSection(std::string_view name) const;
+
+    /// Page aligned link time address of the first PT_LOAD segment, the one mapped at the lowest address
+    [[nodiscard]] uint64_t getLinkBase() const;
+
+    /// Link time address of the end of the last PT_LOAD segment in memory
+    [[nodiscard]] uint64_t getLinkEnd() const;
+
+    /// True for PIE executables and shared objects (ET_DYN), which are relocated by their load address
+    [[nodiscard]] bool isPositionIndependent() const;
+};
+
+} // namespace dbg
@@ -0,0 +1,161 @@
+#include "EventLoop.hpp"
+
+#include <array>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/syscall.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+namespace dbg
+{
+
+/// Notifications read per signalfd read, SIGCHLD is a standard signal and pending at most once
+static constexpr size_t SIGNAL_READ_COUNT = 4;
+
+static void addToEpoll(int epollFd, int fd)
+{
+    epoll_event event{};
+    event.events = EPOLLIN;
+    event.data.fd = fd;
+    if (epoll_ctl(epollFd, EPOLL_CTL_ADD, fd, &event) < 0)
+    {
+        throw std::runtime_error("epoll_ctl failed: " + std::string(strerror(errno)));
+    }
+}
+
+EventLoop::EventLoop(pid_t pid, std::chrono::nanoseconds interval)
+{
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGCHLD);
+    pthread_sigmask(SIG_BLOCK, &mask, &m_previousMask);
+
+    try
+    {
+        m_epollFd = epoll_create1(EPOLL_CLOEXEC);
+        if (m_epollFd < 0)
+        {
+            throw std::runtime_error("epoll_create1 failed: " + std::string(strerror(errno)));
+        }
+
+        m_signalFd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+        if (m_signalFd < 0)
+        {
+            throw std::runtime_error("signalfd failed: " + std::string(strerror(errno)));
+        }
+        addToEpoll(m_epollFd, m_signalFd);
+
+        // Linux 5.3, without it the exit is still reported through SIGCHLD
+        m_pidFd = static_cast<int>(syscall(SYS_pidfd_open, pid, 0));
+        if (m_pidFd >= 0)
+        {
+            addToEpoll(m_epollFd, m_pidFd);
+        }
+
+        m_timerFd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+        if (m_timerFd < 0)
+        {
+            throw std::runtime_error("timerfd_create failed: " + std::string(strerror(errno)));
+        }
+        itimerspec spec{};
+        spec.it_interval.tv_sec = static_cast<time_t>(interval.count() / 1'000'000'000);
+        spec.it_interval.tv_nsec = static_cast<long>(interval.count() % 1'000'000'000);
+        spec.it_value = spec.it_interval;
+        if (timerfd_settime(m_timerFd, 0, &spec, nullptr) < 0)
+        {
+            throw std::runtime_error("timerfd_settime failed: " + std::string(strerror(errno)));
+        }
+        addToEpoll(m_epollFd, m_timerFd);
+    }
+    catch (...)
+    {
+        release();
+        throw;
+    }
+}
+
+EventLoop::~EventLoop()
+{
+    release();
+}
+
+void EventLoop::release()
+{
+    for (int fd : {m_timerFd, m_pidFd, m_signalFd, m_epollFd})
+    {
+        if (fd >= 0)
+        {
+            close(fd);
+        }
+    }
+    m_timerFd = m_pidFd = m_signalFd = m_epollFd = -1;
+    pthread_sigmask(SIG_SETMASK, &m_previousMask, nullptr);
+}
+
+int EventLoop::getFd() const
+{
+    return m_epollFd;
+}
+
+size_t EventLoop::removeProcess()
+{
+    if (m_pidFd < 0)
+    {
+        return 0;
+    }
+
+    if (epoll_ctl(m_epollFd, EPOLL_CTL_DEL, m_pidFd, nullptr) < 0)
+    {
+        throw std::runtime_error("epoll_ctl failed: " + std::string(strerror(errno)));
+    }
+    close(m_pidFd);
+    m_pidFd = -1;
+    return 2;
+}
+
+size_t EventLoop::wait(int timeoutMs)
+{
+    std::array<epoll_event, 3> events{};
+    int count = epoll_wait(m_epollFd, events.data(), static_cast<int>(events.size()), timeoutMs);
+    if (count < 0)
+    {
+        if (errno == EINTR)
+        {
+            return 1;
+        }
+        throw std::runtime_error("epoll_wait failed: " + std::string(strerror(errno)));
+    }
+
+    size_t syscalls = 1;
+    for (int i = 0; i < count; ++i)
+    {
+        // the pidfd stays readable once the process exited, nothing to consume, the exit is reaped by waitpid
+        if (events[i].data.fd == m_signalFd)
+        {
+            std::array<signalfd_siginfo, SIGNAL_READ_COUNT> infos{};
+            if (read(m_signalFd, infos.data(), sizeof(infos)) < 0 && errno != EAGAIN)
+            {
+                throw std::runtime_error("read of signalfd failed: " + std::string(strerror(errno)));
+            }
+            ++syscalls;
+        }
+        else if (events[i].data.fd == m_timerFd)
+        {
+            uint64_t expirations = 0;
+            if (read(m_timerFd, &expirations, sizeof(expirations)) < 0 && errno != EAGAIN)
+            {
+                throw std::runtime_error("read of timerfd failed: " + std::string(strerror(errno)));
+            }
+            ++syscalls;
+        }
+    }
+    return syscalls;
+}
+
+} // namespace dbg
@@ -0,0 +1,51 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <signal.h>
+#include <sys/types.h>
+
+namespace dbg
+{
+
+/// epoll set the ptrace stop loop waits on: a signalfd for SIGCHLD, which the kernel sends to the tracer on every
+/// stop, a pidfd that becomes readable when the traced process exits and a periodic timerfd for housekeeping.
+/// SIGCHLD is blocked on the creating thread while the loop exists, a SIGCHLD another thread of the tracer
+/// accepts is not seen, the stop is then found at the next timer expiration
+class EventLoop
+{
+    int m_epollFd = -1;
+    int m_signalFd = -1;
+    int m_pidFd = -1; // -1 if the kernel has no pidfd_open
+    int m_timerFd = -1;
+    sigset_t m_previousMask{};
+
+    void release();
+
+  public:
+    /// @param pid traced process
+    /// @param interval period of the housekeeping timer
+    EventLoop(pid_t pid, std::chrono::nanoseconds interval);
+    ~EventLoop();
+
+    EventLoop(const EventLoop&) = delete;
+    EventLoop(EventLoop&&) = delete;
+    EventLoop& operator=(const EventLoop&) = delete;
+    EventLoop& operator=(EventLoop&&) = delete;
+
+    /// epoll file descriptor, readable while a stop or an expiration is pending
+    [[nodiscard]] int getFd() const;
+
+    /// Stop watching the pidfd of the exited traced process, which would stay readable while its forked children
+    /// are still traced
+    /// @return number of syscalls made
+    size_t removeProcess();
+
+    /// Wait until a thread of the tracee may have changed state or the timer expired, and consume the
+    /// notifications, returns early with a signal handler of the tracer interrupting the wait
+    /// @param timeoutMs maximum time to wait (milliseconds), 0 to only consume, -1 without limit
+    /// @return number of syscalls made
+    size_t wait(int timeoutMs);
+};
+
+} // namespace dbg
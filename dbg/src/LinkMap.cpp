@@ -0,0 +1,235 @@
+#include "LinkMap.hpp"
+
+#include "SymbolIndex.hpp"
+#include "Util.hpp"
+
+#include <cstddef>
+#include <cstring>
+#include <stdexcept>
+
+#include <elf.h>
+#include <link.h>
+#include <signal.h>
+#include <sys/ptrace.h>
+#include <sys/user.h>
+#include <sys/wait.h>
+
+namespace dbg
+{
+
+/// Longest library path read from the tracee
+static constexpr size_t MAX_PATH_LENGTH = 4096;
+
+/// Length of a chunk of a string read at once, strings are read in chunks as the next page may be unmapped
+static constexpr size_t STRING_CHUNK = 256;
+
+/// Opcode of int3
+static constexpr long BREAKPOINT_OPCODE = 0xCC;
+
+LinkMap::LinkMap(pid_t pid) : m_pid{pid}
+{
+    // the kernel maps the dynamic linker (PT_INTERP) and passes its load address as AT_BASE
+    uintptr_t base = util::getAuxiliaryValue(pid, AT_BASE);
+    if (base == 0)
+    {
+        throw std::runtime_error("Library watches need a dynamically linked program");
+    }
+
+    std::string interpreter;
+    for (const util::MappedFile& file : util::getMappedFiles(pid))
+    {
+        if (file.start == base)
+        {
+            interpreter = file.path;
+            break;
+        }
+    }
+    if (interpreter.empty())
+    {
+        throw std::runtime_error("Could not find the dynamic linker of " + std::to_string(pid));
+    }
+
+    // both are exported by ld.so for debuggers
+    SymbolIndex symbols(interpreter, SymbolIndex::getDefaultCacheDirectory());
+    auto debug = symbols.find("_r_debug");
+    auto debugState = symbols.find("_dl_debug_state");
+    if (!debug || !debugState)
+    {
+        throw std::runtime_error(interpreter + " does not export _r_debug and _dl_debug_state");
+    }
+    m_debugAddr = base + debug->value;
+    m_breakpoint = base + debugState->value;
+}
+
+void LinkMap::insertBreakpoint(pid_t threadId)
+{
+    if (m_inserted)
+    {
+        return;
+    }
+
+    m_syscalls += 2;
+    errno = 0;
+    m_originalWord = ptrace(PTRACE_PEEKTEXT, threadId, m_breakpoint, nullptr);
+    if (m_originalWord == -1 && errno != 0)
+    {
+        throw std::runtime_error("PTRACE_PEEKTEXT failed: " + std::string(strerror(errno)));
+    }
+
+    long word = (m_originalWord & ~0xFFL) | BREAKPOINT_OPCODE;
+    if (ptrace(PTRACE_POKETEXT, threadId, m_breakpoint, word) < 0)
+    {
+        throw std::runtime_error("PTRACE_POKETEXT failed: " + std::string(strerror(errno)));
+    }
+    m_inserted = true;
+}
+
+void LinkMap::removeBreakpoint(pid_t threadId)
+{
+    if (!m_inserted)
+    {
+        return;
+    }
+
+    ++m_syscalls;
+    if (ptrace(PTRACE_POKETEXT, threadId, m_breakpoint, m_originalWord) < 0)
+    {
+        throw std::runtime_error("PTRACE_POKETEXT failed: " + std::string(strerror(errno)));
+    }
+    m_inserted = false;
+}
+
+bool LinkMap::isBreakpointHit(pid_t threadId)
+{
+    if (!m_inserted)
+    {
+        return false;
+    }
+
+    // int3 traps after the opcode
+    ++m_syscalls;
+    errno = 0;
+    long rip = ptrace(PTRACE_PEEKUSER, threadId, offsetof(struct user, regs.rip), nullptr);
+    if (rip == -1 && errno != 0)
+    {
+        throw std::runtime_error("PTRACE_PEEKUSER rip failed: " + std::string(strerror(errno)));
+    }
+    return static_cast<uintptr_t>(rip) == m_breakpoint + 1;
+}
+
+int LinkMap::stepOverBreakpoint(pid_t threadId)
+{
+    removeBreakpoint(threadId);
+
+    ++m_syscalls;
+    if (ptrace(PTRACE_POKEUSER, threadId, offsetof(struct user, regs.rip), m_breakpoint) < 0)
+    {
+        throw std::runtime_error("PTRACE_POKEUSER rip failed: " + std::string(strerror(errno)));
+    }
+
+    // a signal may stop the thread before the instruction executes, it is delivered after the step
+    int pendingSignal = 0;
+    while (true)
+    {
+        m_syscalls += 2;
+        if (ptrace(PTRACE_SINGLESTEP, threadId, nullptr, nullptr) < 0)
+        {
+            throw std::runtime_error("PTRACE_SINGLESTEP failed: " + std::string(strerror(errno)));
+        }
+
+        int status = 0;
+        if (waitpid(threadId, &status, __WALL) < 0)
+        {
+            throw std::runtime_error("waitpid failed: " + std::string(strerror(errno)));
+        }
+
+        if (!WIFSTOPPED(status))
+        {
+            m_inserted = false;
+            return -1;
+        }
+
+        if (WSTOPSIG(status) == SIGTRAP)
+        {
+            break;
+        }
+
+        // a SIGSTOP left pending when the tracer stopped the other threads is not delivered
+        if (WSTOPSIG(status) != SIGSTOP)
+        {
+            pendingSignal = WSTOPSIG(status);
+        }
+    }
+
+    insertBreakpoint(threadId);
+    return pendingSignal;
+}
+
+bool LinkMap::isConsistent()
+{
+    ++m_syscalls;
+    r_debug debug{};
+    return util::readProcessMemory(m_pid, m_debugAddr, &debug, sizeof(debug)) && debug.r_state == r_debug::RT_CONSISTENT;
+}
+
+std::vector<LoadedLibrary> LinkMap::getLibraries()
+{
+    ++m_syscalls;
+    r_debug debug{};
+    if (!util::readProcessMemory(m_pid, m_debugAddr, &debug, sizeof(debug)))
+    {
+        throw std::runtime_error("Reading r_debug failed: " + std::string(strerror(errno)));
+    }
+
+    std::vector<LoadedLibrary> libraries;
+    auto addr = reinterpret_cast<uintptr_t>(debug.r_map);
+    while (addr != 0)
+    {
+        // only the public head of link_map is read, the dynamic linker's private fields follow it
+        ++m_syscalls;
+        link_map entry{};
+        if (!util::readProcessMemory(m_pid, addr, &entry, sizeof(entry)))
+        {
+            throw std::runtime_error("Reading link_map failed: " + std::string(strerror(errno)));
+        }
+
+        std::string path = readString(reinterpret_cast<uintptr_t>(entry.l_name));
+        if (!path.empty())
+        {
+            libraries.push_back({entry.l_addr, std::move(path)});
+        }
+        addr = reinterpret_cast<uintptr_t>(entry.l_next);
+    }
+    return libraries;
+}
+
+std::string LinkMap::readString(uintptr_t addr) const
+{
+    std::string value;
+    while (addr != 0 && value.size() < MAX_PATH_LENGTH)
+    {
+        // a chunk never crosses a page, so it is not cut off by an unmapped page after the string
+        size_t size = STRING_CHUNK - addr % STRING_CHUNK;
+        char chunk[STRING_CHUNK];
+        if (!util::readProcessMemory(m_pid, addr, chunk, size))
+        {
+            break;
+        }
+
+        size_t length = strnlen(chunk, size);
+        value.append(chunk, length);
+        if (length < size)
+        {
+            break;
+        }
+        addr += size;
+    }
+    return value;
+}
+
+uint64_t LinkMap::getSyscalls() const
+{
+    return m_syscalls;
+}
+
+} // namespace dbg
@@ -0,0 +1,71 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <sys/types.h>
+#include <vector>
+
+namespace dbg
+{
+
+/// Shared object on the dynamic linker's list of loaded objects
+struct LoadedLibrary
+{
+    uintptr_t base = 0; // l_addr, difference between the load and the link time addresses
+    std::string path;   // l_name as the dynamic linker opened it
+};
+
+/// Follows the shared libraries of a traced process through the r_debug rendezvous structure of the dynamic linker.
+/// The dynamic linker calls the empty function _dl_debug_state before and after every change of its list of
+/// loaded objects, an int3 breakpoint on it stops the calling thread with SIGTRAP, including for the libraries
+/// loaded at startup and by dlopen, once the list is consistent again the new libraries are mapped and relocated.
+class LinkMap
+{
+    pid_t m_pid;
+    uintptr_t m_debugAddr = 0;  // _r_debug
+    uintptr_t m_breakpoint = 0; // _dl_debug_state
+    long m_originalWord = 0;    // code word the int3 was written into
+    bool m_inserted = false;
+    uint64_t m_syscalls = 0;
+
+    [[nodiscard]] std::string readString(uintptr_t addr) const;
+
+  public:
+    /// Locate r_debug and _dl_debug_state in the dynamic linker of a stopped process
+    /// @param pid id of the traced process, throws if it is statically linked
+    explicit LinkMap(pid_t pid);
+
+    LinkMap(const LinkMap&) = delete;
+    LinkMap(LinkMap&&) = delete;
+    LinkMap& operator=(const LinkMap&) = delete;
+    LinkMap& operator=(LinkMap&&) = delete;
+
+    /// Write the int3 breakpoint into _dl_debug_state
+    /// @param threadId any stopped thread of the process
+    void insertBreakpoint(pid_t threadId);
+
+    /// Restore the original code of _dl_debug_state
+    /// @param threadId any stopped thread of the process
+    void removeBreakpoint(pid_t threadId);
+
+    /// Check if a thread stopped with SIGTRAP on the breakpoint, costs one syscall
+    /// @param threadId thread stopped with SIGTRAP
+    [[nodiscard]] bool isBreakpointHit(pid_t threadId);
+
+    /// Execute the original instruction under the breakpoint and write the breakpoint again
+    /// @param threadId thread stopped on the breakpoint
+    /// @return signal the thread received meanwhile and that has to be delivered, -1 if the thread is gone
+    int stepOverBreakpoint(pid_t threadId);
+
+    /// Check if the dynamic linker finished the last change of the loaded objects (RT_CONSISTENT)
+    [[nodiscard]] bool isConsistent();
+
+    /// Walk the link_map list of r_debug, the main executable (empty name) is left out
+    /// @return loaded shared libraries, empty while the dynamic linker did not initialize r_debug yet
+    [[nodiscard]] std::vector<LoadedLibrary> getLibraries();
+
+    /// Syscalls made to read the rendezvous structure and to handle the breakpoint
+    [[nodiscard]] uint64_t getSyscalls() const;
+};
+
+} // namespace dbg
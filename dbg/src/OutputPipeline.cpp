@@ -0,0 +1,342 @@
+#include "OutputPipeline.hpp"
+
+#include <algorithm>
+#include <bit>
+#include <cerrno>
+#include <charconv>
+#include <chrono>
+#include <cstring>
+#include <unistd.h>
+
+namespace dbg
+{
+
+namespace
+{
+
+/// Output is formatted into BUFFER_CHUNKS chunks and written with one writev once they are full
+constexpr size_t BUFFER_CHUNK_SIZE = 64 * 1024;
+constexpr size_t BUFFER_CHUNKS = 4;
+
+/// Longest line without the variable name: offset, two values, count, stack, pid and separators
+constexpr size_t MAX_LINE_LENGTH = 160;
+
+/// Most distinct (watch, kind, offset, pid) summaries kept while the ring is full
+constexpr size_t MAX_PENDING = 64;
+
+/// The writer polls the ring, backing off while it stays empty, so pushing an event never needs a syscall
+constexpr std::chrono::microseconds MIN_IDLE_INTERVAL{50};
+constexpr std::chrono::microseconds MAX_IDLE_INTERVAL{10000};
+
+/// Time a blocked producer waits before checking the ring again
+constexpr std::chrono::microseconds BLOCK_INTERVAL{20};
+
+char* append(char* out, std::string_view text)
+{
+    memcpy(out, text.data(), text.size());
+    return out + text.size();
+}
+
+/// Same representation as Variable::toString
+char* formatValue(char* out, char* end, uint64_t bytes, uint64_t high, size_t size, bool isSigned, bool isFloat)
+{
+    std::to_chars_result result{};
+    if (isFloat && size == sizeof(float))
+    {
+        return std::to_chars(out, end, std::bit_cast<float>(static_cast<uint32_t>(bytes))).ptr;
+    }
+    if (isFloat && size == sizeof(double))
+    {
+        return std::to_chars(out, end, std::bit_cast<double>(bytes)).ptr;
+    }
+
+    switch (size)
+    {
+    case 1:
+        result = isSigned ? std::to_chars(out, end, static_cast<int8_t>(bytes))
+                          : std::to_chars(out, end, static_cast<uint8_t>(bytes));
+        break;
+    case 2:
+        result = isSigned ? std::to_chars(out, end, static_cast<int16_t>(bytes))
+                          : std::to_chars(out, end, static_cast<uint16_t>(bytes));
+        break;
+    case 4:
+        result = isSigned ? std::to_chars(out, end, static_cast<int32_t>(bytes))
+                          : std::to_chars(out, end, static_cast<uint32_t>(bytes));
+        break;
+    case 8:
+        result = isSigned ? std::to_chars(out, end, static_cast<int64_t>(bytes)) : std::to_chars(out, end, bytes);
+        break;
+    default:
+        if (size == 0 || size > 2 * sizeof(bytes))
+        {
+            return append(out, "undefined");
+        }
+
+        // wide values as raw bytes, most significant first
+        static constexpr char HEX[] = "0123456789abcdef";
+        out = append(out, "0x");
+        for (size_t i = size; i-- > 0;)
+        {
+            uint64_t word = i < sizeof(bytes) ? bytes : high;
+            auto byte = static_cast<uint8_t>(word >> (8 * (i % sizeof(bytes))));
+            *out++ = HEX[byte >> 4];
+            *out++ = HEX[byte & 0xF];
+        }
+        return out;
+    }
+    return result.ptr;
+}
+
+} // namespace
+
+OutputPipeline::OutputPipeline(int fd, const std::vector<Variable>& watches, OverflowPolicy policy, size_t capacity)
+    : m_fd{fd},
+      m_policy{policy},
+      m_ring(std::bit_ceil(std::max<size_t>(capacity, 2))),
+      m_mask{m_ring.size() - 1},
+      m_buffer(BUFFER_CHUNK_SIZE * BUFFER_CHUNKS)
+{
+    for (const Variable& var : watches)
+    {
+        m_watches.push_back({var.name, var.isSigned, var.isFloat});
+    }
+
+    m_pending.reserve(MAX_PENDING);
+    m_chunks.reserve(BUFFER_CHUNKS);
+    m_writer = std::thread(&OutputPipeline::writerLoop, this);
+}
+
+OutputPipeline::~OutputPipeline()
+{
+    close();
+}
+
+bool OutputPipeline::tryPush(const OutputEvent& event)
+{
+    uint64_t head = m_head.load(std::memory_order_relaxed);
+    if (head - m_tail.load(std::memory_order_acquire) > m_mask)
+    {
+        return false;
+    }
+
+    m_ring[head & m_mask] = event;
+    m_head.store(head + 1, std::memory_order_release);
+    return true;
+}
+
+bool OutputPipeline::flushPending()
+{
+    size_t pushed = 0;
+    while (pushed < m_pending.size() && tryPush(m_pending[pushed]))
+    {
+        ++pushed;
+    }
+
+    m_pending.erase(m_pending.begin(), m_pending.begin() + static_cast<long>(pushed));
+    return m_pending.empty();
+}
+
+void OutputPipeline::aggregate(const OutputEvent& event)
+{
+    ++m_aggregated;
+
+    // consecutive writes collapse into one transition from the first old value to the last new value
+    for (OutputEvent& pending : m_pending)
+    {
+        if (pending.watch == event.watch && pending.kind == event.kind && pending.offset == event.offset &&
+            pending.element == event.element && pending.pid == event.pid)
+        {
+            pending.newValue = event.newValue;
+            pending.newHigh = event.newHigh;
+            pending.count += event.count;
+            pending.stack = pending.stack == event.stack ? pending.stack : 0;
+            return;
+        }
+    }
+
+    if (m_pending.size() == MAX_PENDING)
+    {
+        --m_aggregated;
+        ++m_dropped;
+        return;
+    }
+    m_pending.push_back(event);
+}
+
+void OutputPipeline::push(const OutputEvent& event)
+{
+    // summaries go first to keep the order of events per watch
+    if (!m_pending.empty() && !flushPending())
+    {
+        aggregate(event);
+        return;
+    }
+
+    if (tryPush(event))
+    {
+        return;
+    }
+
+    switch (m_policy)
+    {
+    case OverflowPolicy::BLOCK:
+        while (!tryPush(event))
+        {
+            std::this_thread::sleep_for(BLOCK_INTERVAL);
+        }
+        break;
+    case OverflowPolicy::DROP: ++m_dropped; break;
+    case OverflowPolicy::AGGREGATE: aggregate(event); break;
+    }
+}
+
+void OutputPipeline::close()
+{
+    if (!m_writer.joinable())
+    {
+        return;
+    }
+
+    while (!flushPending())
+    {
+        std::this_thread::sleep_for(BLOCK_INTERVAL);
+    }
+
+    m_closed.store(true, std::memory_order_release);
+    m_writer.join();
+}
+
+void OutputPipeline::writerLoop()
+{
+    auto idle = MIN_IDLE_INTERVAL;
+    uint64_t tail = m_tail.load(std::memory_order_relaxed);
+
+    while (true)
+    {
+        // closed has to be read before head, so no event pushed before close is missed
+        bool closed = m_closed.load(std::memory_order_acquire);
+        uint64_t head = m_head.load(std::memory_order_acquire);
+
+        if (head == tail)
+        {
+            flush();
+            if (closed)
+            {
+                break;
+            }
+
+            std::this_thread::sleep_for(idle);
+            idle = std::min(idle * 2, MAX_IDLE_INTERVAL);
+            continue;
+        }
+
+        idle = MIN_IDLE_INTERVAL;
+        for (; tail != head; ++tail)
+        {
+            format(m_ring[tail & m_mask]);
+        }
+        m_tail.store(tail, std::memory_order_release);
+    }
+}
+
+void OutputPipeline::format(const OutputEvent& event)
+{
+    const Watch& watch = m_watches[event.watch];
+
+    // start the next chunk when the line may not fit, write all chunks once they are full
+    size_t lineLength = watch.name.size() + MAX_LINE_LENGTH;
+    if (m_chunks.empty() || m_chunks.back().iov_len + lineLength > BUFFER_CHUNK_SIZE)
+    {
+        if (m_chunks.size() == BUFFER_CHUNKS)
+        {
+            flush();
+        }
+        m_chunks.push_back({m_buffer.data() + m_chunks.size() * BUFFER_CHUNK_SIZE, 0});
+    }
+
+    iovec& chunk = m_chunks.back();
+    char* begin = static_cast<char*>(chunk.iov_base);
+    char* out = begin + chunk.iov_len;
+    char* end = begin + BUFFER_CHUNK_SIZE;
+
+    out = append(out, watch.name);
+    if (event.element)
+    {
+        *out++ = '+';
+        out = std::to_chars(out, end, event.offset).ptr;
+    }
+
+    if (event.kind == OutputEvent::READ)
+    {
+        out = append(out, "\tread:\t");
+    }
+    else
+    {
+        out = append(out, "\twrite:\t");
+        out = formatValue(out, end, event.oldValue, event.oldHigh, event.size, watch.isSigned, watch.isFloat);
+        out = append(out, " -> ");
+    }
+    out = formatValue(out, end, event.newValue, event.newHigh, event.size, watch.isSigned, watch.isFloat);
+
+    if (event.count > 1)
+    {
+        out = append(out, "\t(");
+        out = std::to_chars(out, end, event.count).ptr;
+        out = append(out, " events)");
+    }
+    if (event.stack != 0)
+    {
+        out = append(out, "\tstack #");
+        out = std::to_chars(out, end, event.stack).ptr;
+    }
+    if (event.pid != 0)
+    {
+        out = append(out, "\tpid ");
+        out = std::to_chars(out, end, event.pid).ptr;
+    }
+    *out++ = '\n';
+
+    chunk.iov_len = static_cast<size_t>(out - begin);
+}
+
+void OutputPipeline::flush()
+{
+    size_t first = 0;
+    while (!m_failed && first < m_chunks.size())
+    {
+        ssize_t written = writev(m_fd, m_chunks.data() + first, static_cast<int>(m_chunks.size() - first));
+        if (written < 0)
+        {
+            // output is gone (e.g. closed pipe), keep draining the ring so the producer never blocks
+            m_failed = errno != EINTR;
+            continue;
+        }
+
+        // partial write, skip the written chunks and advance into the first unfinished one
+        auto remaining = static_cast<size_t>(written);
+        while (first < m_chunks.size() && remaining >= m_chunks[first].iov_len)
+        {
+            remaining -= m_chunks[first++].iov_len;
+        }
+        if (first < m_chunks.size())
+        {
+            m_chunks[first].iov_base = static_cast<char*>(m_chunks[first].iov_base) + remaining;
+            m_chunks[first].iov_len -= remaining;
+        }
+    }
+
+    m_chunks.clear();
+}
+
+uint64_t OutputPipeline::getDropped() const
+{
+    return m_dropped;
+}
+
+uint64_t OutputPipeline::getAggregated() const
+{
+    return m_aggregated;
+}
+
+} // namespace dbg
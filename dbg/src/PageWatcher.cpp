@@ -0,0 +1,420 @@
+#include "PageWatcher.hpp"
+
+#include "Decoder.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cstring>
+#include <fstream>
+#include <initializer_list>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/ptrace.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+namespace dbg
+{
+
+namespace
+{
+
+/// "syscall; int3" in little endian
+constexpr long SYSCALL_STUB = 0xCC050F;
+
+/// Bytes of the syscall instruction (0F 05)
+constexpr long SYSCALL_INSTRUCTION = 0x050F;
+constexpr long SYSCALL_INSTRUCTION_MASK = 0xFFFF;
+
+/// Pages an instruction may need unprotected to complete (two operands, each crossing a page boundary)
+constexpr size_t MAX_STEP_PAGES = 4;
+
+} // namespace
+
+bool PageFault::overlaps(uintptr_t rangeAddr, size_t rangeSize) const
+{
+    // undecoded accesses are matched by the faulting address only
+    size_t accessSize = size > 0 ? size : 1;
+    return addr < rangeAddr + rangeSize && rangeAddr < addr + accessSize;
+}
+
+PageWatcher::PageWatcher(pid_t pid)
+    : m_pid{pid},
+      m_pageSize{static_cast<size_t>(sysconf(_SC_PAGESIZE))}
+{
+}
+
+void PageWatcher::watch(uintptr_t addr, size_t size)
+{
+    m_ranges.push_back({addr, size});
+}
+
+const PageWatcher::Page* PageWatcher::findPage(uintptr_t addr) const
+{
+    uintptr_t pageAddr = addr & ~(m_pageSize - 1);
+    auto it = std::lower_bound(m_pages.begin(), m_pages.end(), pageAddr,
+                               [](const Page& page, uintptr_t value) { return page.addr < value; });
+    return it != m_pages.end() && it->addr == pageAddr ? &*it : nullptr;
+}
+
+void PageWatcher::readProtections()
+{
+    std::string mapsPath = "/proc/" + std::to_string(m_pid) + "/maps";
+    std::ifstream maps(mapsPath);
+    if (!maps)
+    {
+        throw std::runtime_error("failed to open " + mapsPath);
+    }
+
+    std::string line;
+    while (std::getline(maps, line))
+    {
+        std::istringstream iss(line);
+        std::string range, perms;
+        if (!(iss >> range >> perms))
+        {
+            continue;
+        }
+
+        size_t dash = range.find('-');
+        uintptr_t start = std::stoull(range.substr(0, dash), nullptr, 16);
+        uintptr_t end = std::stoull(range.substr(dash + 1), nullptr, 16);
+
+        int prot = PROT_NONE;
+        prot |= perms[0] == 'r' ? PROT_READ : 0;
+        prot |= perms[1] == 'w' ? PROT_WRITE : 0;
+        prot |= perms[2] == 'x' ? PROT_EXEC : 0;
+
+        for (Page& page : m_pages)
+        {
+            if (page.addr >= start && page.addr < end)
+            {
+                page.prot = prot;
+            }
+        }
+    }
+}
+
+int PageWatcher::singleStep(pid_t threadId)
+{
+    m_stats.syscalls += 2;
+    long pRet = ptrace(PTRACE_SINGLESTEP, threadId, nullptr, nullptr);
+    if (pRet < 0)
+    {
+        throw std::runtime_error("PTRACE_SINGLESTEP failed: " + std::string(strerror(errno)));
+    }
+
+    int status = 0;
+    if (waitpid(threadId, &status, __WALL) < 0)
+    {
+        throw std::runtime_error("waitpid failed: " + std::string(strerror(errno)));
+    }
+
+    return WIFSTOPPED(status) ? WSTOPSIG(status) : -1;
+}
+
+long PageWatcher::injectSyscall(pid_t threadId, uintptr_t syscallAddr, long number,
+                                std::initializer_list<uint64_t> args)
+{
+    m_stats.syscalls += 4; // save, set, read the result and restore the registers
+    user_regs_struct saved{};
+    long pRet = ptrace(PTRACE_GETREGS, threadId, nullptr, &saved);
+    if (pRet < 0)
+    {
+        throw std::runtime_error("PTRACE_GETREGS failed: " + std::string(strerror(errno)));
+    }
+
+    // orig_rax = -1 keeps the kernel from restarting an interrupted syscall at the stub
+    user_regs_struct regs = saved;
+    regs.rax = static_cast<uint64_t>(number);
+    regs.orig_rax = ~0ULL;
+    regs.rip = syscallAddr;
+
+    std::array<unsigned long long*, 6> argRegs{&regs.rdi, &regs.rsi, &regs.rdx, &regs.r10, &regs.r8, &regs.r9};
+    size_t i = 0;
+    for (uint64_t arg : args)
+    {
+        *argRegs[i++] = arg;
+    }
+
+    pRet = ptrace(PTRACE_SETREGS, threadId, nullptr, &regs);
+    if (pRet < 0)
+    {
+        throw std::runtime_error("PTRACE_SETREGS failed: " + std::string(strerror(errno)));
+    }
+
+    // a signal arriving before the syscall stops the thread first, it is delivered once the fault was handled
+    while (true)
+    {
+        int stop = singleStep(threadId);
+        if (stop < 0)
+        {
+            throw std::runtime_error("thread " + std::to_string(threadId) + " exited during an injected syscall");
+        }
+        if (stop == SIGTRAP)
+        {
+            break;
+        }
+        if (stop != SIGSTOP) // left pending when the tracer stopped the other threads, not delivered
+        {
+            m_pendingSignal = stop;
+        }
+    }
+
+    pRet = ptrace(PTRACE_GETREGS, threadId, nullptr, &regs);
+    if (pRet < 0)
+    {
+        throw std::runtime_error("PTRACE_GETREGS failed: " + std::string(strerror(errno)));
+    }
+
+    pRet = ptrace(PTRACE_SETREGS, threadId, nullptr, &saved);
+    if (pRet < 0)
+    {
+        throw std::runtime_error("PTRACE_SETREGS failed: " + std::string(strerror(errno)));
+    }
+
+    return static_cast<long>(regs.rax);
+}
+
+void PageWatcher::mapSyscallStub(pid_t threadId)
+{
+    user_regs_struct regs{};
+    long pRet = ptrace(PTRACE_GETREGS, threadId, nullptr, &regs);
+    if (pRet < 0)
+    {
+        throw std::runtime_error("PTRACE_GETREGS failed: " + std::string(strerror(errno)));
+    }
+
+    // borrow the instruction at rip for the first syscall, safe only while no other thread exists
+    errno = 0;
+    long word = ptrace(PTRACE_PEEKTEXT, threadId, regs.rip, nullptr);
+    if (word == -1 && errno != 0)
+    {
+        throw std::runtime_error("PTRACE_PEEKTEXT failed: " + std::string(strerror(errno)));
+    }
+
+    long patched = (word & ~SYSCALL_INSTRUCTION_MASK) | SYSCALL_INSTRUCTION;
+    pRet = ptrace(PTRACE_POKETEXT, threadId, regs.rip, patched);
+    if (pRet < 0)
+    {
+        throw std::runtime_error("PTRACE_POKETEXT failed: " + std::string(strerror(errno)));
+    }
+
+    long addr = injectSyscall(threadId, regs.rip, SYS_mmap,
+                              {0, m_pageSize, PROT_READ | PROT_EXEC, MAP_PRIVATE | MAP_ANONYMOUS, ~0ULL, 0});
+
+    pRet = ptrace(PTRACE_POKETEXT, threadId, regs.rip, word);
+    if (pRet < 0)
+    {
+        throw std::runtime_error("PTRACE_POKETEXT failed: " + std::string(strerror(errno)));
+    }
+
+    if (addr < 0 && addr > -4096)
+    {
+        throw std::runtime_error("injected mmap failed: " + std::string(strerror(static_cast<int>(-addr))));
+    }
+
+    // later syscalls run from a page no other code executes, so other threads keep running meanwhile
+    m_syscallAddr = static_cast<uintptr_t>(addr);
+    pRet = ptrace(PTRACE_POKETEXT, threadId, m_syscallAddr, SYSCALL_STUB);
+    if (pRet < 0)
+    {
+        throw std::runtime_error("PTRACE_POKETEXT failed: " + std::string(strerror(errno)));
+    }
+}
+
+void PageWatcher::protect(pid_t threadId, const Page& page, bool armed)
+{
+    auto prot = static_cast<uint64_t>(armed ? PROT_NONE : page.prot);
+    long ret = injectSyscall(threadId, m_syscallAddr, SYS_mprotect, {page.addr, m_pageSize, prot});
+    if (ret < 0)
+    {
+        throw std::runtime_error("injected mprotect failed: " + std::string(strerror(static_cast<int>(-ret))));
+    }
+}
+
+void PageWatcher::arm(pid_t threadId)
+{
+    for (const Range& range : m_ranges)
+    {
+        uintptr_t first = range.addr & ~(m_pageSize - 1);
+        for (uintptr_t addr = first; addr < range.addr + range.size; addr += m_pageSize)
+        {
+            m_pages.push_back({addr, PROT_READ | PROT_WRITE});
+        }
+    }
+
+    std::sort(m_pages.begin(), m_pages.end(), [](const Page& a, const Page& b) { return a.addr < b.addr; });
+    m_pages.erase(std::unique(m_pages.begin(), m_pages.end(), [](const Page& a, const Page& b) { return a.addr == b.addr; }),
+                  m_pages.end());
+
+    readProtections();
+    mapSyscallStub(threadId);
+
+    for (const Page& page : m_pages)
+    {
+        protect(threadId, page, true);
+    }
+}
+
+void PageWatcher::disarm(pid_t threadId)
+{
+    for (const Page& page : m_pages)
+    {
+        protect(threadId, page, false);
+    }
+}
+
+bool PageWatcher::decodeFault(pid_t threadId, PageFault& fault)
+{
+    ++m_stats.syscalls;
+    siginfo_t info{};
+    long pRet = ptrace(PTRACE_GETSIGINFO, threadId, nullptr, &info);
+    if (pRet < 0)
+    {
+        throw std::runtime_error("PTRACE_GETSIGINFO failed: " + std::string(strerror(errno)));
+    }
+
+    auto addr = reinterpret_cast<uintptr_t>(info.si_addr);
+    if (info.si_signo != SIGSEGV || info.si_code != SEGV_ACCERR || !findPage(addr))
+    {
+        return false;
+    }
+
+    fault = PageFault{};
+    fault.addr = addr;
+
+    // the fault is raised before the instruction executes, so rip points at its first byte
+    m_stats.syscalls += 2; // registers and instruction bytes
+    user_regs_struct regs{};
+    pRet = ptrace(PTRACE_GETREGS, threadId, nullptr, &regs);
+    if (pRet < 0)
+    {
+        throw std::runtime_error("PTRACE_GETREGS failed: " + std::string(strerror(errno)));
+    }
+
+    // the page following the instruction may be unmapped
+    std::array<uint8_t, util::MAX_INSTRUCTION_LENGTH> code{};
+    size_t codeSize = code.size();
+    if (!util::readProcessMemory(m_pid, regs.rip, code.data(), codeSize))
+    {
+        codeSize = std::min<size_t>(codeSize, m_pageSize - (regs.rip & (m_pageSize - 1)));
+        ++m_stats.syscalls;
+        if (!util::readProcessMemory(m_pid, regs.rip, code.data(), codeSize))
+        {
+            codeSize = 0;
+        }
+    }
+
+    fault.ip = regs.rip;
+    if (auto instr = util::decodeInstruction(std::span(code).first(codeSize)))
+    {
+        fault.size = instr->operandSize;
+        fault.event = instr->access;
+        fault.ip += instr->length;
+    }
+
+    ++m_stats.faults;
+    fault.hit = std::any_of(m_ranges.begin(), m_ranges.end(),
+                            [&fault](const Range& range) { return fault.overlaps(range.addr, range.size); });
+    if (fault.hit)
+    {
+        ++m_stats.hits;
+    }
+    else
+    {
+        ++m_stats.falseSharing;
+    }
+
+    return true;
+}
+
+bool PageWatcher::stepOver(pid_t threadId, const PageFault& fault, int& signal)
+{
+    std::array<const Page*, MAX_STEP_PAGES> unprotected{};
+    size_t count = 0;
+
+    auto unprotect = [&](uintptr_t addr)
+    {
+        const Page* page = findPage(addr);
+        if (!page || count == unprotected.size() ||
+            std::find(unprotected.begin(), unprotected.begin() + count, page) != unprotected.begin() + count)
+        {
+            return false;
+        }
+
+        protect(threadId, *page, false);
+        unprotected[count++] = page;
+        return true;
+    };
+
+    // an access crossing into the next page is handled by the retry below if the size is unknown
+    unprotect(fault.addr);
+    if (fault.size > 0)
+    {
+        unprotect(fault.addr + fault.size - 1);
+    }
+
+    signal = 0;
+    bool executed = false;
+    while (true)
+    {
+        int stop = singleStep(threadId);
+        if (stop < 0)
+        {
+            signal = -1;
+            return false;
+        }
+
+        if (stop == SIGTRAP)
+        {
+            executed = true;
+            break;
+        }
+
+        // left pending when the tracer stopped the other threads while this one was stopped already
+        if (stop == SIGSTOP)
+        {
+            continue;
+        }
+
+        // instructions with a second memory operand (movs, push/pop) may fault on another protected page
+        if (stop == SIGSEGV)
+        {
+            ++m_stats.syscalls;
+            siginfo_t info{};
+            if (ptrace(PTRACE_GETSIGINFO, threadId, nullptr, &info) == 0 && info.si_code == SEGV_ACCERR &&
+                unprotect(reinterpret_cast<uintptr_t>(info.si_addr)))
+            {
+                continue;
+            }
+        }
+
+        signal = stop;
+        break;
+    }
+
+    for (size_t i = 0; i < count; ++i)
+    {
+        protect(threadId, *unprotected[i], true);
+    }
+
+    if (signal == 0)
+    {
+        signal = m_pendingSignal;
+    }
+    m_pendingSignal = 0;
+    return executed;
+}
+
+const PageWatchStats& PageWatcher::getStats() const
+{
+    return m_stats;
+}
+
+} // namespace dbg
@@ -0,0 +1,95 @@
+#pragma once
+
+#include "Debugger.hpp"
+#include "Util.hpp"
+
+#include <cstdint>
+#include <initializer_list>
+#include <sys/types.h>
+#include <sys/user.h>
+#include <vector>
+
+namespace dbg
+{
+
+/// Access that faulted on a page protected by the PageWatcher
+struct PageFault
+{
+    uintptr_t addr = 0; // faulting data address
+    size_t size = 0;    // bytes accessed by the faulting instruction, 0 if it could not be decoded
+    uint64_t ip = 0;    // address of the instruction following the access (of the access itself if not decoded)
+    util::WatchpointEvent event = util::WatchpointEvent::OTHER;
+    bool hit = false; // the access overlaps a watched range, otherwise it only shares the page with one
+
+    /// Check if the access overlaps [rangeAddr, rangeAddr + rangeSize)
+    [[nodiscard]] bool overlaps(uintptr_t rangeAddr, size_t rangeSize) const;
+};
+
+/// Software watchpoints for ranges that do not fit into the debug registers,
+/// the pages holding the ranges are made inaccessible with mprotect injected into the tracee,
+/// every access then stops the accessing thread with SIGSEGV before the instruction executes.
+/// Accesses to the watched ranges are reported, other accesses to the same pages are counted as false sharing,
+/// in both cases the page is unprotected for one single step of the faulting thread.
+class PageWatcher
+{
+    struct Range
+    {
+        uintptr_t addr;
+        size_t size;
+    };
+
+    struct Page
+    {
+        uintptr_t addr;
+        int prot; // protection of the page before it was armed
+    };
+
+    pid_t m_pid;
+    size_t m_pageSize;
+    uintptr_t m_syscallAddr = 0; // "syscall; int3" stub mapped into the tracee
+    std::vector<Range> m_ranges;
+    std::vector<Page> m_pages; // sorted by address
+    PageWatchStats m_stats;
+    int m_pendingSignal = 0; // signal that stopped a thread during an injected syscall, delivered after the step
+
+    [[nodiscard]] const Page* findPage(uintptr_t addr) const;
+    void readProtections();
+    void mapSyscallStub(pid_t threadId);
+    long injectSyscall(pid_t threadId, uintptr_t syscallAddr, long number, std::initializer_list<uint64_t> args);
+    void protect(pid_t threadId, const Page& page, bool armed);
+    int singleStep(pid_t threadId);
+
+  public:
+    /// @param pid id of the traced process
+    explicit PageWatcher(pid_t pid);
+
+    /// Add a watched range, must be called before arm
+    /// @param addr start address of the range
+    /// @param size size of the range in bytes
+    void watch(uintptr_t addr, size_t size);
+
+    /// Protect every page holding a watched range
+    /// @param threadId stopped thread used to run the injected syscalls, the only thread of the process
+    void arm(pid_t threadId);
+
+    /// Restore the original protection of every armed page, the syscall stub stays mapped
+    /// @param threadId stopped thread used to run the injected syscalls, every other thread has to be stopped as well
+    void disarm(pid_t threadId);
+
+    /// Inspect a SIGSEGV stop of threadId
+    /// @param threadId thread stopped with SIGSEGV
+    /// @param fault filled with the faulting access
+    /// @return true if the fault was caused by a protected page, false for a genuine segmentation fault
+    bool decodeFault(pid_t threadId, PageFault& fault);
+
+    /// Let the faulting instruction execute: unprotect its pages, single step the thread and protect them again
+    /// @param threadId thread stopped with SIGSEGV on a protected page
+    /// @param fault access returned by decodeFault
+    /// @param signal set to a signal the thread received meanwhile and that has to be delivered, -1 if the thread is gone
+    /// @return true if the instruction executed, otherwise it faults again once the thread continues
+    bool stepOver(pid_t threadId, const PageFault& fault, int& signal);
+
+    [[nodiscard]] const PageWatchStats& getStats() const;
+};
+
+} // namespace dbg
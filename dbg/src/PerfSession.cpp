@@ -0,0 +1,289 @@
+#include "PerfSession.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <ctime>
+#include <stdexcept>
+#include <string>
+
+#include <linux/hw_breakpoint.h>
+#include <linux/perf_event.h>
+#include <poll.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+namespace dbg
+{
+
+namespace
+{
+
+/// Ring buffer data size in pages (must be a power of two), one extra page holds the metadata
+constexpr size_t RING_PAGES = 128;
+
+/// Sample fields, the order of the fields in a record is fixed by the kernel
+constexpr uint64_t SAMPLE_TYPE =
+    PERF_SAMPLE_IDENTIFIER | PERF_SAMPLE_IP | PERF_SAMPLE_TID | PERF_SAMPLE_TIME | PERF_SAMPLE_ADDR;
+
+/// perf_event_x86_regs bits: AX, BX, CX, DX, SI, DI, BP, SP, IP, FLAGS, CS, SS and R8 - R15
+/// (DS, ES, FS and GS are rejected by the kernel on x86-64)
+constexpr uint64_t SAMPLE_REGS_USER = 0xFFFULL | (0xFFULL << 16);
+constexpr size_t SAMPLE_REGS_COUNT = 20;
+
+int perfEventOpen(perf_event_attr* attr, pid_t pid, int cpu)
+{
+    return static_cast<int>(syscall(SYS_perf_event_open, attr, pid, cpu, -1, PERF_FLAG_FD_CLOEXEC));
+}
+
+/// Copy n bytes from a ring buffer starting at offset, handling wrap around
+void copyFromRing(const uint8_t* data, size_t dataSize, uint64_t offset, void* dst, size_t n)
+{
+    size_t start = offset & (dataSize - 1);
+    size_t first = std::min(n, dataSize - start);
+    memcpy(dst, data + start, first);
+    memcpy(static_cast<uint8_t*>(dst) + first, data, n - first);
+}
+
+} // namespace
+
+PerfSession::PerfSession(pid_t pid, const std::vector<util::DebugRegisterSlot>& slots, bool sampleRegisters)
+    : m_sampleRegisters{sampleRegisters}
+{
+    long cpuCount = sysconf(_SC_NPROCESSORS_CONF);
+    size_t pageSize = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+    size_t mapSize = (RING_PAGES + 1) * pageSize;
+
+    try
+    {
+        for (int cpu = 0; cpu < cpuCount; ++cpu)
+        {
+            Ring ring{};
+
+            for (size_t i = 0; i < slots.size(); ++i)
+            {
+                perf_event_attr attr{};
+                attr.size = sizeof(attr);
+                attr.type = PERF_TYPE_BREAKPOINT;
+                attr.bp_type = slots[i].type == util::ON_DATA_WRITE ? HW_BREAKPOINT_W : HW_BREAKPOINT_RW;
+                attr.bp_addr = slots[i].addr;
+                attr.bp_len = slots[i].size;
+                attr.sample_period = 1;
+                attr.sample_type = SAMPLE_TYPE;
+                attr.inherit = 1;
+                attr.exclude_kernel = 1;
+                attr.exclude_hv = 1;
+                attr.use_clockid = 1;
+                attr.clockid = CLOCK_MONOTONIC; // same clock as the other backends
+                attr.watermark = 1;
+                attr.wakeup_watermark = static_cast<uint32_t>(RING_PAGES * pageSize / 4);
+
+                if (sampleRegisters)
+                {
+                    attr.sample_type |= PERF_SAMPLE_REGS_USER;
+                    attr.sample_regs_user = SAMPLE_REGS_USER;
+                }
+
+                int fd = perfEventOpen(&attr, pid, cpu);
+                if (fd < 0)
+                {
+                    // offline cpu
+                    if (errno == ENODEV && ring.fd < 0)
+                    {
+                        break;
+                    }
+                    throw std::runtime_error("perf_event_open failed: " + std::string(strerror(errno)));
+                }
+                m_fds.push_back(fd);
+
+                uint64_t id = 0;
+                if (ioctl(fd, PERF_EVENT_IOC_ID, &id) < 0)
+                {
+                    throw std::runtime_error("PERF_EVENT_IOC_ID failed: " + std::string(strerror(errno)));
+                }
+                m_slotById.emplace_back(id, i);
+
+                // first event of a cpu owns the ring buffer, the others write to it so samples stay ordered
+                if (ring.fd < 0)
+                {
+                    void* map = mmap(nullptr, mapSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+                    if (map == MAP_FAILED)
+                    {
+                        throw std::runtime_error("perf mmap failed: " + std::string(strerror(errno)));
+                    }
+
+                    ring = Ring{fd, map};
+                    m_rings.push_back(ring);
+                }
+                else if (ioctl(fd, PERF_EVENT_IOC_SET_OUTPUT, ring.fd) < 0)
+                {
+                    throw std::runtime_error("PERF_EVENT_IOC_SET_OUTPUT failed: " + std::string(strerror(errno)));
+                }
+            }
+        }
+    }
+    catch (...)
+    {
+        release();
+        throw;
+    }
+
+    std::sort(m_slotById.begin(), m_slotById.end());
+}
+
+PerfSession::~PerfSession()
+{
+    release();
+}
+
+void PerfSession::release()
+{
+    size_t mapSize = (RING_PAGES + 1) * static_cast<size_t>(sysconf(_SC_PAGESIZE));
+
+    for (const Ring& ring : m_rings)
+    {
+        munmap(ring.map, mapSize);
+    }
+    for (int fd : m_fds)
+    {
+        close(fd);
+    }
+
+    m_rings.clear();
+    m_fds.clear();
+}
+
+void PerfSession::wait(int timeoutMs) const
+{
+    std::vector<pollfd> fds;
+    fds.reserve(m_rings.size());
+    for (const Ring& ring : m_rings)
+    {
+        fds.push_back({ring.fd, POLLIN, 0});
+    }
+
+    int ret = poll(fds.data(), fds.size(), timeoutMs);
+    if (ret < 0 && errno != EINTR)
+    {
+        throw std::runtime_error("poll failed: " + std::string(strerror(errno)));
+    }
+}
+
+void PerfSession::drain(std::vector<PerfSample>& samples)
+{
+    size_t first = samples.size();
+
+    for (const Ring& ring : m_rings)
+    {
+        drainRing(ring, samples);
+    }
+
+    // rings are ordered by themselves, merge them by time
+    std::stable_sort(samples.begin() + static_cast<long>(first), samples.end(),
+                     [](const PerfSample& a, const PerfSample& b) { return a.time < b.time; });
+}
+
+void PerfSession::drainRing(const Ring& ring, std::vector<PerfSample>& samples)
+{
+    auto* meta = static_cast<perf_event_mmap_page*>(ring.map);
+    const uint8_t* data = static_cast<const uint8_t*>(ring.map) + meta->data_offset;
+    size_t dataSize = meta->data_size;
+
+    uint64_t head = __atomic_load_n(&meta->data_head, __ATOMIC_ACQUIRE);
+    uint64_t tail = meta->data_tail;
+
+    std::vector<uint8_t> record;
+    while (tail < head)
+    {
+        perf_event_header header{};
+        copyFromRing(data, dataSize, tail, &header, sizeof(header));
+
+        record.resize(header.size);
+        copyFromRing(data, dataSize, tail, record.data(), header.size);
+
+        if (header.type == PERF_RECORD_SAMPLE)
+        {
+            parseSample(record.data() + sizeof(header), samples);
+        }
+        else if (header.type == PERF_RECORD_LOST)
+        {
+            // struct { header; u64 id; u64 lost; }
+            uint64_t lost = 0;
+            memcpy(&lost, record.data() + sizeof(header) + sizeof(uint64_t), sizeof(lost));
+            m_lost += lost;
+        }
+
+        tail += header.size;
+    }
+
+    __atomic_store_n(&meta->data_tail, tail, __ATOMIC_RELEASE);
+}
+
+void PerfSession::parseSample(const uint8_t* record, std::vector<PerfSample>& samples) const
+{
+    auto next = [&record]()
+    {
+        uint64_t value = 0;
+        memcpy(&value, record, sizeof(value));
+        record += sizeof(value);
+        return value;
+    };
+
+    PerfSample sample{};
+
+    uint64_t id = next();
+    auto it = std::lower_bound(m_slotById.begin(), m_slotById.end(), std::make_pair(id, size_t{0}));
+    if (it == m_slotById.end() || it->first != id)
+    {
+        return;
+    }
+    sample.slot = it->second;
+
+    sample.ip = next();
+    uint64_t pidTid = next();
+    sample.pid = static_cast<uint32_t>(pidTid);
+    sample.tid = static_cast<uint32_t>(pidTid >> 32);
+    sample.time = next();
+    sample.addr = next();
+
+    if (m_sampleRegisters && next() != PERF_SAMPLE_REGS_ABI_NONE)
+    {
+        uint64_t regs[SAMPLE_REGS_COUNT];
+        for (uint64_t& reg : regs)
+        {
+            reg = next();
+        }
+
+        // perf_event_x86_regs order
+        sample.regs.rax = regs[0];
+        sample.regs.rbx = regs[1];
+        sample.regs.rcx = regs[2];
+        sample.regs.rdx = regs[3];
+        sample.regs.rsi = regs[4];
+        sample.regs.rdi = regs[5];
+        sample.regs.rbp = regs[6];
+        sample.regs.rsp = regs[7];
+        sample.regs.rip = regs[8];
+        sample.regs.eflags = regs[9];
+        sample.regs.cs = regs[10];
+        sample.regs.ss = regs[11];
+        sample.regs.r8 = regs[12];
+        sample.regs.r9 = regs[13];
+        sample.regs.r10 = regs[14];
+        sample.regs.r11 = regs[15];
+        sample.regs.r12 = regs[16];
+        sample.regs.r13 = regs[17];
+        sample.regs.r14 = regs[18];
+        sample.regs.r15 = regs[19];
+    }
+
+    samples.push_back(sample);
+}
+
+uint64_t PerfSession::getLost() const
+{
+    return m_lost;
+}
+
+} // namespace dbg
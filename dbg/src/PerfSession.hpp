@@ -0,0 +1,71 @@
+#pragma once
+
+#include "Util.hpp"
+
+#include <cstdint>
+#include <sys/types.h>
+#include <sys/user.h>
+#include <vector>
+
+namespace dbg
+{
+
+/// Hardware breakpoint hit written by the kernel into a perf ring buffer
+struct PerfSample
+{
+    size_t slot = 0; // index of the debug register slot whose event fired
+    uint32_t pid = 0;
+    uint32_t tid = 0;
+    uint64_t ip = 0; // address of the instruction following the access
+    uint64_t time = 0;
+    uint64_t addr = 0;
+    user_regs_struct regs{}; // general purpose registers, only filled when registers are sampled
+};
+
+/// perf_event_open based watchpoints,
+/// one PERF_TYPE_BREAKPOINT event per debug register slot and cpu is inherited by every thread of the tracee,
+/// hits are written to one mmap'd ring buffer per cpu and collected in batches while the tracee keeps running
+class PerfSession
+{
+    struct Ring
+    {
+        int fd = -1;
+        void* map = nullptr;
+    };
+
+    std::vector<int> m_fds;
+    std::vector<Ring> m_rings;
+    std::vector<std::pair<uint64_t, size_t>> m_slotById; // perf event id -> slot index
+    bool m_sampleRegisters;
+    uint64_t m_lost = 0;
+
+    void release();
+    void drainRing(const Ring& ring, std::vector<PerfSample>& samples);
+    void parseSample(const uint8_t* record, std::vector<PerfSample>& samples) const;
+
+  public:
+    /// Open breakpoint events for process pid and all threads it creates afterwards
+    /// @param pid id of the process to watch, should be stopped until the session is created
+    /// @param slots debug register slots to open events for
+    /// @param sampleRegisters capture user registers of the accessing thread with every sample
+    PerfSession(pid_t pid, const std::vector<util::DebugRegisterSlot>& slots, bool sampleRegisters);
+    ~PerfSession();
+
+    PerfSession(const PerfSession&) = delete;
+    PerfSession(PerfSession&&) = delete;
+    PerfSession& operator=(const PerfSession&) = delete;
+    PerfSession& operator=(PerfSession&&) = delete;
+
+    /// Block until any ring buffer passes its wakeup watermark or timeout expires
+    /// @param timeoutMs maximum time to wait (milliseconds)
+    void wait(int timeoutMs) const;
+
+    /// Move all available samples of every ring buffer to samples, ordered by time
+    /// @param samples vector the samples are appended to
+    void drain(std::vector<PerfSample>& samples);
+
+    /// Number of samples dropped by the kernel because a ring buffer was full
+    [[nodiscard]] uint64_t getLost() const;
+};
+
+} // namespace dbg
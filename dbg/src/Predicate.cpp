@@ -0,0 +1,409 @@
+#include "Predicate.hpp"
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cctype>
+#include <charconv>
+#include <stdexcept>
+
+namespace dbg
+{
+
+/// Recursive descent parser emitting the bytecode of a Predicate, operators by increasing precedence:
+/// || (or), && (and), ! (not), comparisons and "in"
+class Predicate::Parser
+{
+    Predicate& m_predicate;
+    std::string_view m_text;
+    size_t m_pos = 0;
+    size_t m_depth = 0; // stack depth after the instructions emitted so far
+
+    [[noreturn]] void fail(const std::string& message) const
+    {
+        throw std::invalid_argument(message + " at position " + std::to_string(m_pos) + " of --when '" +
+                                    std::string(m_text) + "'");
+    }
+
+    void skipSpaces()
+    {
+        while (m_pos < m_text.size() && std::isspace(static_cast<unsigned char>(m_text[m_pos])))
+        {
+            ++m_pos;
+        }
+    }
+
+    /// Consume an operator or a keyword, keywords only match whole words
+    bool accept(std::string_view token)
+    {
+        skipSpaces();
+        if (m_text.substr(m_pos, token.size()) != token)
+        {
+            return false;
+        }
+
+        size_t end = m_pos + token.size();
+        bool isWord = std::isalpha(static_cast<unsigned char>(token.front()));
+        if (isWord && end < m_text.size() && (std::isalnum(static_cast<unsigned char>(m_text[end])) || m_text[end] == '_'))
+        {
+            return false;
+        }
+        m_pos = end;
+        return true;
+    }
+
+    std::string_view identifier()
+    {
+        skipSpaces();
+        size_t start = m_pos;
+        while (m_pos < m_text.size() && (std::isalnum(static_cast<unsigned char>(m_text[m_pos])) ||
+                                         m_text[m_pos] == '_' || m_text[m_pos] == '.' || m_text[m_pos] == '$'))
+        {
+            ++m_pos;
+        }
+        return m_text.substr(start, m_pos - start);
+    }
+
+    size_t emit(Op op, Number value = {}, size_t arg = 0)
+    {
+        switch (op)
+        {
+        case Op::PUSH:
+        case Op::LOAD_NEW:
+        case Op::LOAD_OLD:
+        case Op::LOAD_TID:
+        case Op::LOAD_IP:
+        case Op::IS_WRITE: ++m_depth; break;
+        case Op::EQUAL:
+        case Op::NOT_EQUAL:
+        case Op::LESS:
+        case Op::LESS_EQUAL:
+        case Op::GREATER:
+        case Op::GREATER_EQUAL:
+        case Op::JUMP_IF_FALSE:
+        case Op::JUMP_IF_TRUE: --m_depth; break; // a jump pops its operand when it falls through
+        case Op::IN_FUNCTION:
+        case Op::NOT: break;
+        }
+
+        if (m_depth > MAX_DEPTH)
+        {
+            fail("Expression too deep");
+        }
+        m_predicate.m_code.push_back({op, value, arg});
+        return m_predicate.m_code.size() - 1;
+    }
+
+    void number(bool negative)
+    {
+        skipSpaces();
+        size_t start = m_pos;
+        while (m_pos < m_text.size() && (std::isalnum(static_cast<unsigned char>(m_text[m_pos])) || m_text[m_pos] == '.' ||
+                                         ((m_text[m_pos] == '-' || m_text[m_pos] == '+') &&
+                                          (m_text[m_pos - 1] == 'e' || m_text[m_pos - 1] == 'E'))))
+        {
+            ++m_pos;
+        }
+        std::string_view text = m_text.substr(start, m_pos - start);
+        const char* end = text.data() + text.size();
+
+        Number value{};
+        uint64_t integer = 0;
+        bool isHex = text.starts_with("0x") || text.starts_with("0X");
+        auto [ptr, error] = isHex ? std::from_chars(text.data() + 2, end, integer, 16)
+                                  : std::from_chars(text.data(), end, integer);
+        if (error == std::errc{} && ptr == end && (!isHex || text.size() > 2))
+        {
+            value.kind = negative ? Number::SIGNED : Number::UNSIGNED;
+            value.bits = negative ? static_cast<uint64_t>(-static_cast<int64_t>(integer)) : integer;
+            emit(Op::PUSH, value);
+            return;
+        }
+
+        double real = 0;
+        auto [realPtr, realError] = std::from_chars(text.data(), end, real);
+        if (realError != std::errc{} || realPtr != end || text.empty())
+        {
+            fail("Invalid number '" + std::string(text) + "'");
+        }
+        value.kind = Number::FLOAT;
+        value.bits = std::bit_cast<uint64_t>(negative ? -real : real);
+        emit(Op::PUSH, value);
+    }
+
+    void operand()
+    {
+        skipSpaces();
+        if (accept("("))
+        {
+            disjunction();
+            if (!accept(")"))
+            {
+                fail("Missing )");
+            }
+            return;
+        }
+
+        if (accept("-"))
+        {
+            number(true);
+            return;
+        }
+
+        if (m_pos < m_text.size() && (std::isdigit(static_cast<unsigned char>(m_text[m_pos])) || m_text[m_pos] == '.'))
+        {
+            number(false);
+            return;
+        }
+
+        size_t start = m_pos;
+        std::string_view name = identifier();
+        if (name == "new")
+        {
+            emit(Op::LOAD_NEW);
+        }
+        else if (name == "old")
+        {
+            emit(Op::LOAD_OLD);
+        }
+        else if (name == "tid")
+        {
+            emit(Op::LOAD_TID);
+        }
+        else if (name == "ip")
+        {
+            emit(Op::LOAD_IP);
+            m_predicate.m_usesIp = true;
+        }
+        else if (name == "write")
+        {
+            emit(Op::IS_WRITE);
+        }
+        else if (name == "read")
+        {
+            emit(Op::IS_WRITE);
+            emit(Op::NOT);
+        }
+        else
+        {
+            m_pos = start;
+            fail(name.empty() ? "Expected an operand" : "Unknown operand '" + std::string(name) + "'");
+        }
+    }
+
+    void comparison()
+    {
+        operand();
+
+        static constexpr std::array<std::pair<std::string_view, Op>, 6> OPERATORS{
+            {{"==", Op::EQUAL},
+             {"!=", Op::NOT_EQUAL},
+             {"<=", Op::LESS_EQUAL},
+             {">=", Op::GREATER_EQUAL},
+             {"<", Op::LESS},
+             {">", Op::GREATER}}};
+        for (auto [token, op] : OPERATORS)
+        {
+            if (accept(token))
+            {
+                operand();
+                emit(op);
+                return;
+            }
+        }
+
+        if (accept("in"))
+        {
+            std::string_view name = identifier();
+            if (name.empty())
+            {
+                fail("Expected a function name");
+            }
+            m_predicate.m_functions.push_back({std::string(name)});
+            emit(Op::IN_FUNCTION, {}, m_predicate.m_functions.size() - 1);
+        }
+    }
+
+    void negation()
+    {
+        if (accept("!") || accept("not"))
+        {
+            negation();
+            emit(Op::NOT);
+            return;
+        }
+        comparison();
+    }
+
+    // the left operand decides a short-circuit, the jump target is patched once the right operand is emitted
+    void conjunction()
+    {
+        negation();
+        while (accept("&&") || accept("and"))
+        {
+            size_t jump = emit(Op::JUMP_IF_FALSE);
+            negation();
+            m_predicate.m_code[jump].arg = m_predicate.m_code.size();
+        }
+    }
+
+    void disjunction()
+    {
+        conjunction();
+        while (accept("||") || accept("or"))
+        {
+            size_t jump = emit(Op::JUMP_IF_TRUE);
+            conjunction();
+            m_predicate.m_code[jump].arg = m_predicate.m_code.size();
+        }
+    }
+
+  public:
+    Parser(Predicate& predicate, std::string_view text) : m_predicate{predicate}, m_text{text} {}
+
+    void parse()
+    {
+        disjunction();
+        skipSpaces();
+        if (m_pos != m_text.size())
+        {
+            fail("Unexpected '" + std::string(m_text.substr(m_pos)) + "'");
+        }
+    }
+};
+
+Predicate::Predicate(std::string_view expression) : m_expression{expression}
+{
+    Parser(*this, m_expression).parse();
+}
+
+void Predicate::bind(const std::function<std::optional<std::pair<uint64_t, uint64_t>>(const std::string&)>& resolve)
+{
+    for (Function& function : m_functions)
+    {
+        auto range = resolve(function.name);
+        if (!range)
+        {
+            throw std::runtime_error("Function not found: " + function.name + " (--when '" + m_expression + "')");
+        }
+        function.start = range->first;
+        function.end = range->second;
+    }
+}
+
+Predicate::Number Predicate::load(const Variable& var, const Value& value)
+{
+    size_t size = std::min(value.size(), sizeof(uint64_t));
+    uint64_t word = value.word(0);
+    if (var.isFloat && (size == sizeof(float) || size == sizeof(double)))
+    {
+        double real = size == sizeof(float) ? std::bit_cast<float>(static_cast<uint32_t>(word))
+                                            : std::bit_cast<double>(word);
+        return {Number::FLOAT, std::bit_cast<uint64_t>(real)};
+    }
+
+    if (var.isSigned && size > 0 && size < sizeof(uint64_t))
+    {
+        unsigned shift = 64 - 8 * static_cast<unsigned>(size);
+        word = static_cast<uint64_t>(static_cast<int64_t>(word << shift) >> shift);
+    }
+    return {var.isSigned ? Number::SIGNED : Number::UNSIGNED, word};
+}
+
+std::partial_ordering Predicate::compare(Number lhs, Number rhs)
+{
+    auto toDouble = [](Number number)
+    {
+        switch (number.kind)
+        {
+        case Number::SIGNED: return static_cast<double>(static_cast<int64_t>(number.bits));
+        case Number::FLOAT: return std::bit_cast<double>(number.bits);
+        case Number::UNSIGNED: break;
+        }
+        return static_cast<double>(number.bits);
+    };
+
+    if (lhs.kind == Number::FLOAT || rhs.kind == Number::FLOAT)
+    {
+        return toDouble(lhs) <=> toDouble(rhs);
+    }
+
+    // a negative signed value is below every unsigned one, otherwise both compare as unsigned
+    bool lhsNegative = lhs.kind == Number::SIGNED && static_cast<int64_t>(lhs.bits) < 0;
+    bool rhsNegative = rhs.kind == Number::SIGNED && static_cast<int64_t>(rhs.bits) < 0;
+    if (lhsNegative != rhsNegative)
+    {
+        return lhsNegative ? std::partial_ordering::less : std::partial_ordering::greater;
+    }
+    if (lhsNegative)
+    {
+        return static_cast<int64_t>(lhs.bits) <=> static_cast<int64_t>(rhs.bits);
+    }
+    return lhs.bits <=> rhs.bits;
+}
+
+bool Predicate::evaluate(const Access& access) const
+{
+    auto isTrue = [](Number number)
+    { return number.kind == Number::FLOAT ? std::bit_cast<double>(number.bits) != 0 : number.bits != 0; };
+    auto boolean = [](bool value) { return Number{Number::UNSIGNED, value ? 1U : 0U}; };
+
+    std::array<Number, MAX_DEPTH> stack;
+    size_t top = 0; // number of operands on the stack
+    for (size_t pc = 0; pc < m_code.size(); ++pc)
+    {
+        const Instruction& instruction = m_code[pc];
+        switch (instruction.op)
+        {
+        case Op::PUSH: stack[top++] = instruction.value; break;
+        case Op::LOAD_NEW: stack[top++] = load(*access.var, access.var->value); break;
+        case Op::LOAD_OLD: stack[top++] = load(*access.var, *access.oldValue); break;
+        case Op::LOAD_TID: stack[top++] = {Number::SIGNED, static_cast<uint64_t>(access.tid)}; break;
+        case Op::LOAD_IP: stack[top++] = {Number::UNSIGNED, access.ip}; break;
+        case Op::IS_WRITE: stack[top++] = boolean(access.isWrite); break;
+        case Op::IN_FUNCTION:
+        {
+            const Function& function = m_functions[instruction.arg];
+            uint64_t addr = stack[top - 1].bits;
+            stack[top - 1] = boolean(stack[top - 1].kind != Number::FLOAT && addr >= function.start && addr < function.end);
+            break;
+        }
+        case Op::EQUAL: --top; stack[top - 1] = boolean(compare(stack[top - 1], stack[top]) == 0); break;
+        case Op::NOT_EQUAL: --top; stack[top - 1] = boolean(compare(stack[top - 1], stack[top]) != 0); break;
+        case Op::LESS: --top; stack[top - 1] = boolean(compare(stack[top - 1], stack[top]) < 0); break;
+        case Op::LESS_EQUAL: --top; stack[top - 1] = boolean(compare(stack[top - 1], stack[top]) <= 0); break;
+        case Op::GREATER: --top; stack[top - 1] = boolean(compare(stack[top - 1], stack[top]) > 0); break;
+        case Op::GREATER_EQUAL: --top; stack[top - 1] = boolean(compare(stack[top - 1], stack[top]) >= 0); break;
+        case Op::NOT: stack[top - 1] = boolean(!isTrue(stack[top - 1])); break;
+        case Op::JUMP_IF_FALSE:
+        case Op::JUMP_IF_TRUE:
+            if (isTrue(stack[top - 1]) == (instruction.op == Op::JUMP_IF_TRUE))
+            {
+                pc = instruction.arg - 1; // the loop increments pc
+            }
+            else
+            {
+                --top;
+            }
+            break;
+        }
+    }
+    return top > 0 && isTrue(stack[top - 1]);
+}
+
+bool Predicate::usesInstructionPointer() const
+{
+    return m_usesIp;
+}
+
+bool Predicate::usesFunctions() const
+{
+    return !m_functions.empty();
+}
+
+const std::string& Predicate::getExpression() const
+{
+    return m_expression;
+}
+
+} // namespace dbg
@@ -0,0 +1,128 @@
+#include "ProcessMemory.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <string>
+
+#include <fcntl.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+namespace dbg
+{
+
+/// Ranges passed to a single process_vm_readv call, well below IOV_MAX
+static constexpr size_t MAX_RANGES_PER_CALL = 64;
+
+ProcessMemory::ProcessMemory(pid_t pid)
+    : m_pid{pid}
+{
+}
+
+ProcessMemory::~ProcessMemory()
+{
+    if (m_memFd >= 0)
+    {
+        close(m_memFd);
+    }
+}
+
+bool ProcessMemory::readMem(uintptr_t addr, void* dst, size_t size)
+{
+    if (m_memFd < 0)
+    {
+        std::string memPath = "/proc/" + std::to_string(m_pid) + "/mem";
+        ++m_syscalls;
+        m_memFd = open(memPath.c_str(), O_RDONLY | O_CLOEXEC);
+        if (m_memFd < 0)
+        {
+            return false;
+        }
+    }
+
+    // unlike process_vm_readv, /proc/<pid>/mem reads pages regardless of their protection
+    auto* out = static_cast<uint8_t*>(dst);
+    while (size > 0)
+    {
+        ++m_syscalls;
+        ssize_t n = pread(m_memFd, out, size, static_cast<off_t>(addr));
+        if (n < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (n <= 0)
+        {
+            return false;
+        }
+
+        out += n;
+        addr += static_cast<size_t>(n);
+        size -= static_cast<size_t>(n);
+    }
+    return true;
+}
+
+bool ProcessMemory::read(uintptr_t addr, void* dst, size_t size)
+{
+    MemoryRange range{addr, dst, size};
+    return read(std::span(&range, 1));
+}
+
+bool ProcessMemory::read(std::span<const MemoryRange> ranges)
+{
+    bool complete = true;
+    while (!ranges.empty())
+    {
+        size_t count = std::min(ranges.size(), MAX_RANGES_PER_CALL);
+        std::array<iovec, MAX_RANGES_PER_CALL> local{};
+        std::array<iovec, MAX_RANGES_PER_CALL> remote{};
+        for (size_t i = 0; i < count; ++i)
+        {
+            local[i] = {ranges[i].dst, ranges[i].size};
+            remote[i] = {reinterpret_cast<void*>(ranges[i].addr), ranges[i].size};
+        }
+
+        // process_vm_readv stops at the first range it cannot read completely, the rest is read one by one
+        ++m_syscalls;
+        ssize_t n = process_vm_readv(m_pid, local.data(), count, remote.data(), count, 0);
+        size_t done = n > 0 ? static_cast<size_t>(n) : 0;
+        for (size_t i = 0; i < count; ++i)
+        {
+            if (done >= ranges[i].size)
+            {
+                done -= ranges[i].size;
+                continue;
+            }
+
+            auto* dst = static_cast<uint8_t*>(ranges[i].dst);
+            complete &= readMem(ranges[i].addr + done, dst + done, ranges[i].size - done);
+            done = 0;
+        }
+
+        ranges = ranges.subspan(count);
+    }
+    return complete;
+}
+
+std::span<const uint8_t> ProcessMemory::readPreceding(uintptr_t addr, std::span<uint8_t> dst)
+{
+    if (read(addr - dst.size(), dst.data(), dst.size()))
+    {
+        return dst;
+    }
+
+    std::span<uint8_t> word = dst.last(sizeof(long));
+    if (read(addr - word.size(), word.data(), word.size()))
+    {
+        return word;
+    }
+    return {};
+}
+
+uint64_t ProcessMemory::getSyscalls() const
+{
+    return m_syscalls;
+}
+
+} // namespace dbg
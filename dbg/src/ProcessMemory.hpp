@@ -0,0 +1,63 @@
+#pragma once
+
+#include <cstdint>
+#include <span>
+#include <sys/types.h>
+
+namespace dbg
+{
+
+/// Range of the traced process copied into a local buffer
+struct MemoryRange
+{
+    uintptr_t addr;
+    void* dst;
+    size_t size;
+};
+
+/// Reads memory of the traced process without stopping it or going through ptrace word by word.
+/// Ranges are copied with process_vm_readv, several ranges with a single call,
+/// pages process_vm_readv cannot read (e.g. protected by the PageWatcher) are read from /proc/<pid>/mem,
+/// which is opened on first use and kept open
+class ProcessMemory
+{
+    pid_t m_pid;
+    int m_memFd = -1;
+    uint64_t m_syscalls = 0;
+
+    bool readMem(uintptr_t addr, void* dst, size_t size);
+
+  public:
+    /// @param pid id of the process to read from
+    explicit ProcessMemory(pid_t pid);
+    ~ProcessMemory();
+
+    ProcessMemory(const ProcessMemory&) = delete;
+    ProcessMemory(ProcessMemory&&) = delete;
+    ProcessMemory& operator=(const ProcessMemory&) = delete;
+    ProcessMemory& operator=(ProcessMemory&&) = delete;
+
+    /// Read a single range
+    /// @param addr address in the process
+    /// @param dst destination buffer
+    /// @param size number of bytes to read
+    /// @return true if all bytes were read
+    bool read(uintptr_t addr, void* dst, size_t size);
+
+    /// Read several ranges at once
+    /// @param ranges ranges to read, each into its own buffer
+    /// @return true if all ranges were read completely
+    bool read(std::span<const MemoryRange> ranges);
+
+    /// Read the bytes preceding an address, e.g. the instruction before rip, the first word may be unmapped
+    /// if the address is close to the start of a mapping
+    /// @param addr address following the bytes
+    /// @param dst destination buffer, at least one word
+    /// @return the bytes that could be read, a suffix of dst, empty if not even the last word is mapped
+    std::span<const uint8_t> readPreceding(uintptr_t addr, std::span<uint8_t> dst);
+
+    /// Number of syscalls made to read memory so far
+    [[nodiscard]] uint64_t getSyscalls() const;
+};
+
+} // namespace dbg
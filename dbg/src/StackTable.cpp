@@ -0,0 +1,88 @@
+#include "StackTable.hpp"
+
+#include <algorithm>
+#include <bit>
+
+namespace dbg
+{
+
+StackTable::StackTable(size_t capacity) : m_index(std::bit_ceil(std::max<size_t>(capacity, 16)))
+{
+    m_mask = m_index.size() - 1;
+}
+
+uint64_t StackTable::hash(std::span<const uint64_t> frames)
+{
+    // FNV-1a over the frames, the finalizer of splitmix64 spreads the low bits used as slot
+    uint64_t value = 0xCBF29CE484222325ULL;
+    for (uint64_t frame : frames)
+    {
+        value = (value ^ frame) * 0x100000001B3ULL;
+    }
+    value = (value ^ (value >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    value = (value ^ (value >> 27)) * 0x94D049BB133111EBULL;
+    return value ^ (value >> 31);
+}
+
+uint32_t StackTable::intern(std::span<const uint64_t> frames)
+{
+    uint64_t stackHash = hash(frames);
+    for (size_t slot = stackHash & m_mask;; slot = (slot + 1) & m_mask)
+    {
+        uint32_t id = m_index[slot];
+        if (id == 0)
+        {
+            m_stacks.push_back({stackHash, m_frames.size(), frames.size(), 1});
+            m_frames.insert(m_frames.end(), frames.begin(), frames.end());
+            id = static_cast<uint32_t>(m_stacks.size());
+            m_index[slot] = id;
+
+            // at most half full, probe sequences stay short
+            if (m_stacks.size() * 2 > m_index.size())
+            {
+                grow();
+            }
+            return id;
+        }
+
+        Stack& stack = m_stacks[id - 1];
+        if (stack.hash == stackHash && std::ranges::equal(getFrames(id), frames))
+        {
+            ++stack.count;
+            return id;
+        }
+    }
+}
+
+void StackTable::grow()
+{
+    m_index.assign(m_index.size() * 2, 0);
+    m_mask = m_index.size() - 1;
+    for (size_t i = 0; i < m_stacks.size(); ++i)
+    {
+        size_t slot = m_stacks[i].hash & m_mask;
+        while (m_index[slot] != 0)
+        {
+            slot = (slot + 1) & m_mask;
+        }
+        m_index[slot] = static_cast<uint32_t>(i + 1);
+    }
+}
+
+std::span<const uint64_t> StackTable::getFrames(uint32_t id) const
+{
+    const Stack& stack = m_stacks.at(id - 1);
+    return std::span(m_frames).subspan(stack.offset, stack.depth);
+}
+
+uint64_t StackTable::getCount(uint32_t id) const
+{
+    return m_stacks.at(id - 1).count;
+}
+
+size_t StackTable::size() const
+{
+    return m_stacks.size();
+}
+
+} // namespace dbg
@@ -0,0 +1,341 @@
+#include "SymbolIndex.hpp"
+
+#include "ElfFile.hpp"
+#include "Util.hpp"
+
+#include <bit>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <stdexcept>
+
+#include <elf.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace dbg
+{
+
+namespace
+{
+constexpr char CACHE_MAGIC[8] = {'G', 'W', 'S', 'Y', 'M', 'I', 'D', 'X'};
+constexpr uint32_t CACHE_VERSION = 1;
+
+/// Layout of a cache file: header, slots, entries, name pool
+struct CacheHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t reserved;
+    uint64_t capacity;
+    uint64_t count;
+    uint64_t namesSize;
+};
+
+/// 64-bit FNV-1a, stable across runs so cached tables stay valid,
+/// mixed afterwards, as the low bits of similar names (var_1, var_2, ...) would otherwise cluster
+uint64_t hashName(std::string_view name)
+{
+    uint64_t hash = 0xCBF29CE484222325;
+    for (char c : name)
+    {
+        hash ^= static_cast<uint8_t>(c);
+        hash *= 0x100000001B3;
+    }
+
+    hash ^= hash >> 30;
+    hash *= 0xBF58476D1CE4E5B9;
+    hash ^= hash >> 31;
+    return hash;
+}
+} // namespace
+
+SymbolIndex::SymbolIndex(const std::string& exePath, const std::string& cacheDir)
+    : SymbolIndex(exePath, cacheDir, ".symidx", nullptr)
+{
+}
+
+SymbolIndex::SymbolIndex(const std::string& exePath, const std::string& cacheDir, const std::string& extension,
+                         const std::function<std::vector<NamedSymbol>()>& collect)
+{
+    std::string buildId = cacheDir.empty() ? std::string{} : util::getBuildId(exePath);
+    std::string cachePath = buildId.empty() ? std::string{} : cacheDir + "/" + buildId + extension;
+
+    if (!cachePath.empty() && loadCache(cachePath))
+    {
+        m_cached = true;
+        return;
+    }
+
+    if (collect)
+    {
+        build(collect());
+    }
+    else
+    {
+        build(exePath);
+    }
+    if (!cachePath.empty())
+    {
+        saveCache(cachePath);
+    }
+}
+
+SymbolIndex::~SymbolIndex()
+{
+    if (m_map)
+    {
+        munmap(m_map, m_mapSize);
+    }
+}
+
+void SymbolIndex::build(const std::string& exePath)
+{
+    ElfFile elf(exePath);
+    std::vector<ElfFile::SymbolTable> tables = elf.getSymbolTables();
+    if (tables.empty())
+    {
+        throw std::runtime_error(".symtab or .strtab section was not found: " + exePath);
+    }
+
+    // the table is sized for every entry, so it is never rehashed and stays below 3/4 full
+    size_t entries = 0;
+    size_t namesSize = 0;
+    for (const ElfFile::SymbolTable& table : tables)
+    {
+        entries += table.symbols.size();
+        namesSize += table.namesSize;
+    }
+    m_capacity = std::bit_ceil(entries + entries / 3 + 1);
+    m_ownedSlots.assign(m_capacity, Slot{});
+    m_ownedEntries.reserve(entries);
+    m_ownedNames.reserve(namesSize);
+
+    // .symtab first, so its definitions win over the exported copies in .dynsym
+    for (const ElfFile::SymbolTable& table : tables)
+    {
+        for (const Elf64_Sym& symbol : table.symbols)
+        {
+            unsigned char type = ELF64_ST_TYPE(symbol.st_info);
+            if (symbol.st_name == 0 || symbol.st_shndx == SHN_UNDEF || type == STT_SECTION || type == STT_FILE)
+            {
+                continue;
+            }
+
+            // ignore c++ name mangling (see README on global variables)
+            insert(table.name(symbol), symbol.st_value, symbol.st_size);
+        }
+    }
+
+    m_slots = m_ownedSlots.data();
+    m_entries = m_ownedEntries.data();
+    m_count = m_ownedEntries.size();
+    m_names = m_ownedNames.data();
+    m_namesSize = m_ownedNames.size();
+}
+
+void SymbolIndex::build(const std::vector<NamedSymbol>& symbols)
+{
+    size_t namesSize = 0;
+    for (const NamedSymbol& symbol : symbols)
+    {
+        namesSize += symbol.name.size() + 1;
+    }
+    m_capacity = std::bit_ceil(symbols.size() + symbols.size() / 3 + 1);
+    m_ownedSlots.assign(m_capacity, Slot{});
+    m_ownedEntries.reserve(symbols.size());
+    m_ownedNames.reserve(namesSize);
+
+    for (const NamedSymbol& symbol : symbols)
+    {
+        insert(symbol.name, symbol.symbol.value, symbol.symbol.size);
+    }
+
+    // an empty pool would not pass the checks of a cached index
+    if (m_ownedNames.empty())
+    {
+        m_ownedNames.push_back('\0');
+    }
+
+    m_slots = m_ownedSlots.data();
+    m_entries = m_ownedEntries.data();
+    m_count = m_ownedEntries.size();
+    m_names = m_ownedNames.data();
+    m_namesSize = m_ownedNames.size();
+}
+
+void SymbolIndex::insert(std::string_view name, uint64_t value, uint64_t size)
+{
+    uint64_t hash = hashName(name);
+    auto tag = static_cast<uint32_t>(hash >> 32);
+
+    size_t mask = m_capacity - 1;
+    for (size_t i = hash & mask;; i = (i + 1) & mask)
+    {
+        Slot& slot = m_ownedSlots[i];
+        if (slot.entry == 0)
+        {
+            m_ownedEntries.push_back({value, size, m_ownedNames.size()});
+            m_ownedNames.append(name);
+            m_ownedNames.push_back('\0');
+            slot = {tag, static_cast<uint32_t>(m_ownedEntries.size())};
+            return;
+        }
+
+        const Entry& entry = m_ownedEntries[slot.entry - 1];
+        if (slot.tag == tag && name == std::string_view(m_ownedNames.data() + entry.name))
+        {
+            return; // keep the first definition
+        }
+    }
+}
+
+bool SymbolIndex::loadCache(const std::string& path)
+{
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+    {
+        return false;
+    }
+
+    struct stat st{};
+    if (fstat(fd, &st) < 0 || static_cast<size_t>(st.st_size) < sizeof(CacheHeader))
+    {
+        close(fd);
+        return false;
+    }
+
+    void* map = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+    {
+        return false;
+    }
+
+    // a cache written by another version or cut off while writing is rebuilt
+    const auto* header = reinterpret_cast<const CacheHeader*>(map);
+    const char* base = reinterpret_cast<const char*>(map);
+    auto fileSize = static_cast<uint64_t>(st.st_size);
+    uint64_t maxSlots = (fileSize - sizeof(CacheHeader)) / sizeof(Slot);
+    bool valid = memcmp(header->magic, CACHE_MAGIC, sizeof(CACHE_MAGIC)) == 0 && header->version == CACHE_VERSION &&
+                 std::has_single_bit(header->capacity) && header->capacity <= maxSlots &&
+                 header->count < header->capacity && header->namesSize > 0 &&
+                 sizeof(CacheHeader) + header->capacity * sizeof(Slot) + header->count * sizeof(Entry) +
+                         header->namesSize ==
+                     fileSize &&
+                 base[fileSize - 1] == '\0';
+    if (!valid)
+    {
+        munmap(map, st.st_size);
+        return false;
+    }
+
+    m_map = map;
+    m_mapSize = st.st_size;
+    m_slots = reinterpret_cast<const Slot*>(base + sizeof(CacheHeader));
+    m_capacity = header->capacity;
+    m_entries = reinterpret_cast<const Entry*>(m_slots + m_capacity);
+    m_count = header->count;
+    m_names = reinterpret_cast<const char*>(m_entries + m_count);
+    m_namesSize = header->namesSize;
+    return true;
+}
+
+void SymbolIndex::saveCache(const std::string& path) const
+{
+    // the cache is an optimization, failing to write it is not an error
+    std::error_code error;
+    std::filesystem::create_directories(std::filesystem::path(path).parent_path(), error);
+
+    // written to a temporary file and renamed, so concurrent runs never map a partial index
+    std::string tmpPath = path + "." + std::to_string(getpid()) + ".tmp";
+    int fd = open(tmpPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0)
+    {
+        return;
+    }
+
+    CacheHeader header{};
+    memcpy(header.magic, CACHE_MAGIC, sizeof(CACHE_MAGIC));
+    header.version = CACHE_VERSION;
+    header.capacity = m_capacity;
+    header.count = m_count;
+    header.namesSize = m_namesSize;
+
+    bool written = true;
+    for (auto [data, size] : {std::pair{static_cast<const void*>(&header), sizeof(header)},
+                              std::pair{static_cast<const void*>(m_slots), m_capacity * sizeof(Slot)},
+                              std::pair{static_cast<const void*>(m_entries), m_count * sizeof(Entry)},
+                              std::pair{static_cast<const void*>(m_names), m_namesSize}})
+    {
+        const auto* bytes = static_cast<const char*>(data);
+        while (written && size > 0)
+        {
+            ssize_t n = write(fd, bytes, size);
+            written = n > 0;
+            bytes += written ? n : 0;
+            size -= written ? static_cast<size_t>(n) : 0;
+        }
+    }
+
+    close(fd);
+    if (!written || rename(tmpPath.c_str(), path.c_str()) < 0)
+    {
+        unlink(tmpPath.c_str());
+    }
+}
+
+std::optional<ElfSymbol> SymbolIndex::find(std::string_view name) const
+{
+    uint64_t hash = hashName(name);
+    auto tag = static_cast<uint32_t>(hash >> 32);
+
+    size_t mask = m_capacity - 1;
+    size_t index = hash & mask;
+    for (size_t probes = 0; probes < m_capacity; ++probes, index = (index + 1) & mask)
+    {
+        const Slot& slot = m_slots[index];
+        if (slot.entry == 0 || slot.entry > m_count)
+        {
+            return std::nullopt;
+        }
+
+        const Entry& entry = m_entries[slot.entry - 1];
+        if (slot.tag == tag && entry.name < m_namesSize && name == std::string_view(m_names + entry.name))
+        {
+            return ElfSymbol{entry.value, entry.size};
+        }
+    }
+    return std::nullopt;
+}
+
+size_t SymbolIndex::size() const
+{
+    return m_count;
+}
+
+bool SymbolIndex::isCached() const
+{
+    return m_cached;
+}
+
+std::string SymbolIndex::getDefaultCacheDirectory()
+{
+    if (const char* dir = std::getenv("GWATCH_CACHE_DIR"))
+    {
+        return dir;
+    }
+    if (const char* dir = std::getenv("XDG_CACHE_HOME"); dir && *dir)
+    {
+        return std::string(dir) + "/gwatch";
+    }
+    if (const char* home = std::getenv("HOME"); home && *home)
+    {
+        return std::string(home) + "/.cache/gwatch";
+    }
+    return {};
+}
+
+} // namespace dbg
@@ -0,0 +1,103 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace dbg
+{
+
+/// Link time address and size of an elf symbol
+struct ElfSymbol
+{
+    uint64_t value = 0;
+    uint64_t size = 0;
+};
+
+/// Name and symbol of an index whose entries are collected by the caller
+struct NamedSymbol
+{
+    std::string name;
+    ElfSymbol symbol;
+};
+
+/// Name -> symbol hash of the defined symbols of .symtab and .dynsym, built with one pass over both tables.
+/// The index is a flat open addressing table plus a pool of the names, so it is written to a cache file
+/// named after the GNU build-id of the binary as is, and later loads of the same build only map that file.
+/// Other per binary name lookups (e.g. the DWARF variables) use the same table with entries of their own
+class SymbolIndex
+{
+    // the hash table only holds small slots, so probing stays within few cache lines
+    struct Slot
+    {
+        uint32_t tag;   // high half of the name hash, compared before the name
+        uint32_t entry; // index + 1 into the entries, 0 for an empty slot
+    };
+
+    struct Entry
+    {
+        uint64_t value;
+        uint64_t size;
+        uint64_t name; // offset into the name pool
+    };
+
+    // storage of a built index, a cached index is used in place from the mapping
+    std::vector<Slot> m_ownedSlots;
+    std::vector<Entry> m_ownedEntries;
+    std::string m_ownedNames;
+    void* m_map = nullptr;
+    size_t m_mapSize = 0;
+
+    const Slot* m_slots = nullptr;
+    size_t m_capacity = 0; // power of two
+    const Entry* m_entries = nullptr;
+    size_t m_count = 0;
+    const char* m_names = nullptr;
+    size_t m_namesSize = 0;
+    bool m_cached = false;
+
+    void build(const std::string& exePath);
+    void build(const std::vector<NamedSymbol>& symbols);
+    void insert(std::string_view name, uint64_t value, uint64_t size);
+    bool loadCache(const std::string& path);
+    void saveCache(const std::string& path) const;
+
+  public:
+    /// Load the index from the cache directory, or build it from the elf file and store it there
+    /// @param exePath path to an elf binary
+    /// @param cacheDir directory of cached indexes, empty to always build the index
+    explicit SymbolIndex(const std::string& exePath, const std::string& cacheDir = "");
+
+    /// Load an index with other entries from the cache directory, or collect them and store the index there
+    /// @param exePath path to the elf binary the entries belong to
+    /// @param cacheDir directory of cached indexes, empty to always collect the entries
+    /// @param extension of the cache file, tells the indexes of one binary apart, e.g. ".dwidx"
+    /// @param collect returns the entries, the first one of a name wins
+    SymbolIndex(const std::string& exePath, const std::string& cacheDir, const std::string& extension,
+                const std::function<std::vector<NamedSymbol>()>& collect);
+    ~SymbolIndex();
+
+    SymbolIndex(const SymbolIndex&) = delete;
+    SymbolIndex(SymbolIndex&&) = delete;
+    SymbolIndex& operator=(const SymbolIndex&) = delete;
+    SymbolIndex& operator=(SymbolIndex&&) = delete;
+
+    /// Look up a symbol by its (mangled) name, the first definition wins, .symtab before .dynsym
+    /// @param name symbol name
+    /// @return link time offset and size, nothing if the binary has no such symbol
+    [[nodiscard]] std::optional<ElfSymbol> find(std::string_view name) const;
+
+    /// Number of indexed symbols
+    [[nodiscard]] size_t size() const;
+
+    /// True if the index was read from the cache instead of the elf file
+    [[nodiscard]] bool isCached() const;
+
+    /// $GWATCH_CACHE_DIR if set (empty disables caching), otherwise $XDG_CACHE_HOME/gwatch or ~/.cache/gwatch
+    static std::string getDefaultCacheDirectory();
+};
+
+} // namespace dbg
@@ -0,0 +1,120 @@
+#include "Symbolizer.hpp"
+
+#include "ElfFile.hpp"
+
+#include <algorithm>
+#include <numeric>
+#include <stdexcept>
+#include <thread>
+
+namespace dbg
+{
+
+/// Batches below this size are resolved on the calling thread, threads would cost more than they save
+static constexpr size_t PARALLEL_BATCH = 16384;
+
+Symbolizer::Symbolizer(const std::vector<util::MappedFile>& files)
+{
+    for (const util::MappedFile& file : files)
+    {
+        addObject(file);
+    }
+
+    // symbols of .symtab are added before their copies in .dynsym, the stable sort keeps the first of equal starts
+    std::stable_sort(m_intervals.begin(), m_intervals.end(),
+                     [](const Interval& lhs, const Interval& rhs) { return lhs.start < rhs.start; });
+    auto duplicates = std::unique(m_intervals.begin(), m_intervals.end(),
+                                  [](const Interval& lhs, const Interval& rhs) { return lhs.start == rhs.start; });
+    m_intervals.erase(duplicates, m_intervals.end());
+}
+
+void Symbolizer::addObject(const util::MappedFile& file)
+{
+    // the same relocation as getBaseAddress: PIE executables and shared objects move by their load address,
+    // fixed position executables are mapped at their link time addresses
+    try
+    {
+        ElfFile elf(file.path);
+        uint64_t bias = elf.isPositionIndependent() ? file.start - elf.getLinkBase() : 0;
+
+        size_t object = m_objects.size();
+        m_objects.push_back(file.path);
+        for (const ElfFile::SymbolTable& table : elf.getSymbolTables())
+        {
+            for (const Elf64_Sym& symbol : table.symbols)
+            {
+                unsigned char type = ELF64_ST_TYPE(symbol.st_info);
+                if ((type != STT_FUNC && type != STT_GNU_IFUNC) || symbol.st_shndx == SHN_UNDEF || symbol.st_size == 0)
+                {
+                    continue;
+                }
+
+                m_intervals.push_back(
+                    {bias + symbol.st_value, bias + symbol.st_value + symbol.st_size, m_names.size(), object});
+                m_names.append(table.name(symbol));
+                m_names.push_back('\0');
+            }
+        }
+    }
+    catch (const std::runtime_error&)
+    {
+        // mapped files like locale archives are no elf files
+    }
+}
+
+std::vector<CodeLocation> Symbolizer::resolve(std::span<const uint64_t> addresses) const
+{
+    // sorted addresses walk the interval array front to back, which keeps the searches in cache
+    std::vector<size_t> order(addresses.size());
+    std::iota(order.begin(), order.end(), 0);
+    std::sort(order.begin(), order.end(), [&](size_t lhs, size_t rhs) { return addresses[lhs] < addresses[rhs]; });
+
+    std::vector<CodeLocation> locations(addresses.size());
+    size_t threadCount = std::min<size_t>(std::thread::hardware_concurrency(), addresses.size() / PARALLEL_BATCH);
+    if (threadCount <= 1)
+    {
+        resolveRange(addresses, order, locations);
+        return locations;
+    }
+
+    // every thread writes the locations of its own share of the addresses
+    std::vector<std::thread> threads;
+    size_t share = (order.size() + threadCount - 1) / threadCount;
+    for (size_t first = 0; first < order.size(); first += share)
+    {
+        std::span<const size_t> part = std::span(order).subspan(first, std::min(share, order.size() - first));
+        threads.emplace_back([this, addresses, part, &locations]() { resolveRange(addresses, part, locations); });
+    }
+    for (std::thread& thread : threads)
+    {
+        thread.join();
+    }
+    return locations;
+}
+
+void Symbolizer::resolveRange(std::span<const uint64_t> addresses, std::span<const size_t> order,
+                              std::vector<CodeLocation>& locations) const
+{
+    for (size_t index : order)
+    {
+        uint64_t address = addresses[index];
+
+        // last function starting at or before the address
+        auto next = std::upper_bound(m_intervals.begin(), m_intervals.end(), address,
+                                     [](uint64_t value, const Interval& interval) { return value < interval.start; });
+        if (next == m_intervals.begin() || address >= std::prev(next)->end)
+        {
+            continue;
+        }
+
+        const Interval& interval = *std::prev(next);
+        locations[index] = {m_names.data() + interval.name, address - interval.start, m_objects[interval.object]};
+    }
+}
+
+size_t Symbolizer::size() const
+{
+    return m_intervals.size();
+}
+
+} // namespace dbg
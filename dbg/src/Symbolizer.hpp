@@ -0,0 +1,49 @@
+#pragma once
+
+#include "Debugger.hpp"
+#include "Util.hpp"
+
+#include <cstdint>
+#include <span>
+#include <string>
+#include <vector>
+
+namespace dbg
+{
+
+/// Resolves code addresses of a traced process to function + offset. The STT_FUNC symbols of every mapped object
+/// are relocated by the load bias of their object and kept as one interval array sorted by start address, so a batch
+/// of addresses is resolved with one binary search each, large batches in parallel
+class Symbolizer
+{
+    struct Interval
+    {
+        uint64_t start;
+        uint64_t end;
+        size_t name;   // offset into the name pool
+        size_t object; // index of the object
+    };
+
+    std::vector<Interval> m_intervals; // sorted by start, without duplicates
+    std::string m_names;               // NUL terminated names
+    std::vector<std::string> m_objects;
+
+    void addObject(const util::MappedFile& file);
+    void resolveRange(std::span<const uint64_t> addresses, std::span<const size_t> order,
+                      std::vector<CodeLocation>& locations) const;
+
+  public:
+    /// Read the function symbols of the mapped files, files that are no elf files are left out
+    /// @param files files mapped into the process, the start of a file is the address its first segment is mapped at
+    explicit Symbolizer(const std::vector<util::MappedFile>& files);
+
+    /// Resolve a batch of addresses
+    /// @param addresses code addresses in the traced process
+    /// @return location of each address in the same order, without function if no symbol covers it
+    [[nodiscard]] std::vector<CodeLocation> resolve(std::span<const uint64_t> addresses) const;
+
+    /// Number of indexed functions
+    [[nodiscard]] size_t size() const;
+};
+
+} // namespace dbg
@@ -0,0 +1,213 @@
+#include "TraceBackend.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstddef>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <sys/ptrace.h>
+#include <sys/wait.h>
+
+namespace dbg
+{
+
+/// Bytes per recorded word
+static constexpr size_t WORD_SIZE = sizeof(uint64_t);
+
+static size_t toWords(size_t size)
+{
+    return (size + WORD_SIZE - 1) / WORD_SIZE;
+}
+
+LiveBackend::LiveBackend(ProcessMemory& memory, StopRecording* recording) : m_memory{memory}, m_recording{recording}
+{
+}
+
+void LiveBackend::record(const void* data, size_t size)
+{
+    // reads made before the first stop, e.g. the initial values, are part of the recorded variables
+    if (!m_recording || m_recording->stops.empty())
+    {
+        return;
+    }
+
+    std::vector<uint64_t>& words = m_recording->words;
+    size_t first = words.size();
+    words.resize(first + toWords(size));
+    memcpy(words.data() + first, data, size);
+    m_recording->stops.back().wordCount = words.size() - m_recording->stops.back().firstWord;
+}
+
+pid_t LiveBackend::wait(pid_t threadId, int& status, int options)
+{
+    pid_t stopped = waitpid(threadId, &status, __WALL | options);
+    if (m_recording && stopped > 0)
+    {
+        m_recording->stops.push_back({stopped, status, 0, 0, m_recording->words.size(), 0});
+    }
+    return stopped;
+}
+
+long LiveBackend::resume(pid_t threadId, int signal)
+{
+    return ptrace(PTRACE_CONT, threadId, nullptr, signal);
+}
+
+long LiveBackend::getEventMessage(pid_t threadId, unsigned long& message)
+{
+    long ret = ptrace(PTRACE_GETEVENTMSG, threadId, nullptr, &message);
+    if (m_recording && ret == 0 && !m_recording->stops.empty())
+    {
+        m_recording->stops.back().eventMessage = message;
+    }
+    return ret;
+}
+
+uint64_t LiveBackend::getDebugStatus(pid_t threadId, bool reset)
+{
+    uint64_t dr6 = util::getDebugStatus(threadId, reset);
+    if (m_recording && !m_recording->stops.empty())
+    {
+        m_recording->stops.back().debugStatus = dr6;
+    }
+    return dr6;
+}
+
+size_t LiveBackend::setHardwareWatchpoints(pid_t threadId, const std::vector<util::DebugRegisterSlot>& slots,
+                                           util::DebugRegisterState& state)
+{
+    return util::setHardwareWatchpoints(threadId, slots, state);
+}
+
+long LiveBackend::getRegisters(pid_t threadId, user_regs_struct& regs)
+{
+    long ret = ptrace(PTRACE_GETREGS, threadId, nullptr, &regs);
+    if (ret == 0)
+    {
+        record(&regs, sizeof(regs));
+    }
+    return ret;
+}
+
+bool LiveBackend::getInstructionPointer(pid_t threadId, uint64_t& ip)
+{
+    errno = 0;
+    long rip = ptrace(PTRACE_PEEKUSER, threadId, offsetof(struct user, regs.rip), nullptr);
+    if (rip == -1 && errno != 0)
+    {
+        return false;
+    }
+    ip = static_cast<uint64_t>(rip);
+    record(&ip, sizeof(ip));
+    return true;
+}
+
+bool LiveBackend::readMemory(std::span<const MemoryRange> ranges)
+{
+    if (!m_memory.read(ranges))
+    {
+        return false;
+    }
+    for (const MemoryRange& range : ranges)
+    {
+        record(range.dst, range.size);
+    }
+    return true;
+}
+
+std::span<const uint8_t> LiveBackend::readPreceding(uintptr_t addr, std::span<uint8_t> dst)
+{
+    std::span<const uint8_t> bytes = m_memory.readPreceding(addr, dst);
+    uint64_t count = bytes.size();
+    record(&count, sizeof(count));
+    record(bytes.data(), bytes.size());
+    return bytes;
+}
+
+ReplayBackend::ReplayBackend(const StopRecording& recording) : m_recording{recording}
+{
+}
+
+void ReplayBackend::replay(void* data, size_t size)
+{
+    // the stop is handled differently than it was recorded, e.g. with another watch mode
+    if (m_word + toWords(size) > m_wordEnd)
+    {
+        throw std::runtime_error("Replayed stop " + std::to_string(m_next - 1) + " reads more than was recorded");
+    }
+    memcpy(data, m_recording.words.data() + m_word, size);
+    m_word += toWords(size);
+}
+
+pid_t ReplayBackend::wait(pid_t, int& status, int)
+{
+    if (m_next == m_recording.stops.size())
+    {
+        m_current = nullptr;
+        m_word = m_wordEnd = 0;
+        status = 0; // exited with 0
+        return m_recording.pid;
+    }
+
+    m_current = &m_recording.stops[m_next++];
+    m_word = m_current->firstWord;
+    m_wordEnd = std::min(m_current->firstWord + m_current->wordCount, m_recording.words.size());
+    status = m_current->status;
+    return m_current->tid;
+}
+
+long ReplayBackend::resume(pid_t, int)
+{
+    return 0;
+}
+
+long ReplayBackend::getEventMessage(pid_t, unsigned long& message)
+{
+    message = m_current ? m_current->eventMessage : 0;
+    return 0;
+}
+
+uint64_t ReplayBackend::getDebugStatus(pid_t, bool)
+{
+    return m_current ? m_current->debugStatus : 0;
+}
+
+size_t ReplayBackend::setHardwareWatchpoints(pid_t, const std::vector<util::DebugRegisterSlot>&,
+                                             util::DebugRegisterState&)
+{
+    return 0;
+}
+
+long ReplayBackend::getRegisters(pid_t, user_regs_struct& regs)
+{
+    replay(&regs, sizeof(regs));
+    return 0;
+}
+
+bool ReplayBackend::getInstructionPointer(pid_t, uint64_t& ip)
+{
+    replay(&ip, sizeof(ip));
+    return true;
+}
+
+bool ReplayBackend::readMemory(std::span<const MemoryRange> ranges)
+{
+    for (const MemoryRange& range : ranges)
+    {
+        replay(range.dst, range.size);
+    }
+    return true;
+}
+
+std::span<const uint8_t> ReplayBackend::readPreceding(uintptr_t, std::span<uint8_t> dst)
+{
+    uint64_t count = 0;
+    replay(&count, sizeof(count));
+    count = std::min<uint64_t>(count, dst.size());
+    std::span<uint8_t> bytes = dst.last(count);
+    replay(bytes.data(), bytes.size());
+    return bytes;
+}
+
+} // namespace dbg
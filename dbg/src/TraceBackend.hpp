@@ -0,0 +1,110 @@
+#pragma once
+
+#include "ProcessMemory.hpp"
+#include "StopRecording.hpp"
+#include "Util.hpp"
+
+#include <cstdint>
+#include <span>
+#include <sys/types.h>
+#include <sys/user.h>
+#include <vector>
+
+namespace dbg
+{
+
+/// Kernel calls the ptrace stop loop of the Debugger makes, so the loop can run against recorded stops.
+/// Calls return what the syscall returned, errors are reported through errno as with the syscalls
+class TraceBackend
+{
+  public:
+    virtual ~TraceBackend() = default;
+
+    /// waitpid with __WALL
+    /// @param threadId thread to wait for, -1 for any
+    /// @param status wait status of the returned thread
+    /// @param options added to __WALL, e.g. WNOHANG
+    /// @return id of the stopped or exited thread, 0 if none with WNOHANG, -1 on error
+    virtual pid_t wait(pid_t threadId, int& status, int options) = 0;
+
+    /// PTRACE_CONT
+    virtual long resume(pid_t threadId, int signal) = 0;
+
+    /// PTRACE_GETEVENTMSG
+    virtual long getEventMessage(pid_t threadId, unsigned long& message) = 0;
+
+    /// DR6 of a stopped thread, see util::getDebugStatus
+    virtual uint64_t getDebugStatus(pid_t threadId, bool reset) = 0;
+
+    /// Program the debug registers of a stopped thread, see util::setHardwareWatchpoints
+    virtual size_t setHardwareWatchpoints(pid_t threadId, const std::vector<util::DebugRegisterSlot>& slots,
+                                          util::DebugRegisterState& state) = 0;
+
+    /// PTRACE_GETREGS
+    virtual long getRegisters(pid_t threadId, user_regs_struct& regs) = 0;
+
+    /// PTRACE_PEEKUSER of rip
+    /// @return false if the register could not be read
+    virtual bool getInstructionPointer(pid_t threadId, uint64_t& ip) = 0;
+
+    /// See ProcessMemory::read
+    virtual bool readMemory(std::span<const MemoryRange> ranges) = 0;
+
+    /// See ProcessMemory::readPreceding
+    virtual std::span<const uint8_t> readPreceding(uintptr_t addr, std::span<uint8_t> dst) = 0;
+};
+
+/// Makes the syscalls, and appends every stop and what was read while handling it to a recording if given
+class LiveBackend final : public TraceBackend
+{
+    ProcessMemory& m_memory;
+    StopRecording* m_recording;
+
+    void record(const void* data, size_t size);
+
+  public:
+    /// @param memory memory of the traced process
+    /// @param recording filled with the stops, nullptr to not record
+    LiveBackend(ProcessMemory& memory, StopRecording* recording);
+
+    pid_t wait(pid_t threadId, int& status, int options) override;
+    long resume(pid_t threadId, int signal) override;
+    long getEventMessage(pid_t threadId, unsigned long& message) override;
+    uint64_t getDebugStatus(pid_t threadId, bool reset) override;
+    size_t setHardwareWatchpoints(pid_t threadId, const std::vector<util::DebugRegisterSlot>& slots,
+                                  util::DebugRegisterState& state) override;
+    long getRegisters(pid_t threadId, user_regs_struct& regs) override;
+    bool getInstructionPointer(pid_t threadId, uint64_t& ip) override;
+    bool readMemory(std::span<const MemoryRange> ranges) override;
+    std::span<const uint8_t> readPreceding(uintptr_t addr, std::span<uint8_t> dst) override;
+};
+
+/// Returns the recorded stops one after the other and the recorded reads of the current stop,
+/// the main thread exits after the last stop, calls that change the tracee do nothing
+class ReplayBackend final : public TraceBackend
+{
+    const StopRecording& m_recording;
+    size_t m_next = 0;             // next stop returned by wait
+    const RecordedStop* m_current = nullptr;
+    size_t m_word = 0;             // next word of the current stop
+    size_t m_wordEnd = 0;
+
+    void replay(void* data, size_t size);
+
+  public:
+    /// @param recording stops to return, has to outlive the backend
+    explicit ReplayBackend(const StopRecording& recording);
+
+    pid_t wait(pid_t threadId, int& status, int options) override;
+    long resume(pid_t threadId, int signal) override;
+    long getEventMessage(pid_t threadId, unsigned long& message) override;
+    uint64_t getDebugStatus(pid_t threadId, bool reset) override;
+    size_t setHardwareWatchpoints(pid_t threadId, const std::vector<util::DebugRegisterSlot>& slots,
+                                  util::DebugRegisterState& state) override;
+    long getRegisters(pid_t threadId, user_regs_struct& regs) override;
+    bool getInstructionPointer(pid_t threadId, uint64_t& ip) override;
+    bool readMemory(std::span<const MemoryRange> ranges) override;
+    std::span<const uint8_t> readPreceding(uintptr_t addr, std::span<uint8_t> dst) override;
+};
+
+} // namespace dbg
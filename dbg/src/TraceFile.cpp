@@ -0,0 +1,443 @@
+#include "TraceFile.hpp"
+
+#include "Util.hpp"
+
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+namespace dbg
+{
+
+namespace
+{
+
+void putVarint(std::vector<uint8_t>& out, uint64_t value)
+{
+    while (value >= 0x80)
+    {
+        out.push_back(static_cast<uint8_t>(value | 0x80));
+        value >>= 7;
+    }
+    out.push_back(static_cast<uint8_t>(value));
+}
+
+/// Map signed deltas to unsigned values, small magnitudes of either sign get short varints
+uint64_t zigzag(int64_t value)
+{
+    return (static_cast<uint64_t>(value) << 1) ^ static_cast<uint64_t>(value >> 63);
+}
+
+int64_t unzigzag(uint64_t value)
+{
+    return static_cast<int64_t>(value >> 1) ^ -static_cast<int64_t>(value & 1);
+}
+
+void putU32(std::vector<uint8_t>& out, uint32_t value)
+{
+    const auto* bytes = reinterpret_cast<const uint8_t*>(&value);
+    out.insert(out.end(), bytes, bytes + sizeof(value));
+}
+
+void putString(std::vector<uint8_t>& out, const std::string& value)
+{
+    putVarint(out, value.size());
+    out.insert(out.end(), value.begin(), value.end());
+}
+
+uint64_t getVarint(const uint8_t*& in, const uint8_t* end)
+{
+    uint64_t value = 0;
+    for (unsigned shift = 0; shift < 64; shift += 7)
+    {
+        if (in == end)
+        {
+            throw std::runtime_error("truncated trace");
+        }
+        uint8_t byte = *in++;
+        value |= static_cast<uint64_t>(byte & 0x7F) << shift;
+        if ((byte & 0x80) == 0)
+        {
+            return value;
+        }
+    }
+    throw std::runtime_error("malformed varint in trace");
+}
+
+template <typename T> T getFixed(const uint8_t*& in, const uint8_t* end)
+{
+    if (static_cast<size_t>(end - in) < sizeof(T))
+    {
+        throw std::runtime_error("truncated trace");
+    }
+    T value{};
+    memcpy(&value, in, sizeof(T));
+    in += sizeof(T);
+    return value;
+}
+
+std::string getString(const uint8_t*& in, const uint8_t* end)
+{
+    uint64_t size = getVarint(in, end);
+    if (size > static_cast<size_t>(end - in))
+    {
+        throw std::runtime_error("truncated trace");
+    }
+    std::string value(reinterpret_cast<const char*>(in), size);
+    in += size;
+    return value;
+}
+
+} // namespace
+
+TraceWriter::TraceWriter(const std::string& path, const std::string& target, const std::vector<Variable>& watches)
+{
+    std::vector<uint8_t> header;
+    header.insert(header.end(), std::begin(trace::MAGIC), std::end(trace::MAGIC));
+    putU32(header, trace::VERSION);
+    putU32(header, static_cast<uint32_t>(watches.size()));
+    putString(header, target);
+    putString(header, util::getBuildId(target));
+    for (const Variable& var : watches)
+    {
+        putVarint(header, var.address);
+        putVarint(header, var.size);
+        header.push_back(var.isFloat ? 2 : var.isSigned ? 1 : 0);
+        putString(header, var.name);
+    }
+
+    m_fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (m_fd < 0)
+    {
+        throw std::runtime_error("Could not open " + path + ": " + std::string(strerror(errno)));
+    }
+
+    try
+    {
+        writeAll(header, {});
+    }
+    catch (std::runtime_error&)
+    {
+        close(m_fd);
+        throw;
+    }
+
+    m_chunk.reserve(trace::MAX_CHUNK_PAYLOAD + trace::MAX_RECORD_SIZE);
+}
+
+TraceWriter::~TraceWriter()
+{
+    try
+    {
+        finish();
+    }
+    catch (std::runtime_error&) // destructor must not throw, call finish to see write errors
+    {
+    }
+}
+
+void TraceWriter::writeAll(std::span<const uint8_t> header, std::span<const uint8_t> payload)
+{
+    iovec iov[2] = {{const_cast<uint8_t*>(header.data()), header.size()},
+                    {const_cast<uint8_t*>(payload.data()), payload.size()}};
+    int first = 0;
+    while (first < 2)
+    {
+        ssize_t written = writev(m_fd, iov + first, 2 - first);
+        if (written < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            throw std::runtime_error("Writing trace failed: " + std::string(strerror(errno)));
+        }
+
+        auto remaining = static_cast<size_t>(written);
+        while (first < 2 && remaining >= iov[first].iov_len)
+        {
+            remaining -= iov[first++].iov_len;
+        }
+        if (first < 2)
+        {
+            iov[first].iov_base = static_cast<uint8_t*>(iov[first].iov_base) + remaining;
+            iov[first].iov_len -= remaining;
+        }
+    }
+}
+
+void TraceWriter::flushChunk()
+{
+    if (m_chunkHeader.count == 0)
+    {
+        return;
+    }
+
+    m_chunkHeader.magic = trace::CHUNK_MAGIC;
+    m_chunkHeader.payloadSize = static_cast<uint32_t>(m_chunk.size());
+    writeAll({reinterpret_cast<const uint8_t*>(&m_chunkHeader), sizeof(m_chunkHeader)}, m_chunk);
+
+    m_chunk.clear();
+    m_chunkHeader = {};
+}
+
+void TraceWriter::append(const TraceRecord& record)
+{
+    // deltas restart with every chunk, so a chunk can be decoded without the ones before it
+    if (m_chunkHeader.count == 0)
+    {
+        m_chunkHeader.baseTime = record.time;
+        m_previous = {};
+        m_previous.time = record.time;
+    }
+
+    const OutputEvent& event = record.event;
+    uint64_t tag = static_cast<uint64_t>(event.watch) << 2 | static_cast<uint64_t>(event.element) << 1 |
+                   (event.kind == OutputEvent::WRITE ? 1 : 0);
+    putVarint(m_chunk, tag);
+    putVarint(m_chunk, record.time - m_previous.time);
+    putVarint(m_chunk, zigzag(static_cast<int64_t>(record.tid) - m_previous.tid));
+    putVarint(m_chunk, zigzag(static_cast<int64_t>(record.ip - m_previous.ip)));
+    putVarint(m_chunk, event.newValue);
+    if (event.kind == OutputEvent::WRITE)
+    {
+        putVarint(m_chunk, zigzag(static_cast<int64_t>(event.newValue - event.oldValue)));
+    }
+    if (event.element)
+    {
+        putVarint(m_chunk, event.offset);
+        m_chunk.push_back(event.size);
+    }
+    if (event.size > sizeof(uint64_t))
+    {
+        putVarint(m_chunk, event.newHigh);
+        if (event.kind == OutputEvent::WRITE)
+        {
+            putVarint(m_chunk, zigzag(static_cast<int64_t>(event.newHigh - event.oldHigh)));
+        }
+    }
+
+    m_previous = record;
+    ++m_chunkHeader.count;
+    ++m_records;
+
+    if (m_chunk.size() >= trace::MAX_CHUNK_PAYLOAD)
+    {
+        flushChunk();
+    }
+}
+
+void TraceWriter::finish()
+{
+    if (m_fd < 0)
+    {
+        return;
+    }
+
+    flushChunk();
+    close(m_fd);
+    m_fd = -1;
+}
+
+uint64_t TraceWriter::getRecordCount() const
+{
+    return m_records;
+}
+
+TraceReader::TraceReader(const std::string& path)
+{
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+    {
+        throw std::runtime_error("Could not open " + path + ": " + std::string(strerror(errno)));
+    }
+
+    struct stat st{};
+    if (fstat(fd, &st) < 0)
+    {
+        close(fd);
+        throw std::runtime_error("Fstat failed: " + path);
+    }
+
+    m_mapSize = static_cast<size_t>(st.st_size);
+    void* map = m_mapSize > 0 ? mmap(nullptr, m_mapSize, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+    close(fd);
+    if (map == MAP_FAILED)
+    {
+        throw std::runtime_error("Mmap failed: " + path);
+    }
+
+    // records are read once front to back
+    madvise(map, m_mapSize, MADV_SEQUENTIAL);
+    m_begin = static_cast<const uint8_t*>(map);
+    m_end = m_begin + m_mapSize;
+
+    try
+    {
+        const uint8_t* in = m_begin;
+        if (m_mapSize < sizeof(trace::MAGIC) || memcmp(in, trace::MAGIC, sizeof(trace::MAGIC)) != 0)
+        {
+            throw std::runtime_error(path + " is not a gwatch trace");
+        }
+        in += sizeof(trace::MAGIC);
+
+        uint32_t version = getFixed<uint32_t>(in, m_end);
+        if (version != trace::VERSION)
+        {
+            throw std::runtime_error("Unsupported trace version " + std::to_string(version));
+        }
+
+        uint32_t watchCount = getFixed<uint32_t>(in, m_end);
+        m_target = getString(in, m_end);
+        m_buildId = getString(in, m_end);
+        for (uint32_t i = 0; i < watchCount; ++i)
+        {
+            TraceWatch watch{};
+            watch.address = getVarint(in, m_end);
+            watch.size = getVarint(in, m_end);
+            auto encoding = getFixed<uint8_t>(in, m_end);
+            watch.isSigned = encoding == 1;
+            watch.isFloat = encoding == 2;
+            watch.name = getString(in, m_end);
+            m_watches.push_back(std::move(watch));
+        }
+
+        m_firstChunk = in;
+    }
+    catch (std::runtime_error&)
+    {
+        munmap(const_cast<uint8_t*>(m_begin), m_mapSize);
+        throw;
+    }
+
+    rewind();
+}
+
+TraceReader::~TraceReader()
+{
+    munmap(const_cast<uint8_t*>(m_begin), m_mapSize);
+}
+
+void TraceReader::rewind()
+{
+    m_nextChunk = m_firstChunk;
+    m_cursor = m_chunkEnd = m_firstChunk;
+    m_remaining = 0;
+}
+
+bool TraceReader::nextChunk()
+{
+    // a chunk cut off by a crash of the tracer ends the trace
+    if (static_cast<size_t>(m_end - m_nextChunk) < sizeof(trace::ChunkHeader))
+    {
+        return false;
+    }
+
+    trace::ChunkHeader header{};
+    memcpy(&header, m_nextChunk, sizeof(header));
+    const uint8_t* payload = m_nextChunk + sizeof(header);
+    if (header.magic != trace::CHUNK_MAGIC || header.payloadSize > static_cast<size_t>(m_end - payload))
+    {
+        return false;
+    }
+
+    m_cursor = payload;
+    m_chunkEnd = payload + header.payloadSize;
+    m_nextChunk = m_chunkEnd;
+    m_remaining = header.count;
+    m_previous = {};
+    m_previous.time = header.baseTime;
+    return true;
+}
+
+bool TraceReader::next(TraceRecord& record)
+{
+    while (m_remaining == 0)
+    {
+        if (!nextChunk())
+        {
+            return false;
+        }
+    }
+
+    const uint8_t* in = m_cursor;
+    uint64_t tag = getVarint(in, m_chunkEnd);
+
+    record = {};
+    OutputEvent& event = record.event;
+    event.watch = static_cast<uint32_t>(tag >> 2);
+    event.element = (tag & 2) != 0;
+    event.kind = (tag & 1) != 0 ? OutputEvent::WRITE : OutputEvent::READ;
+    if (event.watch >= m_watches.size())
+    {
+        throw std::runtime_error("trace record refers to unknown watch " + std::to_string(event.watch));
+    }
+
+    record.time = m_previous.time + getVarint(in, m_chunkEnd);
+    record.tid = static_cast<pid_t>(m_previous.tid + unzigzag(getVarint(in, m_chunkEnd)));
+    record.ip = m_previous.ip + static_cast<uint64_t>(unzigzag(getVarint(in, m_chunkEnd)));
+    event.newValue = getVarint(in, m_chunkEnd);
+    if (event.kind == OutputEvent::WRITE)
+    {
+        event.oldValue = event.newValue - static_cast<uint64_t>(unzigzag(getVarint(in, m_chunkEnd)));
+    }
+    if (event.element)
+    {
+        event.offset = static_cast<uint32_t>(getVarint(in, m_chunkEnd));
+        event.size = getFixed<uint8_t>(in, m_chunkEnd);
+    }
+    else
+    {
+        event.size = static_cast<uint8_t>(m_watches[event.watch].size);
+    }
+    if (event.size > sizeof(uint64_t))
+    {
+        event.newHigh = getVarint(in, m_chunkEnd);
+        if (event.kind == OutputEvent::WRITE)
+        {
+            event.oldHigh = event.newHigh - static_cast<uint64_t>(unzigzag(getVarint(in, m_chunkEnd)));
+        }
+    }
+
+    m_cursor = in;
+    m_previous = record;
+    --m_remaining;
+    return true;
+}
+
+const std::string& TraceReader::getTarget() const
+{
+    return m_target;
+}
+
+const std::string& TraceReader::getBuildId() const
+{
+    return m_buildId;
+}
+
+const std::vector<TraceWatch>& TraceReader::getWatches() const
+{
+    return m_watches;
+}
+
+std::vector<Variable> TraceReader::getVariables() const
+{
+    std::vector<Variable> vars;
+    vars.reserve(m_watches.size());
+    for (const TraceWatch& watch : m_watches)
+    {
+        Variable& var = vars.emplace_back(watch.name, watch.isSigned);
+        var.address = watch.address;
+        var.size = watch.size;
+        var.isFloat = watch.isFloat;
+    }
+    return vars;
+}
+
+} // namespace dbg
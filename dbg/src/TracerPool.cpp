@@ -0,0 +1,699 @@
+#include "TracerPool.hpp"
+
+#include "Decoder.hpp"
+#include "ProcessMemory.hpp"
+#include "TraceBackend.hpp"
+#include "WatchpointHits.hpp"
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstring>
+#include <ctime>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+
+#include <sys/ptrace.h>
+#include <sys/syscall.h>
+#include <sys/user.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+namespace dbg
+{
+
+/// Interrupts the wait of a shard for the stops of its tracees when a thread is handed over to it
+static constexpr int WAKEUP_SIGNAL = SIGURG;
+
+/// Interval at which a shard is woken up again while threads handed to it wait to be seized, a wakeup is lost if it
+/// arrives right before the shard blocks in waitpid
+static constexpr std::chrono::microseconds HANDOVER_RETRY_INTERVAL{50};
+
+/// Signal mask of a parked thread, nothing but SIGKILL and SIGSTOP can interrupt its pause() while it is detached
+static constexpr uint64_t ALL_SIGNALS_BLOCKED = ~0ULL;
+
+/// Options of the threads seized by a shard, their clones are attached to the same shard by the kernel
+static constexpr long SHARD_OPTIONS = PTRACE_O_TRACECLONE | PTRACE_O_EXITKILL;
+
+/// x86-64 syscall instruction, a new thread stops right after the one of clone
+static constexpr std::array<uint8_t, 2> SYSCALL_INSTRUCTION{0x0f, 0x05};
+
+/// New thread on its way to another shard
+struct HandOver
+{
+    pid_t threadId;
+    user_regs_struct regs; // registers at its initial stop, restored by the new tracer
+    uint64_t sigmask;      // signal mask at its initial stop, restored by the new tracer
+};
+
+struct TracerPool::Shard
+{
+    /// Tracer side state of a traced thread
+    struct Tracee
+    {
+        util::DebugRegisterState debugRegisters{};
+        bool armed = false;
+        std::optional<user_regs_struct> regs{}; // restored at the first stop of a thread that was handed over
+        uint64_t sigmask = 0;                   // restored with regs
+    };
+
+    std::thread thread;
+    std::atomic<pid_t> threadId{0}; // kernel id of the tracer thread
+    std::unordered_map<pid_t, Tracee> tracees;
+    std::unordered_set<pid_t> unannounced; // new threads stopped before the clone event of their parent
+    std::unordered_set<pid_t> cloned;      // new threads announced by a clone event, their initial stop is pending
+    std::atomic<size_t> load{0};           // tracees including the handed over ones that are not seized yet
+
+    std::mutex inboxMutex;
+    std::vector<HandOver> inbox;
+    std::atomic<uint64_t> wakeups{0}; // a shard without tracees or with a full ring waits on it
+    timer_t retryTimer{};             // repeats the wakeup while the inbox is not empty
+    std::atomic<bool> hasRetryTimer{false};
+    std::atomic<bool> finished{false};
+
+    std::unique_ptr<ProcessMemory> memory;
+    std::unique_ptr<LiveBackend> backend; // reads the values of the hits from memory
+    std::vector<uint64_t> values; // last value read per variable, for accesses the decoder cannot classify
+
+    std::vector<ShardRecord> ring = std::vector<ShardRecord>(RING_SIZE);
+    alignas(64) std::atomic<uint64_t> head{0};
+    alignas(64) std::atomic<uint64_t> tail{0};
+    bool pushed = false; // records pushed while handling the current stop
+
+    size_t traced = 0;
+    uint64_t stops = 0;
+    uint64_t syscalls = 0;
+    uint64_t cpuTime = 0;
+    uint64_t handedOver = 0;
+};
+
+static void onWakeup(int)
+{
+}
+
+TracerPool::TracerPool(size_t shardCount, const ShardConfig& config) : m_config{config}
+{
+    for (size_t i = 0; i < std::max<size_t>(shardCount, 1); ++i)
+    {
+        m_shards.push_back(std::make_unique<Shard>());
+    }
+}
+
+TracerPool::~TracerPool()
+{
+    if (std::any_of(m_shards.begin(), m_shards.end(), [](const auto& shard) { return shard->thread.joinable(); }))
+    {
+        abort();
+    }
+
+    try
+    {
+        join();
+    }
+    catch (const std::exception&)
+    {
+        // already reported by join or superseded by the error that abandoned the pool
+    }
+}
+
+void TracerPool::start(std::function<pid_t()> launch)
+{
+    // no SA_RESTART, the signal has to interrupt waitpid
+    struct sigaction action{};
+    action.sa_handler = onWakeup;
+    sigemptyset(&action.sa_mask);
+    if (sigaction(WAKEUP_SIGNAL, &action, &m_previousAction) < 0)
+    {
+        throw std::runtime_error("sigaction failed: " + std::string(strerror(errno)));
+    }
+    m_started = true;
+
+    m_running = m_shards.size();
+    for (size_t i = 0; i < m_shards.size(); ++i)
+    {
+        m_shards[i]->thread = std::thread(&TracerPool::runShard, this, std::ref(*m_shards[i]),
+                                          i == 0 ? launch : std::function<pid_t()>{});
+    }
+}
+
+void TracerPool::runShard(Shard& shard, const std::function<pid_t()>& launch)
+{
+    shard.threadId = static_cast<pid_t>(syscall(SYS_gettid));
+    try
+    {
+        sigevent event{};
+        event.sigev_notify = SIGEV_THREAD_ID;
+        event.sigev_signo = WAKEUP_SIGNAL;
+        event._sigev_un._tid = shard.threadId;
+        if (timer_create(CLOCK_MONOTONIC, &event, &shard.retryTimer) < 0)
+        {
+            throw std::runtime_error("timer_create failed: " + std::string(strerror(errno)));
+        }
+        shard.hasRetryTimer = true;
+
+        // the first shard starts the tracee, so its main thread is attached to this thread
+        if (launch)
+        {
+            pid_t pid = launch();
+            shard.tracees[pid].armed = true;
+            shard.load = 1;
+            shard.traced = 1;
+            m_pid = pid;
+            m_launched = true;
+            m_launched.notify_all();
+            if (m_stop)
+            {
+                kill(pid, SIGKILL);
+            }
+        }
+        else
+        {
+            m_launched.wait(false);
+        }
+
+        if (m_pid != 0)
+        {
+            shard.memory = std::make_unique<ProcessMemory>(m_pid);
+            shard.backend = std::make_unique<LiveBackend>(*shard.memory, nullptr);
+            for (const Variable& var : m_config.vars)
+            {
+                shard.values.push_back(var.value.word(0));
+            }
+            traceShard(shard);
+        }
+    }
+    catch (...)
+    {
+        {
+            std::lock_guard lock(m_errorMutex);
+            if (!m_error)
+            {
+                m_error = std::current_exception();
+            }
+        }
+        abort();
+        m_launched = true;
+        m_launched.notify_all();
+    }
+
+    shard.cpuTime = util::getThreadCpuTime();
+    shard.syscalls += shard.memory ? shard.memory->getSyscalls() : 0;
+    shard.finished = true;
+    if (shard.hasRetryTimer.exchange(false))
+    {
+        timer_delete(shard.retryTimer);
+    }
+    m_running.fetch_sub(1, std::memory_order_release);
+    m_published.fetch_add(1, std::memory_order_release);
+    m_published.notify_all();
+}
+
+void TracerPool::traceShard(Shard& shard)
+{
+    while (true)
+    {
+        adopt(shard);
+
+        if (shard.tracees.empty())
+        {
+            // nothing to wait for until a thread is handed over or the process is gone
+            uint64_t wakeups = shard.wakeups.load();
+            if (m_exited || m_stop)
+            {
+                break;
+            }
+            {
+                std::lock_guard lock(shard.inboxMutex);
+                if (!shard.inbox.empty())
+                {
+                    continue;
+                }
+            }
+            shard.wakeups.wait(wakeups);
+            continue;
+        }
+
+        // stops of the threads attached by this thread only
+        int status = 0;
+        ++shard.syscalls;
+        pid_t threadId = waitpid(-1, &status, __WALL | __WNOTHREAD);
+        if (threadId < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue; // woken up to seize a thread that was handed over
+            }
+            if (errno == ECHILD)
+            {
+                shard.tracees.clear();
+                shard.load = 0;
+                continue;
+            }
+            throw std::runtime_error("waitpid failed:" + std::string(strerror(errno)));
+        }
+
+        if (WIFEXITED(status) || WIFSIGNALED(status))
+        {
+            shard.load -= shard.tracees.erase(threadId);
+            shard.cloned.erase(threadId);
+
+            // the main thread is reported last, once every other thread was reaped by its shard
+            if (threadId == m_pid)
+            {
+                m_exitStatus = status;
+                m_exited = true;
+                for (const auto& other : m_shards)
+                {
+                    wake(*other);
+                }
+            }
+            continue;
+        }
+
+        if (!WIFSTOPPED(status))
+        {
+            continue;
+        }
+
+        ++shard.stops;
+        auto tracee = shard.tracees.find(threadId);
+        if (tracee == shard.tracees.end())
+        {
+            // initial stop of a new thread, reported before the clone event it stays stopped until then
+            if (shard.cloned.erase(threadId) > 0)
+            {
+                placeNewThread(shard, threadId);
+            }
+            else
+            {
+                shard.unannounced.insert(threadId);
+            }
+            continue;
+        }
+        if (!tracee->second.armed)
+        {
+            arm(shard, threadId);
+        }
+
+        if (WSTOPSIG(status) == SIGTRAP)
+        {
+            unsigned int event = static_cast<unsigned int>(status) >> 16;
+            if (event == PTRACE_EVENT_CLONE)
+            {
+                handleClone(shard, threadId);
+            }
+            // a seized thread stopped by PTRACE_INTERRUPT only has to continue, an exiting one too
+            else if (event != PTRACE_EVENT_STOP && event != PTRACE_EVENT_EXIT)
+            {
+                handleWatchpoint(shard, threadId);
+            }
+        }
+
+        if (shard.pushed)
+        {
+            shard.pushed = false;
+            m_published.fetch_add(1, std::memory_order_release);
+            m_published.notify_one();
+        }
+
+        ++shard.syscalls;
+        if (ptrace(PTRACE_CONT, threadId, nullptr, nullptr) < 0 && errno != ESRCH)
+        {
+            throw std::runtime_error("PTRACE_CONT failed: " + std::string(strerror(errno)));
+        }
+    }
+}
+
+void TracerPool::adopt(Shard& shard)
+{
+    // the timer is stopped while the inbox is emptied, a thread handed over afterwards starts it again
+    std::vector<HandOver> handed;
+    {
+        std::lock_guard lock(shard.inboxMutex);
+        if (shard.inbox.empty())
+        {
+            return;
+        }
+        setRetryTimer(shard, false);
+        handed.swap(shard.inbox);
+    }
+
+    // the threads wait in pause(), PTRACE_INTERRUPT stops them there
+    for (const HandOver& thread : handed)
+    {
+        shard.syscalls += 2;
+        if (ptrace(PTRACE_SEIZE, thread.threadId, nullptr, SHARD_OPTIONS) < 0 ||
+            ptrace(PTRACE_INTERRUPT, thread.threadId, nullptr, nullptr) < 0)
+        {
+            --shard.load; // exited meanwhile
+            continue;
+        }
+        Shard::Tracee& tracee = shard.tracees[thread.threadId];
+        tracee.regs = thread.regs;
+        tracee.sigmask = thread.sigmask;
+        ++shard.traced;
+    }
+}
+
+void TracerPool::handleClone(Shard& shard, pid_t parent)
+{
+    // the message is an unsigned long, reading it into a pid_t overwrites the stack
+    unsigned long newTid = 0;
+    ++shard.syscalls;
+    if (ptrace(PTRACE_GETEVENTMSG, parent, nullptr, &newTid) < 0)
+    {
+        throw std::runtime_error("PTRACE_GETEVENTMSG failed: " + std::string(strerror(errno)));
+    }
+    auto threadId = static_cast<pid_t>(newTid);
+
+    // the thread is placed at its initial stop, waiting for it here would hold the other tracees of the shard
+    if (shard.unannounced.erase(threadId) > 0)
+    {
+        placeNewThread(shard, threadId);
+    }
+    else
+    {
+        shard.cloned.insert(threadId);
+    }
+}
+
+void TracerPool::placeNewThread(Shard& shard, pid_t threadId)
+{
+    // least loaded shard, ties stay with the tracer of the parent
+    Shard* target = &shard;
+    for (const auto& other : m_shards)
+    {
+        if (!other->finished && other->load < target->load)
+        {
+            target = other.get();
+        }
+    }
+
+    if (target != &shard)
+    {
+        user_regs_struct regs{};
+        ++shard.syscalls;
+        if (ptrace(PTRACE_GETREGS, threadId, nullptr, &regs) < 0)
+        {
+            throw std::runtime_error("PTRACE_GETREGS failed: " + std::string(strerror(errno)));
+        }
+
+        // the thread can only be parked if it returns from the syscall instruction of clone
+        std::array<uint8_t, SYSCALL_INSTRUCTION.size()> code{};
+        if (shard.memory->read(regs.rip - code.size(), code.data(), code.size()) && code == SYSCALL_INSTRUCTION)
+        {
+            handOver(shard, *target, threadId, regs);
+            return;
+        }
+    }
+
+    // debug registers are not inherited by new threads
+    shard.tracees[threadId];
+    ++shard.load;
+    ++shard.traced;
+    arm(shard, threadId);
+
+    ++shard.syscalls;
+    if (ptrace(PTRACE_CONT, threadId, nullptr, nullptr) < 0 && errno != ESRCH)
+    {
+        throw std::runtime_error("PTRACE_CONT failed: " + std::string(strerror(errno)));
+    }
+}
+
+void TracerPool::handOver(Shard& owner, Shard& target, pid_t threadId, user_regs_struct regs)
+{
+    // run the syscall instruction again as pause(), so the detached thread waits for its new tracer
+    // instead of running without watchpoints, orig_rax -1 keeps the kernel from restarting a syscall
+    user_regs_struct parked = regs;
+    parked.rip -= SYSCALL_INSTRUCTION.size();
+    parked.rax = SYS_pause;
+    parked.orig_rax = static_cast<unsigned long long>(-1);
+    regs.orig_rax = static_cast<unsigned long long>(-1);
+
+    // a signal handler would interrupt pause() and run the thread at the return of clone with -EINTR,
+    // so every signal is blocked until the new tracer restores the mask together with the registers
+    uint64_t sigmask = 0;
+    owner.syscalls += 4;
+    if (ptrace(PTRACE_GETSIGMASK, threadId, sizeof(sigmask), &sigmask) < 0 ||
+        ptrace(PTRACE_SETSIGMASK, threadId, sizeof(ALL_SIGNALS_BLOCKED), &ALL_SIGNALS_BLOCKED) < 0)
+    {
+        throw std::runtime_error("PTRACE_SETSIGMASK failed: " + std::string(strerror(errno)));
+    }
+    if (ptrace(PTRACE_SETREGS, threadId, nullptr, &parked) < 0)
+    {
+        throw std::runtime_error("PTRACE_SETREGS failed: " + std::string(strerror(errno)));
+    }
+    if (ptrace(PTRACE_DETACH, threadId, nullptr, nullptr) < 0)
+    {
+        throw std::runtime_error("PTRACE_DETACH failed: " + std::string(strerror(errno)));
+    }
+    ++owner.handedOver;
+
+    // the owner goes back to its own tracees, the timer of the target repeats the wakeup until it seized the thread
+    ++target.load;
+    {
+        std::lock_guard lock(target.inboxMutex);
+        target.inbox.push_back({threadId, regs, sigmask});
+        setRetryTimer(target, true);
+    }
+    wake(target);
+}
+
+void TracerPool::setRetryTimer(Shard& shard, bool armed)
+{
+    // not created yet, the shard then adopts its inbox before it waits for the first time
+    if (!shard.hasRetryTimer)
+    {
+        return;
+    }
+
+    itimerspec spec{};
+    if (armed)
+    {
+        spec.it_interval.tv_nsec = std::chrono::nanoseconds(HANDOVER_RETRY_INTERVAL).count();
+        spec.it_value = spec.it_interval;
+    }
+    timer_settime(shard.retryTimer, 0, &spec, nullptr);
+}
+
+void TracerPool::arm(Shard& shard, pid_t threadId)
+{
+    Shard::Tracee& tracee = shard.tracees.at(threadId);
+    if (tracee.regs)
+    {
+        shard.syscalls += 2;
+        if (ptrace(PTRACE_SETREGS, threadId, nullptr, &*tracee.regs) < 0 ||
+            ptrace(PTRACE_SETSIGMASK, threadId, sizeof(tracee.sigmask), &tracee.sigmask) < 0)
+        {
+            throw std::runtime_error("PTRACE_SETREGS failed: " + std::string(strerror(errno)));
+        }
+        tracee.regs.reset();
+    }
+
+    shard.syscalls += util::setHardwareWatchpoints(threadId, m_config.slots, tracee.debugRegisters);
+    tracee.armed = true;
+}
+
+void TracerPool::handleWatchpoint(Shard& shard, pid_t threadId)
+{
+    // kernels since 5.11 reset DR6 on every debug exception, so it is only read once the signal info is checked
+    uint64_t dr6 = util::getDebugStatus(threadId, m_config.resetDebugStatus);
+    shard.syscalls += 2;
+    ShardRecord record{util::getMonotonicTime(), 0, 0, static_cast<uint32_t>(threadId), 0, 0};
+
+    bool dualRegister = m_config.mode == WatchMode::DUAL_REGISTER;
+    WatchpointHits hits;
+    if (!readWatchpointHits(dr6, m_config.slots, m_config.slotVars, m_config.vars, m_config.mode, *shard.backend,
+                            hits))
+    {
+        throw std::runtime_error("Reading process memory failed: " + std::string(strerror(errno)));
+    }
+    if (hits.count == 0)
+    {
+        return;
+    }
+
+    user_regs_struct regs{};
+    if (!dualRegister || m_config.captureIp)
+    {
+        ++shard.syscalls;
+        if (ptrace(PTRACE_GETREGS, threadId, nullptr, &regs) < 0)
+        {
+            throw std::runtime_error("PTRACE_GETREGS failed: " + std::string(strerror(errno)));
+        }
+        record.ip = regs.rip;
+    }
+
+    for (size_t j = 0; j < hits.count; ++j)
+    {
+        const Variable& var = m_config.vars[hits.vars[j]];
+        uint64_t value = hits.values[j].word(0);
+        auto event = hits.writes[j] ? util::WatchpointEvent::WRITE : util::WatchpointEvent::READ;
+        if (!dualRegister)
+        {
+            std::array<uint8_t, 2 * sizeof(long)> code{};
+            event = util::classifyTrappedAccess(shard.memory->readPreceding(regs.rip, code), regs, var.address,
+                                                var.size);
+
+            // instruction could not be decoded, fall back to comparing with the last value this shard read
+            if (event == util::WatchpointEvent::OTHER)
+            {
+                event = value == shard.values[hits.vars[j]] ? util::WatchpointEvent::READ
+                                                            : util::WatchpointEvent::WRITE;
+            }
+        }
+
+        record.value = value;
+        record.watch = static_cast<uint8_t>(hits.vars[j]);
+        record.event = static_cast<uint8_t>(event);
+        push(shard, record);
+        shard.values[hits.vars[j]] = value;
+    }
+}
+
+void TracerPool::push(Shard& shard, const ShardRecord& record)
+{
+    // the tracee stays stopped while the consumer falls behind, the full ring is published so the consumer
+    // drains it and wakes the shard
+    uint64_t head = shard.head.load(std::memory_order_relaxed);
+    while (true)
+    {
+        uint64_t wakeups = shard.wakeups.load(std::memory_order_acquire);
+        if (head - shard.tail.load(std::memory_order_acquire) < RING_SIZE)
+        {
+            break;
+        }
+        if (m_stop)
+        {
+            return;
+        }
+        if (shard.pushed)
+        {
+            shard.pushed = false;
+            m_published.fetch_add(1, std::memory_order_release);
+            m_published.notify_one();
+        }
+        shard.wakeups.wait(wakeups, std::memory_order_acquire);
+    }
+
+    shard.ring[head & (RING_SIZE - 1)] = record;
+    shard.head.store(head + 1, std::memory_order_release);
+    shard.pushed = true;
+}
+
+void TracerPool::wake(Shard& shard)
+{
+    shard.wakeups.fetch_add(1);
+    shard.wakeups.notify_all();
+
+    pid_t threadId = shard.threadId;
+    if (threadId != 0 && !shard.finished)
+    {
+        syscall(SYS_tgkill, getpid(), threadId, WAKEUP_SIGNAL);
+    }
+}
+
+void TracerPool::abort()
+{
+    m_stop = true;
+    if (pid_t pid = m_pid; pid != 0)
+    {
+        kill(pid, SIGKILL);
+    }
+    for (const auto& shard : m_shards)
+    {
+        wake(*shard);
+    }
+}
+
+bool TracerPool::drain(std::vector<ShardRecord>& records)
+{
+    while (true)
+    {
+        // records pushed before a shard finished are drained before the end is reported
+        uint64_t published = m_published.load(std::memory_order_acquire);
+        bool finished = m_running.load(std::memory_order_acquire) == 0;
+
+        for (const auto& shard : m_shards)
+        {
+            uint64_t tail = shard->tail.load(std::memory_order_relaxed);
+            uint64_t head = shard->head.load(std::memory_order_acquire);
+            for (; tail != head; ++tail)
+            {
+                records.push_back(shard->ring[tail & (RING_SIZE - 1)]);
+            }
+            if (tail != shard->tail.load(std::memory_order_relaxed))
+            {
+                shard->tail.store(tail, std::memory_order_release);
+                shard->wakeups.fetch_add(1, std::memory_order_release);
+                shard->wakeups.notify_all();
+            }
+        }
+
+        if (!records.empty())
+        {
+            // merge the shards by time of the hit
+            std::stable_sort(records.begin(), records.end(),
+                             [](const ShardRecord& lhs, const ShardRecord& rhs) { return lhs.time < rhs.time; });
+            return true;
+        }
+        if (finished)
+        {
+            return false;
+        }
+        m_published.wait(published, std::memory_order_acquire);
+    }
+}
+
+void TracerPool::join()
+{
+    for (const auto& shard : m_shards)
+    {
+        if (shard->thread.joinable())
+        {
+            shard->thread.join();
+        }
+    }
+
+    if (m_started)
+    {
+        sigaction(WAKEUP_SIGNAL, &m_previousAction, nullptr);
+        m_started = false;
+    }
+
+    if (m_error)
+    {
+        std::rethrow_exception(std::exchange(m_error, nullptr));
+    }
+}
+
+pid_t TracerPool::getPid() const
+{
+    return m_pid;
+}
+
+int TracerPool::getExitStatus() const
+{
+    return m_exitStatus;
+}
+
+PoolStats TracerPool::getStats() const
+{
+    PoolStats stats{};
+    for (const auto& shard : m_shards)
+    {
+        stats.stops += shard->stops;
+        stats.syscalls += shard->syscalls;
+        stats.cpuTime += shard->cpuTime;
+        stats.handedOver += shard->handedOver;
+        stats.tracedThreads.push_back(shard->traced);
+    }
+    return stats;
+}
+
+} // namespace dbg
@@ -0,0 +1,128 @@
+#pragma once
+
+#include "Debugger.hpp"
+#include "Util.hpp"
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <signal.h>
+#include <sys/types.h>
+#include <sys/user.h>
+#include <vector>
+
+namespace dbg
+{
+
+/// Watchpoint hit collected by a tracer thread, values of debug register watches fit into one word
+struct ShardRecord
+{
+    uint64_t time; // CLOCK_MONOTONIC nanoseconds
+    uint64_t ip;   // address of the instruction following the access, 0 if not captured
+    uint64_t value;
+    uint32_t tid;
+    uint8_t watch; // index of the variable
+    uint8_t event; // util::WatchpointEvent
+};
+
+/// Debug register setup shared by the tracer threads, fixed once the variables are resolved
+struct ShardConfig
+{
+    std::vector<Variable> vars;
+    std::vector<size_t> slotVars; // variable watched by each slot
+    std::vector<util::DebugRegisterSlot> slots;
+    WatchMode mode = WatchMode::DUAL_REGISTER;
+    bool captureIp = false;       // read rip on every hit in dual register mode
+    bool resetDebugStatus = true; // clear DR6 after every hit
+};
+
+/// Counters of the tracer threads
+struct PoolStats
+{
+    uint64_t stops = 0;
+    uint64_t syscalls = 0;
+    uint64_t cpuTime = 0;              // CPU time of all tracer threads in nanoseconds
+    uint64_t handedOver = 0;           // new threads moved to another tracer thread
+    std::vector<size_t> tracedThreads; // threads traced by each tracer thread over the run
+};
+
+/// Traces the threads of one process from several tracer threads (shards). ptrace ties a tracee to the thread
+/// that attached it, so every shard owns a subset of the tracee threads and waits for their stops only (__WNOTHREAD).
+/// The kernel attaches a new thread to the tracer of its parent, if another shard traces fewer threads the new
+/// thread is parked in pause() before it runs, detached and seized by that shard, which restores its registers.
+/// Hits are read by the owning shard while its tracee is stopped and passed to the consumer through one
+/// lock-free single producer / single consumer ring per shard
+class TracerPool
+{
+    struct Shard;
+
+    const ShardConfig& m_config;
+    std::vector<std::unique_ptr<Shard>> m_shards;
+    std::atomic<pid_t> m_pid{0};
+    std::atomic<bool> m_launched{false};
+    std::atomic<bool> m_exited{false};    // the main thread of the tracee exited
+    std::atomic<bool> m_stop{false};      // tracing failed or was abandoned, the tracee is killed
+    std::atomic<size_t> m_running{0};     // shards whose thread did not finish yet
+    std::atomic<uint64_t> m_published{0}; // stops that pushed records, the consumer waits on it
+    int m_exitStatus = 0;                 // wait status of the main thread
+
+    std::mutex m_errorMutex;
+    std::exception_ptr m_error;
+    bool m_started = false; // the wakeup handler is installed
+    struct sigaction m_previousAction{};
+
+    void runShard(Shard& shard, const std::function<pid_t()>& launch);
+    void traceShard(Shard& shard);
+    void adopt(Shard& shard);
+    void handleClone(Shard& shard, pid_t parent);
+    void placeNewThread(Shard& shard, pid_t threadId);
+    void handOver(Shard& owner, Shard& target, pid_t threadId, user_regs_struct regs);
+    void setRetryTimer(Shard& shard, bool armed);
+    void handleWatchpoint(Shard& shard, pid_t threadId);
+    void arm(Shard& shard, pid_t threadId);
+    void push(Shard& shard, const ShardRecord& record);
+    void wake(Shard& shard);
+    void abort();
+
+  public:
+    /// Records a shard can hold before its tracees stay stopped until the consumer catches up, a power of two
+    static constexpr size_t RING_SIZE = 16384;
+
+    /// @param shardCount number of tracer threads
+    /// @param config debug register setup, filled by the launch function of start
+    TracerPool(size_t shardCount, const ShardConfig& config);
+    ~TracerPool();
+
+    TracerPool(const TracerPool&) = delete;
+    TracerPool(TracerPool&&) = delete;
+    TracerPool& operator=(const TracerPool&) = delete;
+    TracerPool& operator=(TracerPool&&) = delete;
+
+    /// Start the tracer threads, the first one calls launch and owns the main thread of the tracee
+    /// @param launch starts the tracee attached to the calling thread, arms its main thread, fills the config
+    /// and returns the pid
+    void start(std::function<pid_t()> launch);
+
+    /// Move the records of all shards to records, blocks until there is at least one
+    /// @return false once every shard finished and all records were drained
+    bool drain(std::vector<ShardRecord>& records);
+
+    /// Wait for the tracer threads
+    /// @throws the first error of a tracer thread
+    void join();
+
+    /// Process of the tracee, 0 until launch returned
+    [[nodiscard]] pid_t getPid() const;
+
+    /// Wait status of the main thread of the tracee, valid after join
+    [[nodiscard]] int getExitStatus() const;
+
+    /// Counters of all tracer threads, valid after join
+    [[nodiscard]] PoolStats getStats() const;
+};
+
+} // namespace dbg
@@ -0,0 +1,205 @@
+#include "Unwinder.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cstring>
+#include <optional>
+#include <stdexcept>
+
+#include <sys/ptrace.h>
+#include <sys/uio.h>
+#include <sys/user.h>
+
+namespace dbg
+{
+
+/// Granularity of the remote reads, a read stops at the first unmapped page instead of failing
+static constexpr uint64_t REMOTE_PAGE_SIZE = 4096;
+
+Unwinder::Unwinder(pid_t pid) : m_pid{pid}, m_window(STACK_WINDOW)
+{
+}
+
+void Unwinder::unwind(pid_t threadId, size_t depth, std::vector<uint64_t>& frames)
+{
+    frames.clear();
+    if (depth == 0)
+    {
+        return;
+    }
+
+    ++m_syscalls;
+    user_regs_struct regs{};
+    if (ptrace(PTRACE_GETREGS, threadId, nullptr, &regs) < 0)
+    {
+        throw std::runtime_error("PTRACE_GETREGS failed: " + std::string(strerror(errno)));
+    }
+    frames.push_back(regs.rip);
+    readWindow(threadId, regs.rsp);
+
+    // the CFA of a function that keeps a frame pointer is rbp + 16 once its prologue ran
+    const CallFrameTable* table = findTable(regs.rip);
+    std::optional<FrameRule> rule = table ? table->find(regs.rip) : std::nullopt;
+    if (!rule || rule->cfaFromFramePointer)
+    {
+        walkFramePointers(regs.rbp, depth, frames);
+    }
+    else
+    {
+        walkCallFrames(regs.rip, regs.rsp, regs.rbp, depth, frames);
+    }
+}
+
+void Unwinder::readWindow(pid_t threadId, uint64_t stackPointer)
+{
+    // one remote element per page, so the read ends at the top of the stack instead of failing
+    std::array<iovec, STACK_WINDOW / REMOTE_PAGE_SIZE + 1> remote{};
+    size_t count = 0;
+    for (uint64_t address = stackPointer; address < stackPointer + STACK_WINDOW && count < remote.size(); ++count)
+    {
+        uint64_t next = std::min((address & ~(REMOTE_PAGE_SIZE - 1)) + REMOTE_PAGE_SIZE, stackPointer + STACK_WINDOW);
+        remote[count] = {reinterpret_cast<void*>(address), next - address};
+        address = next;
+    }
+
+    ++m_syscalls;
+    iovec local{m_window.data(), m_window.size()};
+    ssize_t read = process_vm_readv(threadId, &local, 1, remote.data(), count, 0);
+    m_windowStart = stackPointer;
+    m_windowSize = read > 0 ? static_cast<size_t>(read) : 0;
+}
+
+bool Unwinder::load(uint64_t address, uint64_t& value) const
+{
+    if (address < m_windowStart || address - m_windowStart + sizeof(value) > m_windowSize)
+    {
+        return false;
+    }
+    memcpy(&value, m_window.data() + (address - m_windowStart), sizeof(value));
+    return true;
+}
+
+void Unwinder::walkFramePointers(uint64_t framePointer, size_t depth, std::vector<uint64_t>& frames) const
+{
+    // each frame holds the caller's rbp followed by the return address, the chain grows towards the stack top
+    while (frames.size() < depth)
+    {
+        uint64_t next = 0;
+        uint64_t returnAddress = 0;
+        if (framePointer % sizeof(uint64_t) != 0 || !load(framePointer, next) ||
+            !load(framePointer + sizeof(uint64_t), returnAddress) || returnAddress == 0)
+        {
+            break;
+        }
+
+        frames.push_back(returnAddress);
+        if (next <= framePointer)
+        {
+            break;
+        }
+        framePointer = next;
+    }
+}
+
+void Unwinder::walkCallFrames(uint64_t pc, uint64_t stackPointer, uint64_t framePointer, size_t depth,
+                              std::vector<uint64_t>& frames)
+{
+    // a return address may lie past the end of a function calling a noreturn one, callers are looked up at pc - 1
+    bool isCaller = false;
+    while (frames.size() < depth)
+    {
+        uint64_t lookup = isCaller ? pc - 1 : pc;
+        const CallFrameTable* table = findTable(lookup);
+        std::optional<FrameRule> rule = table ? table->find(lookup) : std::nullopt;
+        if (!rule)
+        {
+            break;
+        }
+
+        uint64_t cfa = (rule->cfaFromFramePointer ? framePointer : stackPointer) + rule->cfaOffset;
+        uint64_t returnAddress = 0;
+        if (!load(cfa + rule->returnOffset, returnAddress) || returnAddress == 0)
+        {
+            break;
+        }
+        if (rule->framePointerSaved && !load(cfa + rule->framePointerOffset, framePointer))
+        {
+            break;
+        }
+
+        frames.push_back(returnAddress);
+        pc = returnAddress;
+        stackPointer = cfa;
+        isCaller = true;
+    }
+}
+
+const CallFrameTable* Unwinder::findTable(uint64_t pc)
+{
+    // libraries loaded since the last read show up with the next address that lies outside every known object
+    for (bool refreshed : {false, true})
+    {
+        if (refreshed || m_objects.empty())
+        {
+            refreshObjects();
+        }
+
+        auto next = std::upper_bound(m_objects.begin(), m_objects.end(), pc,
+                                     [](uint64_t value, const Object& object) { return value < object.file.start; });
+        if (next == m_objects.begin())
+        {
+            continue;
+        }
+
+        Object& object = *std::prev(next);
+        if (!object.indexed)
+        {
+            object.indexed = true;
+            try
+            {
+                object.table = std::make_unique<CallFrameTable>(object.file.path, object.file.start);
+            }
+            catch (const std::runtime_error&)
+            {
+                // not an elf file
+            }
+        }
+
+        if (object.table && object.table->contains(pc))
+        {
+            return object.table.get();
+        }
+    }
+    return nullptr;
+}
+
+void Unwinder::refreshObjects()
+{
+    ++m_syscalls;
+    std::vector<Object> objects;
+    for (util::MappedFile& file : util::getMappedFiles(m_pid))
+    {
+        // objects that are still mapped at the same address keep their index
+        auto known = std::find_if(m_objects.begin(), m_objects.end(), [&](const Object& object)
+                                  { return object.file.start == file.start && object.file.path == file.path; });
+        if (known != m_objects.end())
+        {
+            objects.push_back(std::move(*known));
+        }
+        else
+        {
+            objects.push_back({std::move(file), nullptr, false});
+        }
+    }
+
+    std::sort(objects.begin(), objects.end(),
+              [](const Object& lhs, const Object& rhs) { return lhs.file.start < rhs.file.start; });
+    m_objects = std::move(objects);
+}
+
+uint64_t Unwinder::getSyscalls() const
+{
+    return m_syscalls;
+}
+
+} // namespace dbg
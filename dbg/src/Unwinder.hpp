@@ -0,0 +1,62 @@
+#pragma once
+
+#include "CallFrameTable.hpp"
+#include "Util.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <sys/types.h>
+#include <vector>
+
+namespace dbg
+{
+
+/// Captures the call stack of a stopped thread. rip, rsp and rbp come from one PTRACE_GETREGS and the stack window
+/// above rsp is copied with one process_vm_readv, the frames are then walked in the copy. The frame pointer chain
+/// is followed if the function of rip keeps a frame pointer (its CFA is based on rbp), only otherwise every frame
+/// is unwound with the .eh_frame call frame information of its object
+class Unwinder
+{
+    /// Mapped object with its call frame information, indexed on first use
+    struct Object
+    {
+        util::MappedFile file;
+        std::unique_ptr<CallFrameTable> table;
+        bool indexed = false;
+    };
+
+    pid_t m_pid;
+    std::vector<uint8_t> m_window;
+    uint64_t m_windowStart = 0;
+    size_t m_windowSize = 0;
+    std::vector<Object> m_objects; // sorted by start
+    uint64_t m_syscalls = 0;
+
+    void readWindow(pid_t threadId, uint64_t stackPointer);
+    [[nodiscard]] bool load(uint64_t address, uint64_t& value) const;
+    const CallFrameTable* findTable(uint64_t pc);
+    void refreshObjects();
+
+    void walkFramePointers(uint64_t framePointer, size_t depth, std::vector<uint64_t>& frames) const;
+    void walkCallFrames(uint64_t pc, uint64_t stackPointer, uint64_t framePointer, size_t depth,
+                        std::vector<uint64_t>& frames);
+
+  public:
+    /// Bytes of the stack above rsp copied per capture, frames beyond it are cut off
+    static constexpr size_t STACK_WINDOW = 32 * 1024;
+
+    /// @param pid id of the traced process, its mapped objects are read on first use
+    explicit Unwinder(pid_t pid);
+
+    /// Capture the call stack of a stopped thread
+    /// @param threadId stopped thread
+    /// @param depth maximum number of frames
+    /// @param frames filled with rip followed by the return addresses, innermost first
+    void unwind(pid_t threadId, size_t depth, std::vector<uint64_t>& frames);
+
+    /// Syscalls made for the captures, including the reads of /proc/<pid>/maps
+    [[nodiscard]] uint64_t getSyscalls() const;
+};
+
+} // namespace dbg
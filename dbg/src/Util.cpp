@@ -1,17 +1,23 @@
 #include "Util.hpp"
 
+#include <csignal>
+#include <cstdio>
 #include <cstring>
+#include <ctime>
 #include <filesystem>
 #include <fstream>
 #include <sstream>
 #include <stdexcept>
+#include <unordered_set>
 
 #include <elf.h>
 #include <fcntl.h>
 #include <sys/mman.h>
 #include <sys/ptrace.h>
 #include <sys/stat.h>
+#include <sys/uio.h>
 #include <sys/user.h>
+#include <sys/wait.h>
 #include <unistd.h>
 
 namespace dbg::util
@@ -53,7 +59,7 @@ std::string getExecErrnoMessage()
     }
 }
 
-uintptr_t getBaseAddress(pid_t pid, const std::string& exePath)
+std::vector<MappedFile> getMappedFiles(pid_t pid)
 {
     std::string mapsPath = "/proc/" + std::to_string(pid) + "/maps";
     std::ifstream maps(mapsPath);
@@ -62,12 +68,20 @@ uintptr_t getBaseAddress(pid_t pid, const std::string& exePath)
         throw std::runtime_error("failed to open" + mapsPath);
     }
 
+    // a file has one line per mapped segment, only its first line is canonicalized
+    std::vector<MappedFile> files;
+    std::unordered_set<std::string> seen; // "device inode"
     std::string line;
     while (std::getline(maps, line))
     {
         std::istringstream iss(line);
         std::string addr, perms, offset, dev, inode, path;
-        if (!(iss >> addr >> perms >> offset >> dev >> inode))
+        if (!(iss >> addr >> perms >> offset >> dev >> inode) || inode == "0")
+        {
+            continue; // anonymous mapping, heap or stack
+        }
+
+        if (!seen.insert(dev + " " + inode).second)
         {
             continue;
         }
@@ -78,196 +92,345 @@ uintptr_t getBaseAddress(pid_t pid, const std::string& exePath)
             path.erase(0, path.find_first_not_of(' '));
         }
 
-        try
+        // use fs::canonical to resolve relative paths and links, deleted files can not be resolved
+        std::error_code error;
+        fs::path canonical = fs::canonical(fs::path(path), error);
+        if (error)
         {
-            // use fs::canonical to resolve relative paths
-            fs::path exeCanonical = fs::canonical(fs::path(exePath));
-            fs::path mapCanonical = fs::canonical(fs::path(path));
-
-            if (exeCanonical == mapCanonical)
-            {
-                size_t dash = addr.find('-'); // start addr is before '-'
-                std::string startAddress = addr.substr(0, dash);
-                return std::stoull(startAddress, nullptr, 16);
-            }
+            continue;
         }
-        catch (std::exception& e) // fs::canonical may throw if path does not exist
+
+        size_t dash = addr.find('-'); // start addr is before '-'
+        files.push_back({std::stoull(addr.substr(0, dash), nullptr, 16), canonical.string()});
+    }
+    return files;
+}
+
+uintptr_t getBaseAddress(pid_t pid, const std::string& exePath)
+{
+    std::error_code error;
+    fs::path exeCanonical = fs::canonical(fs::path(exePath), error);
+    for (const MappedFile& file : getMappedFiles(pid))
+    {
+        if (!error && file.path == exeCanonical)
         {
+            return file.start;
         }
     }
 
     throw std::runtime_error("could not find mappings for " + exePath);
 }
 
-std::pair<uint64_t, uint64_t> findSymbol(const std::string& exePath, const std::string& symbolName)
+uintptr_t getAuxiliaryValue(pid_t pid, uint64_t type)
 {
-    int fd = open(exePath.c_str(), O_RDONLY);
-    if (fd < 0)
+    std::string auxvPath = "/proc/" + std::to_string(pid) + "/auxv";
+    std::ifstream auxv(auxvPath, std::ios::binary);
+    if (!auxv)
     {
-        throw std::runtime_error("Could not open " + exePath);
+        throw std::runtime_error("failed to open " + auxvPath);
     }
 
-    struct stat st{};
-    int ret = fstat(fd, &st);
-    if (ret < 0)
+    Elf64_auxv_t entry{};
+    while (auxv.read(reinterpret_cast<char*>(&entry), sizeof(entry)) && entry.a_type != AT_NULL)
     {
-        close(fd);
-        throw std::runtime_error("Fstat failed: " + exePath);
+        if (entry.a_type == type)
+        {
+            return entry.a_un.a_val;
+        }
     }
+    return 0;
+}
 
-    void* map = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
-    if (map == MAP_FAILED)
+std::vector<pid_t> getThreadIds(pid_t pid)
+{
+    std::string taskPath = "/proc/" + std::to_string(pid) + "/task";
+    std::error_code error;
+    fs::directory_iterator it(taskPath, error);
+    if (error)
     {
-        close(fd);
-        throw std::runtime_error("Mmap failed: " + exePath);
+        throw std::runtime_error("failed to open " + taskPath + ": " + error.message());
     }
 
-    const char* base = reinterpret_cast<const char*>(map);
-    const Elf64_Ehdr* elfHdr = reinterpret_cast<const Elf64_Ehdr*>(base);
-
-    // check elf magic
-    if (memcmp(elfHdr->e_ident, ELFMAG, SELFMAG) != 0)
+    std::vector<pid_t> threadIds;
+    for (const fs::directory_entry& entry : it)
     {
-        munmap(map, st.st_size);
-        close(fd);
-        throw std::runtime_error(exePath + " is not an ELF file");
+        threadIds.push_back(static_cast<pid_t>(std::stol(entry.path().filename().string())));
     }
+    return threadIds;
+}
 
-    // setup section headers
-    const Elf64_Shdr* elfSecHdr = reinterpret_cast<const Elf64_Shdr*>(base + elfHdr->e_shoff);
-    const Elf64_Shdr& secHdrStrTableHdr = elfSecHdr[elfHdr->e_shstrndx];
-    const char* secHdrStrTable = base + secHdrStrTableHdr.sh_offset;
-
-    // find .symtab and .strtab section headers
-    const Elf64_Shdr* symtabHdr = nullptr;
-    const Elf64_Shdr* strtabHdr = nullptr;
-    for (int i = 0; i < elfHdr->e_shnum; ++i)
+std::string getBuildId(const std::string& exePath)
+{
+    int fd = open(exePath.c_str(), O_RDONLY);
+    if (fd < 0)
     {
-        const char* name = secHdrStrTable + elfSecHdr[i].sh_name;
-
-        if (strcmp(name, ".symtab") == 0)
-            symtabHdr = &elfSecHdr[i];
-        if (strcmp(name, ".strtab") == 0)
-            strtabHdr = &elfSecHdr[i];
+        return {};
     }
 
-    if (!symtabHdr || !strtabHdr)
+    struct stat st{};
+    if (fstat(fd, &st) < 0 || static_cast<size_t>(st.st_size) < sizeof(Elf64_Ehdr))
     {
-        munmap(map, st.st_size);
         close(fd);
-        throw std::runtime_error(".symtab or .strtab section was not found: " + exePath);
+        return {};
+    }
+
+    void* map = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+    {
+        return {};
     }
 
-    // interpret the symbol table as an array of symbols
-    const Elf64_Sym* symbols = reinterpret_cast<const Elf64_Sym*>(base + symtabHdr->sh_offset);
-    size_t symbolCount = symtabHdr->sh_size / sizeof(Elf64_Sym);
-    const char* stringTable = base + strtabHdr->sh_offset;
+    const char* base = reinterpret_cast<const char*>(map);
+    const Elf64_Ehdr* elfHdr = reinterpret_cast<const Elf64_Ehdr*>(base);
+    const Elf64_Shdr* elfSecHdr = reinterpret_cast<const Elf64_Shdr*>(base + elfHdr->e_shoff);
 
-    // search symbol table entries
-    for (size_t i = 0; i < symbolCount; ++i)
+    std::string buildId;
+    for (int i = 0; memcmp(elfHdr->e_ident, ELFMAG, SELFMAG) == 0 && i < elfHdr->e_shnum && buildId.empty(); ++i)
     {
-        std::string name = stringTable + symbols[i].st_name; // st_name is offset to stringTable
-        if (name == symbolName) // ignore c++ name mangling (see README on global variables)
+        if (elfSecHdr[i].sh_type != SHT_NOTE)
+        {
+            continue;
+        }
+
+        // notes are 4 byte aligned: header, name ("GNU\0") and descriptor (the id)
+        size_t offset = 0;
+        while (offset + sizeof(Elf64_Nhdr) <= elfSecHdr[i].sh_size)
         {
-            uint64_t val = symbols[i].st_value; // symbols link-time offset
-            uint64_t size = symbols[i].st_size;
-            munmap(map, st.st_size);
-            close(fd);
-            return {val, size};
+            const char* note = base + elfSecHdr[i].sh_offset + offset;
+            const Elf64_Nhdr* noteHdr = reinterpret_cast<const Elf64_Nhdr*>(note);
+            size_t nameSize = (noteHdr->n_namesz + 3) & ~size_t{3};
+            size_t descSize = (noteHdr->n_descsz + 3) & ~size_t{3};
+
+            if (noteHdr->n_type == NT_GNU_BUILD_ID && noteHdr->n_namesz == 4 &&
+                memcmp(note + sizeof(Elf64_Nhdr), "GNU", 4) == 0)
+            {
+                static constexpr char HEX[] = "0123456789abcdef";
+                const auto* id = reinterpret_cast<const uint8_t*>(note + sizeof(Elf64_Nhdr) + nameSize);
+                for (size_t j = 0; j < noteHdr->n_descsz; ++j)
+                {
+                    buildId += HEX[id[j] >> 4];
+                    buildId += HEX[id[j] & 0xF];
+                }
+                break;
+            }
+            offset += sizeof(Elf64_Nhdr) + nameSize + descSize;
         }
     }
 
     munmap(map, st.st_size);
-    close(fd);
-    throw std::runtime_error("Symbol not found: " + symbolName);
+    return buildId;
 }
 
-/// RW Access type for hardware debug registers
-enum AccessType
+uint64_t getMonotonicTime()
 {
-    ON_EXECUTION = 0,
-    ON_DATA_WRITE = 1,
-    ON_READ_WRITE = 3
-};
+    timespec now{};
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return static_cast<uint64_t>(now.tv_sec) * 1'000'000'000ULL + static_cast<uint64_t>(now.tv_nsec);
+}
 
-void setHardwareWatchpoint(pid_t pid, uintptr_t addr, size_t size)
+uint64_t getThreadCpuTime()
 {
-    //  Note: two debug registers are used, first set to write-only and second to read-write, this way:
-    //  read = read-write && !write-only
-    //  write = read-write && write-only
+    timespec now{};
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &now);
+    return static_cast<uint64_t>(now.tv_sec) * 1'000'000'000ULL + static_cast<uint64_t>(now.tv_nsec);
+}
 
-    // set address to DR0
-    long ret = ptrace(PTRACE_POKEUSER, pid, offsetof(struct user, u_debugreg[0]), reinterpret_cast<void*>(addr));
-    if (ret == -1)
+bool readProcessMemory(pid_t pid, uintptr_t addr, void* dst, size_t size)
+{
+    iovec local{dst, size};
+    iovec remote{reinterpret_cast<void*>(addr), size};
+    return process_vm_readv(pid, &local, 1, &remote, 1, 0) == static_cast<ssize_t>(size);
+}
+
+bool fitsDebugRegister(uintptr_t addr, size_t size)
+{
+    return (size == 1 || size == 2 || size == 4 || size == 8) && addr % size == 0;
+}
+
+std::vector<DebugRegisterSlot> planWatch(uintptr_t addr, size_t size)
+{
+    std::vector<DebugRegisterSlot> slots;
+    uintptr_t end = addr + size;
+    while (addr < end)
     {
-        throw std::runtime_error("PTRACE_POKEUSER DR0 failed: " + std::string(strerror(errno)));
+        size_t length = sizeof(uint64_t);
+        while (addr % length != 0 || addr + length > end)
+        {
+            length /= 2;
+        }
+        slots.push_back({addr, length, ON_READ_WRITE});
+        addr += length;
     }
+    return slots;
+}
 
-    // set address to DR1
-    ret = ptrace(PTRACE_POKEUSER, pid, offsetof(struct user, u_debugreg[1]), reinterpret_cast<void*>(addr));
-    if (ret == -1)
+size_t setHardwareWatchpoints(pid_t pid, const std::vector<DebugRegisterSlot>& slots, DebugRegisterState& state)
+{
+    if (slots.size() > DEBUG_REGISTER_COUNT)
     {
-        throw std::runtime_error("PTRACE_POKEUSER DR0 failed: " + std::string(strerror(errno)));
+        throw std::runtime_error("Too many watchpoints: " + std::to_string(slots.size()) + " debug registers requested");
     }
 
     // Construct DR7 value (x64 specific)
-    // RW0 (bits 16 - 17) = type 00=on exec, 01=on writes, 11=on read and write
-    // LEN0 (bits 18-19) = size encoding 00=1, 01=2, 10=8, 11=4
-    unsigned int lenEncoding;
-    switch (size)
+    // Li (bit 2 * i) = local enable of DRi
+    // RWi (bits 16 + 4 * i) = type 00=on exec, 01=on writes, 11=on read and write
+    // LENi (bits 18 + 4 * i) = size encoding 00=1, 01=2, 10=8, 11=4
+    uint64_t dr7 = 0;
+    size_t calls = 0;
+
+    for (size_t i = 0; i < slots.size(); ++i)
     {
-    case 1: lenEncoding = 0; break;
-    case 2: lenEncoding = 1; break;
-    case 4: lenEncoding = 3; break;
-    case 8: lenEncoding = 2; break;
-    default: throw std::runtime_error("Invalid watchpoint size " + std::to_string(size));
-    }
+        const DebugRegisterSlot& slot = slots[i];
+        if (slot.size == 0)
+        {
+            continue; // disabled, e.g. the library of the watch is not loaded
+        }
 
-    uint64_t dr7 = 0;
+        unsigned int lenEncoding;
+        switch (slot.size)
+        {
+        case 1: lenEncoding = 0; break;
+        case 2: lenEncoding = 1; break;
+        case 4: lenEncoding = 3; break;
+        case 8: lenEncoding = 2; break;
+        default: throw std::runtime_error("Invalid watchpoint size " + std::to_string(slot.size));
+        }
 
-    dr7 |= 1ULL << 0;                                  // enable local L0
-    dr7 |= static_cast<uint64_t>(ON_DATA_WRITE) << 16; // set RW0 bits to write only
-    dr7 |= static_cast<uint64_t>(lenEncoding) << 18;   // set LEN0 bits
+        // set address to DRi
+        if (state.addr[i] != slot.addr)
+        {
+            size_t offset = offsetof(struct user, u_debugreg) + i * sizeof(long);
+            long ret = ptrace(PTRACE_POKEUSER, pid, offset, reinterpret_cast<void*>(slot.addr));
+            if (ret == -1)
+            {
+                throw std::runtime_error("PTRACE_POKEUSER DR" + std::to_string(i) +
+                                         " failed: " + std::string(strerror(errno)));
+            }
+            state.addr[i] = slot.addr;
+            ++calls;
+        }
 
-    dr7 |= 1ULL << 2;                                  // enable local L1
-    dr7 |= static_cast<uint64_t>(ON_READ_WRITE) << 20; // set RW1 bits to read write
-    dr7 |= static_cast<uint64_t>(lenEncoding) << 22;   // set LEN1 bits
+        dr7 |= 1ULL << (2 * i);                                    // enable local Li
+        dr7 |= static_cast<uint64_t>(slot.type) << (16 + 4 * i);   // set RWi bits
+        dr7 |= static_cast<uint64_t>(lenEncoding) << (18 + 4 * i); // set LENi bits
+    }
 
-    ret = ptrace(PTRACE_POKEUSER, pid, offsetof(struct user, u_debugreg[7]), reinterpret_cast<void*>(dr7));
-    if (ret == -1)
+    if (state.control != dr7)
     {
-        throw std::runtime_error("PTRACE_POKEUSER DR7 failed: " + std::string(strerror(errno)));
+        long ret = ptrace(PTRACE_POKEUSER, pid, offsetof(struct user, u_debugreg[7]), reinterpret_cast<void*>(dr7));
+        if (ret == -1)
+        {
+            throw std::runtime_error("PTRACE_POKEUSER DR7 failed: " + std::string(strerror(errno)));
+        }
+        state.control = dr7;
+        ++calls;
     }
+
+    return calls;
 }
 
-WatchpointEvent getWatchpointEvent(pid_t pid)
+uint64_t getDebugStatus(pid_t pid, bool reset)
 {
+    // without the reset DR6 keeps the bits of the last debug exception, a SIGTRAP sent with kill would show them
+    if (!reset)
+    {
+        siginfo_t info{};
+        if (ptrace(PTRACE_GETSIGINFO, pid, nullptr, &info) < 0)
+        {
+            throw std::runtime_error("PTRACE_GETSIGINFO failed: " + std::string(strerror(errno)));
+        }
+        // a single step of the tracer that also hit a debug register is reported as TRAP_BRKPT or TRAP_TRACE,
+        // kill and raise give SI_USER or SI_TKILL, an int3 of the tracee SI_KERNEL
+        if (info.si_code != TRAP_HWBKPT && info.si_code != TRAP_BRKPT && info.si_code != TRAP_TRACE)
+        {
+            return 0;
+        }
+    }
+
+    errno = 0;
     long reg = ptrace(PTRACE_PEEKUSER, pid, offsetof(struct user, u_debugreg[6]), nullptr);
     if (reg == -1 && errno != 0)
     {
         throw std::runtime_error("PTRACE_PEEKUSER DR6 failed: " + std::string(strerror(errno)));
     }
 
-    uint64_t reg0 = reg & (1ULL << 0); // write only
-    uint64_t reg1 = reg & (1ULL << 1); // read and write
-
     // clear the debug register
-    long ret = ptrace(PTRACE_POKEUSER, pid, offsetof(struct user, u_debugreg[6]), 0);
-    if (ret != 0)
+    if (reset)
+    {
+        long ret = ptrace(PTRACE_POKEUSER, pid, offsetof(struct user, u_debugreg[6]), 0);
+        if (ret != 0)
+        {
+            throw std::runtime_error("PTRACE_POKEUSER DR6 failed: " + std::string(strerror(errno)));
+        }
+    }
+
+    return static_cast<uint64_t>(reg);
+}
+
+namespace
+{
+// written by the child of the DR6 probe, each one watched by its own debug register
+volatile int g_probeFirst = 0;
+volatile int g_probeSecond = 0;
+
+/// Let a traced child hit two debug registers in a row without clearing DR6 in between
+/// @return true if DR6 only holds the bit of the second hit then
+bool probeDebugStatusReset()
+{
+    pid_t pid = fork();
+    if (pid < 0)
     {
-        throw std::runtime_error("PTRACE_POKEUSER DR6 failed: " + std::string(strerror(errno)));
+        return false;
+    }
+    if (pid == 0)
+    {
+        ptrace(PTRACE_TRACEME, 0, nullptr, nullptr);
+        raise(SIGSTOP);
+        g_probeFirst = 1;
+        g_probeSecond = 1;
+        _exit(0);
     }
 
-    if (reg0 && reg1)
+    // any failure keeps the reset, which is correct on every kernel
+    bool resets = false;
+    int status = 0;
+    try
     {
-        return WatchpointEvent::WRITE;
+        std::vector<DebugRegisterSlot> slots{
+            {reinterpret_cast<uintptr_t>(&g_probeFirst), sizeof(g_probeFirst), ON_DATA_WRITE},
+            {reinterpret_cast<uintptr_t>(&g_probeSecond), sizeof(g_probeSecond), ON_DATA_WRITE}};
+        DebugRegisterState registers;
+        if (waitpid(pid, &status, 0) == pid && WIFSTOPPED(status))
+        {
+            setHardwareWatchpoints(pid, slots, registers);
+
+            int traps = 0;
+            while (traps < 2 && ptrace(PTRACE_CONT, pid, nullptr, 0) == 0 && waitpid(pid, &status, 0) == pid &&
+                   WIFSTOPPED(status) && WSTOPSIG(status) == SIGTRAP)
+            {
+                ++traps;
+            }
+
+            uint64_t hits = traps == 2 ? getDebugStatus(pid, false) & 0b11 : 0;
+            resets = hits == 0b10;
+        }
     }
-    if (!reg0 && reg1)
+    catch (const std::runtime_error&)
     {
-        return WatchpointEvent::READ;
+        resets = false;
     }
 
-    return WatchpointEvent::OTHER;
+    kill(pid, SIGKILL);
+    waitpid(pid, &status, 0);
+    return resets;
+}
+} // namespace
+
+bool kernelResetsDebugStatus()
+{
+    static const bool resets = probeDebugStatusReset();
+    return resets;
 }
 
 } // namespace dbg::util
\ No newline at end of file
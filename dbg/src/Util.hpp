@@ -1,5 +1,6 @@
 #pragma once
 
+#include <array>
 #include <cstdint>
 #include <string>
 #include <vector>
@@ -16,36 +17,120 @@ std::vector<char*> toCStringArray(const std::vector<std::string>& args, const st
 /// Get error message after exec using errno
 std::string getExecErrnoMessage();
 
+/// File mapped into a running process
+struct MappedFile
+{
+    uintptr_t start = 0; // lowest address the file is mapped at
+    std::string path;    // canonical path
+};
+
+/// List the files mapped into a running process, each path is canonicalized once per device and inode
+/// @param pid currently running process
+/// @return one entry per file in address order, files that no longer exist are left out
+std::vector<MappedFile> getMappedFiles(pid_t pid);
+
 /// Get base address of a running process
 /// @param pid currently running process
 /// @param exePath path to an elf binary
 /// @return base address of the mapped main executable at runtime
 uintptr_t getBaseAddress(pid_t pid, const std::string& exePath);
 
-/// Find symbol in and elf file's symtable section
+/// Read an entry of the auxiliary vector the kernel passed to a running process
+/// @param pid currently running process
+/// @param type entry type, e.g. AT_BASE
+/// @return value of the entry, 0 if the process has none
+uintptr_t getAuxiliaryValue(pid_t pid, uint64_t type);
+
+/// List the threads of a running process
+/// @param pid currently running process
+/// @return thread ids found in /proc/<pid>/task, threads may exit or be created meanwhile
+std::vector<pid_t> getThreadIds(pid_t pid);
+
+/// Read the GNU build-id note of an elf file
 /// @param exePath path to an elf binary
-/// @param symbolName symbol name to be extracted from the binary
-/// @return link time offset and size of the symbol
-std::pair<uintptr_t, size_t> findSymbol(const std::string& exePath, const std::string& symbolName);
+/// @return build-id as lowercase hex, empty if the file has none or could not be read
+std::string getBuildId(const std::string& exePath);
+
+/// Read memory of another process without stopping it (process_vm_readv)
+/// @param pid id of the process to read from
+/// @param addr address in the process
+/// @param dst destination buffer
+/// @param size number of bytes to read
+/// @return true if all bytes were read
+bool readProcessMemory(pid_t pid, uintptr_t addr, void* dst, size_t size);
 
-/// Set watchpoint for process with pid at address addr
-/// @param pid id of process watchpoint will be set to
-/// @param addr address of the watchpoint
-/// @param size size of the tracked address (bytes)
-void setHardwareWatchpoint(pid_t pid, uintptr_t addr, size_t size);
+/// Current CLOCK_MONOTONIC time in nanoseconds, the clock of every event timestamp
+uint64_t getMonotonicTime();
+
+/// CPU time consumed by the calling thread in nanoseconds
+uint64_t getThreadCpuTime();
 
 /// Symbolizes in which context did the watchpoint occur
 enum class WatchpointEvent
 {
     READ,
     WRITE,
-    OTHER   // any other event (ignored for this task)
+    READ_WRITE, // read-modify-write instruction (e.g. lock add)
+    OTHER       // any other event (ignored for this task)
 };
 
-/// Returns the WatchpointEvent which was a cause of current interrupt,
-/// should be executed only once per interrupt, because also clears DR6 debug register
+/// RW Access type for hardware debug registers
+enum AccessType
+{
+    ON_EXECUTION = 0,
+    ON_DATA_WRITE = 1,
+    ON_READ_WRITE = 3
+};
+
+/// Number of address debug registers (DR0 - DR3)
+constexpr size_t DEBUG_REGISTER_COUNT = 4;
+
+/// Single address debug register configuration
+struct DebugRegisterSlot
+{
+    uintptr_t addr = 0;
+    size_t size = 0;
+    AccessType type = ON_READ_WRITE;
+};
+
+/// Debug register values last written to a thread, new threads start without watchpoints
+struct DebugRegisterState
+{
+    std::array<uintptr_t, DEBUG_REGISTER_COUNT> addr{}; // DR0 - DR3
+    uint64_t control = 0;                               // DR7
+};
+
+/// Check if a range can be watched with a single debug register (naturally aligned 1, 2, 4 or 8 bytes)
+/// @param addr start address of the range
+/// @param size size of the range in bytes
+bool fitsDebugRegister(uintptr_t addr, size_t size);
+
+/// Split a range into the fewest naturally aligned ranges debug registers can watch, the largest aligned range is
+/// taken from the start each time, e.g. 12 bytes at an 8 byte boundary become 8 + 4 bytes and 4 bytes at an odd
+/// 2 byte boundary 2 + 2 bytes
+/// @param addr start address of the range
+/// @param size size of the range in bytes
+/// @return slots of type ON_READ_WRITE covering exactly the range, in address order
+std::vector<DebugRegisterSlot> planWatch(uintptr_t addr, size_t size);
+
+/// Program debug registers of process with pid, slot i is written to DRi,
+/// registers that already hold the requested value are not written again
+/// @param pid id of process watchpoints will be set to
+/// @param slots up to DEBUG_REGISTER_COUNT slots to program, slots of size 0 and remaining registers are disabled
+/// @param state registers last written to the thread, updated
+/// @return number of ptrace calls made
+size_t setHardwareWatchpoints(pid_t pid, const std::vector<DebugRegisterSlot>& slots, DebugRegisterState& state);
+
+/// Returns the DR6 debug status register of a stopped thread
 /// @param pid id of the process to check
-/// @return WatchpointEvent which was a cause of current interrupt
-WatchpointEvent getWatchpointEvent(pid_t pid);
+/// @param reset also clear DR6, so the bits of this interrupt are not seen again with the next one,
+///              without it the signal info is checked instead, so a SIGTRAP not raised by a debug register gives 0
+/// @return DR6 value, bit i is set when DRi caused current interrupt
+uint64_t getDebugStatus(pid_t pid, bool reset);
+
+/// Check if the kernel resets the DR6 value seen by ptrace on every debug exception (Linux 5.11 and later),
+/// older kernels accumulate the bits until the tracer clears them. Probed once with a traced child, as distribution
+/// kernels backport the change without their version telling
+bool kernelResetsDebugStatus();
 
 } // namespace dbg::util
\ No newline at end of file
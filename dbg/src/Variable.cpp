@@ -1,7 +1,77 @@
 #include "Variable.hpp"
 
+#include <algorithm>
+#include <bit>
+#include <charconv>
+
 namespace dbg
 {
+    Value::Value(size_t size)
+        : m_size{size}
+    {
+        if (size > INLINE_SIZE)
+        {
+            m_heap.resize(size);
+        }
+    }
+
+    Value Value::fromWord(uint64_t word, size_t size)
+    {
+        Value value(std::min(size, sizeof(word)));
+        memcpy(value.data(), &word, value.size());
+        return value;
+    }
+
+    uint8_t* Value::data()
+    {
+        return m_size > INLINE_SIZE ? m_heap.data() : m_inline.data();
+    }
+
+    const uint8_t* Value::data() const
+    {
+        return m_size > INLINE_SIZE ? m_heap.data() : m_inline.data();
+    }
+
+    size_t Value::size() const
+    {
+        return m_size;
+    }
+
+    std::span<const uint8_t> Value::bytes() const
+    {
+        return {data(), m_size};
+    }
+
+    uint64_t Value::word(size_t index) const
+    {
+        uint64_t word = 0;
+        size_t offset = index * sizeof(word);
+        if (offset < m_size)
+        {
+            memcpy(&word, data() + offset, std::min(sizeof(word), m_size - offset));
+        }
+        return word;
+    }
+
+    std::string Value::toHex() const
+    {
+        static constexpr char HEX[] = "0123456789abcdef";
+
+        std::string hex = "0x";
+        hex.reserve(2 + 2 * m_size);
+        for (size_t i = m_size; i-- > 0;)
+        {
+            hex += HEX[data()[i] >> 4];
+            hex += HEX[data()[i] & 0xF];
+        }
+        return hex;
+    }
+
+    bool Value::operator==(const Value& other) const
+    {
+        return m_size == other.m_size && memcmp(data(), other.data(), m_size) == 0;
+    }
+
     Variable::Variable(const std::string& varName, bool varSigned)
         : name{varName},
           isSigned{varSigned}
@@ -10,6 +80,18 @@ namespace dbg
 
     std::string Variable::toString() const
     {
+        uint64_t bytes = value.word();
+
+        // shortest representation that reads back to the same value, e.g. 21.75
+        if (isFloat && (size == sizeof(float) || size == sizeof(double)))
+        {
+            char text[32];
+            auto result = size == sizeof(float)
+                              ? std::to_chars(text, std::end(text), std::bit_cast<float>(static_cast<uint32_t>(bytes)))
+                              : std::to_chars(text, std::end(text), std::bit_cast<double>(bytes));
+            return std::string(text, result.ptr);
+        }
+
         // clang-format off
         switch (size)
         {
@@ -35,6 +117,11 @@ namespace dbg
         }
         // clang-format on
 
+        // wide values (16 byte atomics, structs) are printed as raw bytes
+        if (size > 0 && value.size() == size)
+        {
+            return value.toHex();
+        }
         return "undefined";
     }
-}
\ No newline at end of file
+}
@@ -0,0 +1,44 @@
+#include "WatchpointHits.hpp"
+
+#include <algorithm>
+#include <span>
+
+namespace dbg
+{
+
+bool readWatchpointHits(uint64_t dr6, const std::vector<util::DebugRegisterSlot>& slots,
+                        const std::vector<size_t>& slotVars, const std::vector<Variable>& vars, WatchMode mode,
+                        TraceBackend& backend, WatchpointHits& hits)
+{
+    std::array<MemoryRange, util::DEBUG_REGISTER_COUNT> ranges{};
+    hits.count = 0;
+
+    for (size_t slot = 0; slot < slots.size(); ++slot)
+    {
+        if (slots[slot].type != util::ON_READ_WRITE || !(dr6 & (1ULL << slot)))
+        {
+            continue;
+        }
+        bool write = mode == WatchMode::DUAL_REGISTER && (dr6 & (1ULL << (slot - 1)));
+
+        size_t index = slotVars[slot];
+        auto end = hits.vars.begin() + static_cast<long>(hits.count);
+        size_t j = static_cast<size_t>(std::find(hits.vars.begin(), end, index) - hits.vars.begin());
+        if (j < hits.count)
+        {
+            hits.writes[j] = hits.writes[j] || write;
+            continue;
+        }
+
+        const Variable& var = vars[index];
+        hits.vars[hits.count] = index;
+        hits.writes[hits.count] = write;
+        hits.values[hits.count] = Value(var.size);
+        ranges[hits.count] = {var.address, hits.values[hits.count].data(), var.size};
+        ++hits.count;
+    }
+
+    return hits.count == 0 || backend.readMemory(std::span(ranges).first(hits.count));
+}
+
+} // namespace dbg
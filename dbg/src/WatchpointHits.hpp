@@ -0,0 +1,38 @@
+#pragma once
+
+#include "Debugger.hpp"
+#include "TraceBackend.hpp"
+#include "Util.hpp"
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace dbg
+{
+
+/// Variables hit by one debug register trap and their values after the access
+struct WatchpointHits
+{
+    std::array<size_t, util::DEBUG_REGISTER_COUNT> vars{}; // indices into the watched variables
+    std::array<bool, util::DEBUG_REGISTER_COUNT> writes{}; // set by the write-only slot, dual register mode only
+    std::array<Value, util::DEBUG_REGISTER_COUNT> values{};
+    size_t count = 0;
+};
+
+/// Decode DR6 into the hit variables and read their values with a single call. In dual register mode the write-only
+/// slot of a range precedes its read-write slot, an access across two ranges of a split variable is one hit
+/// @param dr6 debug status of the trap
+/// @param slots programmed debug register slots
+/// @param slotVars variable watched by each slot
+/// @param vars watched variables
+/// @param mode layout of the slots
+/// @param backend reads the values
+/// @param hits filled with the hit variables
+/// @return false if the values could not be read, errno is set
+bool readWatchpointHits(uint64_t dr6, const std::vector<util::DebugRegisterSlot>& slots,
+                        const std::vector<size_t>& slotVars, const std::vector<Variable>& vars, WatchMode mode,
+                        TraceBackend& backend, WatchpointHits& hits);
+
+} // namespace dbg
@@ -1,19 +1,88 @@
 #include <Debugger.hpp>
+#include <OutputPipeline.hpp>
+#include <TraceFile.hpp>
+#include <csignal>
+#include <cstdlib>
+#include <cxxabi.h>
+#include <filesystem>
+#include <iomanip>
 #include <iostream>
+#include <memory>
+#include <optional>
+#include <pthread.h>
+#include <span>
+#include <sstream>
+#include <tuple>
+#include <unistd.h>
 #include <vector>
 
 static constexpr int MIN_ARG_COUNT = 5;
 
 struct Args
 {
-    dbg::Variable var{};
+    std::vector<dbg::Variable> vars{};
+    std::vector<std::string> conditions{}; // --when of each variable, empty for none
+    dbg::Backend backend = dbg::Backend::PTRACE;
+    dbg::OverflowPolicy overflow = dbg::OverflowPolicy::BLOCK;
+    std::string traceOut{}; // binary trace instead of text output
     std::string path{};
     std::vector<std::string> args{};
+    pid_t pid = 0;          // attach to a running process instead of starting path
+    uint64_t maxEvents = 0;    // detach after this many events
+    unsigned duration = 0;     // detach after this many seconds
+    uint64_t sampleEvery = 1;  // report every nth access of a variable
+    double overheadBudget = 0; // share of the run time the tracer may spend, 0 for always armed
+    size_t statsTop = 0;       // count accesses and print this many call sites instead of the events
+    size_t backtrace = 0;      // frames captured per write, 0 for none
+    size_t tracerThreads = 1;  // threads waiting for the stops of the tracee
+    bool followFork = false;   // also trace forked children, events are tagged with their pid
 };
 
+/// Debugger detached by SIGINT and SIGALRM when attached with --pid
+static dbg::Debugger* g_debugger = nullptr;
+
+void onDetachSignal(int)
+{
+    g_debugger->requestDetach();
+}
+
 void printHelp()
 {
-    std::cout << "Usage: gwatch (--var | --svar) <symbol> --exec <path> [-- arg1 ... argN]\n";
+    std::cout << "Usage: gwatch (--var | --svar) <symbol> [(--var | --svar) <symbol> ...] [options] --exec <path> "
+                 "[-- arg1 ... argN]\n"
+                 "       gwatch (--var | --svar) <symbol> [(--var | --svar) <symbol> ...] [options] --pid <pid>\n"
+                 "Variables:\n"
+                 "  --var <symbol>                global variable, members and elements with -g (e.g. cfg.limits[1].max)\n"
+                 "  --svar <symbol>               same, printed as signed without debug information\n"
+                 "  --var <library>:<symbol>      global variable of a shared library, armed once it is loaded\n"
+                 "  --when <expression>           only report accesses of the preceding variable that satisfy the\n"
+                 "                                expression, e.g. 'new > 1000', 'new != old', 'write && tid == 1234'\n"
+                 "                                or 'ip in update_counter'\n"
+                 "Sampling:\n"
+                 "  --sample <n>                  report every nth access of each variable\n"
+                 "  --overhead-budget <percent>   arm the watchpoints only part of the time so that tracing costs\n"
+                 "                                about the given share of the run time, e.g. 5% (ptrace backend)\n"
+                 "Options:\n"
+                 "  --backend ptrace|perf|agent   collect accesses with ptrace stops (default), perf_event ring buffers\n"
+                 "                                or the in-process agent (libgwatch_agent.so)\n"
+                 "  --tracer-threads <n>          wait for the stops of the tracee on n threads, each owning a share\n"
+                 "                                of its threads (ptrace backend, debug register watches only)\n"
+                 "  --follow-fork                 also trace forked children and the programs they exec, every\n"
+                 "                                event is tagged with the pid (ptrace backend, not with --pid)\n"
+                 "  --output-overflow block|drop|aggregate\n"
+                 "                                what to do with events while output falls behind: stop the\n"
+                 "                                tracee until there is room (default), drop them or merge them\n"
+                 "                                into one line per variable\n"
+                 "  --stats <n>                   count accesses per thread and call site instead of printing them,\n"
+                 "                                print the n most frequent call sites and every thread at exit\n"
+                 "  --backtrace <n>               capture up to n frames of the call stack of every write, writes\n"
+                 "                                refer to the stacks printed at exit (ptrace backend)\n"
+                 "  --trace-out <file>            write a binary trace with timestamps, thread ids and\n"
+                 "                                instruction pointers instead of text, see gwatch-dump\n"
+                 "  --pid <pid>                   attach to a running process (ptrace backend), Ctrl-C detaches\n"
+                 "                                and lets it continue at full speed\n"
+                 "  --max-events <n>              with --pid, detach after n events\n"
+                 "  --duration <seconds>          with --pid, detach after the given time\n";
 }
 
 Args parseArgs(int argc, char* argv[])
@@ -25,26 +94,192 @@ Args parseArgs(int argc, char* argv[])
 
     Args args{};
 
-    // --var should always be specified as the first argument
-    std::string varArg = argv[1];
-    if (varArg != "--var" && varArg != "--svar")
+    // variables and options are specified before --exec
+    int i = 1;
+    while (i < argc && std::string(argv[i]) != "--exec")
+    {
+        std::string option = argv[i++];
+        if (option == "--follow-fork")
+        {
+            args.followFork = true;
+            continue;
+        }
+
+        if (i >= argc)
+        {
+            throw std::invalid_argument("Missing value for " + option);
+        }
+        std::string value = argv[i++];
+
+        if (option == "--var" || option == "--svar")
+        {
+            bool isSigned = option == "--svar";
+            args.vars.emplace_back(value, isSigned);
+            args.conditions.emplace_back();
+        }
+        else if (option == "--when")
+        {
+            if (args.vars.empty())
+            {
+                throw std::invalid_argument("--when has to follow the --var it filters");
+            }
+
+            // compiled once here to report syntax errors before the program starts, repeated --when are combined
+            std::string& condition = args.conditions.back();
+            condition = condition.empty() ? value : "(" + condition + ") && (" + value + ")";
+            std::ignore = dbg::Predicate(condition);
+        }
+        else if (option == "--backend")
+        {
+            if (value == "ptrace")
+                args.backend = dbg::Backend::PTRACE;
+            else if (value == "perf")
+                args.backend = dbg::Backend::PERF;
+            else if (value == "agent")
+                args.backend = dbg::Backend::AGENT;
+            else
+                throw std::invalid_argument("Unknown backend " + value);
+        }
+        else if (option == "--tracer-threads")
+        {
+            args.tracerThreads = std::stoull(value);
+            if (args.tracerThreads == 0)
+            {
+                throw std::invalid_argument("--tracer-threads has to be at least 1");
+            }
+        }
+        else if (option == "--output-overflow")
+        {
+            if (value == "block")
+                args.overflow = dbg::OverflowPolicy::BLOCK;
+            else if (value == "drop")
+                args.overflow = dbg::OverflowPolicy::DROP;
+            else if (value == "aggregate")
+                args.overflow = dbg::OverflowPolicy::AGGREGATE;
+            else
+                throw std::invalid_argument("Unknown overflow policy " + value);
+        }
+        else if (option == "--stats")
+        {
+            args.statsTop = std::stoull(value);
+            if (args.statsTop == 0)
+            {
+                throw std::invalid_argument("--stats has to print at least 1 call site");
+            }
+        }
+        else if (option == "--backtrace")
+        {
+            args.backtrace = std::stoull(value);
+            if (args.backtrace == 0)
+            {
+                throw std::invalid_argument("--backtrace has to capture at least 1 frame");
+            }
+        }
+        else if (option == "--trace-out")
+        {
+            args.traceOut = value;
+        }
+        else if (option == "--pid")
+        {
+            args.pid = static_cast<pid_t>(std::stol(value));
+        }
+        else if (option == "--sample")
+        {
+            args.sampleEvery = std::stoull(value);
+            if (args.sampleEvery == 0)
+            {
+                throw std::invalid_argument("--sample has to be at least 1");
+            }
+        }
+        else if (option == "--overhead-budget")
+        {
+            if (value.ends_with('%'))
+            {
+                value.pop_back();
+            }
+            args.overheadBudget = std::stod(value) / 100.0;
+            if (args.overheadBudget <= 0 || args.overheadBudget > 1)
+            {
+                throw std::invalid_argument("--overhead-budget has to be between 0 and 100%");
+            }
+        }
+        else if (option == "--max-events")
+        {
+            args.maxEvents = std::stoull(value);
+        }
+        else if (option == "--duration")
+        {
+            args.duration = static_cast<unsigned>(std::stoul(value));
+        }
+        else
+        {
+            throw std::invalid_argument("Unknown option " + option);
+        }
+    }
+
+    if (args.vars.empty())
+    {
+        throw std::invalid_argument("at least one --var should be specified");
+    }
+
+    if (args.statsTop > 0 && !args.traceOut.empty())
+    {
+        throw std::invalid_argument("--stats and --trace-out cannot be combined");
+    }
+
+    if (args.backtrace > 0 && args.backend != dbg::Backend::PTRACE)
+    {
+        throw std::invalid_argument("--backtrace requires the ptrace backend");
+    }
+
+    if (args.followFork && (args.pid != 0 || args.backend != dbg::Backend::PTRACE || args.tracerThreads > 1))
+    {
+        throw std::invalid_argument("--follow-fork requires the ptrace backend, a single tracer thread and --exec");
+    }
+
+    if (args.tracerThreads > 1 && args.pid != 0)
     {
-        throw std::invalid_argument("--var should be specified first");
+        throw std::invalid_argument("--tracer-threads cannot be combined with --pid");
+    }
+
+    if (args.pid == 0 && (args.maxEvents > 0 || args.duration > 0))
+    {
+        throw std::invalid_argument("--max-events and --duration require --pid");
+    }
+
+    if (args.pid != 0)
+    {
+        if (i < argc)
+        {
+            throw std::invalid_argument("--pid and --exec cannot be combined");
+        }
+
+        // the binary of the process, used as target of a trace
+        std::error_code error;
+        args.path = std::filesystem::canonical("/proc/" + std::to_string(args.pid) + "/exe", error).string();
+        if (error)
+        {
+            throw std::invalid_argument("No process with pid " + std::to_string(args.pid));
+        }
+        return args;
     }
 
-    bool isSigned = varArg == "--svar";
-    args.var = dbg::Variable(argv[2], isSigned);
+    // --exec should always be specified after the variables and options
+    if (i + 1 >= argc || std::string(argv[i]) != "--exec")
+    {
+        throw std::invalid_argument("--exec should be specified after the variables");
+    }
+    args.path = argv[i + 1];
+    i += 2;
 
-    // --exec should always be specified as the second argument
-    std::string execArg = argv[3];
-    if (execArg != "--exec")
+    // skip optional separator
+    if (i < argc && std::string(argv[i]) == "--")
     {
-        throw std::invalid_argument("--exec should be specified as the second argument");
+        ++i;
     }
-    args.path = argv[4];
 
     // read any arguments that the input program accept
-    for (int i = MIN_ARG_COUNT; i < argc; ++i)
+    for (; i < argc; ++i)
     {
         args.args.emplace_back(argv[i]);
     }
@@ -52,6 +287,113 @@ Args parseArgs(int argc, char* argv[])
     return args;
 }
 
+/// Describe a hit for the output pipeline, the batch event already refers to the variable by its index
+dbg::OutputEvent makeEvent(const dbg::Event& event, bool tagProcess)
+{
+    dbg::OutputEvent output{};
+    output.kind = event.isWrite ? dbg::OutputEvent::WRITE : dbg::OutputEvent::READ;
+    output.size = event.size;
+    output.newValue = event.newValue[0];
+    output.newHigh = event.newValue[1];
+    output.stack = event.stack;
+    if (event.isWrite)
+    {
+        output.oldValue = event.oldValue[0];
+        output.oldHigh = event.oldValue[1];
+    }
+    output.watch = event.watch;
+    output.offset = event.offset;
+    output.element = event.element;
+    output.pid = tagProcess ? static_cast<uint32_t>(event.pid) : 0;
+    return output;
+}
+
+/// Demangled function of a call site and the object it is in unless it is the program, e.g. update(int)+0x1a
+std::string describeLocation(const dbg::CodeLocation& location, const std::string& program)
+{
+    if (location.function.empty())
+    {
+        return "?";
+    }
+
+    int status = 0;
+    std::unique_ptr<char, decltype(&std::free)> demangled(
+        abi::__cxa_demangle(location.function.c_str(), nullptr, nullptr, &status), &std::free);
+
+    std::ostringstream description;
+    description << (status == 0 ? demangled.get() : location.function) << "+0x" << std::hex << location.offset;
+
+    std::error_code error;
+    if (!std::filesystem::equivalent(location.object, program, error))
+    {
+        description << " (" << std::filesystem::path(location.object).filename().string() << ")";
+    }
+    return description.str();
+}
+
+/// Print the counters of --stats: the most frequent call sites and the reads and writes of every thread,
+/// the call sites are symbolized in one batch after the run
+void printAccessStats(const dbg::Debugger& debugger, const std::string& program, size_t top)
+{
+    const dbg::AccessStats& stats = *debugger.getAccessStats();
+    const std::vector<dbg::Variable>& vars = debugger.getVars();
+    std::vector<dbg::AccessCount> sites = stats.getTopCallSites(top);
+    std::vector<dbg::ThreadAccesses> threads = stats.getThreads();
+
+    std::vector<uint64_t> addresses;
+    for (const dbg::AccessCount& site : sites)
+    {
+        addresses.push_back(site.ip);
+    }
+    std::vector<dbg::CodeLocation> locations = debugger.symbolize(addresses);
+
+    std::cout << stats.getTotal() << " accesses from " << stats.getTopCallSites(0).size() << " call sites in "
+              << threads.size() << " threads\n\n";
+
+    std::cout << std::setw(12) << "count" << "  " << std::setw(18) << "ip" << "  access  variable  function\n";
+    for (size_t i = 0; i < sites.size(); ++i)
+    {
+        const dbg::AccessCount& site = sites[i];
+        std::cout << std::setw(12) << site.count << "  " << std::setw(18) << std::hex << std::showbase << site.ip
+                  << std::dec << std::noshowbase << "  " << std::setw(6) << std::left
+                  << (site.isWrite ? "write" : "read") << "  " << std::setw(8) << vars[site.watch].name << std::right
+                  << "  " << describeLocation(locations[i], program) << "\n";
+    }
+
+    std::cout << "\n" << std::setw(12) << "tid" << "  " << std::setw(12) << "reads" << "  " << std::setw(12) << "writes"
+              << "\n";
+    for (const dbg::ThreadAccesses& thread : threads)
+    {
+        std::cout << std::setw(12) << thread.tid << "  " << std::setw(12) << thread.reads << "  " << std::setw(12)
+                  << thread.writes << "\n";
+    }
+}
+
+/// Print the distinct call stacks of --backtrace with their number of writes, all frames are symbolized in one batch
+void printStacks(const dbg::Debugger& debugger, const std::string& program)
+{
+    const dbg::StackTable& stacks = debugger.getStacks();
+
+    std::vector<uint64_t> addresses;
+    for (uint32_t id = 1; id <= stacks.size(); ++id)
+    {
+        std::span<const uint64_t> frames = stacks.getFrames(id);
+        addresses.insert(addresses.end(), frames.begin(), frames.end());
+    }
+    std::vector<dbg::CodeLocation> locations = debugger.symbolize(addresses);
+
+    size_t location = 0;
+    for (uint32_t id = 1; id <= stacks.size(); ++id)
+    {
+        std::cout << "\nstack #" << id << ": " << stacks.getCount(id) << " writes\n";
+        for (uint64_t frame : stacks.getFrames(id))
+        {
+            std::cout << "  " << std::setw(18) << std::hex << std::showbase << frame << std::dec << std::noshowbase
+                      << "  " << describeLocation(locations[location++], program) << "\n";
+        }
+    }
+}
+
 int main(int argc, char* argv[])
 {
     // Collect input arguments
@@ -68,33 +410,148 @@ int main(int argc, char* argv[])
     }
 
     // Start debugger
-    dbg::Debugger debugger = dbg::Debugger(args.path, args.args, args.var);
-
-    // clang-format off
-    debugger.setOnRead(
-        [](const dbg::Variable& var)
+    dbg::Debugger debugger = dbg::Debugger(args.path, args.args, args.vars);
+    debugger.setBackend(args.backend);
+    debugger.setMaxEvents(args.maxEvents);
+    debugger.setSampling(args.sampleEvery);
+    debugger.setOverheadBudget(args.overheadBudget);
+    debugger.setAccessStats(args.statsTop > 0);
+    debugger.setBacktrace(args.backtrace);
+    debugger.setTracerThreads(args.tracerThreads);
+    debugger.setFollowFork(args.followFork);
+    debugger.setSymbolize(args.statsTop > 0 || args.backtrace > 0);
+    for (size_t i = 0; i < args.conditions.size(); ++i)
+    {
+        if (!args.conditions[i].empty())
         {
-            std::cout << var.name << "\tread:\t" << var.toString() << "\n";
-        });
+            debugger.setPredicate(i, dbg::Predicate(args.conditions[i]));
+        }
+    }
+
+    // events are formatted and written on a separate thread while the tracee continues,
+    // it is started with the first event, once DWARF resolved the members and types of the variables
+    std::optional<dbg::OutputPipeline> output;
+    auto startOutput = [&]()
+    {
+        // the detach signals are blocked on the writer thread, so they interrupt the tracer waiting for the next stop,
+        // SIGCHLD as well, so every stop wakes the tracer
+        sigset_t tracerSignals;
+        sigemptyset(&tracerSignals);
+        sigaddset(&tracerSignals, SIGINT);
+        sigaddset(&tracerSignals, SIGALRM);
+        sigaddset(&tracerSignals, SIGCHLD);
+        sigset_t previous;
+        pthread_sigmask(SIG_BLOCK, &tracerSignals, &previous);
+        output.emplace(STDOUT_FILENO, debugger.getVars(), args.overflow);
+        pthread_sigmask(SIG_SETMASK, &previous, nullptr);
+    };
+
+    if (args.pid != 0)
+    {
+        g_debugger = &debugger;
+
+        struct sigaction action{};
+        action.sa_handler = onDetachSignal; // no SA_RESTART, waitpid returns with EINTR
+        sigaction(SIGINT, &action, nullptr);
+        sigaction(SIGALRM, &action, nullptr);
+        alarm(args.duration);
+    }
 
-    debugger.setOnWrite(
-        [&debugger](const dbg::Variable& var)
+    // the trace header holds the resolved addresses, so the file is created with the first event
+    std::optional<dbg::TraceWriter> trace;
+    if (!args.traceOut.empty())
+    {
+        debugger.setCaptureInstructionPointer(true);
+    }
+
+    // one call per batch of events instead of one per event
+    debugger.setOnEvents(
+        [&](std::span<const dbg::Event> events)
         {
-            const auto& lastVar = debugger.getLastVar();
-            std::cout << var.name << "\twrite:\t" << lastVar.toString() << " -> " << var.toString() << "\n";
+            for (const dbg::Event& event : events)
+            {
+                if (args.traceOut.empty())
+                {
+                    if (!output)
+                    {
+                        startOutput();
+                    }
+                    output->push(makeEvent(event, args.followFork));
+                    continue;
+                }
+
+                if (!trace)
+                {
+                    trace.emplace(args.traceOut, args.path, debugger.getVars());
+                }
+                trace->append({event.time, event.ip, event.tid, makeEvent(event, false)});
+            }
         });
-    // clang-format on
 
     try
     {
-        debugger.run();
+        if (args.pid != 0)
+        {
+            debugger.attach(args.pid);
+        }
+        else
+        {
+            debugger.run();
+        }
+
+        if (!args.traceOut.empty())
+        {
+            if (!trace)
+            {
+                trace.emplace(args.traceOut, args.path, debugger.getVars());
+            }
+            trace->finish();
+            std::cerr << "trace: " << trace->getRecordCount() << " events written to " << args.traceOut << "\n";
+        }
     }
     catch (std::runtime_error& e)
     {
+        output.reset();
+        trace.reset(); // keep the events recorded so far
         std::cerr << e.what() << "\n";
         printHelp();
         std::exit(2);
     }
 
+    if (output)
+    {
+        output->close();
+        if (output->getDropped() > 0)
+        {
+            std::cerr << "output: " << output->getDropped() << " events dropped\n";
+        }
+        if (output->getAggregated() > 0)
+        {
+            std::cerr << "output: " << output->getAggregated() << " events aggregated\n";
+        }
+    }
+
+    if (debugger.getAccessStats())
+    {
+        printAccessStats(debugger, args.path, args.statsTop);
+    }
+    if (debugger.getStacks().size() > 0)
+    {
+        printStacks(debugger, args.path);
+    }
+
+    dbg::TraceStats stats = debugger.getTraceStats();
+    if (stats.suppressed > 0)
+    {
+        std::cerr << "when: " << stats.suppressed << " of " << stats.suppressed + stats.sampledOut + stats.events
+                  << " events suppressed\n";
+    }
+    if (stats.samplingRatio < 1.0)
+    {
+        std::cerr << "sampling: " << std::fixed << std::setprecision(1) << 100.0 * stats.samplingRatio
+                  << "% of accesses observed, scale counts by " << std::setprecision(2) << 1.0 / stats.samplingRatio
+                  << "\n";
+    }
+
     return 0;
 }
\ No newline at end of file
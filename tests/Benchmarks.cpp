@@ -0,0 +1,388 @@
+#include "Debugger.hpp"
+#include "SymbolIndex.hpp"
+#include "Util.hpp"
+#include "Variable.hpp"
+
+#include <algorithm>
+#include <array>
+#include <benchmark/benchmark.h>
+#include <bit>
+#include <csignal>
+#include <cstring>
+#include <fcntl.h>
+#include <filesystem>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <sys/mman.h>
+#include <sys/ptrace.h>
+#include <sys/wait.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+/// Microbenchmarks of the parts of the tracer, run as
+/// ./gwatch_bench --benchmark_out=bench.json --benchmark_out_format=json
+/// and compared against a stored baseline with tools/compare_bench.py
+
+namespace fs = std::filesystem;
+
+/// Variables watched in forked copies of the benchmark, their addresses are the same in the copies
+alignas(8) static volatile uint64_t g_watched = 0;
+alignas(8) static volatile uint64_t g_otherWatched = 0;
+
+/// Forked copy of the benchmark with extra threads parked in pause(), every thread is seized and stopped
+class ParkedProcess
+{
+    pid_t m_pid = 0;
+    std::vector<pid_t> m_threads;
+
+  public:
+    /// @param threadCount threads of the copy, the main thread included
+    explicit ParkedProcess(size_t threadCount)
+    {
+        int ready[2];
+        if (pipe(ready) != 0)
+        {
+            throw std::runtime_error("pipe failed: " + std::string(strerror(errno)));
+        }
+
+        m_pid = fork();
+        if (m_pid == -1)
+        {
+            throw std::runtime_error("fork failed: " + std::string(strerror(errno)));
+        }
+        if (m_pid == 0)
+        {
+            for (size_t i = 1; i < threadCount; ++i)
+            {
+                std::thread(
+                    []
+                    {
+                        while (true)
+                        {
+                            pause();
+                        }
+                    })
+                    .detach();
+            }
+            char byte = 0;
+            (void)!write(ready[1], &byte, 1);
+            while (true)
+            {
+                pause();
+            }
+        }
+
+        char byte = 0;
+        close(ready[1]);
+        (void)!read(ready[0], &byte, 1);
+        close(ready[0]);
+
+        // no thread is created or exits while the copy is parked, one pass over the task list finds all of them
+        for (pid_t threadId : dbg::util::getThreadIds(m_pid))
+        {
+            if (ptrace(PTRACE_SEIZE, threadId, nullptr, PTRACE_O_EXITKILL) != 0 ||
+                ptrace(PTRACE_INTERRUPT, threadId, nullptr, nullptr) != 0)
+            {
+                std::string error = strerror(errno);
+                kill(m_pid, SIGKILL);
+                while (waitpid(-1, nullptr, __WALL) > 0)
+                {
+                }
+                throw std::runtime_error("PTRACE_SEIZE failed: " + error);
+            }
+            int status = 0;
+            waitpid(threadId, &status, __WALL);
+            m_threads.push_back(threadId);
+        }
+    }
+
+    ~ParkedProcess()
+    {
+        // the main thread is reported only after the other traced threads were reaped
+        kill(m_pid, SIGKILL);
+        for (pid_t threadId : m_threads)
+        {
+            if (threadId != m_pid)
+            {
+                waitpid(threadId, nullptr, __WALL);
+            }
+        }
+        waitpid(m_pid, nullptr, __WALL);
+    }
+
+    ParkedProcess(const ParkedProcess&) = delete;
+    ParkedProcess(ParkedProcess&&) = delete;
+    ParkedProcess& operator=(const ParkedProcess&) = delete;
+    ParkedProcess& operator=(ParkedProcess&&) = delete;
+
+    [[nodiscard]] const std::vector<pid_t>& getThreads() const
+    {
+        return m_threads;
+    }
+};
+
+/// Build the symbol index of an elf file from its symbol tables, without the cache
+static void BM_SymbolIndexBuild(benchmark::State& state, const std::string& path)
+{
+    for (auto _ : state)
+    {
+        dbg::SymbolIndex symbols(path);
+        benchmark::DoNotOptimize(symbols.size());
+    }
+    state.counters["symbols"] = static_cast<double>(dbg::SymbolIndex(path).size());
+}
+BENCHMARK_CAPTURE(BM_SymbolIndexBuild, small, std::string("./raw"))->Unit(benchmark::kMicrosecond);
+BENCHMARK_CAPTURE(BM_SymbolIndexBuild, huge, std::string("./symbols_huge"))->Unit(benchmark::kMicrosecond);
+
+/// Load the symbol index of an elf file from the cache
+static void BM_SymbolIndexLoadCached(benchmark::State& state, const std::string& path)
+{
+    char cacheDir[] = "/tmp/gwatch_bench_XXXXXX";
+    if (!mkdtemp(cacheDir))
+    {
+        state.SkipWithError("mkdtemp failed");
+        return;
+    }
+    dbg::SymbolIndex(path, cacheDir);
+
+    for (auto _ : state)
+    {
+        dbg::SymbolIndex symbols(path, cacheDir);
+        benchmark::DoNotOptimize(symbols.isCached());
+    }
+    fs::remove_all(cacheDir);
+}
+BENCHMARK_CAPTURE(BM_SymbolIndexLoadCached, small, std::string("./raw"))->Unit(benchmark::kMicrosecond);
+BENCHMARK_CAPTURE(BM_SymbolIndexLoadCached, huge, std::string("./symbols_huge"))->Unit(benchmark::kMicrosecond);
+
+/// Look up a symbol in a built index
+static void BM_FindSymbol(benchmark::State& state, const std::string& path, const std::string& name)
+{
+    dbg::SymbolIndex symbols(path);
+    if (!symbols.find(name))
+    {
+        state.SkipWithError("symbol not found");
+        return;
+    }
+
+    for (auto _ : state)
+    {
+        benchmark::DoNotOptimize(symbols.find(name));
+    }
+    state.SetItemsProcessed(static_cast<int64_t>(state.iterations()));
+}
+BENCHMARK_CAPTURE(BM_FindSymbol, small, std::string("./raw"), std::string("global_var"));
+BENCHMARK_CAPTURE(BM_FindSymbol, huge, std::string("./symbols_huge"), std::string("bench_symbol_999999"));
+
+/// Find the base address of the benchmark in its own maps file, made longer by mapping the binary range(0) times
+static void BM_GetBaseAddress(benchmark::State& state)
+{
+    std::string exePath = fs::read_symlink("/proc/self/exe");
+    int fd = open(exePath.c_str(), O_RDONLY);
+    if (fd < 0)
+    {
+        state.SkipWithError("open failed");
+        return;
+    }
+
+    // every mapping starts at file offset 0, so the kernel does not merge them into one line
+    std::vector<void*> mappings;
+    for (int64_t i = 0; i < state.range(0); ++i)
+    {
+        void* mapping = mmap(nullptr, sysconf(_SC_PAGESIZE), PROT_READ, MAP_PRIVATE, fd, 0);
+        if (mapping != MAP_FAILED)
+        {
+            mappings.push_back(mapping);
+        }
+    }
+    close(fd);
+
+    for (auto _ : state)
+    {
+        benchmark::DoNotOptimize(dbg::util::getBaseAddress(getpid(), exePath));
+    }
+
+    for (void* mapping : mappings)
+    {
+        munmap(mapping, sysconf(_SC_PAGESIZE));
+    }
+    state.counters["mappings"] = static_cast<double>(mappings.size());
+}
+BENCHMARK(BM_GetBaseAddress)->Arg(0)->Arg(1000)->Arg(10000)->Unit(benchmark::kMicrosecond);
+
+/// Move the watchpoints of every thread of a stopped process between two variables, as a new watch layout does
+static void BM_SetHardwareWatchpoints(benchmark::State& state)
+{
+    std::optional<ParkedProcess> process;
+    try
+    {
+        process.emplace(static_cast<size_t>(state.range(0)));
+    }
+    catch (const std::runtime_error& e)
+    {
+        state.SkipWithError(e.what());
+        return;
+    }
+
+    const std::vector<pid_t>& threads = process->getThreads();
+    std::vector<dbg::util::DebugRegisterState> registers(threads.size());
+    std::array<std::vector<dbg::util::DebugRegisterSlot>, 2> layouts{{
+        {{reinterpret_cast<uintptr_t>(&g_watched), sizeof(uint64_t), dbg::util::ON_DATA_WRITE},
+         {reinterpret_cast<uintptr_t>(&g_watched), sizeof(uint64_t), dbg::util::ON_READ_WRITE}},
+        {{reinterpret_cast<uintptr_t>(&g_otherWatched), sizeof(uint64_t), dbg::util::ON_DATA_WRITE},
+         {reinterpret_cast<uintptr_t>(&g_otherWatched), sizeof(uint64_t), dbg::util::ON_READ_WRITE}},
+    }};
+
+    size_t layout = 0;
+    size_t syscalls = 0;
+    for (auto _ : state)
+    {
+        layout ^= 1;
+        for (size_t i = 0; i < threads.size(); ++i)
+        {
+            syscalls += dbg::util::setHardwareWatchpoints(threads[i], layouts[layout], registers[i]);
+        }
+    }
+    state.SetItemsProcessed(static_cast<int64_t>(state.iterations() * threads.size()));
+    state.counters["syscalls"] = benchmark::Counter(static_cast<double>(syscalls), benchmark::Counter::kAvgIterations);
+}
+BENCHMARK(BM_SetHardwareWatchpoints)->Arg(1)->Arg(8)->Arg(64)->Unit(benchmark::kMicrosecond);
+
+/// One hardware watchpoint stop: continue the tracee, wait for its next write to trap and read DR6
+static void BM_StopRoundTrip(benchmark::State& state)
+{
+    pid_t pid = fork();
+    if (pid == -1)
+    {
+        state.SkipWithError("fork failed");
+        return;
+    }
+    if (pid == 0)
+    {
+        ptrace(PTRACE_TRACEME, 0, nullptr, nullptr);
+        raise(SIGSTOP);
+        while (true)
+        {
+            g_watched = g_watched + 1;
+        }
+    }
+
+    int status = 0;
+    waitpid(pid, &status, 0);
+    dbg::util::DebugRegisterState registers;
+    bool reset = !dbg::util::kernelResetsDebugStatus();
+    try
+    {
+        ptrace(PTRACE_SETOPTIONS, pid, nullptr, PTRACE_O_EXITKILL);
+        dbg::util::setHardwareWatchpoints(
+            pid, {{reinterpret_cast<uintptr_t>(&g_watched), sizeof(uint64_t), dbg::util::ON_DATA_WRITE}}, registers);
+    }
+    catch (const std::runtime_error& e)
+    {
+        state.SkipWithError(e.what());
+        kill(pid, SIGKILL);
+        waitpid(pid, &status, 0);
+        return;
+    }
+
+    for (auto _ : state)
+    {
+        if (ptrace(PTRACE_CONT, pid, nullptr, nullptr) != 0 || waitpid(pid, &status, 0) != pid ||
+            !WIFSTOPPED(status))
+        {
+            state.SkipWithError("tracee did not stop");
+            break;
+        }
+        benchmark::DoNotOptimize(dbg::util::getDebugStatus(pid, reset));
+    }
+    state.SetItemsProcessed(static_cast<int64_t>(state.iterations()));
+
+    kill(pid, SIGKILL);
+    waitpid(pid, &status, 0);
+}
+BENCHMARK(BM_StopRoundTrip)->Unit(benchmark::kMicrosecond);
+
+/// Counts the events of a replay, dispatched statically
+struct EventCounter
+{
+    uint64_t events = 0;
+
+    void onEvent(const dbg::Event& event)
+    {
+        events += event.isWrite ? 1 : 0;
+    }
+};
+
+/// Stop loop, dispatch and thread bookkeeping without a kernel: replay range(0) synthetic write stops
+/// spread over range(1) threads in dual register mode
+static void BM_ReplayStops(benchmark::State& state)
+{
+    const pid_t pid = 1000;
+    const auto stopCount = static_cast<size_t>(state.range(0));
+    const auto threadCount = static_cast<pid_t>(state.range(1));
+
+    dbg::StopRecording recording;
+    recording.pid = pid;
+    recording.mode = dbg::WatchMode::DUAL_REGISTER;
+    dbg::Variable var{"global_var"};
+    var.address = 0x1000;
+    var.size = sizeof(uint64_t);
+    var.value = dbg::Value::fromWord(0, sizeof(uint64_t));
+    recording.vars = {var};
+
+    // the threads are announced by clone events of the main thread, then write in turns
+    const int trap = SIGTRAP << 8 | 0x7f;
+    for (pid_t i = 1; i < threadCount; ++i)
+    {
+        recording.stops.push_back({pid, trap | PTRACE_EVENT_CLONE << 16, 0, static_cast<unsigned long>(pid + i), 0, 0});
+        recording.stops.push_back({pid + i, SIGSTOP << 8 | 0x7f, 0, 0, 0, 0});
+    }
+    for (size_t i = 0; i < stopCount; ++i)
+    {
+        recording.stops.push_back({pid + static_cast<pid_t>(i % threadCount), trap, 0b11, 0, i, 1});
+        recording.words.push_back(i + 1);
+    }
+
+    uint64_t events = 0;
+    for (auto _ : state)
+    {
+        dbg::Debugger debugger("replay", {}, var);
+        EventCounter counter;
+        debugger.setHandler(counter);
+        debugger.replay(recording);
+        events += counter.events;
+    }
+
+    if (events != state.iterations() * stopCount)
+    {
+        state.SkipWithError("replay lost events");
+    }
+    state.SetItemsProcessed(static_cast<int64_t>(state.iterations() * stopCount));
+}
+BENCHMARK(BM_ReplayStops)->Args({1'000'000, 1})->Args({1'000'000, 64})->Unit(benchmark::kMillisecond);
+
+/// Format values of a variable the way the callbacks of gwatch print them
+static void BM_VariableToString(benchmark::State& state, size_t size, bool isSigned, bool isFloat)
+{
+    dbg::Variable var{"global_var", isSigned};
+    var.size = size;
+    var.isFloat = isFloat;
+    var.value = dbg::Value(size);
+
+    uint64_t word = isFloat ? std::bit_cast<uint64_t>(21.75) : 0x123456789abcdefULL;
+    for (auto _ : state)
+    {
+        memcpy(var.value.data(), &word, std::min(size, sizeof(word)));
+        benchmark::DoNotOptimize(var.toString());
+        ++word;
+    }
+    state.SetItemsProcessed(static_cast<int64_t>(state.iterations()));
+}
+BENCHMARK_CAPTURE(BM_VariableToString, int32, sizeof(int32_t), true, false);
+BENCHMARK_CAPTURE(BM_VariableToString, uint64, sizeof(uint64_t), false, false);
+BENCHMARK_CAPTURE(BM_VariableToString, double, sizeof(double), true, true);
+BENCHMARK_CAPTURE(BM_VariableToString, bytes16, 2 * sizeof(uint64_t), false, false);
+
+BENCHMARK_MAIN();
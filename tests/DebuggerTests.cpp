@@ -1,5 +1,44 @@
 #include "Debugger.hpp"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <csignal>
+#include <cstdlib>
+#include <filesystem>
 #include <gtest/gtest.h>
+#include <map>
+#include <new>
+#include <numeric>
+#include <set>
+#include <sys/epoll.h>
+#include <sys/ptrace.h>
+#include <sys/wait.h>
+#include <thread>
+#include <tuple>
+#include <unistd.h>
+
+/// Heap allocations of the test process, counted by the replaced operator new
+static std::atomic<uint64_t> g_allocations{0};
+
+void* operator new(size_t size)
+{
+    g_allocations.fetch_add(1, std::memory_order_relaxed);
+    if (void* block = std::malloc(size == 0 ? 1 : size))
+    {
+        return block;
+    }
+    throw std::bad_alloc();
+}
+
+void operator delete(void* block) noexcept
+{
+    std::free(block);
+}
+
+void operator delete(void* block, size_t) noexcept
+{
+    std::free(block);
+}
 
 /// Functional tests for Debugger class
 class DebuggerTests : public ::testing::Test
@@ -9,11 +48,41 @@ class DebuggerTests : public ::testing::Test
     const std::string ONE_READ_SHORT_PATH = "./one_read_short";
     const std::string ONE_READ_LONG_PATH = "./one_read_long";
     const std::string ONE_WRITE_PATH = "./one_write";
+    const std::string SELF_TRAP_PATH = "./self_trap";
 
     // multithreading
     const std::string READ_THREAD_PATH = "./thread_read";
     const std::string WRITE_THREAD_PATH = "./thread_write";
     const std::string MULTI_THREAD_PATH = "./thread_multi";
+    const std::string THREAD_CHURN_PATH = "./thread_churn";
+
+    // multiple variables
+    const std::string MULTI_VAR_PATH = "./multi_var";
+    const std::string RMW_PATH = "./rmw";
+    const std::string WIDE_VAR_PATH = "./wide_var";
+    const std::string WIDE_VAR_THREADS_PATH = "./wide_var_threads";
+    const std::string WIDE_VALUE_PATH = "./wide_value";
+    const std::string SPLIT_VAR_PATH = "./split_var";
+
+    // attach to a running process
+    const std::string ATTACH_LOOP_PATH = "./attach_loop";
+
+    // forked and exec'd workers
+    const std::string FORK_EXEC_PATH = "./fork_exec";
+
+    // members and types from DWARF
+    const std::string TYPED_VARS_PATH = "./typed_vars";
+
+    // variables of shared libraries
+    const std::string PLUGIN_DLOPEN_PATH = "./plugin_dlopen";
+    const std::string PLUGIN_LINKED_PATH = "./plugin_linked";
+
+    // sampling
+    const std::string RAW_PATH = "./raw";
+
+    // call stacks with and without frame pointers
+    const std::string BACKTRACE_PATH = "./backtrace";
+    const std::string BACKTRACE_NOFP_PATH = "./backtrace_nofp";
 };
 
 TEST_F(DebuggerTests, OneRead)
@@ -143,6 +212,36 @@ TEST_F(DebuggerTests, OneWrite)
     ASSERT_EQ(write[0], 142);
 }
 
+TEST_F(DebuggerTests, SelfSentTrap)
+{
+    std::vector<std::string> args{};
+    dbg::Variable var{"global_var"};
+    dbg::Debugger debugger(SELF_TRAP_PATH, args, var);
+
+    size_t read = 0;
+    std::vector<long> write;
+
+    // clang-format off
+    debugger.setOnRead(
+        [&read](const dbg::Variable&)
+        {
+            ++read;
+        });
+
+    debugger.setOnWrite(
+        [&write](const dbg::Variable& var)
+        {
+            write.push_back(var.get<long>());
+        });
+    // clang-format on
+
+    debugger.run();
+
+    // the SIGTRAP raised by the tracee is no access, even where DR6 is not cleared after a hit
+    ASSERT_EQ(read, 0);
+    ASSERT_EQ(write, std::vector<long>{142});
+}
+
 TEST_F(DebuggerTests, ReadThread)
 {
     std::vector<std::string> args{};
@@ -232,4 +331,1490 @@ TEST_F(DebuggerTests, MutiThread)
 
     ASSERT_EQ(write.size(), 20000);
     ASSERT_EQ(read.size(), 20000);
-}
\ No newline at end of file
+}
+
+TEST_F(DebuggerTests, TracerThreads)
+{
+    for (dbg::WatchMode mode : {dbg::WatchMode::DUAL_REGISTER, dbg::WatchMode::SINGLE_REGISTER})
+    {
+        std::vector<std::string> args{};
+        dbg::Variable var{"global_var"};
+        dbg::Debugger debugger(MULTI_THREAD_PATH, args, var);
+        debugger.setWatchMode(mode);
+        debugger.setTracerThreads(3);
+
+        std::vector<int> read;
+        std::vector<int> write;
+        std::set<pid_t> threads;
+
+        // clang-format off
+        debugger.setOnRead(
+            [&](const dbg::Variable& var)
+            {
+                read.push_back(var.get<int>());
+                threads.insert(debugger.getEventInfo().tid);
+            });
+
+        debugger.setOnWrite(
+            [&](const dbg::Variable& var)
+            {
+                write.push_back(var.get<int>());
+                threads.insert(debugger.getEventInfo().tid);
+            });
+        // clang-format on
+
+        debugger.run();
+
+        // the two worker threads are moved to the idle tracer threads before they run, no access is missed
+        ASSERT_EQ(write.size(), 20000);
+        ASSERT_EQ(read.size(), 20000);
+        ASSERT_EQ(*std::max_element(write.begin(), write.end()), 42 + 20000);
+        ASSERT_EQ(threads.size(), 2);
+    }
+}
+
+TEST_F(DebuggerTests, ThreadChurn)
+{
+    for (size_t tracerThreads : {1, 3})
+    {
+        for (bool signals : {false, true})
+        {
+            // new threads handed to another tracer thread are parked with every signal blocked, a handled signal
+            // would otherwise resume them at the return of clone
+            std::vector<std::string> args{"50", "8"};
+            if (signals)
+            {
+                args.emplace_back("signals");
+            }
+            dbg::Debugger debugger(THREAD_CHURN_PATH, args, dbg::Variable{"global_var"});
+            debugger.setTracerThreads(tracerThreads);
+
+            size_t writes = 0;
+            std::set<pid_t> threads;
+
+            // clang-format off
+            debugger.setOnRead([](const dbg::Variable&) {});
+
+            debugger.setOnWrite(
+                [&](const dbg::Variable&)
+                {
+                    ++writes;
+                    threads.insert(debugger.getEventInfo().tid);
+                });
+            // clang-format on
+
+            debugger.run();
+
+            // every thread is armed at its initial stop, whether it arrives before or after the clone event
+            ASSERT_EQ(writes, 50 * 8);
+            ASSERT_GT(threads.size(), 8);
+        }
+    }
+}
+
+TEST_F(DebuggerTests, MultiThreadSingleRegister)
+{
+    std::vector<std::string> args{};
+    dbg::Variable var{"global_var"};
+    dbg::Debugger debugger(MULTI_THREAD_PATH, args, var);
+    debugger.setWatchMode(dbg::WatchMode::SINGLE_REGISTER);
+
+    std::vector<int> read;
+    std::vector<int> write;
+
+    // clang-format off
+    debugger.setOnRead(
+        [&read](const dbg::Variable& var)
+        {
+            read.push_back(var.get<int>());
+        });
+
+    debugger.setOnWrite(
+        [&write](const dbg::Variable& var)
+        {
+            write.push_back(var.get<int>());
+        });
+    // clang-format on
+
+    debugger.run();
+
+    ASSERT_EQ(write.size(), 20000);
+    ASSERT_EQ(read.size(), 20000);
+    ASSERT_EQ(write.back(), 20042);
+}
+
+TEST_F(DebuggerTests, FourVariables)
+{
+    std::vector<std::string> args{};
+    std::vector<dbg::Variable> vars{{"var_a"}, {"var_b", true}, {"var_c", true}, {"var_d", true}};
+    dbg::Debugger debugger(MULTI_VAR_PATH, args, vars);
+
+    std::vector<std::pair<std::string, long>> read;
+    std::vector<std::pair<std::string, long>> write;
+
+    // clang-format off
+    debugger.setOnRead(
+        [&read](const dbg::Variable& var)
+        {
+            read.emplace_back(var.name, std::stol(var.toString()));
+        });
+
+    debugger.setOnWrite(
+        [&write](const dbg::Variable& var)
+        {
+            write.emplace_back(var.name, std::stol(var.toString()));
+        });
+    // clang-format on
+
+    debugger.run();
+
+    std::vector<std::pair<std::string, long>> expectedRead{{"var_a", 11}, {"var_b", 31}, {"var_c", 61}};
+    std::vector<std::pair<std::string, long>> expectedWrite{
+        {"var_a", 11}, {"var_b", 31}, {"var_c", 61}, {"var_d", 101}, {"var_c", 61}};
+
+    ASSERT_EQ(read, expectedRead);
+    ASSERT_EQ(write, expectedWrite);
+}
+
+TEST_F(DebuggerTests, ReadModifyWrite)
+{
+    std::vector<std::string> args{};
+    dbg::Variable var{"global_var"};
+    dbg::Debugger debugger(RMW_PATH, args, var);
+    debugger.setWatchMode(dbg::WatchMode::SINGLE_REGISTER);
+
+    std::vector<int> read;
+    std::vector<std::pair<int, int>> write;
+
+    // clang-format off
+    debugger.setOnRead(
+        [&read](const dbg::Variable& var)
+        {
+            read.push_back(var.get<int>());
+        });
+
+    debugger.setOnWrite(
+        [&write, &debugger](const dbg::Variable& var)
+        {
+            write.emplace_back(debugger.getLastVar().get<int>(), var.get<int>());
+        });
+    // clang-format on
+
+    debugger.run();
+
+    ASSERT_EQ(read.size(), 1000);
+    ASSERT_EQ(write.size(), 1000);
+
+    for (int i = 0; i < 1000; ++i)
+    {
+        ASSERT_EQ(read[i], i);
+        ASSERT_EQ(write[i], std::make_pair(i, i + 1));
+    }
+}
+
+/// Handler dispatched statically through setHandler, keeps the events in preallocated storage
+struct EventCollector
+{
+    std::vector<dbg::Event> events;
+    uint64_t firstAllocations = 0; // allocations of the process when the first event arrived
+    uint64_t lastAllocations = 0;  // and when the last one arrived
+
+    void onEvent(const dbg::Event& event)
+    {
+        if (events.empty())
+        {
+            firstAllocations = g_allocations.load(std::memory_order_relaxed);
+        }
+        lastAllocations = g_allocations.load(std::memory_order_relaxed);
+        events.push_back(event);
+    }
+};
+
+TEST_F(DebuggerTests, BatchHandler)
+{
+    std::vector<std::string> args{};
+    dbg::Variable var{"global_var"};
+    dbg::Debugger debugger(RMW_PATH, args, var);
+    debugger.setWatchMode(dbg::WatchMode::SINGLE_REGISTER);
+
+    EventCollector collector;
+    collector.events.reserve(2000);
+    debugger.setHandler(collector);
+
+    debugger.run();
+
+    // a read of the old value followed by a write of the new one per increment
+    ASSERT_EQ(collector.events.size(), 2000);
+    for (size_t i = 0; i < collector.events.size(); ++i)
+    {
+        const dbg::Event& event = collector.events[i];
+        auto value = static_cast<uint64_t>(i / 2);
+        ASSERT_EQ(event.watch, 0);
+        ASSERT_EQ(event.size, sizeof(int));
+        ASSERT_FALSE(event.element);
+        ASSERT_GT(event.tid, 0);
+        ASSERT_EQ(event.isWrite, i % 2 == 1);
+        ASSERT_EQ(event.oldValue[0], value);
+        ASSERT_EQ(event.newValue[0], event.isWrite ? value + 1 : value);
+    }
+}
+
+TEST_F(DebuggerTests, NoAllocationPerEvent)
+{
+    std::vector<std::string> args{};
+    dbg::Variable var{"global_var"};
+
+    // per event callbacks
+    {
+        dbg::Debugger debugger(RMW_PATH, args, var);
+        debugger.setWatchMode(dbg::WatchMode::SINGLE_REGISTER);
+
+        uint64_t events = 0;
+        uint64_t firstAllocations = 0;
+        uint64_t lastAllocations = 0;
+        auto onEvent = [&](const dbg::Variable&)
+        {
+            if (events++ == 0)
+            {
+                firstAllocations = g_allocations.load(std::memory_order_relaxed);
+            }
+            lastAllocations = g_allocations.load(std::memory_order_relaxed);
+        };
+        debugger.setOnRead(onEvent);
+        debugger.setOnWrite(onEvent);
+
+        debugger.run();
+
+        ASSERT_EQ(events, 2000);
+        ASSERT_EQ(lastAllocations - firstAllocations, 0);
+    }
+
+    // batches
+    {
+        dbg::Debugger debugger(RMW_PATH, args, var);
+        debugger.setWatchMode(dbg::WatchMode::SINGLE_REGISTER);
+
+        EventCollector collector;
+        collector.events.reserve(2000);
+        debugger.setHandler(collector);
+
+        debugger.run();
+
+        ASSERT_EQ(collector.events.size(), 2000);
+        ASSERT_EQ(collector.lastAllocations - collector.firstAllocations, 0);
+    }
+}
+
+TEST_F(DebuggerTests, PageWatchArray)
+{
+    std::vector<std::string> args{};
+    dbg::Variable var{"table"};
+    dbg::Debugger debugger(WIDE_VAR_PATH, args, var);
+
+    std::vector<std::pair<std::string, int>> read;
+    std::vector<std::tuple<std::string, int, int>> write;
+
+    // clang-format off
+    debugger.setOnRead(
+        [&read](const dbg::Variable& var)
+        {
+            read.emplace_back(var.name, var.get<int>());
+        });
+
+    debugger.setOnWrite(
+        [&write, &debugger](const dbg::Variable& var)
+        {
+            write.emplace_back(var.name, debugger.getLastVar().get<int>(), var.get<int>());
+        });
+    // clang-format on
+
+    debugger.run();
+
+    ASSERT_EQ(read.size(), 8);
+    ASSERT_EQ(write.size(), 9);
+
+    for (int i = 0; i < 8; ++i)
+    {
+        std::string element = "table+" + std::to_string(4 * i);
+        ASSERT_EQ(write[i], std::make_tuple(element, 0, i + 1));
+        ASSERT_EQ(read[i], std::make_pair(element, i + 1));
+    }
+    ASSERT_EQ(write[8], std::make_tuple(std::string("table+12"), 4, 36));
+
+    // every access to neighbour faults on the protected page but is not reported
+    dbg::PageWatchStats stats = debugger.getPageWatchStats();
+    ASSERT_EQ(stats.hits, 17);
+    ASSERT_GE(stats.falseSharing, 200);
+    ASSERT_EQ(stats.faults, stats.hits + stats.falseSharing);
+}
+
+TEST_F(DebuggerTests, PageWatchMultiThread)
+{
+    std::vector<std::string> args{};
+    dbg::Variable var{"table"};
+    dbg::Debugger debugger(WIDE_VAR_THREADS_PATH, args, var);
+
+    std::map<std::string, std::vector<int>> write;
+
+    // clang-format off
+    debugger.setOnRead(
+        [](const dbg::Variable&)
+        {
+        });
+
+    debugger.setOnWrite(
+        [&write](const dbg::Variable& var)
+        {
+            write[var.name].push_back(var.get<int>());
+        });
+    // clang-format on
+
+    debugger.run();
+
+    // the other threads are stopped while one steps over its access, none of their writes is missed
+    ASSERT_EQ(write.size(), 4);
+    for (const auto& [element, values] : write)
+    {
+        ASSERT_EQ(values.size(), 2000) << element;
+        for (size_t i = 0; i < values.size(); ++i)
+        {
+            ASSERT_EQ(values[i], static_cast<int>(i) + 1) << element;
+        }
+    }
+}
+
+TEST_F(DebuggerTests, PageWatchWithHardwareWatch)
+{
+    std::vector<std::string> args{};
+    std::vector<dbg::Variable> vars{{"table"}, {"neighbour"}};
+    dbg::Debugger debugger(WIDE_VAR_PATH, args, vars);
+
+    size_t tableRead = 0;
+    size_t tableWrite = 0;
+    std::vector<int> neighbourWrite;
+
+    // clang-format off
+    debugger.setOnRead(
+        [&tableRead](const dbg::Variable& var)
+        {
+            tableRead += var.name.starts_with("table") ? 1 : 0;
+        });
+
+    debugger.setOnWrite(
+        [&tableWrite, &neighbourWrite](const dbg::Variable& var)
+        {
+            if (var.name == "neighbour")
+                neighbourWrite.push_back(var.get<int>());
+            else
+                ++tableWrite;
+        });
+    // clang-format on
+
+    debugger.run();
+
+    // neighbour fits into a debug register, its hits are reported from the single step over the page fault
+    ASSERT_EQ(tableRead, 8);
+    ASSERT_EQ(tableWrite, 9);
+    ASSERT_EQ(neighbourWrite.size(), 100);
+    ASSERT_EQ(neighbourWrite.back(), 100);
+}
+
+TEST_F(DebuggerTests, WideValue)
+{
+    struct Pair
+    {
+        long first;
+        long second;
+    };
+
+    std::vector<std::string> args{};
+    dbg::Variable var{"global_pair", true};
+    dbg::Debugger debugger(WIDE_VALUE_PATH, args, var);
+
+    std::vector<Pair> read;
+    std::vector<std::pair<Pair, Pair>> write;
+
+    // clang-format off
+    debugger.setOnRead(
+        [&read](const dbg::Variable& var)
+        {
+            read.push_back(var.get<Pair>());
+        });
+
+    debugger.setOnWrite(
+        [&debugger, &write](const dbg::Variable& var)
+        {
+            write.emplace_back(debugger.getLastVar().get<Pair>(), var.get<Pair>());
+            ASSERT_EQ(var.name, "global_pair");
+        });
+    // clang-format on
+
+    debugger.run();
+
+    // the whole 16 byte value is captured on every 8 byte write
+    ASSERT_EQ(write.size(), 20);
+    ASSERT_EQ(write.front().first.first, 1);
+    ASSERT_EQ(write.front().first.second, 2);
+    ASSERT_EQ(write.front().second.first, 0);
+    ASSERT_EQ(write.front().second.second, 2);
+    ASSERT_EQ(write.back().second.first, 9);
+    ASSERT_EQ(write.back().second.second, -9);
+
+    ASSERT_FALSE(read.empty());
+    ASSERT_EQ(read.back().first, 9);
+    ASSERT_EQ(read.back().second, -9);
+}
+
+TEST_F(DebuggerTests, SplitUnalignedVariable)
+{
+    for (dbg::WatchMode mode : {dbg::WatchMode::DUAL_REGISTER, dbg::WatchMode::SINGLE_REGISTER})
+    {
+        std::vector<std::string> args{};
+        dbg::Variable var{"packed.value"};
+        dbg::Debugger debugger(SPLIT_VAR_PATH, args, var);
+        debugger.setWatchMode(mode);
+
+        std::vector<int> write;
+        size_t read = 0;
+
+        // clang-format off
+        debugger.setOnRead(
+            [&read](const dbg::Variable&)
+            {
+                ++read;
+            });
+
+        debugger.setOnWrite(
+            [&write](const dbg::Variable& var)
+            {
+                write.push_back(var.get<int>());
+            });
+        // clang-format on
+
+        debugger.run();
+
+        // a write covers both 2 byte ranges, the two hits are one event
+        std::vector<int> expected(10);
+        std::iota(expected.begin(), expected.end(), 1);
+        ASSERT_EQ(write, expected);
+        ASSERT_EQ(read, 1);
+        ASSERT_EQ(debugger.getPageWatchStats().faults, 0);
+    }
+}
+
+TEST_F(DebuggerTests, SplitStruct)
+{
+    struct Triple
+    {
+        int a;
+        int b;
+        int c;
+    };
+
+    std::vector<std::string> args{};
+    dbg::Variable var{"triple"};
+    dbg::Debugger debugger(SPLIT_VAR_PATH, args, var);
+
+    std::vector<std::pair<Triple, Triple>> write;
+
+    // clang-format off
+    debugger.setOnRead([](const dbg::Variable&) {});
+
+    debugger.setOnWrite(
+        [&debugger, &write](const dbg::Variable& var)
+        {
+            write.emplace_back(debugger.getLastVar().get<Triple>(), var.get<Triple>());
+        });
+    // clang-format on
+
+    debugger.run();
+
+    // writes to either range are reported with the whole 12 byte value
+    ASSERT_EQ(write.size(), 20);
+    ASSERT_EQ(write[0].first.b, 0);
+    ASSERT_EQ(write[0].second.b, 1);
+    ASSERT_EQ(write[1].second.c, -1);
+    ASSERT_EQ(write.back().first.b, 10);
+    ASSERT_EQ(write.back().first.c, -9);
+    ASSERT_EQ(write.back().second.c, -10);
+    ASSERT_EQ(debugger.getPageWatchStats().faults, 0);
+}
+
+TEST_F(DebuggerTests, SplitBeyondFreeRegisters)
+{
+    // both need four registers in dual register mode, triple falls back to page protection
+    std::vector<std::string> args{};
+    std::vector<dbg::Variable> vars{{"packed.value"}, {"triple"}};
+    dbg::Debugger debugger(SPLIT_VAR_PATH, args, vars);
+
+    size_t packedWrites = 0;
+    size_t tripleWrites = 0;
+    debugger.setOnRead([](const dbg::Variable&) {});
+    debugger.setOnWrite([&](const dbg::Variable& var) { ++(var.name == "triple" ? tripleWrites : packedWrites); });
+
+    debugger.run();
+
+    ASSERT_EQ(packedWrites, 10);
+    ASSERT_EQ(tripleWrites, 20);
+    ASSERT_GT(debugger.getPageWatchStats().hits, 0);
+}
+
+TEST_F(DebuggerTests, DwarfTypes)
+{
+    std::vector<std::string> args{};
+    std::vector<dbg::Variable> vars{{"cfg.max_conns"}, {"cfg.limits[1].max"}, {"counter"}, {"temperature"}};
+    dbg::Debugger debugger(TYPED_VARS_PATH, args, vars);
+
+    std::vector<std::pair<std::string, std::string>> read;
+    std::vector<std::pair<std::string, std::string>> write;
+
+    // clang-format off
+    debugger.setOnRead(
+        [&read](const dbg::Variable& var)
+        {
+            read.emplace_back(var.name, var.toString());
+        });
+
+    debugger.setOnWrite(
+        [&write](const dbg::Variable& var)
+        {
+            write.emplace_back(var.name, var.toString());
+        });
+    // clang-format on
+
+    debugger.run();
+
+    // signedness and floating point come from DWARF, none of the variables was given as --svar
+    std::vector<std::pair<std::string, std::string>> expectedRead{{"counter", "-5"}, {"temperature", "20.5"}};
+    std::vector<std::pair<std::string, std::string>> expectedWrite{
+        {"cfg.max_conns", "64"}, {"cfg.limits[1].max", "-300"}, {"counter", "-15"}, {"temperature", "21.75"}};
+    ASSERT_EQ(read, expectedRead);
+    ASSERT_EQ(write, expectedWrite);
+
+    const auto& resolved = debugger.getVars();
+    ASSERT_EQ(resolved[0].size, sizeof(unsigned));
+    ASSERT_EQ(resolved[1].size, sizeof(short));
+    ASSERT_EQ(resolved[1].address - resolved[0].address, 18);
+    ASSERT_EQ(resolved[3].size, sizeof(double));
+    ASSERT_FALSE(resolved[0].isSigned);
+    ASSERT_TRUE(resolved[1].isSigned);
+    ASSERT_TRUE(resolved[2].isSigned);
+    ASSERT_TRUE(resolved[3].isFloat);
+}
+
+TEST_F(DebuggerTests, Predicates)
+{
+    std::vector<std::string> args{};
+    std::vector<dbg::Variable> vars{{"cfg.max_conns"}, {"counter"}, {"temperature"}};
+    dbg::Debugger debugger(TYPED_VARS_PATH, args, vars);
+    debugger.setPredicate(1, dbg::Predicate("write && new < -10"));
+    debugger.setPredicate(2, dbg::Predicate("new != old && ip in main"));
+
+    std::vector<std::pair<std::string, std::string>> read;
+    std::vector<std::pair<std::string, std::string>> write;
+
+    // clang-format off
+    debugger.setOnRead(
+        [&read](const dbg::Variable& var)
+        {
+            read.emplace_back(var.name, var.toString());
+        });
+
+    debugger.setOnWrite(
+        [&write](const dbg::Variable& var)
+        {
+            write.emplace_back(var.name, var.toString());
+        });
+    // clang-format on
+
+    debugger.run();
+
+    // the reads of counter and temperature are suppressed before the callbacks
+    std::vector<std::pair<std::string, std::string>> expectedWrite{
+        {"cfg.max_conns", "64"}, {"counter", "-15"}, {"temperature", "21.75"}};
+    ASSERT_TRUE(read.empty());
+    ASSERT_EQ(write, expectedWrite);
+    ASSERT_EQ(debugger.getTraceStats().suppressed, 2);
+    ASSERT_EQ(debugger.getTraceStats().events, 3);
+
+    // comparisons follow the type of the variable
+    dbg::Variable value{"value", true};
+    value.size = sizeof(short);
+    value.value = dbg::Value::fromWord(0xFFFE, sizeof(short)); // -2
+    dbg::Value old = dbg::Value::fromWord(7, sizeof(short));
+    dbg::Access access{&value, &old, true, 1234, 0x1000};
+    ASSERT_TRUE(dbg::Predicate("new == -2 and old == 7").evaluate(access));
+    ASSERT_TRUE(dbg::Predicate("new < old || tid != 1234").evaluate(access));
+    ASSERT_TRUE(dbg::Predicate("!(new > 0) && new > -2.5 && ip == 0x1000").evaluate(access));
+    ASSERT_FALSE(dbg::Predicate("read or (write && tid == 1)").evaluate(access));
+
+    value.isSigned = false;
+    ASSERT_TRUE(dbg::Predicate("new == 65534 && new > old").evaluate(access));
+
+    ASSERT_THROW(dbg::Predicate("new >> 3"), std::invalid_argument);
+    ASSERT_THROW(dbg::Predicate("(new > 3"), std::invalid_argument);
+    ASSERT_THROW(dbg::Predicate("value > 3"), std::invalid_argument);
+}
+
+TEST_F(DebuggerTests, Sampling)
+{
+    std::vector<std::string> args{"1000"};
+    dbg::Variable var{"global_var"};
+    dbg::Debugger debugger(RAW_PATH, args, var);
+    debugger.setSampling(10);
+
+    uint64_t read = 0;
+    uint64_t write = 0;
+
+    // clang-format off
+    debugger.setOnRead(
+        [&read](const dbg::Variable& var)
+        {
+            ++read;
+        });
+
+    debugger.setOnWrite(
+        [&write](const dbg::Variable& var)
+        {
+            ++write;
+        });
+    // clang-format on
+
+    debugger.run();
+
+    // reads and writes alternate, every 10th access is a write
+    dbg::TraceStats stats = debugger.getTraceStats();
+    ASSERT_EQ(read, 0);
+    ASSERT_EQ(write, 100);
+    ASSERT_EQ(stats.events, 100);
+    ASSERT_EQ(stats.sampledOut, 900);
+    ASSERT_DOUBLE_EQ(stats.samplingRatio, 0.1);
+}
+
+TEST_F(DebuggerTests, AccessStats)
+{
+    std::vector<std::string> args{};
+    dbg::Variable var{"global_var"};
+    dbg::Debugger debugger(MULTI_THREAD_PATH, args, var);
+    debugger.setAccessStats(true);
+
+    uint64_t callbacks = 0;
+
+    // clang-format off
+    debugger.setOnRead(
+        [&callbacks](const dbg::Variable& var)
+        {
+            ++callbacks;
+        });
+
+    debugger.setOnWrite(
+        [&callbacks](const dbg::Variable& var)
+        {
+            ++callbacks;
+        });
+    // clang-format on
+
+    debugger.run();
+
+    // ++global_var in two threads, 10000 times each, is one read and one write site
+    const dbg::AccessStats* stats = debugger.getAccessStats();
+    ASSERT_NE(stats, nullptr);
+    ASSERT_EQ(callbacks, 0);
+    ASSERT_EQ(stats->getTotal(), 40000);
+    ASSERT_EQ(debugger.getTraceStats().events, 40000);
+
+    std::vector<dbg::AccessCount> sites = stats->getTopCallSites(10);
+    ASSERT_EQ(sites.size(), 2);
+    for (const dbg::AccessCount& site : sites)
+    {
+        ASSERT_EQ(site.count, 20000);
+        ASSERT_NE(site.ip, 0);
+    }
+    ASSERT_NE(sites[0].isWrite, sites[1].isWrite);
+
+    std::vector<dbg::ThreadAccesses> threads = stats->getThreads();
+    ASSERT_EQ(threads.size(), 2);
+    for (const dbg::ThreadAccesses& thread : threads)
+    {
+        ASSERT_EQ(thread.reads, 10000);
+        ASSERT_EQ(thread.writes, 10000);
+    }
+    ASSERT_EQ(stats->getCounts().size(), 4);
+
+    // the table grows past its initial capacity without losing counters
+    dbg::AccessStats table(16);
+    for (uint64_t ip = 0; ip < 1000; ++ip)
+    {
+        table.record(0, 1, ip, false);
+        table.record(0, 2, ip, ip % 3 == 0);
+    }
+    table.record(0, 1, 500, false);
+    ASSERT_EQ(table.size(), 2000);
+    ASSERT_EQ(table.getTotal(), 2001);
+    ASSERT_EQ(table.getCounts().front().count, 2);
+    ASSERT_EQ(table.getTopCallSites(1).front().ip, 500);
+    ASSERT_EQ(table.getTopCallSites(1).front().count, 3);
+}
+
+TEST_F(DebuggerTests, SymbolizeCallSites)
+{
+    std::vector<std::string> args{};
+    std::vector<dbg::Variable> vars{{"global_var"}};
+    dbg::Debugger debugger(MULTI_THREAD_PATH, args, vars);
+    debugger.setAccessStats(true);
+    debugger.setSymbolize(true);
+    debugger.run();
+
+    // both call sites are in the thread lambda of main, the IP follows the access
+    std::vector<uint64_t> addresses;
+    for (const dbg::AccessCount& site : debugger.getAccessStats()->getTopCallSites(0))
+    {
+        addresses.push_back(site.ip);
+    }
+    addresses.push_back(0); // no function
+    std::vector<dbg::CodeLocation> locations = debugger.symbolize(addresses);
+    ASSERT_EQ(locations.size(), 3);
+    for (size_t i = 0; i < 2; ++i)
+    {
+        ASSERT_EQ(locations[i].function, "_ZZ4mainENKUlvE_clEv");
+        ASSERT_GT(locations[i].offset, 0);
+        ASSERT_EQ(std::filesystem::path(locations[i].object).filename(), "thread_multi");
+    }
+    ASSERT_TRUE(locations[2].function.empty());
+
+    // a function of a shared library loaded at startup, the library is relocated by its load address
+    dbg::Debugger library(PLUGIN_LINKED_PATH, args, dbg::Variable{"libplugin.so:plugin_counter"});
+    library.setAccessStats(true);
+    library.setSymbolize(true);
+    library.run();
+
+    std::vector<dbg::AccessCount> sites = library.getAccessStats()->getTopCallSites(0);
+    ASSERT_FALSE(sites.empty());
+    std::vector<uint64_t> libraryAddresses{sites.front().ip};
+    dbg::CodeLocation location = library.symbolize(libraryAddresses).front();
+    ASSERT_EQ(location.function, "plugin_update");
+    ASSERT_EQ(std::filesystem::path(location.object).filename(), "libplugin.so");
+}
+
+TEST_F(DebuggerTests, Backtrace)
+{
+    for (const std::string& path : {BACKTRACE_PATH, BACKTRACE_NOFP_PATH})
+    {
+        std::vector<std::string> args{};
+        dbg::Debugger debugger(path, args, dbg::Variable{"config_value"});
+        debugger.setBacktrace(8);
+        debugger.setSymbolize(true);
+
+        std::vector<uint32_t> writeStacks;
+        debugger.setOnRead([](const dbg::Variable&) {});
+        debugger.setOnWrite([&](const dbg::Variable&) { writeStacks.push_back(debugger.getEventInfo().stack); });
+        debugger.run();
+        ASSERT_EQ(writeStacks.size(), 4) << path;
+
+        // writes through configure and the direct one from main, up to main (the loop may be unrolled with -O2)
+        const dbg::StackTable& stacks = debugger.getStacks();
+        std::map<std::vector<std::string>, uint64_t> counts;
+        for (uint32_t id : writeStacks)
+        {
+            ASSERT_GT(id, 0) << path;
+            std::vector<dbg::CodeLocation> locations = debugger.symbolize(stacks.getFrames(id));
+            std::vector<std::string> functions;
+            for (const dbg::CodeLocation& location : locations)
+            {
+                functions.push_back(location.function);
+                if (location.function == "main")
+                {
+                    break;
+                }
+            }
+            ++counts[functions];
+        }
+
+        std::map<std::vector<std::string>, uint64_t> expected{{{"_Z5applyl", "_Z9configurel", "main"}, 3},
+                                                              {{"_Z5applyl", "main"}, 1}};
+        ASSERT_EQ(counts, expected) << path;
+
+        // repeated hits from the same path are stored once
+        uint64_t total = 0;
+        for (uint32_t id = 1; id <= stacks.size(); ++id)
+        {
+            total += stacks.getCount(id);
+        }
+        ASSERT_EQ(total, 4) << path;
+        ASSERT_LE(stacks.size(), 4) << path;
+    }
+}
+
+TEST_F(DebuggerTests, LibraryLoadedAtStartup)
+{
+    std::vector<std::string> args{};
+    dbg::Variable var{"libplugin.so:plugin_counter"};
+    dbg::Debugger debugger(PLUGIN_LINKED_PATH, args, var);
+
+    std::vector<int> read;
+    std::vector<int> write;
+
+    // clang-format off
+    debugger.setOnRead(
+        [&read](const dbg::Variable& var)
+        {
+            read.push_back(var.get<int>());
+        });
+
+    debugger.setOnWrite(
+        [&write](const dbg::Variable& var)
+        {
+            write.push_back(var.get<int>());
+        });
+    // clang-format on
+
+    debugger.run();
+
+    ASSERT_EQ(read, std::vector<int>{5});
+    ASSERT_EQ(write, std::vector<int>{5});
+    ASSERT_NE(debugger.getVar().address, 0);
+}
+
+TEST_F(DebuggerTests, LibraryLoadedWithDlopen)
+{
+    std::vector<std::string> args{};
+    std::vector<dbg::Variable> vars{{"libplugin.so:plugin_counter"}, {"host_var"}};
+    dbg::Debugger debugger(PLUGIN_DLOPEN_PATH, args, vars);
+
+    std::vector<std::pair<std::string, int>> read;
+    std::vector<std::pair<std::string, int>> write;
+    std::vector<int> oldValues;
+
+    // clang-format off
+    debugger.setOnRead(
+        [&read](const dbg::Variable& var)
+        {
+            read.emplace_back(var.name, var.get<int>());
+        });
+
+    debugger.setOnWrite(
+        [&debugger, &write, &oldValues](const dbg::Variable& var)
+        {
+            write.emplace_back(var.name, var.get<int>());
+            oldValues.push_back(debugger.getLastVar().get<int>());
+        });
+    // clang-format on
+
+    debugger.run();
+
+    // the watch is armed with every load of the library, the second load starts with the initial value again
+    std::vector<std::pair<std::string, int>> expectedRead{{"libplugin.so:plugin_counter", 10},
+                                                          {"libplugin.so:plugin_counter", 20}};
+    std::vector<std::pair<std::string, int>> expectedWrite{{"libplugin.so:plugin_counter", 10},
+                                                           {"host_var", 11},
+                                                           {"libplugin.so:plugin_counter", 20},
+                                                           {"host_var", 21}};
+    ASSERT_EQ(read, expectedRead);
+    ASSERT_EQ(write, expectedWrite);
+    ASSERT_EQ(oldValues, (std::vector<int>{0, 0, 0, 11}));
+}
+
+TEST_F(DebuggerTests, ReplayRecordedStops)
+{
+    // new threads (thread_multi) in dual register mode, decoded accesses (rmw) in single register mode
+    for (auto [path, mode] : {std::pair{MULTI_THREAD_PATH, dbg::WatchMode::DUAL_REGISTER},
+                              std::pair{RMW_PATH, dbg::WatchMode::SINGLE_REGISTER}})
+    {
+        std::vector<std::string> args{};
+        dbg::Variable var{"global_var"};
+        dbg::Debugger debugger(path, args, var);
+        debugger.setWatchMode(mode);
+        debugger.setStopRecording(true);
+
+        EventCollector recorded;
+        debugger.setHandler(recorded);
+        debugger.run();
+
+        const dbg::StopRecording* recording = debugger.getStopRecording();
+        ASSERT_NE(recording, nullptr);
+        ASSERT_FALSE(recording->stops.empty());
+
+        dbg::Debugger replayer(path, args, var);
+        EventCollector replayed;
+        replayer.setHandler(replayed);
+        replayer.replay(*recording);
+
+        ASSERT_EQ(replayed.events.size(), recorded.events.size());
+        for (size_t i = 0; i < recorded.events.size(); ++i)
+        {
+            ASSERT_EQ(replayed.events[i].tid, recorded.events[i].tid);
+            ASSERT_EQ(replayed.events[i].isWrite, recorded.events[i].isWrite);
+            ASSERT_EQ(replayed.events[i].oldValue, recorded.events[i].oldValue);
+            ASSERT_EQ(replayed.events[i].newValue, recorded.events[i].newValue);
+        }
+        ASSERT_EQ(replayer.getTraceStats().stops, debugger.getTraceStats().stops);
+    }
+}
+
+TEST_F(DebuggerTests, ReplaySyntheticStops)
+{
+    // no tracee: a write and a read of the main thread, a new thread and a write of it
+    const pid_t pid = 100;
+    const pid_t newThread = 101;
+    const int trap = SIGTRAP << 8 | 0x7f;
+
+    dbg::StopRecording recording;
+    recording.pid = pid;
+    recording.mode = dbg::WatchMode::DUAL_REGISTER;
+    dbg::Variable counter{"counter"};
+    counter.address = 0x1000;
+    counter.size = sizeof(int);
+    counter.value = dbg::Value::fromWord(7, sizeof(int));
+    recording.vars = {counter};
+
+    auto addStop = [&recording](pid_t tid, int status, uint64_t dr6, std::vector<uint64_t> words)
+    {
+        recording.stops.push_back({tid, status, dr6, 0, recording.words.size(), words.size()});
+        recording.words.insert(recording.words.end(), words.begin(), words.end());
+    };
+    addStop(pid, trap, 0b11, {8});
+    addStop(pid, trap, 0b10, {8});
+    addStop(pid, trap | PTRACE_EVENT_CLONE << 16, 0, {});
+    recording.stops.back().eventMessage = newThread;
+    addStop(newThread, SIGSTOP << 8 | 0x7f, 0, {});
+    addStop(newThread, trap, 0b11, {9});
+
+    dbg::Debugger debugger("synthetic", {}, counter);
+    EventCollector collector;
+    debugger.setHandler(collector);
+    debugger.replay(recording);
+
+    const std::vector<dbg::Event>& events = collector.events;
+    ASSERT_EQ(events.size(), 3);
+    ASSERT_TRUE(events[0].isWrite);
+    ASSERT_EQ(events[0].oldValue[0], 7);
+    ASSERT_EQ(events[0].newValue[0], 8);
+    ASSERT_FALSE(events[1].isWrite);
+    ASSERT_EQ(events[1].newValue[0], 8);
+    ASSERT_TRUE(events[2].isWrite);
+    ASSERT_EQ(events[2].tid, newThread);
+    ASSERT_EQ(events[2].newValue[0], 9);
+}
+
+TEST_F(DebuggerTests, EventInfo)
+{
+    std::vector<std::string> args{};
+    dbg::Variable var{"global_var"};
+    dbg::Debugger debugger(WRITE_THREAD_PATH, args, var);
+    debugger.setCaptureInstructionPointer(true);
+
+    std::vector<dbg::EventInfo> events;
+
+    // clang-format off
+    debugger.setOnWrite(
+        [&debugger, &events](const dbg::Variable& var)
+        {
+            events.push_back(debugger.getEventInfo());
+        });
+    // clang-format on
+
+    debugger.run();
+
+    ASSERT_FALSE(events.empty());
+    for (size_t i = 0; i < events.size(); ++i)
+    {
+        ASSERT_GT(events[i].tid, 0);
+        ASSERT_NE(events[i].ip, 0);
+        if (i > 0)
+        {
+            ASSERT_GE(events[i].time, events[i - 1].time);
+        }
+    }
+}
+
+TEST_F(DebuggerTests, TraceStats)
+{
+    std::vector<std::string> args{};
+    dbg::Variable var{"global_var"};
+    dbg::Debugger debugger(MULTI_THREAD_PATH, args, var);
+
+    uint64_t events = 0;
+
+    // clang-format off
+    debugger.setOnRead(
+        [&events](const dbg::Variable& var)
+        {
+            ++events;
+        });
+
+    debugger.setOnWrite(
+        [&events](const dbg::Variable& var)
+        {
+            ++events;
+        });
+    // clang-format on
+
+    debugger.run();
+
+    // waitpid, DR6, value and PTRACE_CONT per stop, plus the DR6 reset on kernels before 5.11
+    dbg::TraceStats stats = debugger.getTraceStats();
+    ASSERT_EQ(stats.events, events);
+    ASSERT_GE(stats.stops, events);
+    ASSERT_LE(stats.syscalls, 5 * stats.stops + 16);
+    ASSERT_GT(stats.cpuTime, 0);
+}
+
+TEST_F(DebuggerTests, PollFromReactor)
+{
+    std::vector<std::string> args{};
+    dbg::Variable var{"global_var"};
+    dbg::Debugger debugger(RMW_PATH, args, var);
+    debugger.setWatchMode(dbg::WatchMode::SINGLE_REGISTER);
+
+    size_t reads = 0;
+    size_t writes = 0;
+
+    // clang-format off
+    debugger.setOnEvents(
+        [&reads, &writes](std::span<const dbg::Event> events)
+        {
+            for (const dbg::Event& event : events)
+            {
+                ++(event.isWrite ? writes : reads);
+            }
+        });
+    // clang-format on
+
+    ASSERT_EQ(debugger.getFd(), -1);
+    debugger.start();
+    ASSERT_NE(debugger.getFd(), -1);
+
+    // the application waits on its own epoll set, the debugger only handles what is pending
+    int epollFd = epoll_create1(EPOLL_CLOEXEC);
+    ASSERT_NE(epollFd, -1);
+    epoll_event event{};
+    event.events = EPOLLIN;
+    ASSERT_EQ(epoll_ctl(epollFd, EPOLL_CTL_ADD, debugger.getFd(), &event), 0);
+
+    size_t wakeups = 0;
+    bool tracing = true;
+    while (tracing)
+    {
+        epoll_event ready{};
+        if (epoll_wait(epollFd, &ready, 1, 1000) == 1)
+        {
+            ++wakeups;
+        }
+        tracing = debugger.poll(0);
+    }
+    close(epollFd);
+
+    ASSERT_EQ(reads, 1000);
+    ASSERT_EQ(writes, 1000);
+    ASSERT_GT(wakeups, 0);
+    ASSERT_EQ(debugger.getFd(), -1);
+    ASSERT_FALSE(debugger.poll(0));
+}
+
+TEST_F(DebuggerTests, FollowFork)
+{
+    std::vector<std::string> args{};
+    dbg::Variable var{"global_var"};
+    dbg::Debugger debugger(FORK_EXEC_PATH, args, var);
+    debugger.setFollowFork(true);
+
+    std::map<pid_t, std::vector<int>> writes; // by process
+
+    // clang-format off
+    debugger.setOnEvents(
+        [&writes](std::span<const dbg::Event> events)
+        {
+            for (const dbg::Event& event : events)
+            {
+                if (event.isWrite)
+                {
+                    writes[event.pid].push_back(static_cast<int32_t>(event.newValue[0]));
+                }
+            }
+        });
+    // clang-format on
+
+    debugger.run();
+
+    // the parent, two forked workers, one that exec'd the program again and one spawned with vfork + exec
+    std::vector<int> work(100);
+    std::iota(work.begin(), work.end(), 1);
+    ASSERT_EQ(writes.size(), 5);
+    size_t workers = 0;
+    for (const auto& [pid, values] : writes)
+    {
+        if (values == std::vector<int>{-1})
+        {
+            continue;
+        }
+        ASSERT_EQ(values, work) << "worker " << pid;
+        ++workers;
+    }
+    ASSERT_EQ(workers, 4);
+}
+
+TEST_F(DebuggerTests, FollowForkParentExitsFirst)
+{
+    std::vector<std::string> args{"orphan"};
+    dbg::Variable var{"global_var"};
+    dbg::Debugger debugger(FORK_EXEC_PATH, args, var);
+    debugger.setFollowFork(true);
+
+    std::vector<int> writes;
+
+    // clang-format off
+    debugger.setOnEvents(
+        [&writes](std::span<const dbg::Event> events)
+        {
+            for (const dbg::Event& event : events)
+            {
+                if (event.isWrite)
+                {
+                    writes.push_back(static_cast<int32_t>(event.newValue[0]));
+                }
+            }
+        });
+    // clang-format on
+
+    debugger.run();
+
+    std::vector<int> expected(20);
+    std::iota(expected.begin(), expected.end(), 1);
+    ASSERT_EQ(writes, expected);
+
+    // the exited parent must not keep the loop awake while the batched events wait, the housekeeping timer
+    // adds a few syscalls every 10 ms over the 400 ms the child runs
+    dbg::TraceStats stats = debugger.getTraceStats();
+    ASSERT_LE(stats.syscalls, 10 * stats.stops + 400);
+}
+
+TEST_F(DebuggerTests, ForkNotFollowed)
+{
+    std::vector<std::string> args{};
+    dbg::Variable var{"global_var"};
+    dbg::Debugger debugger(FORK_EXEC_PATH, args, var);
+
+    std::vector<int> write;
+    std::set<pid_t> pids;
+
+    // clang-format off
+    debugger.setOnWrite(
+        [&write, &pids, &debugger](const dbg::Variable& var)
+        {
+            write.push_back(var.get<int>());
+            pids.insert(debugger.getEventInfo().pid);
+        });
+    // clang-format on
+
+    debugger.run();
+
+    ASSERT_EQ(write, std::vector<int>{-1});
+    ASSERT_EQ(pids.size(), 1);
+}
+
+TEST_F(DebuggerTests, AttachAndDetach)
+{
+    pid_t pid = fork();
+    ASSERT_NE(pid, -1);
+    if (pid == 0)
+    {
+        execl(ATTACH_LOOP_PATH.c_str(), ATTACH_LOOP_PATH.c_str(), nullptr);
+        std::exit(4);
+    }
+
+    // give the process time to start its second thread
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+    dbg::Variable var{"global_var"};
+    dbg::Debugger debugger("", {}, var);
+    debugger.setMaxEvents(100);
+
+    uint64_t writes = 0;
+    std::set<pid_t> threads;
+
+    // clang-format off
+    debugger.setOnRead(
+        [](const dbg::Variable& var)
+        {
+        });
+
+    debugger.setOnWrite(
+        [&](const dbg::Variable& var)
+        {
+            ++writes;
+            threads.insert(debugger.getEventInfo().tid);
+        });
+    // clang-format on
+
+    debugger.attach(pid);
+
+    // hits reported while the threads are interrupted for the detach are kept
+    ASSERT_GE(writes, 100);
+    ASSERT_EQ(threads.size(), 2);
+
+    // the detached process finishes on its own
+    int status = 0;
+    ASSERT_EQ(waitpid(pid, &status, 0), pid);
+    ASSERT_TRUE(WIFEXITED(status));
+    ASSERT_EQ(WEXITSTATUS(status), 0);
+}
+
+TEST_F(DebuggerTests, SymbolCache)
+{
+    const std::filesystem::path cacheDir = "./symbol_cache";
+    std::filesystem::remove_all(cacheDir);
+    setenv("GWATCH_CACHE_DIR", cacheDir.c_str(), 1);
+
+    // the first run builds and stores the index, the second maps it and the third rebuilds a damaged one
+    for (int run = 0; run < 3; ++run)
+    {
+        std::vector<std::string> args{};
+        dbg::Variable var{"global_var"};
+        dbg::Debugger debugger(ONE_WRITE_PATH, args, var);
+
+        std::vector<long> write;
+
+        // clang-format off
+        debugger.setOnRead(
+            [](const dbg::Variable& var)
+            {
+            });
+
+        debugger.setOnWrite(
+            [&write](const dbg::Variable& var)
+            {
+                write.push_back(var.get<long>());
+            });
+        // clang-format on
+
+        debugger.run();
+
+        ASSERT_EQ(write.size(), 1);
+        ASSERT_EQ(write[0], 142);
+        ASSERT_EQ(debugger.getVar().size, sizeof(long));
+
+        // the binary has no DWARF name index, so its variables are indexed and cached as well
+        std::vector<std::filesystem::path> files;
+        std::set<std::string> extensions;
+        for (const auto& entry : std::filesystem::directory_iterator(cacheDir))
+        {
+            files.push_back(entry.path());
+            extensions.insert(entry.path().extension());
+        }
+        ASSERT_EQ(files.size(), 2);
+        ASSERT_EQ(extensions, (std::set<std::string>{".dwidx", ".symidx"}));
+
+        if (run == 1)
+        {
+            for (const std::filesystem::path& file : files)
+            {
+                std::filesystem::resize_file(file, 100);
+            }
+        }
+    }
+
+    unsetenv("GWATCH_CACHE_DIR");
+    std::filesystem::remove_all(cacheDir);
+}
+
+TEST_F(DebuggerTests, PerfBackendOneWrite)
+{
+    std::vector<std::string> args{};
+    dbg::Variable var{"global_var"};
+    dbg::Debugger debugger(ONE_WRITE_PATH, args, var);
+    debugger.setBackend(dbg::Backend::PERF);
+
+    std::vector<long> read;
+    std::vector<long> write;
+
+    // clang-format off
+    debugger.setOnRead(
+        [&read](const dbg::Variable& var)
+        {
+            read.push_back(var.get<long>());
+        });
+
+    debugger.setOnWrite(
+        [&write](const dbg::Variable& var)
+        {
+            write.push_back(var.get<long>());
+        });
+    // clang-format on
+
+    debugger.run();
+
+    ASSERT_EQ(write.size(), 1);
+    ASSERT_EQ(read.size(), 0);
+
+    ASSERT_EQ(write[0], 142);
+}
+
+TEST_F(DebuggerTests, PerfBackendMultiThread)
+{
+    std::vector<std::string> args{};
+    dbg::Variable var{"global_var"};
+    dbg::Debugger debugger(MULTI_THREAD_PATH, args, var);
+    debugger.setBackend(dbg::Backend::PERF);
+
+    size_t read = 0;
+    size_t write = 0;
+
+    // clang-format off
+    debugger.setOnRead(
+        [&read](const dbg::Variable&)
+        {
+            ++read;
+        });
+
+    debugger.setOnWrite(
+        [&write](const dbg::Variable&)
+        {
+            ++write;
+        });
+    // clang-format on
+
+    debugger.run();
+
+    ASSERT_EQ(write, 20000);
+    ASSERT_EQ(read, 20000);
+}
+
+TEST_F(DebuggerTests, PerfBackendFourVariables)
+{
+    std::vector<std::string> args{};
+    std::vector<dbg::Variable> vars{{"var_a"}, {"var_b", true}, {"var_c", true}, {"var_d", true}};
+    dbg::Debugger debugger(MULTI_VAR_PATH, args, vars);
+    debugger.setBackend(dbg::Backend::PERF);
+
+    std::vector<std::string> read;
+    std::vector<std::string> write;
+
+    // clang-format off
+    debugger.setOnRead(
+        [&read](const dbg::Variable& var)
+        {
+            read.push_back(var.name);
+        });
+
+    debugger.setOnWrite(
+        [&write](const dbg::Variable& var)
+        {
+            write.push_back(var.name);
+        });
+    // clang-format on
+
+    debugger.run();
+
+    std::vector<std::string> expectedRead{"var_a", "var_b", "var_c"};
+    std::vector<std::string> expectedWrite{"var_a", "var_b", "var_c", "var_d", "var_c"};
+
+    ASSERT_EQ(read, expectedRead);
+    ASSERT_EQ(write, expectedWrite);
+}
+
+TEST_F(DebuggerTests, AgentBackendMultiThread)
+{
+    std::vector<std::string> args{};
+    dbg::Variable var{"global_var"};
+    dbg::Debugger debugger(MULTI_THREAD_PATH, args, var);
+    debugger.setBackend(dbg::Backend::AGENT);
+
+    std::vector<int> read;
+    std::vector<std::pair<int, int>> write;
+
+    // clang-format off
+    debugger.setOnRead(
+        [&read](const dbg::Variable& var)
+        {
+            read.push_back(var.get<int>());
+        });
+
+    debugger.setOnWrite(
+        [&write, &debugger](const dbg::Variable& var)
+        {
+            write.emplace_back(debugger.getLastVar().get<int>(), var.get<int>());
+        });
+    // clang-format on
+
+    debugger.run();
+
+    ASSERT_EQ(read.size(), 20000);
+    ASSERT_EQ(write.size(), 20000);
+
+    // values are captured synchronously, every increment is visible
+    for (size_t i = 0; i < write.size(); ++i)
+    {
+        ASSERT_EQ(write[i], std::make_pair(static_cast<int>(42 + i), static_cast<int>(43 + i)));
+    }
+}
+
+TEST_F(DebuggerTests, AgentBackendThreadChurn)
+{
+    // far more short-lived threads than rings, each one hands its ring to the next at exit
+    std::vector<std::string> args{"50", "8"};
+    dbg::Debugger debugger(THREAD_CHURN_PATH, args, dbg::Variable{"global_var"});
+    debugger.setBackend(dbg::Backend::AGENT);
+
+    size_t writes = 0;
+    std::set<pid_t> threads;
+
+    // clang-format off
+    debugger.setOnRead([](const dbg::Variable&) {});
+
+    debugger.setOnWrite(
+        [&](const dbg::Variable&)
+        {
+            ++writes;
+            threads.insert(debugger.getEventInfo().tid);
+        });
+    // clang-format on
+
+    debugger.run();
+
+    ASSERT_EQ(writes, 50 * 8);
+    ASSERT_GT(threads.size(), 64); // agent::MAX_THREADS
+}
+
+TEST_F(DebuggerTests, AgentBackendReadModifyWrite)
+{
+    std::vector<std::string> args{};
+    dbg::Variable var{"global_var"};
+    dbg::Debugger debugger(RMW_PATH, args, var);
+    debugger.setBackend(dbg::Backend::AGENT);
+
+    std::vector<int> read;
+    std::vector<int> write;
+
+    // clang-format off
+    debugger.setOnRead(
+        [&read](const dbg::Variable& var)
+        {
+            read.push_back(var.get<int>());
+        });
+
+    debugger.setOnWrite(
+        [&write](const dbg::Variable& var)
+        {
+            write.push_back(var.get<int>());
+        });
+    // clang-format on
+
+    debugger.run();
+
+    ASSERT_EQ(read.size(), 1000);
+    ASSERT_EQ(write.size(), 1000);
+    ASSERT_EQ(write.back(), 1000);
+}
+
+TEST_F(DebuggerTests, AgentBackendMissingSymbol)
+{
+    std::vector<std::string> args{};
+    dbg::Variable var{"missing_var"};
+    dbg::Debugger debugger(ONE_WRITE_PATH, args, var);
+    debugger.setBackend(dbg::Backend::AGENT);
+
+    debugger.setOnRead([](const dbg::Variable&) {});
+    debugger.setOnWrite([](const dbg::Variable&) {});
+
+    ASSERT_THROW(debugger.run(), std::runtime_error);
+}
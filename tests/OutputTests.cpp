@@ -0,0 +1,305 @@
+#include "OutputPipeline.hpp"
+#include "TraceFile.hpp"
+
+#include <array>
+#include <bit>
+#include <gtest/gtest.h>
+#include <sstream>
+#include <fstream>
+#include <thread>
+#include <unistd.h>
+
+/// Tests for the asynchronous output pipeline of the gwatch CLI
+class OutputTests : public ::testing::Test
+{
+  protected:
+    int m_pipe[2]{-1, -1};
+    std::string m_output;
+    std::thread m_reader;
+
+    void SetUp() override
+    {
+        ASSERT_EQ(pipe(m_pipe), 0);
+    }
+
+    void TearDown() override
+    {
+        if (m_reader.joinable())
+        {
+            m_reader.join();
+        }
+        close(m_pipe[0]);
+    }
+
+    /// Read everything written to the pipe until its write end is closed
+    void startReader()
+    {
+        m_reader = std::thread(
+            [this]()
+            {
+                char buffer[4096];
+                ssize_t n = 0;
+                while ((n = read(m_pipe[0], buffer, sizeof(buffer))) > 0)
+                {
+                    m_output.append(buffer, static_cast<size_t>(n));
+                }
+            });
+    }
+
+    /// Close the write end of the pipe and wait for the reader
+    std::vector<std::string> finish()
+    {
+        close(m_pipe[1]);
+        if (!m_reader.joinable())
+        {
+            startReader();
+        }
+        m_reader.join();
+
+        std::vector<std::string> lines;
+        std::istringstream iss(m_output);
+        for (std::string line; std::getline(iss, line);)
+        {
+            lines.push_back(line);
+        }
+        return lines;
+    }
+
+    static dbg::OutputEvent makeEvent(uint32_t watch, dbg::OutputEvent::Kind kind, uint8_t size, uint64_t oldValue,
+                                      uint64_t newValue)
+    {
+        dbg::OutputEvent event{};
+        event.watch = watch;
+        event.kind = kind;
+        event.size = size;
+        event.oldValue = oldValue;
+        event.newValue = newValue;
+        return event;
+    }
+};
+
+TEST_F(OutputTests, Format)
+{
+    std::vector<dbg::Variable> vars{{"a"}, {"b", true}, {"c"}};
+    vars[2].isFloat = true;
+    startReader();
+
+    {
+        dbg::OutputPipeline output(m_pipe[1], vars, dbg::OverflowPolicy::BLOCK);
+        output.push(makeEvent(0, dbg::OutputEvent::READ, 4, 0, 42));
+        output.push(makeEvent(1, dbg::OutputEvent::WRITE, 2, 0xFFFF, 7));
+        output.push(makeEvent(0, dbg::OutputEvent::WRITE, 8, 1, 0xFFFFFFFFFFFFFFFF));
+        output.push(makeEvent(1, dbg::OutputEvent::READ, 1, 0, 0x80));
+
+        dbg::OutputEvent element = makeEvent(0, dbg::OutputEvent::WRITE, 4, 4, 36);
+        element.element = true;
+        element.offset = 12;
+        output.push(element);
+
+        dbg::OutputEvent wide = makeEvent(1, dbg::OutputEvent::WRITE, 16, 1, 0x0102);
+        wide.oldHigh = 2;
+        wide.newHigh = 0xFFFFFFFFFFFFFFFF;
+        output.push(wide);
+
+        output.push(makeEvent(2, dbg::OutputEvent::WRITE, 8, std::bit_cast<uint64_t>(20.5), std::bit_cast<uint64_t>(-0.1)));
+        output.push(makeEvent(2, dbg::OutputEvent::READ, 4, 0, std::bit_cast<uint32_t>(1.5f)));
+    }
+
+    std::vector<std::string> expected{"a\tread:\t42", "b\twrite:\t-1 -> 7", "a\twrite:\t1 -> 18446744073709551615",
+                                      "b\tread:\t-128", "a+12\twrite:\t4 -> 36",
+                                      "b\twrite:\t0x00000000000000020000000000000001 -> 0xffffffffffffffff0000000000000102",
+                                      "c\twrite:\t20.5 -> -0.1", "c\tread:\t1.5"};
+    ASSERT_EQ(finish(), expected);
+}
+
+TEST_F(OutputTests, BlockKeepsEveryEvent)
+{
+    std::vector<dbg::Variable> vars{{"a"}};
+    startReader();
+
+    constexpr uint64_t EVENTS = 100000;
+    {
+        dbg::OutputPipeline output(m_pipe[1], vars, dbg::OverflowPolicy::BLOCK, 16);
+        for (uint64_t i = 0; i < EVENTS; ++i)
+        {
+            output.push(makeEvent(0, dbg::OutputEvent::WRITE, 8, i, i + 1));
+        }
+        ASSERT_EQ(output.getDropped(), 0);
+    }
+
+    std::vector<std::string> lines = finish();
+    ASSERT_EQ(lines.size(), EVENTS);
+    ASSERT_EQ(lines.back(), "a\twrite:\t99999 -> 100000");
+}
+
+TEST_F(OutputTests, DropWhenWriterIsStalled)
+{
+    std::vector<dbg::Variable> vars{{"a"}};
+
+    // nobody reads the pipe until all events were pushed, so the writer stalls once the pipe is full
+    constexpr uint64_t EVENTS = 100000;
+    uint64_t dropped = 0;
+    {
+        dbg::OutputPipeline output(m_pipe[1], vars, dbg::OverflowPolicy::DROP, 16);
+        for (uint64_t i = 0; i < EVENTS; ++i)
+        {
+            output.push(makeEvent(0, dbg::OutputEvent::READ, 8, 0, i));
+        }
+
+        dropped = output.getDropped();
+        startReader();
+    }
+
+    ASSERT_GT(dropped, 0);
+    ASSERT_EQ(finish().size() + dropped, EVENTS);
+}
+
+TEST_F(OutputTests, AggregateWhenWriterIsStalled)
+{
+    std::vector<dbg::Variable> vars{{"a"}, {"w"}};
+
+    constexpr uint64_t EVENTS = 100000;
+    uint64_t aggregated = 0;
+    {
+        dbg::OutputPipeline output(m_pipe[1], vars, dbg::OverflowPolicy::AGGREGATE, 16);
+        for (uint64_t i = 0; i < EVENTS; ++i)
+        {
+            output.push(makeEvent(0, dbg::OutputEvent::WRITE, 8, i, i + 1));
+
+            // values wider than 8 bytes keep their high word in step with the low one
+            dbg::OutputEvent wide = makeEvent(1, dbg::OutputEvent::WRITE, 16, i, i + 1);
+            wide.oldHigh = i;
+            wide.newHigh = i + 1;
+            output.push(wide);
+        }
+
+        aggregated = output.getAggregated();
+        ASSERT_EQ(output.getDropped(), 0);
+        startReader();
+    }
+
+    ASSERT_GT(aggregated, 0);
+
+    // summary lines carry the number of merged events, together they cover every write in order
+    std::array<uint64_t, 2> events{};
+    std::array<uint64_t, 2> lastValue{};
+    for (const std::string& line : finish())
+    {
+        unsigned long long oldValue = 0;
+        unsigned long long newValue = 0;
+        unsigned long long count = 1;
+        if (line.starts_with("w"))
+        {
+            unsigned long long oldHigh = 0;
+            unsigned long long newHigh = 0;
+            int fields = sscanf(line.c_str(), "w\twrite:\t0x%16llx%16llx -> 0x%16llx%16llx\t(%llu events)", &oldHigh,
+                                &oldValue, &newHigh, &newValue, &count);
+            ASSERT_GE(fields, 4) << line;
+            ASSERT_EQ(oldHigh, oldValue) << line;
+            ASSERT_EQ(newHigh, newValue) << line;
+
+            ASSERT_EQ(oldValue, lastValue[1]);
+            lastValue[1] = newValue;
+            events[1] += count;
+            continue;
+        }
+
+        int fields = sscanf(line.c_str(), "a\twrite:\t%llu -> %llu\t(%llu events)", &oldValue, &newValue, &count);
+        ASSERT_GE(fields, 2) << line;
+
+        ASSERT_EQ(oldValue, lastValue[0]);
+        lastValue[0] = newValue;
+        events[0] += count;
+    }
+
+    ASSERT_EQ(events[0], EVENTS);
+    ASSERT_EQ(lastValue[0], EVENTS);
+    ASSERT_EQ(events[1], EVENTS);
+    ASSERT_EQ(lastValue[1], EVENTS);
+}
+
+TEST_F(OutputTests, TraceRoundTrip)
+{
+    const std::string path = "./trace_round_trip.gwt";
+    close(m_pipe[1]);
+
+    std::vector<dbg::Variable> vars{{"a"}, {"table", true}};
+    vars[0].isFloat = true;
+    vars[0].address = 0x4010;
+    vars[0].size = 8;
+    vars[1].address = 0x4020;
+    vars[1].size = 32;
+
+    // enough records for several chunks, with values, threads and addresses moving in both directions
+    std::vector<dbg::TraceRecord> records;
+    for (uint64_t i = 0; i < 50000; ++i)
+    {
+        dbg::TraceRecord record{};
+        record.time = 1'000'000'000 + i * 1000 + (i % 7);
+        record.tid = static_cast<pid_t>(100 + i % 3);
+        record.ip = 0x401000 + (i % 5) * 0x10;
+        if (i % 4 == 0)
+        {
+            record.event = makeEvent(0, dbg::OutputEvent::WRITE, 8, ~i, i * 0x9E3779B97F4A7C15);
+        }
+        else
+        {
+            record.event = makeEvent(1, i % 2 ? dbg::OutputEvent::READ : dbg::OutputEvent::WRITE, 4, i + 1, i);
+            record.event.element = true;
+            record.event.offset = static_cast<uint32_t>(i % 8 * 4);
+        }
+        records.push_back(record);
+    }
+
+    {
+        dbg::TraceWriter writer(path, "./one_write", vars);
+        for (const dbg::TraceRecord& record : records)
+        {
+            writer.append(record);
+        }
+        writer.finish();
+        ASSERT_EQ(writer.getRecordCount(), records.size());
+    }
+
+    // a chunk cut off at the end of the file is ignored
+    {
+        std::ofstream(path, std::ios::app | std::ios::binary) << "GWCK\x10";
+    }
+
+    dbg::TraceReader reader(path);
+    ASSERT_EQ(reader.getTarget(), "./one_write");
+    ASSERT_FALSE(reader.getBuildId().empty());
+    ASSERT_EQ(reader.getWatches().size(), 2);
+    ASSERT_EQ(reader.getWatches()[1].name, "table");
+    ASSERT_EQ(reader.getWatches()[1].address, 0x4020);
+    ASSERT_EQ(reader.getWatches()[1].size, 32);
+    ASSERT_TRUE(reader.getWatches()[0].isFloat);
+    ASSERT_TRUE(reader.getWatches()[1].isSigned);
+    ASSERT_FALSE(reader.getWatches()[1].isFloat);
+
+    for (int pass = 0; pass < 2; ++pass)
+    {
+        dbg::TraceRecord record{};
+        for (const dbg::TraceRecord& expected : records)
+        {
+            ASSERT_TRUE(reader.next(record));
+            ASSERT_EQ(record.time, expected.time);
+            ASSERT_EQ(record.tid, expected.tid);
+            ASSERT_EQ(record.ip, expected.ip);
+            ASSERT_EQ(record.event.watch, expected.event.watch);
+            ASSERT_EQ(record.event.kind, expected.event.kind);
+            ASSERT_EQ(record.event.newValue, expected.event.newValue);
+            ASSERT_EQ(record.event.size, expected.event.size);
+            ASSERT_EQ(record.event.element, expected.event.element);
+            ASSERT_EQ(record.event.offset, expected.event.offset);
+            if (expected.event.kind == dbg::OutputEvent::WRITE)
+            {
+                ASSERT_EQ(record.event.oldValue, expected.event.oldValue);
+            }
+        }
+        ASSERT_FALSE(reader.next(record));
+        reader.rewind();
+    }
+
+    unlink(path.c_str());
+}
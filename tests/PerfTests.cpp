@@ -1,12 +1,18 @@
 #include "Debugger.hpp"
+#include "DwarfReader.hpp"
+#include "SymbolIndex.hpp"
+#include "Symbolizer.hpp"
+#include "Util.hpp"
 
 #include <chrono>
+#include <filesystem>
 #include <gtest/gtest.h>
+#include <unistd.h>
 
 /// Performance tests for Debugger class
 /// RAW = only read/write accesses
 /// REAL = tries to simulate real workload
-class PerfTests : public ::testing::TestWithParam<std::tuple<std::string, int>>
+class PerfTests : public ::testing::TestWithParam<std::tuple<std::string, int, dbg::Backend>>
 {
   protected:
     const std::string RAW_PATH = "./raw";
@@ -14,12 +20,14 @@ class PerfTests : public ::testing::TestWithParam<std::tuple<std::string, int>>
 
     std::string m_path{};
     int m_accessCount{};
+    dbg::Backend m_backend{};
     double m_directTime{};
 
     void SetUp() override
     {
         m_path = std::get<0>(GetParam());
         m_accessCount = std::get<1>(GetParam());
+        m_backend = std::get<2>(GetParam());
 
         std::string commandStr{m_path + " " + std::to_string(m_accessCount)};
 
@@ -44,6 +52,7 @@ TEST_P(PerfTests, DebuggerPerfTests)
     std::vector<std::string> args{std::to_string(m_accessCount)};
     dbg::Variable var{"global_var"};
     dbg::Debugger debugger(m_path, args, var);
+    debugger.setBackend(m_backend);
 
     std::vector<long> read;
     std::vector<long> write;
@@ -72,13 +81,193 @@ TEST_P(PerfTests, DebuggerPerfTests)
     auto endDebug = std::chrono::high_resolution_clock::now();
     auto debugTime = std::chrono::duration<double, std::milli>(endDebug - startDebug).count();
 
+    switch (m_backend)
+    {
+    case dbg::Backend::PTRACE: std::cout << "Ptrace backend\n"; break;
+    case dbg::Backend::PERF: std::cout << "Perf backend\n"; break;
+    case dbg::Backend::AGENT: std::cout << "Agent backend\n"; break;
+    }
     std::cout << "Debugger run time for " << m_path << ": " << debugTime << " milliseconds\n";
     std::cout << "Performance ratio (debugger / direct) for " << m_path << ": " << (debugTime / m_directTime) << "\n\n";
 
     ASSERT_EQ(read.size() + write.size(), m_accessCount);
 }
 
-// Define parameters {"path, accessCount"}
+// Define parameters {"path, accessCount, backend"}
 INSTANTIATE_TEST_SUITE_P(PerfTestsInstantiation, PerfTests,
-                         ::testing::Values(std::make_tuple("./raw", 10000), std::make_tuple("./real", 10000),
-                                           std::make_tuple("./raw", 50000), std::make_tuple("./real", 50000)));
\ No newline at end of file
+                         ::testing::Values(std::make_tuple("./raw", 10000, dbg::Backend::PTRACE),
+                                           std::make_tuple("./real", 10000, dbg::Backend::PTRACE),
+                                           std::make_tuple("./raw", 50000, dbg::Backend::PTRACE),
+                                           std::make_tuple("./real", 50000, dbg::Backend::PTRACE),
+                                           std::make_tuple("./raw", 50000, dbg::Backend::PERF),
+                                           std::make_tuple("./real", 50000, dbg::Backend::PERF),
+                                           std::make_tuple("./raw", 50000, dbg::Backend::AGENT),
+                                           std::make_tuple("./real", 50000, dbg::Backend::AGENT)));
+
+/// Run time of real with the watchpoints armed only part of the time to stay within an overhead budget
+TEST(OverheadBudget, DutyCycledWatch)
+{
+    const int accessCount = 50000;
+    std::vector<std::string> args{std::to_string(accessCount)};
+    dbg::Variable var{"global_var"};
+    dbg::Debugger debugger("./real", args, var);
+    debugger.setOverheadBudget(0.05);
+
+    uint64_t events = 0;
+
+    // clang-format off
+    debugger.setOnRead(
+        [&events](const dbg::Variable& var)
+        {
+            ++events;
+        });
+
+    debugger.setOnWrite(
+        [&events](const dbg::Variable& var)
+        {
+            ++events;
+        });
+    // clang-format on
+
+    auto start = std::chrono::high_resolution_clock::now();
+    debugger.run();
+    auto end = std::chrono::high_resolution_clock::now();
+    auto debugTime = std::chrono::duration<double, std::milli>(end - start).count();
+
+    dbg::TraceStats stats = debugger.getTraceStats();
+    std::cout << "Debugger run time with a 5% overhead budget: " << debugTime << " milliseconds, " << events
+              << " of " << accessCount << " accesses observed, sampling ratio " << stats.samplingRatio << "\n";
+
+    ASSERT_EQ(stats.events, events);
+    ASSERT_GT(events, 0);
+    ASSERT_LT(events, accessCount);
+    ASSERT_LT(stats.samplingRatio, 1.0);
+}
+
+/// Run time of a fixed number of increments spread over more and more threads, traced by one or several tracer
+/// threads that each own a shard of the threads
+TEST(TracerThreads, ScalingByThreadCount)
+{
+    const int increments = 32000;
+    for (int threadCount : {4, 16, 64})
+    {
+        for (size_t tracerThreads : {1, 2, 4})
+        {
+            std::vector<std::string> args{std::to_string(threadCount), std::to_string(increments / threadCount)};
+            dbg::Debugger debugger("./thread_scale", args, dbg::Variable{"global_var"});
+            debugger.setTracerThreads(tracerThreads);
+
+            uint64_t events = 0;
+            debugger.setOnRead([&events](const dbg::Variable&) { ++events; });
+            debugger.setOnWrite([&events](const dbg::Variable&) { ++events; });
+
+            auto start = std::chrono::high_resolution_clock::now();
+            debugger.run();
+            auto end = std::chrono::high_resolution_clock::now();
+
+            std::cout << threadCount << " threads, " << tracerThreads << " tracer threads: "
+                      << std::chrono::duration<double, std::milli>(end - start).count() << " milliseconds\n";
+            ASSERT_EQ(events, 2 * increments);
+        }
+    }
+}
+
+/// Delay the tracer adds to every thread creation: thread_churn creates waves of short-lived threads that each
+/// write once, the run time above the untraced run is spread over the created threads
+TEST(ThreadChurn, DelayPerThreadCreation)
+{
+    const int waves = 200;
+    const int threadsPerWave = 16;
+    std::vector<std::string> args{std::to_string(waves), std::to_string(threadsPerWave)};
+
+    auto startDirect = std::chrono::high_resolution_clock::now();
+    ASSERT_EQ(std::system(("./thread_churn " + args[0] + " " + args[1]).c_str()), 0);
+    auto endDirect = std::chrono::high_resolution_clock::now();
+    double directTime = std::chrono::duration<double, std::micro>(endDirect - startDirect).count();
+
+    for (size_t tracerThreads : {1, 4})
+    {
+        dbg::Debugger debugger("./thread_churn", args, dbg::Variable{"global_var"});
+        debugger.setTracerThreads(tracerThreads);
+
+        uint64_t writes = 0;
+        debugger.setOnWrite([&writes](const dbg::Variable&) { ++writes; });
+
+        auto start = std::chrono::high_resolution_clock::now();
+        debugger.run();
+        auto end = std::chrono::high_resolution_clock::now();
+        double debugTime = std::chrono::duration<double, std::micro>(end - start).count();
+
+        std::cout << tracerThreads << " tracer threads: " << (debugTime - directTime) / (waves * threadsPerWave)
+                  << " us added per thread creation\n";
+        ASSERT_EQ(writes, waves * threadsPerWave);
+    }
+}
+
+/// Time to resolve a variable and a member through DWARF against the size of the binary,
+/// dwarf_big has a name index, dwarf_big_noindex is the same program where the top-level DIEs are scanned
+TEST(DwarfLookup, LookupTimeByBinarySize)
+{
+    for (const std::string path : {"./raw", "./dwarf_big", "./dwarf_big_noindex"})
+    {
+        bool big = path != "./raw";
+        std::string expression = big ? "record_9999.range.high" : "global_var";
+        std::string symbolName = expression.substr(0, expression.find('.'));
+
+        dbg::SymbolIndex symbols(path);
+        auto symbol = symbols.find(symbolName);
+        ASSERT_TRUE(symbol);
+
+        // a binary without a name index is indexed on the first lookup, the second one loads the cached index
+        std::string cacheDir = "./dwarf_lookup_cache";
+        std::filesystem::remove_all(cacheDir);
+        for (const char* run : {"", ", second lookup"})
+        {
+            auto start = std::chrono::high_resolution_clock::now();
+            dbg::DwarfReader dwarf(path, cacheDir);
+            auto location = dwarf.resolve(expression, symbol->value);
+            auto end = std::chrono::high_resolution_clock::now();
+            auto lookupTime = std::chrono::duration<double, std::milli>(end - start).count();
+
+            ASSERT_TRUE(location);
+            ASSERT_EQ(location->offset, big ? 50 : 0);
+            ASSERT_EQ(location->size, big ? sizeof(short) : sizeof(long));
+            ASSERT_TRUE(location->isSigned);
+
+            std::cout << "DWARF lookup of " << expression << " in " << path << " ("
+                      << std::filesystem::file_size(path) / 1024 << " KiB)" << run << ": " << lookupTime
+                      << " milliseconds\n";
+        }
+        std::filesystem::remove_all(cacheDir);
+    }
+}
+
+/// Time to resolve a batch of addresses against the functions of every object mapped into the test itself
+TEST(Symbolizer, BatchResolveTime)
+{
+    std::vector<dbg::util::MappedFile> files = dbg::util::getMappedFiles(getpid());
+
+    auto start = std::chrono::high_resolution_clock::now();
+    dbg::Symbolizer symbolizer(files);
+    auto indexed = std::chrono::high_resolution_clock::now();
+
+    // addresses spread over the first 64 KiB of every object
+    std::vector<uint64_t> addresses;
+    for (size_t i = 0; i < 200'000; ++i)
+    {
+        addresses.push_back(files[i % files.size()].start + (i * 7919) % 0x10000);
+    }
+
+    std::vector<dbg::CodeLocation> locations = symbolizer.resolve(addresses);
+    auto end = std::chrono::high_resolution_clock::now();
+
+    size_t resolved = std::count_if(locations.begin(), locations.end(),
+                                    [](const dbg::CodeLocation& location) { return !location.function.empty(); });
+    ASSERT_EQ(locations.size(), addresses.size());
+    ASSERT_GT(resolved, 0);
+
+    std::cout << "Symbolizer indexed " << symbolizer.size() << " functions of " << files.size() << " objects in "
+              << std::chrono::duration<double, std::milli>(indexed - start).count() << " milliseconds, resolved "
+              << resolved << " of " << addresses.size() << " addresses in "
+              << std::chrono::duration<double, std::milli>(end - indexed).count() << " milliseconds\n";
+}
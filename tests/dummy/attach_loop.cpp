@@ -0,0 +1,27 @@
+//
+//  g++ -g -o attach_loop attach_loop.cpp
+//
+
+#include <chrono>
+#include <thread>
+
+int global_var = 0;
+
+// keeps writing from two threads for about two seconds, so a debugger can attach and detach meanwhile
+void writeLoop()
+{
+    for (int i = 0; i < 2000; ++i)
+    {
+        global_var = i;
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+}
+
+int main()
+{
+    std::thread t(writeLoop);
+    writeLoop();
+    t.join();
+
+    return 0;
+}
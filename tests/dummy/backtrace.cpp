@@ -0,0 +1,27 @@
+//
+//  g++ -g -fno-omit-frame-pointer -o backtrace backtrace.cpp
+//  g++ -g -O2 -fomit-frame-pointer -o backtrace_nofp backtrace.cpp
+//
+
+volatile long config_value = 0;
+
+__attribute__((noinline)) void apply(long value)
+{
+    config_value = value;
+}
+
+__attribute__((noinline)) void configure(long value)
+{
+    apply(value);
+    asm volatile(""); // keeps the call from becoming a tail call
+}
+
+int main()
+{
+    for (long i = 0; i < 3; ++i)
+    {
+        configure(i);
+    }
+    apply(100);
+    return 0;
+}
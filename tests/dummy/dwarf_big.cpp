@@ -0,0 +1,48 @@
+//
+//  g++ -g -gpubnames -o dwarf_big dwarf_big.cpp
+//
+//  Thousands of struct types and global variables, so .debug_info is large
+//  and global_var is described at its very end
+//
+
+#define STRUCT(n)                                                                                                      \
+    struct Record##n                                                                                                   \
+    {                                                                                                                  \
+        int id;                                                                                                        \
+        long values[4];                                                                                                \
+        double weight;                                                                                                 \
+        struct                                                                                                         \
+        {                                                                                                              \
+            short low;                                                                                                 \
+            short high;                                                                                                \
+        } range;                                                                                                       \
+    };                                                                                                                 \
+    Record##n record_##n = {n, {n, n, n, n}, n * 0.5, {-n, n}};
+
+#define STRUCT10(n)                                                                                                    \
+    STRUCT(n##0) STRUCT(n##1) STRUCT(n##2) STRUCT(n##3) STRUCT(n##4) STRUCT(n##5) STRUCT(n##6) STRUCT(n##7)          \
+        STRUCT(n##8) STRUCT(n##9)
+#define STRUCT100(n)                                                                                                   \
+    STRUCT10(n##0) STRUCT10(n##1) STRUCT10(n##2) STRUCT10(n##3) STRUCT10(n##4) STRUCT10(n##5) STRUCT10(n##6)       \
+        STRUCT10(n##7) STRUCT10(n##8) STRUCT10(n##9)
+#define STRUCT1000(n)                                                                                                  \
+    STRUCT100(n##0) STRUCT100(n##1) STRUCT100(n##2) STRUCT100(n##3) STRUCT100(n##4) STRUCT100(n##5)                \
+        STRUCT100(n##6) STRUCT100(n##7) STRUCT100(n##8) STRUCT100(n##9)
+
+STRUCT1000(1)
+STRUCT1000(2)
+STRUCT1000(3)
+STRUCT1000(4)
+STRUCT1000(5)
+STRUCT1000(6)
+STRUCT1000(7)
+STRUCT1000(8)
+STRUCT1000(9)
+
+long global_var = 0;
+
+int main()
+{
+    global_var = record_1000.id + record_9999.range.high;
+    return 0;
+}
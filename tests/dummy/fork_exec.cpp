@@ -0,0 +1,67 @@
+//
+//  g++ -g -o fork_exec fork_exec.cpp
+//
+
+#include <cstring>
+#include <sys/wait.h>
+#include <unistd.h>
+
+int global_var = 0;
+
+void work()
+{
+    for (int i = 1; i <= 100; ++i)
+    {
+        global_var = i; // write
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    // the program executed again by a worker
+    if (argc > 1 && strcmp(argv[1], "worker") == 0)
+    {
+        work();
+        return 0;
+    }
+
+    // the parent exits right away, the child goes on writing for a while
+    if (argc > 1 && strcmp(argv[1], "orphan") == 0)
+    {
+        if (fork() != 0)
+        {
+            return 0;
+        }
+        for (int i = 1; i <= 20; ++i)
+        {
+            global_var = i; // write
+            usleep(20000);
+        }
+        return 0;
+    }
+
+    global_var = -1;
+
+    // prefork: two plain workers, one that execs this program again, one spawned with vfork + exec
+    for (int worker = 0; worker < 4; ++worker)
+    {
+        pid_t pid = worker == 3 ? vfork() : fork();
+        if (pid != 0)
+        {
+            continue;
+        }
+
+        if (worker >= 2)
+        {
+            execl(argv[0], argv[0], "worker", nullptr);
+            _exit(1);
+        }
+        work();
+        _exit(0);
+    }
+
+    while (wait(nullptr) > 0)
+    {
+    }
+    return 0;
+}
@@ -0,0 +1,21 @@
+//
+//  g++ -g -o multi_var multi_var.cpp
+//
+
+#include <cstdint>
+
+uint8_t var_a = 1;
+short var_b = 2;
+int var_c = 3;
+long var_d = 4;
+
+int main()
+{
+    var_a = 11;
+    var_b = var_a + 20;
+    var_c = var_b + 30;
+    var_d = var_c + 40;
+    var_c = 61; // same value, still a write
+
+    return 0;
+}
@@ -0,0 +1,12 @@
+//
+//  g++ -g -shared -fPIC -o libplugin.so plugin.cpp
+//
+
+// watched as libplugin.so:plugin_counter
+int plugin_counter = 0;
+
+extern "C" int plugin_update(int value)
+{
+    plugin_counter = value;
+    return plugin_counter + 1;
+}
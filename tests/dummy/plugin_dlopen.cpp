@@ -0,0 +1,26 @@
+//
+//  g++ -g -o plugin_dlopen plugin_dlopen.cpp
+//
+
+#include <dlfcn.h>
+
+int host_var = 0;
+
+int main()
+{
+    // the plugin is loaded twice, its variables are mapped again with the second load
+    for (int round = 1; round <= 2; ++round)
+    {
+        void* handle = dlopen("./libplugin.so", RTLD_NOW);
+        if (!handle)
+        {
+            return 1;
+        }
+
+        auto update = reinterpret_cast<int (*)(int)>(dlsym(handle, "plugin_update"));
+        host_var = update(round * 10);
+        dlclose(handle);
+    }
+
+    return 0;
+}
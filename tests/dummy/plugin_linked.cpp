@@ -0,0 +1,11 @@
+//
+//  g++ -g -o plugin_linked plugin_linked.cpp -L. -lplugin
+//
+
+// libplugin.so is loaded by the dynamic linker at startup
+extern "C" int plugin_update(int value);
+
+int main()
+{
+    return plugin_update(5) == 6 ? 0 : 1;
+}
@@ -0,0 +1,16 @@
+//
+//  g++ -g -o rmw rmw.cpp
+//
+
+int global_var = 0;
+
+int main()
+{
+    // lock add: single read-modify-write instruction
+    for (int i = 0; i < 1000; ++i)
+    {
+        __atomic_fetch_add(&global_var, 1, __ATOMIC_SEQ_CST);
+    }
+
+    return 0;
+}
@@ -0,0 +1,16 @@
+//
+//  g++ -g -o self_trap self_trap.cpp
+//
+
+#include <csignal>
+
+long global_var = 42;
+
+int main()
+{
+    global_var = 142;
+
+    // not a debug register hit, DR6 still holds the bit of the write above
+    raise(SIGTRAP);
+    return 0;
+}
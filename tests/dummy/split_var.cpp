@@ -0,0 +1,37 @@
+//
+//  g++ -g -o split_var split_var.cpp
+//
+
+struct __attribute__((packed)) Packed
+{
+    short tag;
+    int value; // 2 bytes past an 8 byte boundary, watched as 2 + 2 bytes
+};
+
+struct Triple
+{
+    int a;
+    int b;
+    int c; // 12 bytes at an 8 byte boundary, watched as 8 + 4 bytes
+};
+
+alignas(8) Packed packed{};
+alignas(8) Triple triple{};
+
+int main()
+{
+    // every write of value covers both of its ranges
+    for (int i = 1; i <= 10; ++i)
+    {
+        packed.value = i;
+    }
+
+    // b is in the first range of triple, c in the second
+    for (int i = 1; i <= 10; ++i)
+    {
+        triple.b = i;
+        triple.c = -i;
+    }
+
+    return packed.value == 10 && triple.c == -10 ? 0 : 1;
+}
@@ -0,0 +1,71 @@
+//
+//  g++ -g -o thread_churn thread_churn.cpp
+//
+
+#include <atomic>
+#include <csignal>
+#include <cstdlib>
+#include <iostream>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+long global_var = 0;
+
+static volatile sig_atomic_t g_signals = 0;
+
+static void onSignal(int)
+{
+    g_signals = g_signals + 1;
+}
+
+/// Thread pool that is torn down and created again over and over, every thread writes the variable once,
+/// with "signals" the process is sent SIGUSR1 with a handler all the time meanwhile
+int main(int argc, char* argv[])
+{
+    if (argc < 3)
+    {
+        std::cerr << "Usage: " << argv[0] << " <waves> <threads per wave> [signals]" << std::endl;
+        return 1;
+    }
+    int waves = std::atoi(argv[1]);
+    int threadCount = std::atoi(argv[2]);
+
+    std::atomic<bool> done{false};
+    std::thread sender;
+    if (argc > 3)
+    {
+        struct sigaction action{};
+        action.sa_handler = onSignal;
+        sigaction(SIGUSR1, &action, nullptr);
+        sender = std::thread(
+            [&done]()
+            {
+                while (!done)
+                {
+                    kill(getpid(), SIGUSR1);
+                    usleep(10);
+                }
+            });
+    }
+
+    for (int wave = 0; wave < waves; ++wave)
+    {
+        std::vector<std::thread> threads;
+        for (int i = 0; i < threadCount; ++i)
+        {
+            threads.emplace_back([wave, threadCount, i]() { global_var = wave * threadCount + i + 1; });
+        }
+        for (std::thread& thread : threads)
+        {
+            thread.join();
+        }
+    }
+
+    done = true;
+    if (sender.joinable())
+    {
+        sender.join();
+    }
+    return 0;
+}
@@ -0,0 +1,44 @@
+//
+//  g++ -g -o thread_scale thread_scale.cpp
+//
+
+#include <cstdlib>
+#include <iostream>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+long global_var = 0;
+
+int main(int argc, char* argv[])
+{
+    if (argc < 3)
+    {
+        std::cerr << "Usage: " << argv[0] << " <threads> <increments per thread>" << std::endl;
+        return 1;
+    }
+    int threadCount = std::atoi(argv[1]);
+    int increments = std::atoi(argv[2]);
+
+    std::mutex mut{};
+    auto func = [&mut, increments]()
+    {
+        for (int i = 0; i < increments; ++i)
+        {
+            std::lock_guard lock(mut);
+            ++global_var; // read + write
+        }
+    };
+
+    std::vector<std::thread> threads;
+    for (int i = 0; i < threadCount; ++i)
+    {
+        threads.emplace_back(func);
+    }
+    for (std::thread& thread : threads)
+    {
+        thread.join();
+    }
+
+    return 0;
+}
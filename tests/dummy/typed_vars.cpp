@@ -0,0 +1,36 @@
+//
+//  g++ -g -o typed_vars typed_vars.cpp
+//
+
+struct Limits
+{
+    short min;
+    short max;
+};
+
+struct Config
+{
+    int id;
+    unsigned max_conns;
+    double ratio;
+    Limits limits[2];
+};
+
+// members and array elements are watched through their DWARF type (e.g. --var cfg.limits[1].max)
+Config cfg = {1, 10, 0.5, {{-1, 1}, {-2, 2}}};
+
+// signedness and floating point are taken from DWARF, --var is enough
+int counter = -5;
+double temperature = 20.5;
+
+int main()
+{
+    cfg.max_conns = 64;
+    cfg.limits[1].max = -300;
+    cfg.ratio = 0.75;
+
+    counter = counter * 3;
+    temperature = temperature + 1.25;
+
+    return 0;
+}
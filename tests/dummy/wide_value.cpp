@@ -0,0 +1,25 @@
+//
+//  g++ -g -o wide_value wide_value.cpp
+//
+
+struct alignas(16) Pair
+{
+    long first;
+    long second;
+};
+
+Pair global_pair{1, 2};
+
+int main()
+{
+    // 8 byte writes into a 16 byte variable
+    for (long i = 0; i < 10; ++i)
+    {
+        global_pair.first = i;
+        global_pair.second = -i;
+    }
+
+    // read of the whole variable
+    Pair copy = global_pair;
+    return copy.first == 9 ? 0 : 1;
+}
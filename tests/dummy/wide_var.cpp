@@ -0,0 +1,31 @@
+//
+//  g++ -g -o wide_var wide_var.cpp
+//
+
+// does not fit into a debug register, watched with page protection
+int table[8] = {0};
+
+// shares a page with table, accesses to it are false sharing for the watch on table
+int neighbour = 0;
+
+int main()
+{
+    for (int i = 0; i < 8; ++i)
+    {
+        table[i] = i + 1;
+    }
+
+    int sum = 0;
+    for (int i = 0; i < 8; ++i)
+    {
+        sum += table[i];
+    }
+
+    for (int i = 0; i < 100; ++i)
+    {
+        neighbour = neighbour + 1;
+    }
+
+    table[3] = sum;
+    return 0;
+}
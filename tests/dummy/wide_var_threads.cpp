@@ -0,0 +1,35 @@
+//
+//  g++ -g -o wide_var_threads wide_var_threads.cpp
+//
+
+#include <thread>
+#include <vector>
+
+// does not fit into a debug register, watched with page protection
+volatile int table[8] = {0};
+
+constexpr int THREADS = 4;
+constexpr int WRITES = 2000;
+
+int main()
+{
+    // every thread writes its own element, the page is shared by all of them
+    std::vector<std::thread> threads;
+    for (int t = 0; t < THREADS; ++t)
+    {
+        threads.emplace_back(
+            [t]()
+            {
+                for (int i = 0; i < WRITES; ++i)
+                {
+                    table[t] = i + 1;
+                }
+            });
+    }
+
+    for (std::thread& thread : threads)
+    {
+        thread.join();
+    }
+    return 0;
+}
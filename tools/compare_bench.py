@@ -0,0 +1,102 @@
+#!/usr/bin/env python3
+"""Compare gwatch_bench results against a stored baseline.
+
+Both files are written by Google Benchmark with --benchmark_out_format=json. With repetitions the median
+aggregate of a benchmark is compared, otherwise the mean of its iterations. The script exits with 1 when
+a benchmark got slower than the baseline by more than the threshold, benchmarks that are only in one of
+the files are listed but do not fail the comparison.
+
+    ./gwatch_bench --benchmark_out=bench.json --benchmark_out_format=json
+    tools/compare_bench.py baseline.json bench.json --threshold 10%
+    tools/compare_bench.py --update baseline.json bench.json   # store the new results as the baseline
+"""
+
+import argparse
+import json
+import shutil
+import sys
+
+# factors from the time units of Google Benchmark to nanoseconds
+TIME_UNITS = {"ns": 1.0, "us": 1e3, "ms": 1e6, "s": 1e9}
+
+
+def load(path, metric):
+    """Time of every benchmark in nanoseconds, keyed by its name"""
+    with open(path) as file:
+        report = json.load(file)
+
+    iterations = {}
+    medians = {}
+    for benchmark in report.get("benchmarks", []):
+        if benchmark.get("error_occurred"):
+            continue
+        time = benchmark[metric] * TIME_UNITS[benchmark.get("time_unit", "ns")]
+        name = benchmark.get("run_name", benchmark["name"])
+        if benchmark.get("run_type") == "aggregate":
+            if benchmark.get("aggregate_name") == "median":
+                medians[name] = time
+        else:
+            iterations.setdefault(name, []).append(time)
+
+    times = {name: sum(values) / len(values) for name, values in iterations.items()}
+    times.update(medians)
+    return times
+
+
+def parse_threshold(text):
+    """Allowed slowdown as a fraction, from 0.1 or 10%"""
+    if text.endswith("%"):
+        return float(text[:-1]) / 100
+    return float(text)
+
+
+def format_time(nanoseconds):
+    for unit in ("s", "ms", "us"):
+        if nanoseconds >= TIME_UNITS[unit]:
+            return f"{nanoseconds / TIME_UNITS[unit]:.3f} {unit}"
+    return f"{nanoseconds:.1f} ns"
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Compare gwatch_bench results against a stored baseline")
+    parser.add_argument("baseline", help="JSON results of the baseline")
+    parser.add_argument("current", help="JSON results of the current build")
+    parser.add_argument("--threshold", type=parse_threshold, default=0.1,
+                        help="allowed slowdown per benchmark, e.g. 0.1 or 10%% (default: 10%%)")
+    parser.add_argument("--metric", choices=("real_time", "cpu_time"), default="real_time",
+                        help="time compared (default: real_time)")
+    parser.add_argument("--update", action="store_true", help="copy the current results over the baseline")
+    args = parser.parse_args()
+
+    if args.update:
+        shutil.copyfile(args.current, args.baseline)
+        print(f"baseline {args.baseline} updated from {args.current}")
+        return 0
+
+    baseline = load(args.baseline, args.metric)
+    current = load(args.current, args.metric)
+
+    width = max((len(name) for name in baseline.keys() | current.keys()), default=0)
+    regressions = []
+    for name in sorted(baseline.keys() & current.keys()):
+        ratio = current[name] / baseline[name] if baseline[name] > 0 else 1.0
+        regressed = ratio > 1.0 + args.threshold
+        if regressed:
+            regressions.append(name)
+        print(f"{name:<{width}}  {format_time(baseline[name]):>12} -> {format_time(current[name]):>12}"
+              f"  {100 * (ratio - 1):+7.1f}%{'  REGRESSION' if regressed else ''}")
+
+    for name in sorted(baseline.keys() - current.keys()):
+        print(f"{name:<{width}}  missing from {args.current}")
+    for name in sorted(current.keys() - baseline.keys()):
+        print(f"{name:<{width}}  new, not in {args.baseline}")
+
+    if regressions:
+        print(f"{len(regressions)} of {len(baseline.keys() & current.keys())} benchmarks slower than the baseline "
+              f"by more than {100 * args.threshold:g}%", file=sys.stderr)
+        return 1
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,59 @@
+#include <OutputPipeline.hpp>
+#include <TraceFile.hpp>
+#include <iostream>
+#include <unistd.h>
+
+void printHelp()
+{
+    std::cout << "Usage: gwatch-dump [--header] <trace>\n"
+                 "Print a trace written with gwatch --trace-out in the output format of gwatch\n"
+                 "Options:\n"
+                 "  --header   print the target, its build-id and the watched variables instead\n";
+}
+
+void printHeader(const dbg::TraceReader& reader)
+{
+    std::cout << "target:\t" << reader.getTarget() << "\n"
+              << "build-id:\t" << (reader.getBuildId().empty() ? "none" : reader.getBuildId()) << "\n";
+
+    for (const dbg::TraceWatch& watch : reader.getWatches())
+    {
+        std::cout << "watch:\t" << watch.name << "\t0x" << std::hex << watch.address << std::dec << "\t" << watch.size
+                  << (watch.isFloat ? "\tfloat" : watch.isSigned ? "\tsigned" : "\tunsigned") << "\n";
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    bool header = argc == 3 && std::string(argv[1]) == "--header";
+    if (argc != 2 && !header)
+    {
+        printHelp();
+        return 1;
+    }
+
+    try
+    {
+        dbg::TraceReader reader(argv[argc - 1]);
+        if (header)
+        {
+            printHeader(reader);
+            return 0;
+        }
+
+        // records decode straight into output events, so the text is the same as gwatch would have written
+        dbg::OutputPipeline output(STDOUT_FILENO, reader.getVariables(), dbg::OverflowPolicy::BLOCK);
+        dbg::TraceRecord record{};
+        while (reader.next(record))
+        {
+            output.push(record.event);
+        }
+    }
+    catch (std::runtime_error& e)
+    {
+        std::cerr << e.what() << "\n";
+        return 2;
+    }
+
+    return 0;
+}